@@ -21,32 +21,46 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <windows.h>
 #include <shlobj.h>
+#include <commctrl.h>
 #include <commdlg.h>
+#include <windowsx.h>
 #include <tchar.h>
+#include <algorithm>
 #include <list>
 #include <map>
+#include <string>
+#include <unordered_map>
 
 #include <stdio.h>
 #include <time.h>
 
 #include "resource.h"
 #include "utils.h"
+#include "dirindex.h"
+#include "dirmerge.h"
+#include "iconcache.h"
+#include "iconstore.h"
+#include "render.h"
+#include "layout.h"
+#include "dirwatch.h"
+#include "buttonlist.h"
 
 #define PROG_NAME _T("LaunchBar")
 #define VERSION_STR _T("3.1.1")
 #define DATE_STR _T("2016-12-13")
 
-// Window classes
-#define BUTTON_CLASS_NAME _T("ICON_BUTTON")
+// Window class
 #define WIND_CLASS_NAME PROG_NAME
 
 // Global variables
 HWND      gMainWindow;              // The main toolbar window
+HWND      gToolTip;                 // Tooltip of the main window and the buttons
 RECT      gWindowRect;              // Main window rectangle in screen coordinates
 POINT     gWindowSize;              // Window size for convenience
 CString   gMainDir(EMPTY_STR);      // Directory to watch and mirror
 CString   gAppPath;                 // The path to the executable
 BOOL      gConfigFileUsed = FALSE;  // Set when configuration file used instead of a directory
+pDirWatcher gDirWatch = NULL;   // Watch of the main directory, the start menus and the folder button targets
 HMENU     gMainPopupMenu,           // Main window popup menu
           gFilePopupMenu,           // Popup menu for file buttons or menu entries
           gDirPopupMenu;            // Popup menu for directory buttons or menu entries
@@ -58,31 +72,38 @@ CString   gStartMenuDir,            // Holds the path to the machine start menu
 BOOL ReadPrefs();
 BOOL SavePrefs();
 
-// Button individual information
+// Button individual information. The buttons have no windows of their own, they
+// are drawn and hit tested by the main window.
 typedef struct {
    CString command;     // Command to execute
    CString params;      // Command parameters
    HMENU hMenu;         // Used for possible sub menu for folder buttons
    HICON hIcon;         // Large icon
    HICON hSmallIcon;    // Small icon
-   HWND  hToolTip;      // Tooltip window
+   CString toolTip;     // Tooltip text, for shortcuts resolved when first shown
    WORD  showType;      // Window type for the application to launch
+   BOOL  missing;       // Set for shortcuts to missing targets, shown grayed
 } tCommandInfo, *pCommandInfo;
 
-// Button information is stored in the window long data field
-#define GET_COM_INFO(hWnd) (pCommandInfo)GetWindowLongPtr(hWnd, GWLP_USERDATA)
-
-// Message ID for directory change event
+// Message ID for directory changes, carrying a tDirChangeList and the DirWatchTime of the first change
 #define WM_USER_DIR_CHANGED WM_USER+1
+// Message ID for indexed folder found changed
+#define WM_USER_INDEX_CHANGED WM_USER+2
+// Message ID for icons loaded in the background
+#define WM_USER_ICONS_LOADED WM_USER+3
 
-// Maximum number of buttons allowed
-#define MAX_BUTTONS 100
+typedef std::basic_string<TCHAR> tString;
 
-// Button list
-struct {
-   DWORD cnt;
-   HWND list[MAX_BUTTONS];
-} gButtons = {0};
+// Button list, only changed through InsertButton, RemoveButton and MoveButton
+tButtonList<pCommandInfo, tString> gButtons;
+
+// Mouse interaction with the buttons
+pCommandInfo gHotButton = NULL;      // Button under the cursor
+pCommandInfo gPushedButton = NULL;   // Button pressed
+pCommandInfo gDragButton = NULL;     // Button dragged to a new position
+POINT gPressPos;                     // Where the pressed button was pressed
+POINT gDragOffset;                   // Cursor position within the dragged button
+RECT gDragRect;                      // Where the dragged button is currently drawn
 
 // Layout data
 BOOL gLargeIcons = FALSE; // Use large buttons
@@ -92,12 +113,23 @@ DWORD gAutoHide = 0;      // Hide toolbar when loosing focus
 BOOL gHidden = FALSE;     // Visibility state
 DWORD gLocation = 3;      // Corner position (1 = left, 2 = top, 3 = right, 4 = bottom)
 BOOL gCenter = FALSE;     // Center the toolbar
+DWORD gMonitor = 0;       // Monitor of the toolbar, 0 for the primary one, otherwise its place in the monitor enumeration
+BOOL gNaturalSort = FALSE; // Sort numbers in folder menu entry names by value
+CString gSharedStartMenu;  // Possible shared start menu merged with the machine and user ones
+CString gSharedStartMenuSetting; // The shared start menu as given, environment variables not expanded
+DWORD gMenuPage = 500;     // Maximum number of entries shown in one folder menu, 0 for no limit
+DWORD gIconCacheSize = 2048; // Memory budget in KB for cached icons not currently shown
+DWORD gIconStoreSize = 4096; // Size limit in KB of the icon store file, 0 for no store
+DWORD gWatchDelay = 250;     // Time in ms without further directory changes before they are applied
+
+tLayout gLayout;         // Window and button geometry computed by SetupLayout
 
-DWORD xOffset, yOffset;  // Offset from window border to button
-DWORD xInc, yInc;        // Increment between buttons
+#define MAX_MONITORS 16
 
 #define ICON_SIZE (gLargeIcons ? 32 : 16) // Standard icon sizes
 #define ICON_OFF (gLargeIcons ? 5 : 3)    // Offset between the icon frame and the toolbar window frame
+#define BUTTON_GAP (gLargeIcons ? 2 : 0)  // Space between adjacent buttons
+#define WIND_MARGIN 2                     // Offset between toolbar window border and button
 #define WIND_OFF 12                       // Offset between toolbar window edge and first/last button
 #define MARK_RADIUS 3                     // Radius of a circle used to mark the toolbar window own space used for the popup menu
 
@@ -253,159 +285,209 @@ BOOL AutoHide(BOOL hide)
 
 //--------------------------------------------------------------------------
 
+// Work areas of the display monitors
+typedef struct {
+   tLayoutRect list[MAX_MONITORS+1];   // The primary work area followed by those of all monitors
+   DWORD cnt;
+} tWorkAreas;
+
+BOOL CALLBACK AddWorkArea(HMONITOR hMonitor, HDC hDC, LPRECT pRect, LPARAM data)
+{
+   // Add the work area of a display monitor to the list, stop when full
+   tWorkAreas *pAreas = (tWorkAreas*)data;
+   MONITORINFO info;
+   info.cbSize = sizeof(info);
+   if (GetMonitorInfo(hMonitor, &info))
+   {
+      tLayoutRect& area = pAreas->list[pAreas->cnt++];
+      area.left = info.rcWork.left;
+      area.top = info.rcWork.top;
+      area.right = info.rcWork.right;
+      area.bottom = info.rcWork.bottom;
+   }
+   return pAreas->cnt < MAX_MONITORS+1;
+}
+
+//--------------------------------------------------------------------------
+
 BOOL SetupLayout()
 {
-   // Position the buttons according to their placement in the list
-   DWORD xButtonPos, yButtonPos;
-   DWORD xButtonSize, yButtonSize;
-   DWORD inc;
+   // Position the buttons according to their placement in the list, wrapped into several
+   // rows or columns when they do not fit along the screen edge of the chosen monitor
+   tWorkAreas areas;
    RECT screenRect;
    SystemParametersInfo(SPI_GETWORKAREA, 0, &screenRect, 0);
+   areas.list[0].left = screenRect.left;
+   areas.list[0].top = screenRect.top;
+   areas.list[0].right = screenRect.right;
+   areas.list[0].bottom = screenRect.bottom;
+   areas.cnt = 1;
+   EnumDisplayMonitors(NULL, NULL, AddWorkArea, (LPARAM)&areas);
 
-   xButtonSize = ICON_SIZE + ICON_OFF*2;
-   yButtonSize = xButtonSize;
-   xOffset = 2;
-   yOffset = xOffset;
-   inc = (gLargeIcons ? 2 : 0);
+   HDC hDC = GetDC(NULL);
+   int dpi = GetDeviceCaps(hDC, LOGPIXELSX);
+   ReleaseDC(NULL, hDC);
 
    IN_RANGE(gLocation, 1, 4);
 
-   if (gLocation == 1)
-   {
-      // Left
-      xInc = 0;
-      yInc = yButtonSize + inc;
-      xButtonPos = xOffset;
-      yButtonPos = yOffset + WIND_OFF;
-      gWindowRect.left = screenRect.left;
-      gWindowRect.right = gWindowRect.left + xOffset*2 + xButtonSize + 2;
-      gWindowRect.top = screenRect.top;
-      gWindowRect.bottom = gWindowRect.top + yButtonPos*2 + gButtons.cnt*yInc;
-   }
-   else if (gLocation == 2)
-   {
-      // Top
-      xInc = xButtonSize + inc;
-      yInc = 0;
-      xButtonPos = xOffset + WIND_OFF;
-      yButtonPos = yOffset;
-      gWindowRect.left = screenRect.left;
-      gWindowRect.right = gWindowRect.left + xButtonPos*2 + gButtons.cnt*xInc;
-      gWindowRect.top = screenRect.top;
-      gWindowRect.bottom = gWindowRect.top + yOffset*2 + yButtonSize + 2;
-   }
-   else if (gLocation == 3)
-   {
-      // Right
-      xInc = 0;
-      yInc = yButtonSize + inc;
-      xButtonPos = xOffset+1;
-      yButtonPos = yOffset + WIND_OFF;
-      gWindowRect.right = screenRect.right;
-      gWindowRect.left = gWindowRect.right - xOffset*2 - xButtonSize - 2;
-      gWindowRect.top = screenRect.top;
-      gWindowRect.bottom = gWindowRect.top + yButtonPos*2 + gButtons.cnt*yInc;
-   }
-   else
-   {
-      // Bottom
-      xInc = xButtonSize + inc;
-      yInc = 0;
-      xButtonPos = xOffset + WIND_OFF;
-      yButtonPos = yOffset;
-      gWindowRect.left = screenRect.left;
-      gWindowRect.right = gWindowRect.left + xButtonPos*2 + gButtons.cnt*xInc;
-      gWindowRect.bottom = screenRect.bottom;
-      gWindowRect.top = gWindowRect.bottom - yOffset*2 - yButtonSize - 2;
-   }
-
-   DWORD i;
-   for (i = 0; i < gButtons.cnt; i++)
-   {
-      // Set position
-      SetWindowPos(gButtons.list[i], NULL, xButtonPos, yButtonPos, xButtonSize, yButtonSize, SWP_SHOWWINDOW | SWP_NOOWNERZORDER);
-      xButtonPos += xInc;
-      yButtonPos += yInc;
-      InvalidateRect(gButtons.list[i], NULL, TRUE);
-   }
+   tLayoutParams params;
+   params.edge = (tLayoutEdge)gLocation;
+   params.center = gCenter != FALSE;
+   params.count = gButtons.cnt;
+   params.iconSize = ICON_SIZE;
+   params.iconOffset = ICON_OFF;
+   params.gap = BUTTON_GAP;
+   params.margin = WIND_MARGIN;
+   params.endSpace = WIND_OFF;
+   params.dpi = dpi;
+   params.workAreas = areas.list;
+   params.workAreaCount = areas.cnt;
+   params.monitor = gMonitor;
+   if (!ComputeLayout(params, gLayout))
+      return FALSE;
 
+   gWindowRect.left = gLayout.window.left;
+   gWindowRect.top = gLayout.window.top;
+   gWindowRect.right = gLayout.window.right;
+   gWindowRect.bottom = gLayout.window.bottom;
    gWindowSize.x = gWindowRect.right-gWindowRect.left;
    gWindowSize.y = gWindowRect.bottom-gWindowRect.top;
 
-   if (gCenter)
-   {
-      DWORD xSpace = (screenRect.right - screenRect.left - gWindowSize.x) / 2;
-      DWORD ySpace = (screenRect.bottom - screenRect.top - gWindowSize.y) / 2;
-      switch (gLocation)
-      {
-         case 1:
-         case 3:
-            gWindowRect.top += ySpace;
-            gWindowRect.bottom += ySpace;
-            break;
-
-         case 2:
-         case 4:
-            gWindowRect.left += xSpace;
-            gWindowRect.right += xSpace;
-            break;
-      }
-
-   }
-
    PositionWindow();
-   // Make sure that the window contents is updated
-   InvalidateRect(gMainWindow, NULL, TRUE);
+   // Make sure that the window contents is updated, the buttons are drawn by the main window
+   InvalidateRect(gMainWindow, NULL, FALSE);
+
+#ifdef _DEBUG
+   CString trace;
+   DWORD frames, avgMicros;
+   GetRenderStats(&frames, NULL, &avgMicros, NULL);
+   trace.Format(_T("SetupLayout: %d buttons in %d lines, %d USER objects, %d GDI objects, %d frames composed in %d us on average\n"),
+                gButtons.cnt, gLayout.lines, GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS),
+                GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS), frames, avgMicros);
+   OutputDebugString(trace);
+#endif
 
    return TRUE;
 }
 
 //--------------------------------------------------------------------------
 
+#ifdef _DEBUG
+void TraceRepaint()
+{
+   // Debug command timing a synchronous repaint of the toolbar, the buttons being drawn
+   // by the main window itself
+   LARGE_INTEGER start, end, freq;
+   QueryPerformanceCounter(&start);
+   RedrawWindow(gMainWindow, NULL, NULL, RDW_INVALIDATE | RDW_UPDATENOW);
+   QueryPerformanceCounter(&end);
+   QueryPerformanceFrequency(&freq);
+   CString trace;
+   trace.Format(_T("TraceRepaint: %d buttons, WM_PAINT in %d us, %d USER objects, %d GDI objects\n"),
+                gButtons.cnt, (DWORD)((end.QuadPart - start.QuadPart)*1000000 / freq.QuadPart),
+                GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS), GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS));
+   OutputDebugString(trace);
+}
+#endif
+
+//--------------------------------------------------------------------------
+
 LONG Pos2Index(LONG x, LONG y)
 {
    // Get the list index for the provided window position
-   LONG ind = -1;
-   switch (gLocation)
-   {
-      case 1:
-      case 3:
-         ind = round((y - (LONG)yOffset - WIND_OFF)/(double)yInc);
-         break;
+   return (LONG)LayoutInsertIndex(gLayout, x, y);
+}
 
-      case 2:
-      case 4:
-         ind = round((x - (LONG)xOffset - WIND_OFF)/(double)xInc);
-   }
+//--------------------------------------------------------------------------
 
-   return (DWORD)max(min(ind, (LONG)gButtons.cnt), 0);
+LONG Button2Index(pCommandInfo pCom)
+{
+   // Get the list index of a button if still present, otherwise -1
+   return gButtons.Find(pCom);
 }
 
 //--------------------------------------------------------------------------
 
-LONG Hwnd2Index(HWND hWnd)
+RECT ButtonRect(DWORD ind)
 {
-   // Get the list index for the provided window handle if available, otherwise -1
-   DWORD i;
-   for (i = 0; i < gButtons.cnt; i++)
-      if (gButtons.list[i] == hWnd)
-         return i;
-   return -1;
+   // Get the rectangle of a button in main window coordinates
+   tLayoutRect cell = LayoutButtonRect(gLayout, ind);
+   RECT r = {cell.left, cell.top, cell.right, cell.bottom};
+   return r;
 }
 
 //--------------------------------------------------------------------------
 
-LONG Com2Index(LPCTSTR com)
+pCommandInfo HitButton(LONG x, LONG y)
 {
-   // Get the list index for the provided command if available, otherwise -1
-   DWORD i;
-   for (i = 0; i < gButtons.cnt; i++)
+   // Get the button at a main window position, NULL if none
+   int ind = LayoutHitTest(gLayout, x, y);
+   return ind >= 0 && (DWORD)ind < gButtons.cnt ? gButtons.list[ind] : NULL;
+}
+
+//--------------------------------------------------------------------------
+
+void InvalidateButton(pCommandInfo pCom)
+{
+   // Have the cell of a button redrawn by the main window
+   LONG ind = Button2Index(pCom);
+   if (ind >= 0)
    {
-      pCommandInfo pCom = GET_COM_INFO(gButtons.list[i]);
-      if (pCom && pCom->command.CompareNoCase(com) == 0)
-         return i;
+      RECT r = ButtonRect(ind);
+      InvalidateRect(gMainWindow, &r, FALSE);
    }
-   return -1;
+}
+
+//--------------------------------------------------------------------------
+
+tString CommandKey(LPCTSTR com)
+{
+   // Get the key of a command in the command index
+   CString key = com;
+   key.MakeUpper();
+   return (LPCTSTR)key;
+}
+
+//--------------------------------------------------------------------------
+
+LONG Com2Index(LPCTSTR com)
+{
+   // Get the list index for the provided command if available, otherwise -1. The
+   // same command may be used by several buttons when read from a configuration file.
+   return gButtons.FindCommand(CommandKey(com));
+}
+
+//--------------------------------------------------------------------------
+
+void InsertButton(pCommandInfo pCom, DWORD pos)
+{
+   // Insert a button in the list and the indexes
+   gButtons.Insert(pCom, CommandKey(pCom->command), pos);
+}
+
+//--------------------------------------------------------------------------
+
+void RemoveButton(DWORD pos)
+{
+   // Remove a button from the list and the indexes, the caller deletes it
+   pCommandInfo pCom = gButtons.list[pos];
+   gButtons.Remove(pos, CommandKey(pCom->command));
+
+   // Forget any mouse interaction with it
+   if (gHotButton == pCom)
+      gHotButton = NULL;
+   if (gPushedButton == pCom)
+      gPushedButton = NULL;
+   if (gDragButton == pCom)
+      gDragButton = NULL;
+}
+
+//--------------------------------------------------------------------------
+
+void MoveButton(DWORD from, DWORD to)
+{
+   // Move a button to another position in the list
+   gButtons.Move(from, to);
 }
 
 //--------------------------------------------------------------------------
@@ -418,119 +500,761 @@ BOOL HandleDragAndDrop(CString& fileName)
 
 //--------------------------------------------------------------------------
 
-BOOL DirSort(CString first, CString second)
+// Folder menu information, stored as menu data of each folder menu
+typedef struct {
+   CString dir;      // Directory listed in the menu
+   CString altDir;   // Possible additional directory merged into the menu
+   CString *link;    // Path of the corresponding menu entry, used for context menu operations
+   BOOL filled;      // Set when the menu entries have been added
+   tDirEntryList entries; // The entries currently in the menu, all pages for a paged menu
+   DWORD first;      // First entry shown, non zero for the continuation pages of a paged menu
+   HMENU pageOwner;  // First page holding the entries, NULL unless a continuation page
+} tDirMenuInfo, *pDirMenuInfo;
+
+pDirMenuInfo GetDirMenuInfo(HMENU hMenu)
 {
-   // Sort directories first
-   BOOL d1 = IsDir(first),
-        d2 = IsDir(second);
-   CString n1 = GetFileNameComp(first, eFcName),
-           n2 = GetFileNameComp(second, eFcName);
-   if (d1 && !d2)
-      return TRUE;
-   else if (!d1 && d2)
-      return FALSE;
-   else
-      // Case insensitive sorting when equal
-      return n1.CompareNoCase(n2) < 0;
+   // Get the folder information of a menu, NULL if not a folder menu
+   MENUINFO menuInf;
+   ZeroMemory(&menuInf, sizeof(menuInf));
+   menuInf.cbSize = sizeof(menuInf);
+   menuInf.fMask = MIM_MENUDATA;
+   return GetMenuInfo(hMenu, &menuInf) ? (pDirMenuInfo)menuInf.dwMenuData : NULL;
 }
 
 //--------------------------------------------------------------------------
 
-HMENU AddDirMenu(CString dir, BOOL doInit, CString altDir)
+HMENU AddDirMenu(CString dir, BOOL doInit, CString altDir, CString *link = NULL)
 {
-   // Create popup menu with entries corresponding to all the shorcuts in a
-   // specified directory and all its sub directories.
+   // Create an empty popup menu for the specified directory. The entries are
+   // added by FillDirMenu when the menu is about to be shown.
    HMENU hMenu = CreateMenu();
 
-   // Find and sort the files and directories
-   CString path = dir + _T("\\*"),
-           fileName = EMPTY_CSTR;
-   HANDLE ref;
-   std::list<CString> fileList;        // List for sorting
-   std::map<CString, CString> fileMap; // Hash used for possible multiple directories
-   // Primary files
-   while (FindFiles(path, fileName, &ref))
-   {
-      fileList.push_back(fileName);
-      fileMap[GetFileNameComp(fileName, eFcName)] = EMPTY_CSTR;
-   }
-   // Special handling for the start menu which is present in two different locations (machine and user)
+   pDirMenuInfo pInf = new tDirMenuInfo;
+   pInf->dir = dir;
+   pInf->altDir = altDir;
+   pInf->link = link;
+   pInf->filled = FALSE;
+   pInf->first = 0;
+   pInf->pageOwner = NULL;
+
+   MENUINFO menuInf;
+   ZeroMemory(&menuInf, sizeof(menuInf));
+   menuInf.cbSize = sizeof(menuInf);
+   menuInf.fMask = MIM_MENUDATA | MIM_STYLE;
+   menuInf.dwStyle = MNS_NOTIFYBYPOS;
+   menuInf.dwMenuData = (ULONG_PTR)pInf;
+   SetMenuInfo(hMenu, &menuInf);
+
+   if (doInit)
+      InitPopupMenu(hMenu, TRUE);
+
+   return hMenu;
+}
+
+//--------------------------------------------------------------------------
+
+// Directory listing task
+typedef struct {
+   CString dir;                  // Directory to list
+   tFileRecordList files;        // All files and sub directories found
+} tListTask;
+
+void ListDirTask(PVOID param)
+{
+   // List the contents of a directory
+   tListTask *pTask = (tListTask*)param;
+   EnumDir(pTask->dir, pTask->files);
+}
+
+//--------------------------------------------------------------------------
+
+// Shortcut resolution task
+typedef struct {
+   CString path;           // Shortcut
+   CString target;         // Resolved target
+   CString iconFile;       // Icon location
+   int iconInd;
+   DWORD targetAttr;       // Attributes of the target, INVALID_FILE_ATTRIBUTES if missing
+} tLinkTask;
+
+void ResolveLinkTask(PVOID param)
+{
+   // Get the target and icon of a shortcut
+   tLinkTask *pTask = (tLinkTask*)param;
+   pTask->iconInd = 0;
+   GetShortcutInfo(pTask->path, pTask->target, NULL, NULL, NULL, &pTask->iconFile, &pTask->iconInd);
+   pTask->targetAttr = pTask->target.IsEmpty() ? INVALID_FILE_ATTRIBUTES : FileAttributes(pTask->target);
+}
+
+//--------------------------------------------------------------------------
+
+BOOL ScanDir(CString dir, CString altDir, tDirEntryList& entries, BOOL pumpMessages = FALSE)
+{
+   // Get the sorted entries corresponding to all the shortcuts and sub directories
+   // in a directory and possibly merge the entries of additional directories,
+   // altDir being a list of directories separated by DIR_LIST_SEP.
+   // Only the shortcut targets need file system calls beside the listings, they are
+   // resolved as one batch. Messages are dispatched meanwhile if called by the UI thread,
+   // FALSE if the user cancelled the scan by pressing Esc then.
+   entries.clear();
+#ifdef _DEBUG
+   DWORD fsCalls = GetFsCallCount();
+#endif
+
+   // Special handling for the start menu which is present in different locations (machine, user and possibly shared)
    if (altDir.IsEmpty() && dir == gStartMenuDir)
+   {
       // Merge the user start menu as well
       altDir = GetStartMenuDir(FALSE);
+      if (!gSharedStartMenu.IsEmpty())
+         altDir += DIR_LIST_SEP + gSharedStartMenu;
+   }
 
-   if (!altDir.IsEmpty())
+   // List all directories at the same time, they may well be on different volumes
+   std::vector<tListTask> lists(1);
+   lists[0].dir = dir;
+   int pos = 0;
+   CString alt = altDir.Tokenize(DIR_LIST_SEP, pos);
+   while (!alt.IsEmpty())
+   {
+      lists.push_back(tListTask());
+      lists.back().dir = alt;
+      alt = altDir.Tokenize(DIR_LIST_SEP, pos);
+   }
+   std::vector<PVOID> tasks;
+   DWORD i, r;
+   for (r = 0; r < lists.size(); r++)
+      tasks.push_back(&lists[r]);
+   if (!RunTasks(ListDirTask, &tasks[0], (DWORD)tasks.size(), 0, pumpMessages))
+      // Cancelled by the user
+      return FALSE;
+
+   // Sort each listing on precomputed collation keys and merge them
+   std::vector<tMergeRoot> roots(lists.size());
+   for (r = 0; r < lists.size(); r++)
    {
-      // Merge additional directory
-      fileName = EMPTY_CSTR;
-      APPEND_BS(altDir);
-      path = altDir + _T("*");
-      while (FindFiles(path, fileName, &ref))
+      tFileRecordList& files = lists[r].files;
+      tMergeRoot& root = roots[r];
+      root.items.resize(files.size());
+      root.keys.reserve(files.size() * 64);
+      for (i = 0; i < files.size(); i++)
       {
-         CString name = GetFileNameComp(fileName, eFcName);
-         if (fileMap.find(name) == fileMap.end())
-            // New
-            fileList.push_back(fileName);
-         else if (IsDir(fileName))
-            // Existing, merge if directory
-            fileMap[name] = fileName;
+         CString name = GetFileNameComp(files[i].name, eFcName);
+         root.items[i].name = (LPCTSTR)name;
+         root.items[i].keyPos = AddSortKey(name, root.keys, gNaturalSort);
+         root.items[i].isDir = (files[i].attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+         root.items[i].tag = i;
       }
+      SortMergeRoot(root);
    }
-   // Sort the entries found
-   fileList.sort(DirSort);
+   tMergedList merged;
+   MergeRoots(roots, merged);
 
-   // Add the menu(s)
-   std::list<CString>::iterator it;
-   for (it=fileList.begin(); it!=fileList.end(); ++it)
+   tDirEntryList found;
+   std::vector<tLinkTask> links;
+   for (i = 0; i < merged.size(); i++)
    {
-      CString fileName = *it;
-      if (FileIsHidden(fileName))
+      const tMergeItem& item = roots[merged[i].item.root].items[merged[i].item.index];
+      tFileRecord& rec = lists[merged[i].item.root].files[item.tag];
+      if (rec.attributes & FILE_ATTRIBUTE_HIDDEN)
          // Ignore hidden files
          continue;
 
-      HICON smallIcon, largeIcon;
-      CString target;
-      CString itemName = GetFileNameComp(fileName, eFcName);
-      HMENU subMenu = NULL;
+      tDirEntry entry;
+      entry.name = item.name.c_str();
+      entry.path = rec.path;
+      entry.attributes = rec.attributes;
+      entry.modTime = rec.modTime;
+      entry.iconInd = 0;
+      if (IS_DIR_ENTRY(entry))
+      {
+         // Directories with the same name in the other roots are merged into the sub menu
+         for (r = 0; r < merged[i].overlays.size(); r++)
+         {
+            const tMergeRef& ref = merged[i].overlays[r];
+            if (!entry.altDir.IsEmpty())
+               entry.altDir += DIR_LIST_SEP;
+            entry.altDir += lists[ref.root].files[roots[ref.root].items[ref.index].tag].path;
+         }
+      }
+      else if (IS_SHORTCUT(entry.path))
+      {
+         links.push_back(tLinkTask());
+         links.back().path = entry.path;
+      }
+      found.push_back(entry);
+   }
 
-      if (IS_SHORTCUT(fileName))
+   // Resolve all shortcuts of the directory as one batch, the results are in listing order
+   std::vector<PVOID> linkTasks;
+   for (i = 0; i < links.size(); i++)
+      linkTasks.push_back(&links[i]);
+   if (!linkTasks.empty() && !RunTasks(ResolveLinkTask, &linkTasks[0], (DWORD)linkTasks.size(), 0, pumpMessages))
+      return FALSE;
+
+   DWORD link = 0;
+   for (i = 0; i < found.size(); i++)
+   {
+      tDirEntry& entry = found[i];
+      if (!IS_DIR_ENTRY(entry) && IS_SHORTCUT(entry.path))
       {
-         GetShortcutInfo(fileName, target, &largeIcon, &smallIcon);
-         if (!FileExists(target))
+         tLinkTask& task = links[link++];
+         if (task.targetAttr == INVALID_FILE_ATTRIBUTES)
             // Ignore shortcuts to missing targets
             continue;
-         if (IsDir(target))
+         entry.target = task.target;
+         entry.iconFile = task.iconFile;
+         entry.iconInd = task.iconInd;
+         if (task.targetAttr & FILE_ATTRIBUTE_DIRECTORY)
+         {
             // Use the target folder
-            fileName = target;
+            entry.path = entry.target;
+            entry.attributes |= FILE_ATTRIBUTE_DIRECTORY;
+         }
+      }
+      entries.push_back(entry);
+   }
+
+#ifdef _DEBUG
+   CString trace;
+   DWORD hits, misses;
+   GetShortcutCacheStats(&hits, &misses);
+   trace.Format(_T("ScanDir %s: %d entries, %d file system calls, shortcut cache %d hits %d misses\n"),
+                (LPCTSTR)dir, entries.size(), GetFsCallCount()-fsCalls, hits, misses);
+   OutputDebugString(trace);
+#endif
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+// Icon load request. Buttons and menu items are shown with placeholder icons
+// until their icons have been loaded in the background.
+typedef struct {
+   pCommandInfo pButton; // Button to update, NULL for a menu item
+   HMENU hMenu;         // Menu holding the menu item to update
+   PVOID itemData;      // Extra data identifying the menu item
+   INT pos;             // Position of the menu item when requested
+   CString path;        // Button command or menu entry path, checked before updating
+   CString iconFile;    // Icon location, empty when the icons of the file are used
+   INT iconInd;
+   CString fileName;    // File providing the icons when not found at the icon location
+   HICON hIcon;         // Loaded large icon
+   HICON hSmallIcon;    // Loaded small icon
+} tIconRequest;
+
+CRITICAL_SECTION gIconQueueLock;
+BOOL gIconQueueLockInit = (InitializeCriticalSection(&gIconQueueLock), TRUE);
+std::vector<tIconRequest*> gIconQueue;  // Requests not yet taken by the loader
+BOOL gIconLoaderRunning = FALSE;        // Set while the loader thread runs
+BOOL gIconLoaderStop = FALSE;           // Set to end the loader after its current batch
+HANDLE gIconLoaderThread = NULL;        // Last loader thread started, waited for when ending
+
+void LoadIconTask(PVOID param)
+{
+   // Load the icons of a request and hand them over to the main window
+   tIconRequest *pReq = (tIconRequest*)param;
+   pReq->hIcon = pReq->hSmallIcon = NULL;
+   GetLocationIcons(pReq->iconFile, pReq->iconInd, pReq->fileName, &pReq->hIcon, &pReq->hSmallIcon);
+   if (!PostMessage(gMainWindow, WM_USER_ICONS_LOADED, (WPARAM)pReq, 0))
+   {
+      ReleaseIcon(pReq->hIcon);
+      ReleaseIcon(pReq->hSmallIcon);
+      delete pReq;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+DWORD WINAPI IconLoaderThreadProc(LPVOID param)
+{
+   // Load the requested icons in batches until no more are queued
+   CoInitialize(NULL);
+   for (;;)
+   {
+      std::vector<tIconRequest*> batch;
+      EnterCriticalSection(&gIconQueueLock);
+      if (!gIconLoaderStop)
+         batch.swap(gIconQueue);
+      if (batch.empty())
+         gIconLoaderRunning = FALSE;
+      LeaveCriticalSection(&gIconQueueLock);
+      if (batch.empty())
+         break;
+      RunTasks(LoadIconTask, (PVOID*)&batch[0], (DWORD)batch.size());
+   }
+   ReleaseShellLinkObjects();
+   CoUninitialize();
+   return 0;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL QueueIconLoad(tIconRequest *pReq)
+{
+   // Queue a request for the icon loader, starting it unless already running
+   BOOL ok = TRUE;
+   EnterCriticalSection(&gIconQueueLock);
+   if (gIconLoaderStop)
+   {
+      // Ending, the placeholder icons remain
+      LeaveCriticalSection(&gIconQueueLock);
+      delete pReq;
+      return FALSE;
+   }
+   gIconQueue.push_back(pReq);
+   if (!gIconLoaderRunning)
+   {
+      // The previous loader has taken its last batch and is ending
+      if (gIconLoaderThread)
+         CloseHandle(gIconLoaderThread);
+      gIconLoaderThread = CreateThread(NULL, 0, IconLoaderThreadProc, NULL, 0, NULL);
+      if (gIconLoaderThread)
+         gIconLoaderRunning = TRUE;
+      else
+      {
+         gIconQueue.pop_back();
+         ok = FALSE;
       }
+   }
+   LeaveCriticalSection(&gIconQueueLock);
+   if (!ok)
+      // Load here instead
+      LoadIconTask(pReq);
+   return ok;
+}
+
+//--------------------------------------------------------------------------
+
+void EndIconLoader()
+{
+   // Stop the icon loader after its current batch and wait for it to end. Requests
+   // still queued are dropped.
+   EnterCriticalSection(&gIconQueueLock);
+   gIconLoaderStop = TRUE;
+   HANDLE hThread = gIconLoaderThread;
+   gIconLoaderThread = NULL;
+   LeaveCriticalSection(&gIconQueueLock);
+   if (hThread)
+   {
+      WaitForSingleObject(hThread, INFINITE);
+      CloseHandle(hThread);
+   }
+   size_t i;
+   for (i = 0; i < gIconQueue.size(); i++)
+      delete gIconQueue[i];
+   gIconQueue.clear();
+}
+
+//--------------------------------------------------------------------------
+
+void LoadButtonIcons(pCommandInfo pCom, LPCTSTR command, LPCTSTR iconFile, INT iconInd, LPCTSTR fileName)
+{
+   // Request the icons of a button
+   tIconRequest *pReq = new tIconRequest;
+   pReq->pButton = pCom;
+   pReq->hMenu = NULL;
+   pReq->itemData = NULL;
+   pReq->pos = 0;
+   pReq->path = command;
+   pReq->iconFile = iconFile;
+   pReq->iconInd = iconInd;
+   pReq->fileName = fileName;
+   QueueIconLoad(pReq);
+}
+
+//--------------------------------------------------------------------------
+
+void LoadMenuItemIcons(HMENU hMenu, INT pos, CString *link, const tDirEntry& entry)
+{
+   // Request the icons of a folder menu item
+   tIconRequest *pReq = new tIconRequest;
+   pReq->pButton = NULL;
+   pReq->hMenu = hMenu;
+   pReq->itemData = link;
+   pReq->pos = pos;
+   pReq->path = entry.path;
+   pReq->iconFile = entry.iconFile;
+   pReq->iconInd = entry.iconInd;
+   pReq->fileName = entry.target.IsEmpty() ? entry.path : entry.target;
+   QueueIconLoad(pReq);
+}
+
+//--------------------------------------------------------------------------
+
+BOOL ApplyLoadedIcons(tIconRequest *pReq)
+{
+   // Show loaded icons on the button or menu item requesting them, if still present.
+   // Only the button or menu item is redrawn.
+   BOOL used = FALSE;
+   if (pReq->hIcon && pReq->hSmallIcon)
+   {
+      if (pReq->pButton)
+      {
+         pCommandInfo pCom = Button2Index(pReq->pButton) >= 0 ? pReq->pButton : NULL;
+         if (pCom && pCom->command == pReq->path)
+         {
+            ReleaseIcon(pCom->hIcon);
+            ReleaseIcon(pCom->hSmallIcon);
+            pCom->hIcon = pReq->hIcon;
+            pCom->hSmallIcon = pReq->hSmallIcon;
+            InvalidateButton(pCom);
+            used = TRUE;
+         }
+      }
+      else if (IsMenu(pReq->hMenu))
+      {
+         // The item may have moved if the menu was patched meanwhile
+         INT pos = pReq->pos, cnt = GetMenuItemCount(pReq->hMenu);
+         if (pos >= cnt || GetMenuItemData(pReq->hMenu, pos) != pReq->itemData)
+            for (pos = 0; pos < cnt && GetMenuItemData(pReq->hMenu, pos) != pReq->itemData; pos++);
+         if (pos < cnt && *(CString*)pReq->itemData == pReq->path)
+            used = SetMenuItemIcons(pReq->hMenu, pos, pReq->hSmallIcon, pReq->hIcon);
+      }
+   }
+   if (!used)
+   {
+      ReleaseIcon(pReq->hIcon);
+      ReleaseIcon(pReq->hSmallIcon);
+   }
+   delete pReq;
+   return used;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL InsertDirMenuItem(HMENU hMenu, INT pos, const tDirEntry& entry)
+{
+   // Create the menu item of a folder entry at the specified position. The item is
+   // shown with a placeholder icon until its icons have been loaded.
+   HMENU subMenu = NULL;
+
+   CString *link = new CString(entry.path);
+   if (IS_DIR_ENTRY(entry))
+      // Sub directory, its entries are added when opened
+      subMenu = AddDirMenu(entry.path, FALSE, entry.altDir, link);
+
+   AddMenuItem(hMenu, entry.name, subMenu, pos);
+   BOOL ok = SetMenuItemData(hMenu, -pos, AcquirePlaceholderIcon(IS_DIR_ENTRY(entry), FALSE),
+                             AcquirePlaceholderIcon(IS_DIR_ENTRY(entry), TRUE), FALSE, link);
+   LoadMenuItemIcons(hMenu, pos, link, entry);
+   return ok;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL AddDirMenuPage(HMENU hMenu, pDirMenuInfo pInf)
+{
+   // Add the menu items of the entries on a folder menu page. Large folders are split
+   // into pages of gMenuPage entries, each but the last ending with a continuation
+   // sub menu which is filled when opened.
+   const tDirEntryList& entries = pInf->pageOwner ? GetDirMenuInfo(pInf->pageOwner)->entries : pInf->entries;
+   DWORD i, last = (DWORD)entries.size();
+   if (gMenuPage && last > pInf->first + gMenuPage)
+      last = pInf->first + gMenuPage;
+   for (i = pInf->first; i < last; i++)
+      InsertDirMenuItem(hMenu, i - pInf->first, entries[i]);
+
+   if (last < entries.size())
+   {
+      HMENU subMenu = AddDirMenu(pInf->dir, FALSE, pInf->altDir, pInf->link);
+      pDirMenuInfo pSubInf = GetDirMenuInfo(subMenu);
+      pSubInf->first = last;
+      pSubInf->pageOwner = pInf->pageOwner ? pInf->pageOwner : hMenu;
+      AddMenuItem(hMenu, LoadFormatResString(IDS_MORE), subMenu, last - pInf->first);
+   }
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL FillDirMenu(HMENU hMenu)
+{
+   // Add the entries of the directory of a folder menu, from the index when available.
+   // Sub directories get empty menus which are filled in the same way when opened.
+   pDirMenuInfo pInf = GetDirMenuInfo(hMenu);
+   if (!pInf || pInf->filled)
+      return FALSE;
+   pInf->filled = TRUE;
+
+   // Continuation pages use the entries of the first page
+   if (!pInf->pageOwner && !GetIndexedDir(pInf->dir, pInf->altDir, pInf->entries))
+   {
+      // Messages are dispatched during the scan, so the menu may be gone when done
+      CString dir = pInf->dir,
+              altDir = pInf->altDir;
+      tDirEntryList entries;
+      BOOL scanned = ScanDir(dir, altDir, entries, TRUE);
+      if (scanned)
+         SetIndexedDir(dir, altDir, entries);
+      pInf = GetDirMenuInfo(hMenu);
+      if (!pInf || GetMenuItemCount(hMenu) > 0)
+         // Destroyed or already patched meanwhile
+         return FALSE;
+      if (!scanned)
+      {
+         // Cancelled, scanned again when opened the next time
+         pInf->filled = FALSE;
+         return FALSE;
+      }
+      pInf->entries = entries;
+   }
+
+   // Add the menu(s)
+   return AddDirMenuPage(hMenu, pInf);
+}
+
+//--------------------------------------------------------------------------
+
+void DeleteDirMenuInfo(HMENU hMenu)
+{
+   // Free the folder information of a menu and all its sub menus
+   INT i;
+   for (i = 0; i < GetMenuItemCount(hMenu); i++)
+   {
+      HMENU subMenu = GetSubMenu(hMenu, i);
+      if (subMenu)
+         DeleteDirMenuInfo(subMenu);
+   }
+   delete GetDirMenuInfo(hMenu);
+}
+
+//--------------------------------------------------------------------------
+
+BOOL DestroyDirMenu(HMENU hMenu)
+{
+   // Destroy a folder menu with all its item data and folder information
+   DeleteDirMenuInfo(hMenu);
+   return DestroyMenuData(hMenu, TRUE);
+}
+
+//--------------------------------------------------------------------------
+
+BOOL RemoveDirMenuItem(HMENU hMenu, INT pos)
+{
+   // Remove a folder menu item together with its data and possible sub menu
+   HMENU subMenu = GetSubMenu(hMenu, pos);
+   if (subMenu)
+   {
+      DeleteDirMenuInfo(subMenu);
+      DestroyMenuData(subMenu);
+   }
+   DestroyMenuItemData(hMenu, pos);
+   return DeleteMenu(hMenu, pos, MF_BYPOSITION);
+}
+
+//--------------------------------------------------------------------------
+
+CString DirEntryKey(const tDirEntry& entry)
+{
+   // Identity of a folder menu entry
+   CString key = entry.name + _T("|") + entry.path;
+   key.MakeUpper();
+   return key;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL SameMenuEntry(const tDirEntry& first, const tDirEntry& second)
+{
+   // Check if the menu item of an entry can be kept. Sub directory contents are handled
+   // by their own menus, so only file entries depend on attributes and modification time.
+   if (IS_DIR_ENTRY(first) && IS_DIR_ENTRY(second))
+      return first.name == second.name &&
+             first.path == second.path &&
+             first.altDir == second.altDir &&
+             first.iconFile == second.iconFile &&
+             first.iconInd == second.iconInd;
+   return EqualDirEntry(first, second);
+}
+
+//--------------------------------------------------------------------------
+
+BOOL PatchDirMenu(HMENU hMenu, const tDirEntryList& entries)
+{
+   // Update a filled folder menu to show the specified entries. Only the items of new,
+   // removed or changed entries are touched, the others keep their icons and data.
+   pDirMenuInfo pInf = GetDirMenuInfo(hMenu);
+   if (!pInf || !pInf->filled)
+      return FALSE;
+
+   if (gMenuPage && (pInf->entries.size() > gMenuPage || entries.size() > gMenuPage))
+   {
+      // Paged menus are rebuilt, only the first page is created again
+      INT pos;
+      for (pos = GetMenuItemCount(hMenu)-1; pos >= 0; pos--)
+         RemoveDirMenuItem(hMenu, pos);
+      pInf->entries = entries;
+      return AddDirMenuPage(hMenu, pInf);
+   }
+
+   std::map<CString, DWORD> newKeys;
+   DWORD i;
+   for (i = 0; i < entries.size(); i++)
+      newKeys[DirEntryKey(entries[i])] = i;
+
+   // Remove the items of entries no longer present or changed, last first to keep positions valid
+   std::vector<CString> keptKeys;
+   INT pos;
+   for (pos = (INT)pInf->entries.size()-1; pos >= 0; pos--)
+   {
+      CString key = DirEntryKey(pInf->entries[pos]);
+      std::map<CString, DWORD>::iterator it = newKeys.find(key);
+      if (it == newKeys.end() || !SameMenuEntry(pInf->entries[pos], entries[it->second]))
+         RemoveDirMenuItem(hMenu, pos);
       else
-         GetFileIcons(fileName, &largeIcon, &smallIcon);
+         keptKeys.push_back(key);
+   }
 
-      if (IsDir(fileName))
-         // Recursively handle sub directories
-         subMenu = AddDirMenu(fileName, FALSE, fileMap[itemName]);
+   // Insert the new items. Kept entries are in the same relative order in both lists
+   // since sorted the same way.
+   std::vector<CString>::reverse_iterator kept = keptKeys.rbegin();
+   for (i = 0; i < entries.size(); i++)
+   {
+      if (kept != keptKeys.rend() && *kept == DirEntryKey(entries[i]))
+         ++kept;
+      else
+         InsertDirMenuItem(hMenu, i, entries[i]);
+   }
+   pInf->entries = entries;
+
+   return TRUE;
+}
 
-      // Insert this item in the menu
-      AddMenuItem(hMenu, itemName, subMenu);
-      CString *link = new CString(fileName);
-      SetMenuItemData(hMenu, -(GetMenuItemCount(hMenu)-1), smallIcon, largeIcon, FALSE, link);
+//--------------------------------------------------------------------------
+
+void UpdateDirMenus(HMENU hMenu, const CString& dir, const CString& altDir, const tDirEntryList& entries)
+{
+   // Patch the filled folder menus showing the specified directory
+   pDirMenuInfo pInf = GetDirMenuInfo(hMenu);
+   if (!pInf || !pInf->filled)
+      return;
+   if (!pInf->pageOwner && pInf->dir.CompareNoCase(dir) == 0 && pInf->altDir.CompareNoCase(altDir) == 0)
+      // Continuation pages are handled together with their first page
+      PatchDirMenu(hMenu, entries);
+   INT i;
+   for (i = 0; i < GetMenuItemCount(hMenu); i++)
+   {
+      HMENU subMenu = GetSubMenu(hMenu, i);
       if (subMenu)
+         UpdateDirMenus(subMenu, dir, altDir, entries);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+// Directory scan task
+typedef struct {
+   CString dir;            // Directory to scan
+   CString altDir;         // Possible directory to merge
+   tDirEntryList entries;  // Resulting entries
+} tScanTask;
+
+LONG gRevalidateRequests = 0;    // Pending requests for index revalidation
+BOOL gRevalidateStop = FALSE;    // Set to end the revalidation at exit
+HANDLE gRevalidateThread = NULL; // Last revalidation thread started, waited for when ending
+
+void ScanDirTask(PVOID param)
+{
+   // Skipped when ending, the results are not used then
+   tScanTask *pTask = (tScanTask*)param;
+   if (!gRevalidateStop)
+      ScanDir(pTask->dir, pTask->altDir, pTask->entries);
+}
+
+//--------------------------------------------------------------------------
+
+DWORD WINAPI RevalidateThreadProc(LPVOID param)
+{
+   // Rescan all indexed directories in the background and report the ones that have changed
+   CoInitialize(NULL);
+   LONG requests;
+   do
+   {
+      requests = gRevalidateRequests;
+      // Folders gone or no longer shown need not be scanned
+      PruneDirIndex();
+      std::vector<CString> dirs, altDirs;
+      DWORD i, cnt = GetIndexedDirList(dirs, altDirs);
+
+      // Scan all directories in parallel
+      std::vector<tScanTask> scans(cnt);
+      std::vector<PVOID> tasks(cnt);
+      for (i = 0; i < cnt; i++)
       {
-         // Insert the name as menu info as well for sub menus.
-         // Needed to handle context menu selection on cascading sub menus.
-         MENUINFO menuInf;
-         ZeroMemory(&menuInf, sizeof(menuInf));
-         menuInf.cbSize = sizeof(menuInf);
-         menuInf.fMask = MIM_MENUDATA;
-         menuInf.dwMenuData = (ULONG_PTR)link;
-         SetMenuInfo(subMenu, &menuInf);
+         scans[i].dir = dirs[i];
+         scans[i].altDir = altDirs[i];
+         tasks[i] = &scans[i];
+      }
+      if (cnt)
+         RunTasks(ScanDirTask, &tasks[0], cnt);
+      if (gRevalidateStop)
+         break;
+
+      for (i = 0; i < cnt; i++)
+         if (SetIndexedDir(dirs[i], altDirs[i], scans[i].entries))
+            PostMessage(gMainWindow, WM_USER_INDEX_CHANGED, (WPARAM)new CString(dirs[i]), (LPARAM)new CString(altDirs[i]));
+      SaveDirIndex();
+      // Start over if requested again meanwhile
+   } while (InterlockedCompareExchange(&gRevalidateRequests, 0, requests) != requests);
+   ReleaseShellLinkObjects();
+   CoUninitialize();
+   return 0;
+}
+
+//--------------------------------------------------------------------------
+
+void UpdateIndexRoots()
+{
+   // Tell the folder index which directories the folder menus of the buttons show
+   std::vector<CString> dirs, altDirs;
+   DWORD i;
+   for (i = 0; i < gButtons.cnt; i++)
+   {
+      pDirMenuInfo pInf = gButtons.list[i]->hMenu ? GetDirMenuInfo(gButtons.list[i]->hMenu) : NULL;
+      if (pInf)
+      {
+         dirs.push_back(pInf->dir);
+         altDirs.push_back(pInf->altDir);
       }
    }
-   if (doInit)
-      InitPopupMenu(hMenu, TRUE);
+   SetIndexRoots(dirs, altDirs);
+}
 
-   return hMenu;
+//--------------------------------------------------------------------------
+
+BOOL RevalidateIndex()
+{
+   // Start revalidation of the folder index unless already running
+   UpdateIndexRoots();
+   if (gRevalidateStop)
+      return FALSE;
+   if (InterlockedIncrement(&gRevalidateRequests) > 1)
+      return TRUE;
+   // The previous thread has served its last request and is ending
+   if (gRevalidateThread)
+      CloseHandle(gRevalidateThread);
+   gRevalidateThread = CreateThread(NULL, 0, RevalidateThreadProc, NULL, 0, NULL);
+   if (!gRevalidateThread)
+   {
+      gRevalidateRequests = 0;
+      return FALSE;
+   }
+   return TRUE;
+}
 
+//--------------------------------------------------------------------------
+
+void EndRevalidation()
+{
+   // Stop a running revalidation without applying its results and wait for it to end
+   gRevalidateStop = TRUE;
+   if (gRevalidateThread)
+   {
+      WaitForSingleObject(gRevalidateThread, INFINITE);
+      CloseHandle(gRevalidateThread);
+      gRevalidateThread = NULL;
+   }
 }
 
 //--------------------------------------------------------------------------
@@ -539,68 +1263,97 @@ BOOL AddNewButton(LPCTSTR command,
                   DWORD pos = gButtons.cnt,
                   LPCTSTR params = EMPTY_CSTR, 
                   CString iconFile = EMPTY_CSTR, DWORD iconInd = 0, 
-                  CString toolTip = EMPTY_CSTR, WORD showType = SW_SHOWNORMAL)
+                  CString toolTip = EMPTY_CSTR, WORD showType = SW_SHOWNORMAL,
+                  DWORD attributes = INVALID_FILE_ATTRIBUTES)
 {
-   if (!FileExists(command) || FileIsHidden(command) || gButtons.cnt >= MAX_BUTTONS)
-      // Missing or too many already
-      return FALSE;
-
-   HWND hWndButton = CreateWindow(BUTTON_CLASS_NAME, EMPTY_STR,  WS_CHILD,
-                                  0, 0, 100, 100, 
-                                  gMainWindow, (HMENU)NULL, CURR_INSTANCE, NULL);
-   if (!hWndButton)
+   // The attributes may be provided by a caller who has already listed the directory
+   if (attributes == INVALID_FILE_ATTRIBUTES)
+      attributes = FileAttributes(command);
+   if (attributes == INVALID_FILE_ATTRIBUTES || (attributes & FILE_ATTRIBUTE_HIDDEN))
+      // Missing or hidden
       return FALSE;
 
    pCommandInfo pCom = new tCommandInfo;
    if (!pCom)
       return FALSE;
 
-   // Save the information structure in window user data field
-   SetWindowLongPtr(hWndButton, GWLP_USERDATA, (LONG)pCom);
-
    pCom->command = command;
    pCom->params = params;
 
    CString target = command;
+   INT ind = iconInd;
    if (IS_SHORTCUT(command))
    {
-      // Get shortcut icons and tooltip
-      GetShortcutInfo(pCom->command, target, &pCom->hIcon, &pCom->hSmallIcon, &toolTip);
+      // Get shortcut icon location, the tooltip is taken from the shortcut when shown
+      GetShortcutInfo(pCom->command, target, NULL, NULL, NULL, &iconFile, &ind);
+      toolTip = EMPTY_CSTR;
    }
-   else
-   {
-      if (toolTip.IsEmpty())
-         toolTip = GetFileNameComp(command, eFcName | eFcType);
-      if (iconFile.IsEmpty())
-         // Icon file not specified, use the command itself
-         GetFileIcons(pCom->command, &pCom->hIcon, &pCom->hSmallIcon);
-      else
-         ExtractIconEx(iconFile, iconInd, &pCom->hIcon, &pCom->hSmallIcon, 1);
-   }
-
-   pCom->hToolTip = CreateTooltip(hWndButton, toolTip);
+   else if (toolTip.IsEmpty())
+      toolTip = GetFileNameComp(command, eFcName | eFcType);
+
+   // Show placeholder icons until the icons have been loaded, those of the shortcut
+   // target or of the command itself if the icon file is not specified
+   DWORD targetAttr = FileAttributes(target);
+   BOOL isDir = targetAttr != INVALID_FILE_ATTRIBUTES && (targetAttr & FILE_ATTRIBUTE_DIRECTORY);
+   pCom->missing = IS_SHORTCUT(command) && !target.IsEmpty() && targetAttr == INVALID_FILE_ATTRIBUTES;
+   pCom->hIcon = AcquirePlaceholderIcon(isDir, TRUE);
+   pCom->hSmallIcon = AcquirePlaceholderIcon(isDir, FALSE);
+   LoadButtonIcons(pCom, command, iconFile, ind, iconFile.IsEmpty() && !target.IsEmpty() ? target : pCom->command);
+
+   pCom->toolTip = toolTip;
    pCom->showType = showType;
    pCom->hMenu = NULL;
 
-   if (IsDir(target))
+   if (isDir)
       // Create a popup menu for this button
       pCom->hMenu = AddDirMenu(target, TRUE, EMPTY_CSTR);
 
-   // Want drag and drop of files for the buttons
-   DragAcceptFiles(hWndButton, TRUE);
-
    // Insert in the list
-   for (DWORD i = gButtons.cnt; i > pos; i--)
-      gButtons.list[i] = gButtons.list[i-1];
-   gButtons.list[pos] = hWndButton;
+   InsertButton(pCom, pos);
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
 
-   gButtons.cnt++;
+BOOL gInFolderMenu = FALSE;                           // Set while a folder menu is shown
+std::list<std::pair<CString, CString> > gPendingDirs; // Changed folders to apply when the menu is closed
 
+BOOL ApplyIndexChange(const CString& dir, const CString& altDir)
+{
+   // Apply a folder change found by the index revalidation to the folder menus.
+   // Postponed while a folder menu is shown.
+   if (gInFolderMenu)
+   {
+      gPendingDirs.push_back(std::make_pair(dir, altDir));
+      return FALSE;
+   }
+   tDirEntryList entries;
+   if (!GetIndexedDir(dir, altDir, entries))
+      return FALSE;
+   DWORD i;
+   for (i = 0; i < gButtons.cnt; i++)
+   {
+      pCommandInfo pCom = gButtons.list[i];
+      if (pCom->hMenu)
+         UpdateDirMenus(pCom->hMenu, dir, altDir, entries);
+   }
    return TRUE;
 }
 
 //--------------------------------------------------------------------------
 
+void ApplyPendingIndexChanges()
+{
+   // Apply folder changes postponed while a folder menu was shown
+   while (!gPendingDirs.empty())
+   {
+      ApplyIndexChange(gPendingDirs.front().first, gPendingDirs.front().second);
+      gPendingDirs.pop_front();
+   }
+}
+
+//--------------------------------------------------------------------------
+
 // Brushes for highlighting of the buttons
 HBRUSH gBgBrush = CreateSolidBrush(RGB(211, 218, 237));        // Normal background
 HBRUSH gPushBrush = CreateSolidBrush(RGB(150, 150, 150));      // Button pushed
@@ -609,12 +1362,10 @@ HPEN gShadowPen = CreatePen(PS_SOLID, 0, RGB(127, 127, 127));  // Normal button
 HPEN gBgPen = CreatePen(PS_SOLID, 0, RGB(211, 218, 237));      // Normal background pen
 
 enum eDrawType {eNormal, eHighlight, ePushed};
-void DrawButton(HWND hWnd, HDC orgDC = NULL, eDrawType type = eNormal)
+
+void DrawButton(HDC hDC, const RECT& r, pCommandInfo pCom, eDrawType type = eNormal)
 {
-   // Draw a button in the specified way
-   RECT r;
-   GetClientRect(hWnd, &r);
-   HDC hDC = orgDC ? orgDC : GetWindowDC(hWnd);
+   // Draw a button cell in the specified way
    SelectObject(hDC, GetStockObject(NULL_PEN));
    if (type == ePushed)
       SelectObject(hDC, gPushBrush);
@@ -634,11 +1385,10 @@ void DrawButton(HWND hWnd, HDC orgDC = NULL, eDrawType type = eNormal)
       LineTo(hDC, r.left, r.bottom-1);
    }
 
-   pCommandInfo pCom = GET_COM_INFO(hWnd);
    if (pCom)
    {
-      DrawIconEx(hDC, ICON_OFF, ICON_OFF, gLargeIcons ? pCom->hIcon : pCom->hSmallIcon, 
-                 ICON_SIZE, ICON_SIZE, 0, NULL, DI_NORMAL);
+      DrawAtlasIcon(hDC, gLargeIcons ? pCom->hIcon : pCom->hSmallIcon, r.left + gLayout.iconOffset, r.top + gLayout.iconOffset, gLayout.iconSize,
+                    pCom->missing);
       if (pCom->hMenu)
       {
          // Draw arrow in order to indicate the popup menu
@@ -658,313 +1408,354 @@ void DrawButton(HWND hWnd, HDC orgDC = NULL, eDrawType type = eNormal)
          LineTo(hDC, r.right-w, c+h/2);
       }
    }
-   if (!orgDC)
-      ReleaseDC(hWnd, hDC);
 }
 
-LRESULT APIENTRY ButtonWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) 
-{
-   // Window callback procedure for the button class
-   pCommandInfo pCom;
-   static HWND tracker = NULL;
-   static BOOL dragging = FALSE;
-   // The actual target for context menu operations is stored here
-   static CString contMenuCom = EMPTY_CSTR;
-
-   // Context menu setup and tracking
-   static BOOL inContext = FALSE;
-#define DO_MENU_CONTEXTMENU(com) \
-   { \
-      POINT pos; \
-      GetCursorPos(&pos); \
-      contMenuCom = com; \
-      inContext = TRUE; \
-      TrackPopupMenu(IsDir(GetTrueTarget(contMenuCom)) ? gDirPopupMenu : gFilePopupMenu, TPM_LEFTBUTTON | TPM_RECURSE, pos.x, pos.y, 0, hWnd, NULL); \
-      inContext = FALSE; \
-      PostMessage(hWnd, WM_CANCELMODE, 0, 0); \
-   }
-
-   // Need to keep track of opened submenus in order to handle right click on cascading submenus
-   static HMENU openMenu = NULL;
-
-	switch (message)
-	{
-      case WM_PAINT:
-         {
-            HDC         hDC;
-            PAINTSTRUCT ps;
-	         hDC = BeginPaint(hWnd, &ps);
-            // Draw the button, higlighted if still tracking
-            DrawButton(hWnd, hDC, tracker == hWnd ? eHighlight : eNormal);
-	         EndPaint(hWnd, &ps);
-         }
-         break;
-
-      case WM_LBUTTONDOWN:
-         // Left button pressed, start visualization of a pressed button
-         DrawButton(hWnd, NULL, ePushed);
-         break;
+//--------------------------------------------------------------------------
 
-      case WM_RBUTTONDOWN:
-         // Right button pressed on button, show appropriate context menu
-          DO_MENU_CONTEXTMENU((GET_COM_INFO(hWnd))->command);
-         break;
+void SetButtonState(pCommandInfo pCom, eDrawType type)
+{
+   // Set the drawing state of a button, only the cells of the buttons changing state are redrawn
+   pCommandInfo prevHot = gHotButton,
+                prevPushed = gPushedButton;
+   if (type == ePushed)
+      gHotButton = gPushedButton = pCom;
+   else
+   {
+      if (gPushedButton == pCom)
+         gPushedButton = NULL;
+      if (type == eHighlight)
+         gHotButton = pCom;
+      else if (gHotButton == pCom)
+         gHotButton = NULL;
+   }
+   if (prevHot && prevHot != pCom)
+      InvalidateButton(prevHot);
+   if (prevPushed && prevPushed != pCom && prevPushed != prevHot)
+      InvalidateButton(prevPushed);
+   InvalidateButton(pCom);
+}
 
-      case WM_MENURBUTTONUP:
-         // Right button pressed during TrackPopupMenu
-         DO_MENU_CONTEXTMENU(*(CString*)GetMenuItemData((HMENU)lParam, (INT)wParam));
-         break;
+//--------------------------------------------------------------------------
 
-      case WM_MOUSEMOVE:
-         // Cursor has entered this button
-         if (!tracker)
-         {
-            // Start tracking in order to detect when leaving
-            TRACKMOUSEEVENT tme;
-            tme.cbSize = sizeof(TRACKMOUSEEVENT);
-            tme.dwFlags = TME_LEAVE;
-            tme.hwndTrack = hWnd;
-            if (TrackMouseEvent(&tme))
-            {
-               // Highlight the button
-               DrawButton(hWnd, NULL, eHighlight);
-	            tracker = hWnd;
-            }
-         }
-         break;
+DWORD DrawToolbar(HDC hDC, HRGN hRgn)
+{
+   // Draw the parts of the toolbar within a region, which is the clipping region of the
+   // device context: lines and simple markers at both ends of the main window and the
+   // button cells. Returns the number of cells drawn.
+   POINT p1, p2;
+   LONG off = gLayout.endSpace;
+   RECT r = {0, 0, gWindowSize.x, gWindowSize.y};
+   FillRect(hDC, &r, gBgBrush);
+   SelectObject(hDC, gBgBrush);
+   if (gLocation == 1 || gLocation == 3)
+   {
+      SelectObject(hDC, gLightPen);
+      MoveToEx(hDC, 0, off-2, NULL);
+      LineTo(hDC, gWindowSize.x, off-2);
+      MoveToEx(hDC, 0, gWindowSize.y - off-1, NULL);
+      LineTo(hDC, gWindowSize.x, gWindowSize.y - off-1);
+
+      SelectObject(hDC, gShadowPen);
+      MoveToEx(hDC, 0, off-1, NULL);
+      LineTo(hDC, gWindowSize.x, off-1);
+      MoveToEx(hDC, 0, gWindowSize.y - off, NULL);
+      LineTo(hDC, gWindowSize.x, gWindowSize.y - off);
+
+      p1.x = p2.x = (gWindowSize.x)/2 - 1;
+      p1.y = MARK_RADIUS + gLayout.margin;
+      p2.y = gWindowSize.y - (MARK_RADIUS + gLayout.margin) - 1;
+   }
+   else
+   {
+      SelectObject(hDC, gLightPen);
+      MoveToEx(hDC, off-2, 0, NULL);
+      LineTo(hDC, off-2, gWindowSize.y);
+      MoveToEx(hDC, gWindowSize.x - off-1, 0, NULL);
+      LineTo(hDC, gWindowSize.x - off-1, gWindowSize.y);
+
+      SelectObject(hDC, gShadowPen);
+      MoveToEx(hDC, off-1, 0, NULL);
+      LineTo(hDC, off-1, gWindowSize.y);
+      MoveToEx(hDC, gWindowSize.x - off, 0, NULL);
+      LineTo(hDC, gWindowSize.x - off, gWindowSize.y);
+
+      p1.x = MARK_RADIUS + gLayout.margin;
+      p2.x = gWindowSize.x - (MARK_RADIUS + gLayout.margin) - 1;
+      p1.y = p2.y = (gWindowSize.y)/2 - 1;
+   }
+   Ellipse(hDC, p1.x-MARK_RADIUS, p1.y-MARK_RADIUS, p1.x+MARK_RADIUS, p1.y+MARK_RADIUS);
+   Ellipse(hDC, p2.x-MARK_RADIUS, p2.y-MARK_RADIUS, p2.x+MARK_RADIUS, p2.y+MARK_RADIUS);
 
-      case WM_MOUSELEAVE:
-         // Cursor is leaving this button
-         InvalidateRect(hWnd, NULL, TRUE); // Back to normal
-         tracker = NULL;
-         if (GetAsyncKeyState(VK_LBUTTON) & 0x8000)
-         {
-            // Button is down, start dragging
-            dragging = TRUE;
-            POINT pt = {0, 0};
-            // Simulate window title drag event to initiate the drag operation
-            PostMessage(hWnd, WM_NCLBUTTONDOWN, HTCAPTION, (LPARAM)&pt);
-            SetCursor(LoadCursor(NULL, IDC_HAND));
-         }
-         break;
+   DWORD i, cells = 0;
+   for (i = 0; i < gButtons.cnt; i++)
+   {
+      r = ButtonRect(i);
+      if (RectInRegion(hRgn, &r))
+      {
+         pCommandInfo pCom = gButtons.list[i];
+         DrawButton(hDC, r, pCom, pCom == gPushedButton ? ePushed : pCom == gHotButton ? eHighlight : eNormal);
+         cells++;
+      }
+   }
+   if (gDragButton && RectInRegion(hRgn, &gDragRect))
+   {
+      // The dragged button on top of the others
+      DrawButton(hDC, gDragRect, gDragButton, eHighlight);
+      cells++;
+   }
+   return cells;
+}
 
-      case WM_LBUTTONUP:
-         // Button released over this button, execute the corresponding command
-         InvalidateRect(hWnd, NULL, TRUE); // Back to normal
-         pCom = GET_COM_INFO(hWnd);
-         if (pCom)
-         {
-            if (pCom->hMenu)
-            {
-               POINT pos;
-               GetCursorPos(&pos);
-               SetLargeMenus(gLargeMenus);
-               openMenu = NULL;
-               TrackPopupMenu(pCom->hMenu, 
-                              TPM_LEFTBUTTON,
-					               pos.x, pos.y, 0, hWnd, NULL);
-               SetLargeMenus(FALSE);
-            }
-            else
-               DoRun(pCom->command, pCom->params, gMainWindow, pCom->showType);
-         }
-         break;
+//--------------------------------------------------------------------------
 
-      case WM_EXITSIZEMOVE:
-         if (dragging)
-         {
-            // Dragging ended. Drop the button on the new location
-            POINT pt = {0, 0};
-            MapWindowPoints(hWnd, gMainWindow, &pt, 1);
-            SetCursor(LoadCursor(NULL, IDC_ARROW));
-            dragging = FALSE;
-            LONG  oldInd = Hwnd2Index(hWnd),
-                  newInd = Pos2Index(pt.x, pt.y),
-                  i;
-            if (oldInd < 0 || newInd < 0)
-               break;
-            if (newInd <= oldInd)
-               // Move up
-               for (i = oldInd; i > newInd; i--)
-                  gButtons.list[i] = gButtons.list[i-1];
-            else
-               // Move down
-               for (i = oldInd; i < newInd; i++)
-                  gButtons.list[i] = gButtons.list[i+1];
-            gButtons.list[newInd] = hWnd;
-            // Update accordingly
-            SetupLayout();
-            SavePrefs();
-         }
-         break;
+BOOL gInContext = FALSE;   // Set while a context menu is shown
+HMENU gOpenMenu = NULL;    // Open folder sub menu, for right clicks on cascading sub menus
 
-      case WM_DROPFILES:
+void DoContextCommand(UINT id, CString com)
+{
+   // Carry out a context menu selection for a button or folder menu entry
+   EnableAutoHide(FALSE);
+   switch (id)
+   {
+      case IDM_DELETE:
          {
-            // A file was dopped on this button
+            // Show Explorer delete dialog
+            SHFILEOPSTRUCT fileOp;
             CString fileName;
-            DragQueryFile((HDROP)wParam, 0, fileName.GetBuffer(MAX_PATH), MAX_PATH);
-            fileName.ReleaseBuffer();
-            pCom = GET_COM_INFO(hWnd);
-            if (pCom && pCom->hMenu)
-            {
-               // Dropped on a menu button,create shortcut in the corresponding directory
-               File2Shortcut(fileName, pCom->command);
-            }
-            else if (IS_SHORTCUT(fileName) || SHGetFileInfo(fileName, 0, NULL, 0, SHGFI_EXETYPE))
-            {
-               // Shortcut or executable file, add it as a new button at this position
-               if (HandleDragAndDrop(fileName))
-                  AddNewButton(fileName, Hwnd2Index(hWnd));
-            }
-            else if (pCom)
-            {
-               // Non-executable file, use it as parameter for the corresponding command
-               DoRun(pCom->command, fileName, gMainWindow, pCom->showType);
-            }
-            DragFinish((HDROP)wParam);
+            ZeroMemory(&fileOp, sizeof(fileOp));
+            fileName = com;
+            fileOp.wFunc = FO_DELETE;
+            fileOp.fFlags = FOF_ALLOWUNDO | FOF_WANTNUKEWARNING;
+            PTCHAR  ptr = fileName.GetBuffer(fileName.GetLength()+2);
+            ptr[fileName.GetLength()+1] = 0; // Extra last zero for SHFILEOPSTRUCT
+            fileOp.pFrom = ptr;
+            SHFileOperation(&fileOp);
          }
          break;
 
-      case WM_INITMENUPOPUP:
-         // Submenu opened
-         if (!inContext)
-            openMenu = (HMENU)wParam;
-         break;
-
-      case WM_UNINITMENUPOPUP:
-         // Submenu closed
-         openMenu = NULL;
+      case IDM_PROPERTIES:
+         DoRun(com, EMPTY_STR, gMainWindow, SW_SHOWNORMAL, _T("properties"));
          break;
 
-      case WM_CONTEXTMENU:
-         if (openMenu)
-         {
-            // Right button pressed on top of cascading submenu
-            // Get corresponding directory and do context menu popup
-            MENUINFO menuInf;
-            ZeroMemory(&menuInf, sizeof(menuInf));
-            menuInf.cbSize = sizeof(menuInf);
-            menuInf.fMask = MIM_MENUDATA;
-            GetMenuInfo(openMenu, &menuInf);
-            CString *link = (CString*)(menuInf.dwMenuData);
-            if (link)
-               DO_MENU_CONTEXTMENU(*link);
-         }
+      case IDM_EXPLORE:
+         // Start Explorer with the target file selected
+         DoRun(_T("explorer.exe"), _T("/select,\"") + GetTrueTarget(com) + _T("\""), gMainWindow);
          break;
 
-	   case WM_COMMAND:
-	      // Popup menu selection
-         EnableAutoHide(FALSE);
-	      switch (LOWORD(wParam))
-	      {
-	         case IDM_DELETE:
-               {
-                  // Show Explorer delete dialog
-                  SHFILEOPSTRUCT fileOp;
-                  CString fileName;
-                  ZeroMemory(&fileOp, sizeof(fileOp));
-                  fileName = contMenuCom;
-                  fileOp.wFunc = FO_DELETE;
-                  fileOp.fFlags = FOF_ALLOWUNDO | FOF_WANTNUKEWARNING;
-                  PTCHAR  ptr = fileName.GetBuffer(fileName.GetLength()+2);
-                  ptr[fileName.GetLength()+1] = 0; // Extra last zero for SHFILEOPSTRUCT
-                  fileOp.pFrom = ptr;
-                  SHFileOperation(&fileOp);
-               }
-		         break;
-
-	         case IDM_PROPERTIES:
-               DoRun(contMenuCom, EMPTY_STR, gMainWindow, SW_SHOWNORMAL, _T("properties"));
-               break;
-
-	         case IDM_EXPLORE:
-               // Start Explorer with the target file selected
-               DoRun(_T("explorer.exe"), _T("/select,\"") + GetTrueTarget(contMenuCom) + _T("\""), gMainWindow);
-		         break;
-
-	         case IDM_RUNASADMIN:
-               // Elevate the corresponding command
-               DoRun(contMenuCom, NULL, gMainWindow, SW_SHOWNORMAL, _T("runas"));
-               break;
-
-	         case IDM_NEW:
-               {
-                  CString fileName = PromptFileName(EMPTY_STR, gMainWindow);
-                  if (fileName.GetLength())
-                     File2Shortcut(fileName, contMenuCom);
-               }
-		         break;
-
-	         case IDM_ADDMENU:
-		         DialogBoxParam(CURR_INSTANCE, MAKEINTRESOURCE(IDD_ADDMENU), hWnd, PromptDirectory, (LPARAM)&contMenuCom);
-		         break;
-
-	         default:
-		         return DefWindowProc(hWnd, message, wParam, lParam);
-	      }
-         EnableAutoHide(TRUE);
-		   break;
+      case IDM_RUNASADMIN:
+         // Elevate the corresponding command
+         DoRun(com, NULL, gMainWindow, SW_SHOWNORMAL, _T("runas"));
+         break;
 
-	   case WM_MENUCOMMAND:
+      case IDM_NEW:
          {
-            // Button popup menu selection, launch the appropriate command
-            DWORD pos = (DWORD)wParam;
-            HMENU hMenu = (HMENU)lParam;
-            CString *path = (CString*)GetMenuItemData(hMenu, pos);
-            if (path)
-               DoRun(*path, EMPTY_STR, gMainWindow, SW_SHOWNORMAL);
+            CString fileName = PromptFileName(EMPTY_STR, gMainWindow);
+            if (fileName.GetLength())
+               File2Shortcut(fileName, com);
          }
          break;
 
-      case WM_MEASUREITEM:
-      case WM_DRAWITEM:
-         // Menu icon message
-         HandleMenuItemIconMessage(message, lParam);
+      case IDM_ADDMENU:
+         DialogBoxParam(CURR_INSTANCE, MAKEINTRESOURCE(IDD_ADDMENU), gMainWindow, PromptDirectory, (LPARAM)&com);
          break;
+   }
+   EnableAutoHide(TRUE);
+}
+
+//--------------------------------------------------------------------------
+
+void ShowContextMenu(CString com)
+{
+   // Show the context menu of a button or folder menu entry at the cursor. An open
+   // folder menu is closed afterwards.
+   POINT pos;
+   GetCursorPos(&pos);
+   gInContext = TRUE;
+   UINT id = TrackPopupMenu(IsDir(GetTrueTarget(com)) ? gDirPopupMenu : gFilePopupMenu,
+                            TPM_LEFTBUTTON | TPM_RECURSE | TPM_RETURNCMD, pos.x, pos.y, 0, gMainWindow, NULL);
+   gInContext = FALSE;
+   PostMessage(gMainWindow, WM_CANCELMODE, 0, 0);
+   if (id)
+      DoContextCommand(id, com);
+}
+
+//--------------------------------------------------------------------------
 
-      default:
-         return DefWindowProc(hWnd, message, wParam, lParam);
+void ActivateButton(pCommandInfo pCom)
+{
+   // Show the folder menu of a button or launch its command. The button may be
+   // removed while the menu is shown.
+   if (pCom->hMenu)
+   {
+      POINT pos;
+      GetCursorPos(&pos);
+      SetLargeMenus(gLargeMenus);
+      gOpenMenu = NULL;
+      gInFolderMenu = TRUE;
+      TrackPopupMenu(pCom->hMenu, TPM_LEFTBUTTON, pos.x, pos.y, 0, gMainWindow, NULL);
+      gInFolderMenu = FALSE;
+      SetLargeMenus(FALSE);
+      ApplyPendingIndexChanges();
    }
+   else
+      DoRun(pCom->command, pCom->params, gMainWindow, pCom->showType);
+}
 
-   return 0;
+//--------------------------------------------------------------------------
+
+void DropOnButton(pCommandInfo pCom, CString& fileName)
+{
+   // Handle a file dropped on a button
+   if (pCom->hMenu)
+   {
+      // Dropped on a menu button,create shortcut in the corresponding directory
+      File2Shortcut(fileName, pCom->command);
+   }
+   else if (IS_SHORTCUT(fileName) || SHGetFileInfo(fileName, 0, NULL, 0, SHGFI_EXETYPE))
+   {
+      // Shortcut or executable file, add it as a new button at this position
+      DWORD pos = Button2Index(pCom);
+      if (HandleDragAndDrop(fileName))
+         AddNewButton(fileName, pos);
+   }
+   else
+   {
+      // Non-executable file, use it as parameter for the corresponding command
+      DoRun(pCom->command, fileName, gMainWindow, pCom->showType);
+   }
 }
 
 //--------------------------------------------------------------------------
 
-ATOM RegButtonWindClass()
+CString ButtonToolTip(pCommandInfo pCom)
 {
-   // Rgister a class for the button windows
-	WNDCLASSEX wcex;
+   // Get the tooltip text of a button. The name and description of a shortcut are
+   // only resolved when its tooltip is about to be shown.
+   if (pCom->toolTip.IsEmpty() && IS_SHORTCUT(pCom->command))
+   {
+      CString target;
+      GetShortcutInfo(pCom->command, target, NULL, NULL, &pCom->toolTip);
+   }
+   return pCom->toolTip;
+}
 
-   ZeroMemory(&wcex, sizeof(WNDCLASSEX));
-	wcex.cbSize = sizeof(WNDCLASSEX);
+//--------------------------------------------------------------------------
 
-	wcex.lpfnWndProc	= ButtonWndProc;
-	wcex.hInstance		= CURR_INSTANCE;
-	wcex.lpszClassName = BUTTON_CLASS_NAME;
+void SetHotButton(pCommandInfo pCom)
+{
+   // Highlight the button under the cursor, NULL if none. A shown tooltip is
+   // removed so that the one of the new button is shown.
+   if (pCom == gHotButton)
+      return;
+   if (gHotButton)
+      SetButtonState(gHotButton, eNormal);
+   if (pCom)
+      SetButtonState(pCom, eHighlight);
+   SendMessage(gToolTip, TTM_POP, 0, 0);
+}
 
-   wcex.hbrBackground = gBgBrush;
+//--------------------------------------------------------------------------
 
-	return RegisterClassEx(&wcex);
+void MoveButtonDrag(POINT pt)
+{
+   // Draw the dragged button at a new cursor position
+   InvalidateRect(gMainWindow, &gDragRect, FALSE);
+   OffsetRect(&gDragRect, pt.x - gDragOffset.x - gDragRect.left, pt.y - gDragOffset.y - gDragRect.top);
+   InvalidateRect(gMainWindow, &gDragRect, FALSE);
+}
+
+//--------------------------------------------------------------------------
+
+void StartButtonDrag(POINT pt)
+{
+   // The cursor left the pressed button with the mouse button down, start dragging it.
+   // The button cell stays in place until dropped.
+   pCommandInfo pCom = gPushedButton;
+   gDragRect = ButtonRect(Button2Index(pCom));
+   gDragOffset.x = gPressPos.x - gDragRect.left;
+   gDragOffset.y = gPressPos.y - gDragRect.top;
+   SetButtonState(pCom, eNormal);
+   gDragButton = pCom;
+   SetCursor(LoadCursor(NULL, IDC_HAND));
+   MoveButtonDrag(pt);
+}
+
+//--------------------------------------------------------------------------
+
+void EndButtonDrag(BOOL drop)
+{
+   // Dragging ended. Possibly drop the button on the new location.
+   LONG oldInd = Button2Index(gDragButton);
+   gDragButton = NULL;
+   InvalidateRect(gMainWindow, &gDragRect, FALSE);
+   SetCursor(LoadCursor(NULL, IDC_ARROW));
+   if (drop && oldInd >= 0)
+   {
+      MoveButton(oldInd, min((DWORD)Pos2Index(gDragRect.left, gDragRect.top), gButtons.cnt-1));
+      // Update accordingly
+      SetupLayout();
+      SavePrefs();
+   }
 }
 
 //--------------------------------------------------------------------------
 
+#define SHARED_START_MENU_SETTING _T("SHAREDSTARTMENU=")
+#define SHARED_START_MENU_SETTING_LEN (sizeof(SHARED_START_MENU_SETTING)/sizeof(TCHAR) - 1)
+#define IS_SHARED_START_MENU_SETTING(str) \
+   (CString(str).Left(SHARED_START_MENU_SETTING_LEN).CompareNoCase(SHARED_START_MENU_SETTING) == 0)
+
 BOOL ParseSetting(LPCTSTR str)
 {
    // Evaluate possible settings specification from config file or command line
+   CString setting = str;
+   if (IS_SHARED_START_MENU_SETTING(setting))
+   {
+      // The path may be quoted in the configuration file
+      gSharedStartMenuSetting = setting.Mid(SHARED_START_MENU_SETTING_LEN).Trim();
+      gSharedStartMenuSetting.Trim(_T('"'));
+      gSharedStartMenu = gSharedStartMenuSetting;
+      ExpEnvVars(gSharedStartMenu);
+      return TRUE;
+   }
    return (
        _stscanf_s(str, _T("POSITION=%d"), &gLocation) ||
        _stscanf_s(str, _T("CENTER=%d"), &gCenter) ||
+       _stscanf_s(str, _T("MONITOR=%d"), &gMonitor) ||
        _stscanf_s(str, _T("LARGE=%d"), &gLargeIcons) ||
        _stscanf_s(str, _T("LARGEMENUS=%d"), &gLargeMenus) ||
        _stscanf_s(str, _T("ONTOP=%d"), &gOnTop) ||
-       _stscanf_s(str, _T("AUTOHIDE=%d"), &gAutoHide)
+       _stscanf_s(str, _T("AUTOHIDE=%d"), &gAutoHide) ||
+       _stscanf_s(str, _T("NATURALSORT=%d"), &gNaturalSort) ||
+       _stscanf_s(str, _T("MENUPAGE=%d"), &gMenuPage) ||
+       _stscanf_s(str, _T("ICONCACHE=%d"), &gIconCacheSize) ||
+       _stscanf_s(str, _T("ICONSTORE=%d"), &gIconStoreSize) ||
+       _stscanf_s(str, _T("WATCHDELAY=%d"), &gWatchDelay)
        );
 }
 
 //--------------------------------------------------------------------------
 
+CString NextArgument(const CString& cmdLine, INT& pos)
+{
+   // Get the next space separated command line argument. Spaces within double quotes are
+   // kept and the quotes removed, e.g. SHAREDSTARTMENU="D:\Shared Start Menu".
+   CString arg;
+   BOOL quoted = FALSE;
+   while (pos < cmdLine.GetLength() && cmdLine[pos] == _T(' '))
+      pos++;
+   for (; pos < cmdLine.GetLength() && (quoted || cmdLine[pos] != _T(' ')); pos++)
+   {
+      if (cmdLine[pos] == _T('"'))
+         quoted = !quoted;
+      else
+         arg += cmdLine[pos];
+   }
+   return arg;
+}
+
+//--------------------------------------------------------------------------
+
 #define SEP _T(";")
 
 BOOL ParseConfigFile(LPCTSTR fileName)
@@ -1017,77 +1808,348 @@ BOOL ParseConfigFile(LPCTSTR fileName)
 
 //--------------------------------------------------------------------------
 
-BOOL UpdateButtons()
+void DeleteButton(DWORD pos)
+{
+   // Remove a button from the toolbar and free it
+   pCommandInfo pCom = gButtons.list[pos];
+   RemoveButton(pos);
+   if (pCom->hMenu)
+      DestroyDirMenu(pCom->hMenu);
+   ReleaseIcon(pCom->hIcon);
+   ReleaseIcon(pCom->hSmallIcon);
+   delete pCom;
+}
+
+//--------------------------------------------------------------------------
+
+void ReloadButton(pCommandInfo pCom)
+{
+   // Update tooltip and icons of a changed button, the current icons are shown until the new ones are loaded.
+   // Only shortcuts are resolved, as in AddNewButton.
+   CString target = pCom->command, iconFile;
+   INT iconInd = 0;
+   if (IS_SHORTCUT(pCom->command))
+   {
+      GetShortcutInfo(pCom->command, target, NULL, NULL, NULL, &iconFile, &iconInd);
+      pCom->toolTip = EMPTY_CSTR;
+   }
+   pCom->missing = IS_SHORTCUT(pCom->command) && !target.IsEmpty() && FileAttributes(target) == INVALID_FILE_ATTRIBUTES;
+   InvalidateButton(pCom);
+   LoadButtonIcons(pCom, pCom->command, iconFile, iconInd,
+                   iconFile.IsEmpty() && !target.IsEmpty() ? target : pCom->command);
+}
+
+//--------------------------------------------------------------------------
+
+void RetargetButtonMenu(pCommandInfo pCom)
+{
+   // Recreate the folder menu of a button if the button now refers to another folder
+   if (!pCom->hMenu)
+      return;
+   CString target = GetTrueTarget(pCom->command);
+   pDirMenuInfo pInf = GetDirMenuInfo(pCom->hMenu);
+   if (!pInf || pInf->dir.CompareNoCase(target) != 0)
+   {
+      DestroyDirMenu(pCom->hMenu);
+      pCom->hMenu = AddDirMenu(target, TRUE, EMPTY_CSTR);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+// State of the main directory the buttons were last brought up to date with
+CString gListedDir;                                   // Main directory listed
+ULONGLONG gListedFingerprint = 0;                     // Fingerprint of the listing
+std::unordered_map<tString, ULONGLONG> gListedStamps; // Entry stamps by command key
+
+void SetListedState(const tFileRecordList& files, ULONGLONG fingerprint)
 {
-   // Update the buttons in accordance to the current state of the main directory
-   static time_t lastUpdate = time(NULL);
+   // Remember the main directory listing the buttons are up to date with
+   gListedDir = gMainDir;
+   gListedFingerprint = fingerprint;
+   gListedStamps.clear();
+   DWORD i;
+   for (i = 0; i < files.size(); i++)
+      gListedStamps[CommandKey(files[i].path)] = FileRecordStamp(files[i]);
+}
 
+//--------------------------------------------------------------------------
+
+BOOL UpdateButtons(BOOL force = FALSE)
+{
+   // Update the buttons in accordance to the current state of the main directory. Returns FALSE
+   // without updating when the fingerprint of the directory is the same as at the last update.
    if (gConfigFileUsed)
       return TRUE;
 
+   // List the main directory once, the buttons are validated against the listing
+   tFileRecordList files;
+   EnumDir(gMainDir, files);
+   ULONGLONG fingerprint = DirFingerprint(files);
+   BOOL sameDir = gMainDir.CompareNoCase(gListedDir) == 0;
+   if (!force && sameDir && fingerprint == gListedFingerprint)
+      return FALSE;
+   if (!sameDir)
+      gListedStamps.clear();
+   std::unordered_map<tString, tFileRecord*> fileMap;
    DWORD i;
+   for (i = 0; i < files.size(); i++)
+      fileMap[CommandKey(files[i].path)] = &files[i];
+
    // Validate current buttons
-   for (i = 0; i < gButtons.cnt; i++)
+   i = 0;
+   while (i < gButtons.cnt)
    {
-      pCommandInfo pCom = GET_COM_INFO(gButtons.list[i]);
-      if (!FileExists(pCom->command))
+      pCommandInfo pCom = gButtons.list[i];
+      tString key = CommandKey(pCom->command);
+      std::unordered_map<tString, tFileRecord*>::iterator file = fileMap.find(key);
+      if (file == fileMap.end())
       {
          // The file or shortcut has been deleted
-         if (pCom->hMenu)
-            DestroyMenuData(pCom->hMenu, TRUE);
-         delete pCom;
-         pCom = NULL;
-         DestroyWindow(gButtons.list[i]);
-         // Move up
-         DWORD k;
-         for (k = i; k < gButtons.cnt; k++)
-            gButtons.list[k] = gButtons.list[k+1];
-         gButtons.cnt--;
-      }
-      else if ((IS_SHORTCUT(pCom->command) || IsDir(pCom->command)) && FileModTime(pCom->command) > lastUpdate)
-      {
-         // Update icons and tooltip
-         CString dum, toolTip;
-         DestroyIcon(pCom->hIcon); DestroyIcon(pCom->hSmallIcon); DestroyWindow(pCom->hToolTip);
-         GetShortcutInfo(pCom->command, dum, &pCom->hIcon, &pCom->hSmallIcon, &toolTip);
-         pCom->hToolTip = CreateTooltip(gButtons.list[i], toolTip);
-      }
-      if (pCom && pCom->hMenu)
-      {
-         // Always update folder menus (quick and dirty really)
-         DestroyMenuData(pCom->hMenu, TRUE);
-         pCom->hMenu = AddDirMenu(GetTrueTarget(pCom->command), TRUE, EMPTY_CSTR);
+         DeleteButton(i);
+         continue;
       }
+      // Reload entries replaced or written since the last update
+      std::unordered_map<tString, ULONGLONG>::iterator stamp = gListedStamps.find(key);
+      if ((IS_SHORTCUT(pCom->command) || (file->second->attributes & FILE_ATTRIBUTE_DIRECTORY)) &&
+          stamp != gListedStamps.end() && stamp->second != FileRecordStamp(*file->second))
+         ReloadButton(pCom);
+      // Folder menu contents are patched by the index revalidation started by Refresh
+      RetargetButtonMenu(pCom);
+      i++;
    }
 
-   // Scan for possible new entries in the directory and add buttons when applicable
-   CString path = gMainDir + _T("*.*"), 
-           fileName = EMPTY_CSTR;
-   HANDLE ref;
-   while (FindFiles(path, fileName, &ref))
-      if (Com2Index(fileName) == -1)
-         AddNewButton(fileName);
+   // Add buttons for possible new entries in the directory when applicable
+   for (i = 0; i < files.size(); i++)
+      if (Com2Index(files[i].path) == -1)
+         AddNewButton(files[i].path, gButtons.cnt, EMPTY_CSTR, EMPTY_CSTR, 0, EMPTY_CSTR, SW_SHOWNORMAL, files[i].attributes);
 
    SavePrefs();
-   lastUpdate = time(NULL);
+   SetListedState(files, fingerprint);
    return TRUE;
 
 }
 
 //--------------------------------------------------------------------------
 
-BOOL Refresh()
+void UpdateWatchedDirs()
+{
+   // Watch the main directory, the start menus and the targets of the folder buttons
+   if (!gDirWatch)
+      return;
+   std::vector<tWatchPath> dirs;
+   dirs.push_back((LPCTSTR)gMainDir);
+   dirs.push_back((LPCTSTR)gStartMenuDir);
+   dirs.push_back((LPCTSTR)GetStartMenuDir(FALSE));
+   if (!gSharedStartMenu.IsEmpty())
+      dirs.push_back((LPCTSTR)gSharedStartMenu);
+   DWORD i;
+   for (i = 0; i < gButtons.cnt; i++)
+   {
+      pDirMenuInfo pInf = gButtons.list[i]->hMenu ? GetDirMenuInfo(gButtons.list[i]->hMenu) : NULL;
+      if (pInf)
+         dirs.push_back((LPCTSTR)pInf->dir);
+   }
+   SetWatchedDirs(gDirWatch, dirs);
+}
+
+//--------------------------------------------------------------------------
+
+BOOL Refresh(BOOL force = FALSE)
 {
-	// Rescan and update all buttons and menus
+	// Rescan and update all buttons and menus, the buttons only when the main directory has
+   // changed since the last update unless forced
    SetCursor(LoadCursor(NULL, IDC_WAIT));
-	UpdateButtons();
-	SetupLayout();
+   if (UpdateButtons(force))
+   {
+      SetupLayout();
+      UpdateWatchedDirs();
+   }
+   // Indexed folders are checked in the background
+   RevalidateIndex();
    SetCursor(LoadCursor(NULL, IDC_ARROW));
    return TRUE;
 }
 
 //--------------------------------------------------------------------------
 
+BOOL ApplyButtonChange(const tDirChange& change)
+{
+   // Update the button of a changed entry in the main directory, TRUE if buttons were added or removed
+   LPCTSTR path = change.path.c_str();
+   BOOL inMainDir = GetFileNameComp(path, eFcDrive | eFcDir).CompareNoCase(gMainDir) == 0;
+   LONG ind = inMainDir ? Com2Index(path) : -1;
+   switch (change.action)
+   {
+      case eDirAdded:
+      case eDirModified:
+         if (ind == -1)
+            // Possibly a new entry, hidden files are ignored
+            return inMainDir && AddNewButton(path);
+         ReloadButton(gButtons.list[ind]);
+         RetargetButtonMenu(gButtons.list[ind]);
+         return FALSE;
+
+      case eDirRemoved:
+         if (ind == -1)
+            return FALSE;
+         DeleteButton(ind);
+         return TRUE;
+
+      case eDirRenamed:
+         {
+            // The button keeps its place when renamed within the main directory
+            if (ind >= 0)
+               DeleteButton(ind);
+            LONG oldInd = Com2Index(change.oldPath.c_str());
+            if (oldInd >= 0)
+               DeleteButton(oldInd);
+            BOOL changed = ind >= 0 || oldInd >= 0;
+            if (inMainDir && AddNewButton(path, oldInd >= 0 ? oldInd : gButtons.cnt))
+               changed = TRUE;
+            return changed;
+         }
+   }
+   return FALSE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL DirListed(CString dir, const CString& altDir, const CString& changedDir)
+{
+   // Tell whether a folder menu of a directory and its merged directories lists a directory
+   int pos = 0;
+   while (!dir.IsEmpty())
+   {
+      TRIM_BS(dir);
+      if (dir.CompareNoCase(changedDir) == 0)
+         return TRUE;
+      dir = altDir.Tokenize(DIR_LIST_SEP, pos);
+   }
+   return FALSE;
+}
+
+//--------------------------------------------------------------------------
+
+DWORD RescanChangedDirs(const std::vector<CString>& changedDirs)
+{
+   // Rescan the indexed folders listing any of the changed directories and patch the
+   // folder menus showing them. Returns the number of folders found changed.
+   std::vector<CString> dirs, altDirs;
+   DWORD i, j, changed = 0, cnt = GetIndexedDirList(dirs, altDirs);
+   for (i = 0; i < cnt; i++)
+      for (j = 0; j < changedDirs.size(); j++)
+         if (DirListed(dirs[i], altDirs[i], changedDirs[j]))
+         {
+            tDirEntryList entries;
+            if (ScanDir(dirs[i], altDirs[i], entries, TRUE) && SetIndexedDir(dirs[i], altDirs[i], entries))
+            {
+               ApplyIndexChange(dirs[i], altDirs[i]);
+               changed++;
+            }
+            break;
+         }
+   if (changed)
+   {
+      UpdateIndexRoots();
+      SaveDirIndex();
+   }
+   return changed;
+}
+
+//--------------------------------------------------------------------------
+
+void ApplyDirChangeList(const tDirChangeList& changes)
+{
+   // Update the buttons and the folder menus of the changed directories
+   DWORD i;
+   BOOL buttonsChanged = FALSE, mainDirChanged = FALSE;
+   std::vector<CString> dirs;
+   CString mainDir = gMainDir;
+   TRIM_BS(mainDir);
+   for (i = 0; i < changes.size(); i++)
+   {
+      const tDirChange& change = changes[i];
+      if (ApplyButtonChange(change))
+         buttonsChanged = TRUE;
+      // The listings of the parent directories have changed
+      CString dir = GetFileNameComp(change.path.c_str(), eFcDrive | eFcDir),
+              oldDir = GetFileNameComp(change.oldPath.c_str(), eFcDrive | eFcDir);
+      TRIM_BS(dir);
+      TRIM_BS(oldDir);
+      if (dir.CompareNoCase(mainDir) == 0 || oldDir.CompareNoCase(mainDir) == 0)
+         mainDirChanged = TRUE;
+      if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end())
+         dirs.push_back(dir);
+      if (!oldDir.IsEmpty() && std::find(dirs.begin(), dirs.end(), oldDir) == dirs.end())
+         dirs.push_back(oldDir);
+   }
+
+   if (buttonsChanged)
+   {
+      SetupLayout();
+      SavePrefs();
+   }
+   if (mainDirChanged && !gConfigFileUsed)
+   {
+      // The buttons are up to date with the main directory again, a refresh need not repeat the changes
+      tFileRecordList files;
+      EnumDir(gMainDir, files);
+      SetListedState(files, DirFingerprint(files));
+   }
+   RescanChangedDirs(dirs);
+
+   UpdateWatchedDirs();
+}
+
+//--------------------------------------------------------------------------
+
+void PostDirChanges(tDirChangeList *pChanges, unsigned int firstChange, void *param)
+{
+   // Hand the changes found by the watch thread over to the main window
+   if (!PostMessage(gMainWindow, WM_USER_DIR_CHANGED, (WPARAM)pChanges, (LPARAM)firstChange))
+      delete pChanges;
+}
+
+//--------------------------------------------------------------------------
+
+// Latency of the directory change reports, from the first change until applied
+DWORD gDirChangeBatches = 0,
+      gDirChangeLatency = 0,     // Sum of all latencies in ms
+      gDirChangeMaxLatency = 0;
+
+BOOL ApplyDirChanges(const tDirChangeList& changes, DWORD firstChange)
+{
+   // Update only the buttons and folder menus affected by the changes in the watched
+   // directories, everything is rescanned when changes were lost
+   DWORD i;
+   for (i = 0; i < changes.size(); i++)
+      if (changes[i].action == eDirOverflow)
+      {
+         InvalidateShortcutCache(gMainDir);
+         Refresh();
+         break;
+      }
+   if (i == changes.size())
+      ApplyDirChangeList(changes);
+
+   DWORD latency = DirWatchTime() - firstChange;
+   gDirChangeBatches++;
+   gDirChangeLatency += latency;
+   gDirChangeMaxLatency = max(gDirChangeMaxLatency, latency);
+#ifdef _DEBUG
+   tDirWatchStats stats;
+   GetDirWatchStats(gDirWatch, stats);
+   CString trace;
+   trace.Format(_T("ApplyDirChanges: %d changes applied %d ms after the first one, %d ms on average, at most %d ms, %d of %d records reported\n"),
+                changes.size(), latency, gDirChangeLatency / gDirChangeBatches, gDirChangeMaxLatency, stats.reported, stats.records);
+   OutputDebugString(trace);
+#endif
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
 INT_PTR CALLBACK About(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
 {
    // Show about dialog
@@ -1195,7 +2257,7 @@ INT_PTR CALLBACK Settings(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
                      DeleteFile(AUTOSTART_SHORTCUT);
                }
                // Update current state accordingly
-               if (doRefresh) Refresh(); else SetupLayout();
+               if (doRefresh) Refresh(TRUE); else SetupLayout();
                SavePrefs();
                AutoHide(gAutoHide);
             }
@@ -1211,62 +2273,43 @@ INT_PTR CALLBACK Settings(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
 
 LRESULT CALLBACK MainWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
-   static BOOL selected = FALSE,
-               tracking = FALSE;
+   static BOOL tracking = FALSE;
+   static CString tipText;
+   pCommandInfo pCom;
    POINT pos;
 	switch (message)
 	{
       case WM_PAINT:
          {
-            // Draw lines and simple markers at both ends of the main window
-            HDC hDC;
+            // Compose the invalid part of the toolbar in the back buffer and present it with one blit
             PAINTSTRUCT ps;
-            POINT p1, p2;
-
-	         hDC = BeginPaint(hWnd, &ps);
-            SelectObject(hDC, gBgBrush);
-            if (gLocation == 1 || gLocation == 3)
+            HRGN hRgn = CreateRectRgn(0, 0, 0, 0);
+            GetUpdateRgn(hWnd, hRgn, FALSE);
+	         HDC hDC = BeginPaint(hWnd, &ps);
+            BOOL newBuffer;
+            HDC hBuffer = BeginRenderFrame(hWnd, &newBuffer);
+            if (hBuffer)
             {
-               SelectObject(hDC, gLightPen);
-               MoveToEx(hDC, 0, WIND_OFF-2, NULL);
-               LineTo(hDC, gWindowSize.x, WIND_OFF-2);
-               MoveToEx(hDC, 0, gWindowSize.y - WIND_OFF-1, NULL);
-               LineTo(hDC, gWindowSize.x, gWindowSize.y - WIND_OFF-1);
-
-               SelectObject(hDC, gShadowPen);
-               MoveToEx(hDC, 0, WIND_OFF-1, NULL);
-               LineTo(hDC, gWindowSize.x, WIND_OFF-1);
-               MoveToEx(hDC, 0, gWindowSize.y - WIND_OFF, NULL);
-               LineTo(hDC, gWindowSize.x, gWindowSize.y - WIND_OFF);
-
-               p1.x = p2.x = (gWindowSize.x)/2 - 1;
-               p1.y = MARK_RADIUS + yOffset;
-               p2.y = gWindowSize.y - (MARK_RADIUS + yOffset) - 1;
+               RECT r, client;
+               GetClientRect(hWnd, &client);
+               if (newBuffer)
+                  // Compose it all
+                  SetRectRgn(hRgn, client.left, client.top, client.right, client.bottom);
+               SelectClipRgn(hBuffer, hRgn);
+               DWORD cells = DrawToolbar(hBuffer, hRgn);
+               SelectClipRgn(hBuffer, NULL);
+               BOOL allDrawn = GetRgnBox(hRgn, &r) == SIMPLEREGION && EqualRect(&r, &client);
+               EndRenderFrame(hDC, r, cells, allDrawn);
             }
-            else
-            {
-               SelectObject(hDC, gLightPen);
-               MoveToEx(hDC, WIND_OFF-2, 0, NULL);
-               LineTo(hDC, WIND_OFF-2, gWindowSize.y);
-               MoveToEx(hDC, gWindowSize.x - WIND_OFF-1, 0, NULL);
-               LineTo(hDC, gWindowSize.x - WIND_OFF-1, gWindowSize.y);
-
-               SelectObject(hDC, gShadowPen);
-               MoveToEx(hDC, WIND_OFF-1, 0, NULL);
-               LineTo(hDC, WIND_OFF-1, gWindowSize.y);
-               MoveToEx(hDC, gWindowSize.x - WIND_OFF, 0, NULL);
-               LineTo(hDC, gWindowSize.x - WIND_OFF, gWindowSize.y);
-
-               p1.x = MARK_RADIUS + xOffset;
-               p2.x = gWindowSize.x - (MARK_RADIUS + xOffset) - 1;
-               p1.y = p2.y = (gWindowSize.y)/2 - 1;
-            }
-            Ellipse(hDC, p1.x-MARK_RADIUS, p1.y-MARK_RADIUS, p1.x+MARK_RADIUS, p1.y+MARK_RADIUS);
-            Ellipse(hDC, p2.x-MARK_RADIUS, p2.y-MARK_RADIUS, p2.x+MARK_RADIUS, p2.y+MARK_RADIUS);
 	         EndPaint(hWnd, &ps);
+            DeleteObject(hRgn);
          }
          break;
 
+      case WM_ERASEBKGND:
+         // All drawn by WM_PAINT
+         return TRUE;
+
 	   case WM_COMMAND:
          {
 		      // Menu selection
@@ -1302,6 +2345,12 @@ LRESULT CALLBACK MainWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
                   Refresh();
 			         break;
 
+#ifdef _DEBUG
+               case IDM_TRACEREPAINT:
+                  TraceRepaint();
+                  break;
+#endif
+
 	            case IDM_EXPLORE:
                   // Start Explorer with the main directory selected
                   DoRun(_T("explorer.exe"), gMainDir, gMainWindow);
@@ -1331,11 +2380,15 @@ LRESULT CALLBACK MainWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
 
       case WM_DROPFILES:
          {
-            // Drag and drop on main window
+            // Drag and drop on a button or the main window spare areas
             CString fileName;
             DragQueryFile((HDROP)wParam, 0, fileName.GetBuffer(MAX_PATH), MAX_PATH);
             fileName.ReleaseBuffer();
-            HandleDragAndDrop(fileName);
+            DragQueryPoint((HDROP)wParam, &pos);
+            if ((pCom = HitButton(pos.x, pos.y)) != NULL)
+               DropOnButton(pCom, fileName);
+            else if (!gConfigFileUsed)
+               HandleDragAndDrop(fileName);
             DragFinish((HDROP)wParam);
          }
          break;
@@ -1346,6 +2399,20 @@ LRESULT CALLBACK MainWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
          {
             AutoHide(FALSE);
          }
+         else if ((pCom = HitButton(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam))) != NULL)
+         {
+            if (message == WM_LBUTTONDOWN)
+            {
+               // Left button pressed on a button, start visualization of a pressed button
+               gPressPos.x = GET_X_LPARAM(lParam);
+               gPressPos.y = GET_Y_LPARAM(lParam);
+               SetCapture(hWnd);
+               SetButtonState(pCom, ePushed);
+            }
+            else
+               // Right button pressed on a button, show appropriate context menu
+               ShowContextMenu(pCom->command);
+         }
          else
          {
             // Do menu selection
@@ -1359,8 +2426,109 @@ LRESULT CALLBACK MainWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
 
       case WM_MOUSEMOVE:
          // Cursor has entered the window, show window if hidden
-         if (gAutoHide == 1)
+         if (gAutoHide == 1 && gHidden)
            AutoHide(FALSE);
+         pos.x = GET_X_LPARAM(lParam);
+         pos.y = GET_Y_LPARAM(lParam);
+         if (gDragButton)
+            MoveButtonDrag(pos);
+         else if (gPushedButton && HitButton(pos.x, pos.y) != gPushedButton)
+            // Pressed button left with the mouse button down, start dragging
+            StartButtonDrag(pos);
+         else if (!gPushedButton)
+         {
+            // Highlight the button under the cursor, track leaving the window
+            SetHotButton(HitButton(pos.x, pos.y));
+            if (!tracking)
+            {
+               TRACKMOUSEEVENT tme;
+               tme.cbSize = sizeof(TRACKMOUSEEVENT);
+               tme.dwFlags = TME_LEAVE;
+               tme.hwndTrack = hWnd;
+               tracking = TrackMouseEvent(&tme);
+            }
+         }
+         break;
+
+      case WM_MOUSELEAVE:
+         // Cursor has left the window
+         tracking = FALSE;
+         if (!gPushedButton && !gDragButton)
+            SetHotButton(NULL);
+         break;
+
+      case WM_LBUTTONUP:
+         {
+            // Button released over the pressed button, execute the corresponding command
+            BOOL dragged = gDragButton != NULL;
+            pCom = gPushedButton;
+            pCommandInfo pHit = HitButton(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+            if (dragged)
+               EndButtonDrag(TRUE);
+            else if (pCom)
+               SetButtonState(pCom, pHit == pCom ? eHighlight : eNormal);
+            ReleaseCapture();
+            if (!dragged && pCom && pHit == pCom)
+               ActivateButton(pCom);
+         }
+         break;
+
+      case WM_CAPTURECHANGED:
+         // Mouse capture lost while pressing or dragging a button
+         if (gDragButton)
+            EndButtonDrag(FALSE);
+         if (gPushedButton)
+            SetButtonState(gPushedButton, eNormal);
+         break;
+
+      case WM_MENURBUTTONUP:
+         // Right button pressed during TrackPopupMenu
+         if (GetMenuItemData((HMENU)lParam, (INT)wParam))
+            ShowContextMenu(*(CString*)GetMenuItemData((HMENU)lParam, (INT)wParam));
+         break;
+
+      case WM_INITMENUPOPUP:
+         // Submenu opened, add the folder entries the first time it is shown
+         FillDirMenu((HMENU)wParam);
+         if (!gInContext)
+            gOpenMenu = (HMENU)wParam;
+         break;
+
+      case WM_UNINITMENUPOPUP:
+         // Submenu closed
+         gOpenMenu = NULL;
+         break;
+
+      case WM_CONTEXTMENU:
+         if (gOpenMenu)
+         {
+            // Right button pressed on top of cascading submenu
+            // Get corresponding directory and do context menu popup
+            pDirMenuInfo pInf = GetDirMenuInfo(gOpenMenu);
+            if (pInf && pInf->link)
+               ShowContextMenu(*pInf->link);
+         }
+         break;
+
+	   case WM_MENUCOMMAND:
+         {
+            // Button popup menu selection, launch the appropriate command
+            CString *path = (CString*)GetMenuItemData((HMENU)lParam, (INT)wParam);
+            if (path)
+               DoRun(*path, EMPTY_STR, gMainWindow, SW_SHOWNORMAL);
+         }
+         break;
+
+      case WM_NOTIFY:
+         if (((LPNMHDR)lParam)->code == TTN_GETDISPINFO)
+         {
+            // Tooltip about to be shown, that of the button under the cursor if any
+            GetCursorPos(&pos);
+            ScreenToClient(hWnd, &pos);
+            pCom = HitButton(pos.x, pos.y);
+            tipText = pCom ? ButtonToolTip(pCom) : LoadFormatResString(IDS_MAIN_TIP);
+            ((LPNMTTDISPINFO)lParam)->lpszText = (LPTSTR)(LPCTSTR)tipText;
+         }
          break;
 
       case WM_TIMER:
@@ -1377,8 +2545,28 @@ LRESULT CALLBACK MainWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
          break;
 
       case WM_USER_DIR_CHANGED:
-         // Change occured in the directory, do a rescan
-         Refresh();
+         {
+            // Entries changed in the watched directories, update what they affect
+            tDirChangeList *pChanges = (tDirChangeList*)wParam;
+            ApplyDirChanges(*pChanges, (DWORD)lParam);
+            delete pChanges;
+         }
+         break;
+
+      case WM_USER_INDEX_CHANGED:
+         {
+            // An indexed folder was found changed by the background revalidation
+            CString *dir = (CString*)wParam,
+                    *altDir = (CString*)lParam;
+            ApplyIndexChange(*dir, *altDir);
+            delete dir;
+            delete altDir;
+         }
+         break;
+
+      case WM_USER_ICONS_LOADED:
+         // Icons of a button or menu item loaded in the background
+         ApplyLoadedIcons((tIconRequest*)wParam);
          break;
 
       case WM_DISPLAYCHANGE:
@@ -1433,8 +2621,19 @@ ATOM RegMainWindClass()
 #define AUTOHIDE_KEY _T("AutoHide")
 #define LOCATION_KEY _T("Location")
 #define CENTER_KEY _T("Center")
+#define MONITOR_KEY _T("Monitor")
+#define NATURAL_SORT_KEY _T("NaturalSort")
+#define SHARED_START_MENU_KEY _T("SharedStartMenu")
+#define MENU_PAGE_KEY _T("MenuPage")
+#define ICON_CACHE_KEY _T("IconCacheSize")
+#define ICON_STORE_KEY _T("IconStoreSize")
+#define WATCH_DELAY_KEY _T("WatchDelay")
 #define BUTTONS_KEY _T("Buttons")
 
+// Folder index file, stored in the local application data directory
+#define INDEX_FILE_NAME _T("FolderIndex.dat")
+#define ICON_STORE_FILE_NAME _T("IconStore.dat")
+
 BOOL ReadPrefs()
 {
    if (!gUseReg)
@@ -1447,6 +2646,23 @@ BOOL ReadPrefs()
    GET_REG_INT(AUTOHIDE_KEY, gAutoHide);
    GET_REG_INT(LOCATION_KEY, gLocation);
    GET_REG_INT(CENTER_KEY, gCenter);
+   GET_REG_INT(MONITOR_KEY, gMonitor);
+   GET_REG_INT(NATURAL_SORT_KEY, gNaturalSort);
+   GET_REG_INT(MENU_PAGE_KEY, gMenuPage);
+   GET_REG_INT(ICON_CACHE_KEY, gIconCacheSize);
+   GET_REG_INT(ICON_STORE_KEY, gIconStoreSize);
+   GET_REG_INT(WATCH_DELAY_KEY, gWatchDelay);
+   if (gSharedStartMenu.IsEmpty())
+   {
+      // Not given on the command line
+      gSharedStartMenuSetting = GetRegVal(SHARED_START_MENU_KEY);
+      gSharedStartMenu = gSharedStartMenuSetting;
+      ExpEnvVars(gSharedStartMenu);
+   }
+
+   // Icons of the previous session, needed before the buttons are created
+   if (gIconStoreSize)
+      LoadIconStore(GetLocalAppDataDir() + PROG_NAME + BS + ICON_STORE_FILE_NAME);
 
    CString buf = GetRegVal(BUTTONS_KEY);
    int pos = 0;
@@ -1474,13 +2690,21 @@ BOOL SavePrefs()
    SET_REG_INT(AUTOHIDE_KEY, gAutoHide);
    SET_REG_INT(LOCATION_KEY, gLocation);
    SET_REG_INT(CENTER_KEY, gCenter);
+   SET_REG_INT(MONITOR_KEY, gMonitor);
+   SET_REG_INT(NATURAL_SORT_KEY, gNaturalSort);
+   SET_REG_INT(MENU_PAGE_KEY, gMenuPage);
+   SET_REG_INT(ICON_CACHE_KEY, gIconCacheSize);
+   SET_REG_INT(ICON_STORE_KEY, gIconStoreSize);
+   SET_REG_INT(WATCH_DELAY_KEY, gWatchDelay);
+   // Saved as given, e.g. with %PUBLIC% unexpanded
+   SetRegVal(SHARED_START_MENU_KEY, gSharedStartMenuSetting);
 
 	// Save the current order of the buttons
    DWORD i;
    CString buf = EMPTY_STR;
    for (i = 0; i < gButtons.cnt; i++)
    {
-      pCommandInfo pCom = GET_COM_INFO(gButtons.list[i]);
+      pCommandInfo pCom = gButtons.list[i];
       buf += GetFileNameComp(pCom->command, eFcName | eFcType) + SEP;
    }
    SetRegVal(BUTTONS_KEY, buf);
@@ -1493,7 +2717,7 @@ BOOL SavePrefs()
 BOOL InitInstance(HINSTANCE hInstance, LPCTSTR lpCmdLine)
 {
    // Register classes and create the main window
-   if (!RegMainWindClass() || !RegButtonWindClass())
+   if (!RegMainWindClass())
       return FALSE;
 
    gMainWindow = CreateWindow(WIND_CLASS_NAME, PROG_NAME, WS_POPUP | WS_BORDER,
@@ -1517,12 +2741,14 @@ BOOL InitInstance(HINSTANCE hInstance, LPCTSTR lpCmdLine)
       // Get possible settings specified on the command line
       CString par;
       INT pos = 0;
-      while ((par = cmdLine.Tokenize(_T(" "), pos)) != EMPTY_STR)
+      while ((par = NextArgument(cmdLine, pos)) != EMPTY_STR)
       {
          if (ParseSetting(par))
          {
-            // Setting found, avoid using the registry
-            gUseReg = FALSE;
+            // Setting found, avoid using the registry. The shared start menu is a
+            // setup of the machine though, it replaces the saved one.
+            if (!IS_SHARED_START_MENU_SETTING(par))
+               gUseReg = FALSE;
             start = pos;
          }
          else
@@ -1533,6 +2759,7 @@ BOOL InitInstance(HINSTANCE hInstance, LPCTSTR lpCmdLine)
    }
    // Get remaining part of the command line
    cmdLine.Delete(0, start);
+   cmdLine.TrimLeft();
 
    if (cmdLine.IsEmpty())
    {
@@ -1565,12 +2792,18 @@ BOOL InitInstance(HINSTANCE hInstance, LPCTSTR lpCmdLine)
       ReadPrefs();
    }
 
+   SetIconCacheBudget(gIconCacheSize*1024);
+
+   // Folder menus are initially shown from the index of the previous session
+   if (gUseReg)
+      LoadDirIndex(GetLocalAppDataDir() + PROG_NAME + BS + INDEX_FILE_NAME);
+
    gStartMenuDir = GetStartMenuDir(TRUE);
    TRIM_BS(gStartMenuDir);
    gStartMenuLink = gMainDir + _T("Start Menu") + SHORTCUT_EXT;
 
    // Setup the layout
-   Refresh();
+   Refresh(TRUE);
    EnableAutoHide(TRUE);
 
    // Init application popup menus and set item icons
@@ -1588,6 +2821,9 @@ BOOL InitInstance(HINSTANCE hInstance, LPCTSTR lpCmdLine)
    SetMenuItemData(gMainPopupMenu, IDM_EXIT, GET_ICON(IDI_EXIT));
    if (IsWinPE())
       DeleteMenu(gMainPopupMenu, IDM_EXIT, MF_BYCOMMAND);
+#ifdef _DEBUG
+   AppendMenu(gMainPopupMenu, MF_STRING, IDM_TRACEREPAINT, _T("Trace Repaint"));
+#endif
 
    gFilePopupMenu = LoadMenu(CURR_INSTANCE, MAKEINTRESOURCE(IDR_MENU2));
    InitPopupMenu(gFilePopupMenu);
@@ -1605,11 +2841,13 @@ BOOL InitInstance(HINSTANCE hInstance, LPCTSTR lpCmdLine)
    SetMenuItemData(gDirPopupMenu, IDM_ADDMENU, GET_ICON(IDI_MENU));
 
 
+   // Accept drag and drop on the buttons and in the main window spare areas
+   DragAcceptFiles(gMainWindow, TRUE);
    if (!gConfigFileUsed)
    {
-      // Accept drag and drop in the main window spare areas
-      DragAcceptFiles(gMainWindow, TRUE);
-      StartWatchDir(gMainDir, gMainWindow, WM_USER_DIR_CHANGED, NULL);
+      IN_RANGE(gWatchDelay, 50, 2000);
+      gDirWatch = StartDirWatcher(PostDirChanges, NULL, gWatchDelay);
+      UpdateWatchedDirs();
    }
    else
    {
@@ -1620,8 +2858,8 @@ BOOL InitInstance(HINSTANCE hInstance, LPCTSTR lpCmdLine)
       DeleteMenu(gMainPopupMenu, IDM_EXPLORE, MF_BYCOMMAND);
    }
 
-   // Tooltip
-   CreateTooltip(gMainWindow, LoadFormatResString(IDS_MAIN_TIP));
+   // Tooltip, the text depends on the button under the cursor
+   gToolTip = CreateTooltip(gMainWindow, LPSTR_TEXTCALLBACK);
 
    EnableAutoHide(TRUE);
 
@@ -1647,6 +2885,15 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 	   TranslateMessage(&msg);
 	   DispatchMessage(&msg);
 	}
+   EndDirWatcher(gDirWatch);
+   // No other thread may use the folder index or the icon store while they are saved
+   EndIconLoader();
+   EndRevalidation();
+   EndTaskPool();
+   UpdateIndexRoots();
+   SaveDirIndex();
+   SaveIconStore(gIconStoreSize*1024);
+   ReleaseShellLinkObjects();
 
 	return (int) msg.wParam;
 
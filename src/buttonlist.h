@@ -0,0 +1,113 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// buttonlist.h
+// The toolbar button list with hash indexes from each button to its
+// position and from the upper case command to the buttons using it, so
+// that neither lookup scans the list. Standard C++ only, the button and
+// key types are given by the user, who also makes the keys upper case.
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+template <class tButton, class tKey>
+class tButtonList {
+public:
+   // Read only, changed through Insert, Remove and Move which maintain the indexes
+   unsigned int cnt;                                 // Number of buttons
+   std::vector<tButton> list;                        // Buttons in toolbar order
+   std::unordered_map<tButton, unsigned int> pos;    // Position of each button
+   std::unordered_multimap<tKey, tButton> commands;  // Buttons by upper case command
+
+   tButtonList() : cnt(0) {}
+
+   long Find(tButton button) const
+   {
+      // Get the position of a button if present, otherwise -1
+      typename std::unordered_map<tButton, unsigned int>::const_iterator it = pos.find(button);
+      return it != pos.end() ? (long)it->second : -1;
+   }
+
+   long FindCommand(const tKey& key) const
+   {
+      // Get the first position of a button with the command, otherwise -1. The same
+      // command may be used by several buttons when read from a configuration file.
+      typedef typename std::unordered_multimap<tKey, tButton>::const_iterator tIter;
+      std::pair<tIter, tIter> range = commands.equal_range(key);
+      long ind = -1;
+      for (tIter it = range.first; it != range.second; ++it)
+      {
+         long at = Find(it->second);
+         if (ind < 0 || at < ind)
+            ind = at;
+      }
+      return ind;
+   }
+
+   void Insert(tButton button, const tKey& key, unsigned int at)
+   {
+      // Insert a button, at the end if the position is beyond it
+      if (at > cnt)
+         at = cnt;
+      list.insert(list.begin() + at, button);
+      commands.insert(std::make_pair(key, button));
+      Reindex(at);
+   }
+
+   void Remove(unsigned int at, const tKey& key)
+   {
+      // Remove the button at a position, key being its command key as inserted
+      tButton button = list[at];
+      typedef typename std::unordered_multimap<tKey, tButton>::iterator tIter;
+      std::pair<tIter, tIter> range = commands.equal_range(key);
+      for (tIter it = range.first; it != range.second; ++it)
+         if (it->second == button)
+         {
+            commands.erase(it);
+            break;
+         }
+      pos.erase(button);
+      list.erase(list.begin() + at);
+      Reindex(at);
+   }
+
+   void Move(unsigned int from, unsigned int to)
+   {
+      // Move a button to another position
+      typename std::vector<tButton>::iterator first = list.begin();
+      if (to < from)
+         std::rotate(first + to, first + from, first + from + 1);
+      else if (to > from)
+         std::rotate(first + from, first + from + 1, first + to + 1);
+      Reindex(from < to ? from : to);
+   }
+
+private:
+   void Reindex(unsigned int from)
+   {
+      // Update the positions from a list position on
+      unsigned int i;
+      cnt = (unsigned int)list.size();
+      for (i = from; i < cnt; i++)
+         pos[list[i]] = i;
+   }
+};
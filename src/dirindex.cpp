@@ -0,0 +1,592 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// dirindex.cpp
+// Persistent index of the scanned folder menu directories.
+//
+// The index file is memory mapped and has the following layout, all
+// fields being 32 bit aligned:
+//
+//    tIndexHeader
+//    tIndexDir[dirCnt]
+//    tIndexEntry[entryCnt]
+//    TCHAR strings[strLen]    Zero terminated strings referred by offset
+//
+// The checksum covers everything following the header. Directories
+// scanned or rescanned during the session are kept in memory and
+// override the mapped ones until the index is saved, after which the
+// new file is mapped again. Directories no longer reachable from the
+// folder menus of the buttons are dropped when saving.
+//
+
+#include <windows.h>
+#include <tchar.h>
+#include <map>
+
+#include "resource.h"
+#include "utils.h"
+#include "dirindex.h"
+
+#define INDEX_MAGIC 0x5849424C                          // "LBIX"
+#define INDEX_VERSION (2 | (sizeof(TCHAR) << 16))      // Format version and character size
+
+typedef struct {
+   DWORD magic;         // INDEX_MAGIC
+   DWORD version;       // INDEX_VERSION
+   DWORD dirCnt;        // Number of directory records
+   DWORD entryCnt;      // Number of entry records
+   DWORD strLen;        // Number of characters in the string section
+   DWORD checksum;      // Checksum of the rest of the file
+} tIndexHeader;
+
+typedef struct {
+   DWORD dir;           // String offsets of the directory key
+   DWORD altDir;
+   DWORD first;         // First entry record
+   DWORD cnt;           // Number of entry records
+} tIndexDir;
+
+typedef struct {
+   DWORD name;          // String offsets
+   DWORD path;
+   DWORD altDir;
+   DWORD target;
+   DWORD iconFile;
+   INT iconInd;
+   DWORD attributes;
+   FILETIME modTime;
+} tIndexEntry;
+
+// A directory scanned during this session
+typedef struct {
+   CString dir;
+   CString altDir;
+   tDirEntryList entries;
+} tChangedDir;
+
+CRITICAL_SECTION gIndexLock;
+BOOL gIndexLockInit = FALSE;
+CString gIndexFile(EMPTY_STR);
+HANDLE gIndexFileHand = INVALID_HANDLE_VALUE,
+       gIndexMapHand = NULL;
+PBYTE gIndexView = NULL;
+std::map<CString, DWORD> gIndexedDirs;        // Key to directory record in the mapped file
+std::map<CString, tChangedDir> gChangedDirs;  // Key to directories scanned during the session
+BOOL gIndexDirty = FALSE;                      // Set when the index file needs to be updated
+std::vector<tChangedDir> gIndexRoots;          // Directories of the button folder menus, entries unused
+BOOL gIndexRootsSet = FALSE;                   // Set once the roots are known, nothing is pruned before
+
+#define LOCK_INDEX() EnterCriticalSection(&gIndexLock)
+#define UNLOCK_INDEX() LeaveCriticalSection(&gIndexLock)
+
+#define INDEX_HEADER ((tIndexHeader*)gIndexView)
+#define INDEX_DIRS ((tIndexDir*)(gIndexView + sizeof(tIndexHeader)))
+#define INDEX_ENTRIES ((tIndexEntry*)(INDEX_DIRS + INDEX_HEADER->dirCnt))
+#define INDEX_STRINGS ((LPCTSTR)(INDEX_ENTRIES + INDEX_HEADER->entryCnt))
+
+//--------------------------------------------------------------------------
+
+void InitIndexLock()
+{
+   if (!gIndexLockInit)
+   {
+      InitializeCriticalSection(&gIndexLock);
+      gIndexLockInit = TRUE;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+CString IndexKey(LPCTSTR dir, LPCTSTR altDir)
+{
+   // Directories are indexed by both the primary and the merged directory
+   CString key = CString(dir) + _T("|") + altDir;
+   key.MakeUpper();
+   return key;
+}
+
+//--------------------------------------------------------------------------
+
+DWORD IndexChecksum(const BYTE *data, DWORD size)
+{
+   // FNV-1a hash of the index contents
+   DWORD hash = 2166136261;
+   while (size--)
+      hash = (hash ^ *data++) * 16777619;
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+void UnmapIndex()
+{
+   // Release the mapped index file
+   if (gIndexView)
+      UnmapViewOfFile(gIndexView);
+   if (gIndexMapHand)
+      CloseHandle(gIndexMapHand);
+   if (gIndexFileHand != INVALID_HANDLE_VALUE)
+      CloseHandle(gIndexFileHand);
+   gIndexView = NULL;
+   gIndexMapHand = NULL;
+   gIndexFileHand = INVALID_HANDLE_VALUE;
+   gIndexedDirs.clear();
+}
+
+//--------------------------------------------------------------------------
+
+BOOL ValidateIndex(DWORD fileSize)
+{
+   // Check that the mapped index is complete and consistent
+   if (fileSize < sizeof(tIndexHeader))
+      return FALSE;
+   tIndexHeader *pHead = INDEX_HEADER;
+   if (pHead->magic != INDEX_MAGIC || pHead->version != INDEX_VERSION)
+      return FALSE;
+
+   ULONGLONG size = sizeof(tIndexHeader) +
+                    (ULONGLONG)pHead->dirCnt*sizeof(tIndexDir) +
+                    (ULONGLONG)pHead->entryCnt*sizeof(tIndexEntry) +
+                    (ULONGLONG)pHead->strLen*sizeof(TCHAR);
+   if (size != fileSize || !pHead->strLen)
+      return FALSE;
+   if (IndexChecksum(gIndexView + sizeof(tIndexHeader), fileSize - sizeof(tIndexHeader)) != pHead->checksum)
+      return FALSE;
+
+   // All strings must be terminated within the string section
+   DWORD strLen = pHead->strLen;
+   if (INDEX_STRINGS[strLen-1] != 0)
+      return FALSE;
+#define VALID_STR(off) ((off) < strLen)
+
+   DWORD i;
+   for (i = 0; i < pHead->dirCnt; i++)
+   {
+      tIndexDir *pDir = &INDEX_DIRS[i];
+      if (!VALID_STR(pDir->dir) || !VALID_STR(pDir->altDir) ||
+          pDir->first > pHead->entryCnt || pDir->cnt > pHead->entryCnt - pDir->first)
+         return FALSE;
+   }
+   for (i = 0; i < pHead->entryCnt; i++)
+   {
+      tIndexEntry *pEnt = &INDEX_ENTRIES[i];
+      if (!VALID_STR(pEnt->name) || !VALID_STR(pEnt->path) || !VALID_STR(pEnt->altDir) ||
+          !VALID_STR(pEnt->target) || !VALID_STR(pEnt->iconFile))
+         return FALSE;
+   }
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL MapIndex()
+{
+   // Map the index file and build the directory lookup table.
+   // A missing, outdated or corrupt file is ignored, i.e. all directories are scanned again
+   gIndexFileHand = CreateFile(gIndexFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   if (gIndexFileHand == INVALID_HANDLE_VALUE)
+      return FALSE;
+   DWORD fileSize = GetFileSize(gIndexFileHand, NULL);
+   BOOL ok = fileSize != INVALID_FILE_SIZE && fileSize > 0;
+   ok = ok && (gIndexMapHand = CreateFileMapping(gIndexFileHand, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL;
+   ok = ok && (gIndexView = (PBYTE)MapViewOfFile(gIndexMapHand, FILE_MAP_READ, 0, 0, 0)) != NULL;
+   ok = ok && ValidateIndex(fileSize);
+   if (!ok)
+   {
+      UnmapIndex();
+      return FALSE;
+   }
+
+   DWORD i;
+   for (i = 0; i < INDEX_HEADER->dirCnt; i++)
+      gIndexedDirs[IndexKey(INDEX_STRINGS + INDEX_DIRS[i].dir, INDEX_STRINGS + INDEX_DIRS[i].altDir)] = i;
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL LoadDirIndex(LPCTSTR fileName)
+{
+   // Open the index file, FALSE if not available and a full scan is needed
+   InitIndexLock();
+   LOCK_INDEX();
+   UnmapIndex();
+   gChangedDirs.clear();
+   gIndexDirty = FALSE;
+   gIndexFile = fileName;
+   BOOL ok = MapIndex();
+   UNLOCK_INDEX();
+   return ok;
+}
+
+//--------------------------------------------------------------------------
+
+void ReadIndexedDir(DWORD dirInd, tDirEntryList& entries)
+{
+   // Copy the entries of a directory from the mapped index
+   tIndexDir *pDir = &INDEX_DIRS[dirInd];
+   LPCTSTR strings = INDEX_STRINGS;
+   entries.resize(pDir->cnt);
+   DWORD i;
+   for (i = 0; i < pDir->cnt; i++)
+   {
+      tIndexEntry *pEnt = &INDEX_ENTRIES[pDir->first + i];
+      tDirEntry& entry = entries[i];
+      entry.name = strings + pEnt->name;
+      entry.path = strings + pEnt->path;
+      entry.altDir = strings + pEnt->altDir;
+      entry.target = strings + pEnt->target;
+      entry.iconFile = strings + pEnt->iconFile;
+      entry.iconInd = pEnt->iconInd;
+      entry.attributes = pEnt->attributes;
+      entry.modTime = pEnt->modTime;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+BOOL GetIndexedDir(LPCTSTR dir, LPCTSTR altDir, tDirEntryList& entries)
+{
+   // Get the entries of a directory from the index, FALSE if not indexed
+   InitIndexLock();
+   BOOL found = TRUE;
+   CString key = IndexKey(dir, altDir);
+   LOCK_INDEX();
+   std::map<CString, tChangedDir>::iterator it = gChangedDirs.find(key);
+   std::map<CString, DWORD>::iterator mapIt;
+   if (it != gChangedDirs.end())
+      entries = it->second.entries;
+   else if ((mapIt = gIndexedDirs.find(key)) != gIndexedDirs.end())
+      ReadIndexedDir(mapIt->second, entries);
+   else
+      found = FALSE;
+   UNLOCK_INDEX();
+   return found;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL EqualDirEntry(const tDirEntry& first, const tDirEntry& second)
+{
+   return first.name == second.name &&
+          first.path == second.path &&
+          first.altDir == second.altDir &&
+          first.target == second.target &&
+          first.iconFile == second.iconFile &&
+          first.iconInd == second.iconInd &&
+          first.attributes == second.attributes &&
+          CompareFileTime(&first.modTime, &second.modTime) == 0;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL SetIndexedDir(LPCTSTR dir, LPCTSTR altDir, const tDirEntryList& entries)
+{
+   // Store the scanned entries of a directory, TRUE if they differ from the indexed ones
+   tDirEntryList current;
+   BOOL changed = !GetIndexedDir(dir, altDir, current) || current.size() != entries.size();
+   DWORD i;
+   for (i = 0; !changed && i < entries.size(); i++)
+      changed = !EqualDirEntry(current[i], entries[i]);
+   if (changed)
+   {
+      LOCK_INDEX();
+      tChangedDir& changedDir = gChangedDirs[IndexKey(dir, altDir)];
+      changedDir.dir = dir;
+      changedDir.altDir = altDir;
+      changedDir.entries = entries;
+      gIndexDirty = TRUE;
+      UNLOCK_INDEX();
+   }
+   return changed;
+}
+
+//--------------------------------------------------------------------------
+
+DWORD GetIndexedDirList(std::vector<CString>& dirs, std::vector<CString>& altDirs)
+{
+   // Get all indexed directories, e.g. for revalidation
+   InitIndexLock();
+   dirs.clear();
+   altDirs.clear();
+   LOCK_INDEX();
+   std::map<CString, tChangedDir>::iterator it;
+   for (it = gChangedDirs.begin(); it != gChangedDirs.end(); ++it)
+   {
+      dirs.push_back(it->second.dir);
+      altDirs.push_back(it->second.altDir);
+   }
+   std::map<CString, DWORD>::iterator mapIt;
+   for (mapIt = gIndexedDirs.begin(); mapIt != gIndexedDirs.end(); ++mapIt)
+   {
+      if (gChangedDirs.find(mapIt->first) == gChangedDirs.end())
+      {
+         dirs.push_back(INDEX_STRINGS + INDEX_DIRS[mapIt->second].dir);
+         altDirs.push_back(INDEX_STRINGS + INDEX_DIRS[mapIt->second].altDir);
+      }
+   }
+   UNLOCK_INDEX();
+   return (DWORD)dirs.size();
+}
+
+//--------------------------------------------------------------------------
+
+void SetIndexRoots(const std::vector<CString>& dirs, const std::vector<CString>& altDirs)
+{
+   // Set the directories of the button folder menus, all indexed directories not
+   // reachable from them through the sub directory entries are dropped
+   InitIndexLock();
+   LOCK_INDEX();
+   gIndexRoots.resize(dirs.size());
+   DWORD i;
+   for (i = 0; i < dirs.size(); i++)
+   {
+      gIndexRoots[i].dir = dirs[i];
+      gIndexRoots[i].altDir = altDirs[i];
+   }
+   gIndexRootsSet = TRUE;
+   UNLOCK_INDEX();
+}
+
+//--------------------------------------------------------------------------
+
+BOOL RemoveIndexedDir(const CString& key)
+{
+   // Drop a directory from the index, the lock being held
+   BOOL removed = gChangedDirs.erase(key) > 0;
+   removed = gIndexedDirs.erase(key) > 0 || removed;
+   if (removed)
+      gIndexDirty = TRUE;
+   return removed;
+}
+
+//--------------------------------------------------------------------------
+
+DWORD PruneUnreachable(std::vector<CString>& reachedDirs, std::vector<CString>& reachedKeys)
+{
+   // Drop the indexed directories not reachable from the roots and get the reachable
+   // ones, the lock being held. Returns the number of dropped directories.
+   reachedDirs.clear();
+   reachedKeys.clear();
+   if (!gIndexRootsSet)
+      return 0;
+   std::map<CString, BOOL> reached;
+   std::vector<tChangedDir> pending = gIndexRoots;
+   while (!pending.empty())
+   {
+      tChangedDir next = pending.back();
+      pending.pop_back();
+      CString key = IndexKey(next.dir, next.altDir);
+      if (reached.find(key) != reached.end())
+         continue;
+      std::map<CString, tChangedDir>::iterator it = gChangedDirs.find(key);
+      std::map<CString, DWORD>::iterator mapIt;
+      if (it != gChangedDirs.end())
+         next.entries = it->second.entries;
+      else if ((mapIt = gIndexedDirs.find(key)) != gIndexedDirs.end())
+         ReadIndexedDir(mapIt->second, next.entries);
+      else
+         // Not indexed, neither are its sub directories then
+         continue;
+      reached[key] = TRUE;
+      reachedDirs.push_back(next.dir);
+      reachedKeys.push_back(key);
+      DWORD i;
+      for (i = 0; i < next.entries.size(); i++)
+      {
+         const tDirEntry& entry = next.entries[i];
+         if (IS_DIR_ENTRY(entry))
+         {
+            pending.push_back(tChangedDir());
+            pending.back().dir = entry.path;
+            pending.back().altDir = entry.altDir;
+         }
+      }
+   }
+
+   std::vector<CString> dropped;
+   std::map<CString, tChangedDir>::iterator it;
+   for (it = gChangedDirs.begin(); it != gChangedDirs.end(); ++it)
+      if (reached.find(it->first) == reached.end())
+         dropped.push_back(it->first);
+   std::map<CString, DWORD>::iterator mapIt;
+   for (mapIt = gIndexedDirs.begin(); mapIt != gIndexedDirs.end(); ++mapIt)
+      if (reached.find(mapIt->first) == reached.end())
+         dropped.push_back(mapIt->first);
+   DWORD i, cnt = 0;
+   for (i = 0; i < dropped.size(); i++)
+      if (RemoveIndexedDir(dropped[i]))
+         cnt++;
+   return cnt;
+}
+
+//--------------------------------------------------------------------------
+
+DWORD PruneDirIndex()
+{
+   // Drop the indexed directories no longer reachable from the roots or no longer
+   // existing. Returns the number of dropped directories.
+   InitIndexLock();
+   std::vector<CString> dirs, keys;
+   LOCK_INDEX();
+   DWORD cnt = PruneUnreachable(dirs, keys);
+   UNLOCK_INDEX();
+
+   // The file system is checked without holding the lock, menus may be filled meanwhile
+   std::vector<CString> missing;
+   DWORD i;
+   for (i = 0; i < dirs.size(); i++)
+   {
+      DWORD attr = GetFileAttributes(dirs[i]);
+      if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY))
+         missing.push_back(keys[i]);
+   }
+   if (!missing.empty())
+   {
+      LOCK_INDEX();
+      for (i = 0; i < missing.size(); i++)
+         if (RemoveIndexedDir(missing[i]))
+            cnt++;
+      UNLOCK_INDEX();
+   }
+   return cnt;
+}
+
+//--------------------------------------------------------------------------
+
+// Index file builder
+class tIndexBuilder {
+public:
+   std::vector<tIndexDir> dirs;
+   std::vector<tIndexEntry> entries;
+   std::vector<TCHAR> strings;
+   std::map<CString, DWORD> stringMap;  // Avoid duplicate strings
+
+   DWORD AddString(const CString& str)
+   {
+      std::map<CString, DWORD>::iterator it = stringMap.find(str);
+      if (it != stringMap.end())
+         return it->second;
+      DWORD off = (DWORD)strings.size();
+      strings.insert(strings.end(), (LPCTSTR)str, (LPCTSTR)str + str.GetLength() + 1);
+      stringMap[str] = off;
+      return off;
+   }
+
+   void AddDir(const CString& dir, const CString& altDir, const tDirEntryList& dirEntries)
+   {
+      tIndexDir rec;
+      rec.dir = AddString(dir);
+      rec.altDir = AddString(altDir);
+      rec.first = (DWORD)entries.size();
+      rec.cnt = (DWORD)dirEntries.size();
+      dirs.push_back(rec);
+      DWORD i;
+      for (i = 0; i < dirEntries.size(); i++)
+      {
+         const tDirEntry& entry = dirEntries[i];
+         tIndexEntry ent;
+         ent.name = AddString(entry.name);
+         ent.path = AddString(entry.path);
+         ent.altDir = AddString(entry.altDir);
+         ent.target = AddString(entry.target);
+         ent.iconFile = AddString(entry.iconFile);
+         ent.iconInd = entry.iconInd;
+         ent.attributes = entry.attributes;
+         ent.modTime = entry.modTime;
+         entries.push_back(ent);
+      }
+   }
+};
+
+BOOL SaveDirIndex()
+{
+   // Write the index file if any directory has been scanned during the session
+   InitIndexLock();
+   LOCK_INDEX();
+   std::vector<CString> reachedDirs, reachedKeys;
+   PruneUnreachable(reachedDirs, reachedKeys);
+   if (gIndexFile.IsEmpty() || !gIndexDirty)
+   {
+      UNLOCK_INDEX();
+      return FALSE;
+   }
+
+   tIndexBuilder builder;
+   builder.AddString(EMPTY_CSTR);
+   std::map<CString, tChangedDir>::iterator it;
+   for (it = gChangedDirs.begin(); it != gChangedDirs.end(); ++it)
+      builder.AddDir(it->second.dir, it->second.altDir, it->second.entries);
+   std::map<CString, DWORD>::iterator mapIt;
+   for (mapIt = gIndexedDirs.begin(); mapIt != gIndexedDirs.end(); ++mapIt)
+   {
+      if (gChangedDirs.find(mapIt->first) == gChangedDirs.end())
+      {
+         tChangedDir& dir = gChangedDirs[mapIt->first];
+         dir.dir = INDEX_STRINGS + INDEX_DIRS[mapIt->second].dir;
+         dir.altDir = INDEX_STRINGS + INDEX_DIRS[mapIt->second].altDir;
+         ReadIndexedDir(mapIt->second, dir.entries);
+         builder.AddDir(dir.dir, dir.altDir, dir.entries);
+      }
+   }
+
+   // Assemble the file contents
+   tIndexHeader head;
+   head.magic = INDEX_MAGIC;
+   head.version = INDEX_VERSION;
+   head.dirCnt = (DWORD)builder.dirs.size();
+   head.entryCnt = (DWORD)builder.entries.size();
+   head.strLen = (DWORD)builder.strings.size();
+   DWORD dirSize = head.dirCnt*sizeof(tIndexDir),
+         entrySize = head.entryCnt*sizeof(tIndexEntry),
+         strSize = head.strLen*sizeof(TCHAR);
+   std::vector<BYTE> body(dirSize + entrySize + strSize);
+   if (dirSize)
+      memcpy(&body[0], &builder.dirs[0], dirSize);
+   if (entrySize)
+      memcpy(&body[dirSize], &builder.entries[0], entrySize);
+   memcpy(&body[dirSize + entrySize], &builder.strings[0], strSize);
+   head.checksum = IndexChecksum(&body[0], (DWORD)body.size());
+
+   // The mapped file can't be replaced, everything is in memory until the new one is mapped
+   UnmapIndex();
+
+   CString tmpFile = gIndexFile + _T(".tmp");
+   CreateDirectory(GetFileNameComp(gIndexFile, eFcDrive | eFcDir), NULL);
+   HANDLE hFile = CreateFile(tmpFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+   BOOL ok = hFile != INVALID_HANDLE_VALUE;
+   DWORD written;
+   ok = ok && WriteFile(hFile, &head, sizeof(head), &written, NULL) && written == sizeof(head);
+   ok = ok && WriteFile(hFile, &body[0], (DWORD)body.size(), &written, NULL) && written == body.size();
+   if (hFile != INVALID_HANDLE_VALUE)
+      CloseHandle(hFile);
+   ok = ok && MoveFileEx(tmpFile, gIndexFile, MOVEFILE_REPLACE_EXISTING);
+   if (ok)
+   {
+      gIndexDirty = FALSE;
+      // Map the new file, the directories are kept in memory if that fails
+      if (MapIndex())
+         gChangedDirs.clear();
+   }
+   else
+      DeleteFile(tmpFile);
+
+   UNLOCK_INDEX();
+   return ok;
+}
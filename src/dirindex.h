@@ -0,0 +1,50 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <atlstr.h>
+#include <vector>
+
+// Scanned folder menu entry
+typedef struct {
+   CString name;        // Display name
+   CString path;        // Path of the entry, the target folder for folder shortcuts
+   CString altDir;      // Possible directories merged into the sub menu of a folder entry, separated by DIR_LIST_SEP
+   CString target;      // Resolved shortcut target, empty if not a shortcut
+   CString iconFile;    // Icon location, empty when the icons of the file itself are used
+   INT iconInd;         // Icon index within the icon location
+   DWORD attributes;    // File attributes of the entry, directory also set for shortcuts to folders
+   FILETIME modTime;    // Last write time of the entry
+} tDirEntry;
+
+typedef std::vector<tDirEntry> tDirEntryList;
+
+#define DIR_LIST_SEP _T("|")
+
+#define IS_DIR_ENTRY(entry) (((entry).attributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+
+BOOL LoadDirIndex(LPCTSTR fileName);
+BOOL SaveDirIndex();
+BOOL GetIndexedDir(LPCTSTR dir, LPCTSTR altDir, tDirEntryList& entries);
+BOOL SetIndexedDir(LPCTSTR dir, LPCTSTR altDir, const tDirEntryList& entries);
+DWORD GetIndexedDirList(std::vector<CString>& dirs, std::vector<CString>& altDirs);
+void SetIndexRoots(const std::vector<CString>& dirs, const std::vector<CString>& altDirs);
+DWORD PruneDirIndex();
+BOOL EqualDirEntry(const tDirEntry& first, const tDirEntry& second);
@@ -0,0 +1,188 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// dirmerge.cpp
+// Merging of overlaid directory listings.
+//
+// Each root listing is sorted on its own (directories first, then by
+// collation key). The merge then makes two linear passes:
+//
+//    1. The names of all roots are entered, in root order, into a flat
+//       open addressing hash table using a case insensitive hash. A name
+//       already entered by an earlier root hides the later entry, which
+//       is instead recorded as an overlay if it is a directory.
+//    2. The visible entries of the sorted roots are combined by a k-way
+//       merge into the final sorted view.
+//
+
+#include <string.h>
+#include <wctype.h>
+#include <algorithm>
+
+#include "dirmerge.h"
+
+#define NO_SLOT 0xFFFFFFFF
+
+//--------------------------------------------------------------------------
+
+struct MergeItemLess
+{
+   const unsigned char *keys;
+   MergeItemLess(const unsigned char *keyBuff) : keys(keyBuff) {}
+   bool operator()(const tMergeItem& first, const tMergeItem& second) const
+   {
+      // Sort directories first
+      if (first.isDir != second.isDir)
+         return first.isDir;
+      else
+         // Collation order when equal
+         return strcmp((const char*)&keys[first.keyPos], (const char*)&keys[second.keyPos]) < 0;
+   }
+};
+
+void SortMergeRoot(tMergeRoot& root)
+{
+   // Sort the listing of a root before merging
+   if (!root.items.empty())
+      std::stable_sort(root.items.begin(), root.items.end(), MergeItemLess(&root.keys[0]));
+}
+
+//--------------------------------------------------------------------------
+
+unsigned int MergeNameHash(const std::wstring& name)
+{
+   // Case insensitive FNV-1a hash of a name
+   unsigned int hash = 2166136261U;
+   for (size_t i = 0; i < name.size(); i++)
+   {
+      hash ^= (unsigned int)towupper(name[i]);
+      hash *= 16777619U;
+   }
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+static bool SameName(const std::wstring& first, const std::wstring& second)
+{
+   // Case insensitive name comparison
+   if (first.size() != second.size())
+      return false;
+   for (size_t i = 0; i < first.size(); i++)
+      if (first[i] != second[i] && towupper(first[i]) != towupper(second[i]))
+         return false;
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+void MergeRoots(const std::vector<tMergeRoot>& roots, tMergedList& merged)
+{
+   // Produce the sorted merged view of the provided sorted root listings
+   merged.clear();
+   unsigned int r, i, total = 0;
+   for (r = 0; r < roots.size(); r++)
+      total += (unsigned int)roots[r].items.size();
+
+   // Hash table of the visible entries, index into merged
+   unsigned int tableSize = 16;
+   while (tableSize < total * 2)
+      tableSize <<= 1;
+   std::vector<unsigned int> table(tableSize, NO_SLOT);
+   std::vector<unsigned int> hashes;
+   std::vector<std::vector<unsigned int> > visible(roots.size()); // Merged index of each root entry or NO_SLOT
+   merged.reserve(total);
+   hashes.reserve(total);
+
+   for (r = 0; r < roots.size(); r++)
+   {
+      const std::vector<tMergeItem>& items = roots[r].items;
+      unsigned int firstOfRoot = (unsigned int)merged.size();
+      visible[r].assign(items.size(), NO_SLOT);
+      for (i = 0; i < items.size(); i++)
+      {
+         unsigned int hash = MergeNameHash(items[i].name),
+                      slot = hash & (tableSize - 1),
+                      found = NO_SLOT;
+         // Only entries of earlier roots hide the entry, names may be repeated
+         // within a root (e.g. a folder and a shortcut with the same name)
+         for (; table[slot] != NO_SLOT; slot = (slot + 1) & (tableSize - 1))
+         {
+            unsigned int m = table[slot];
+            if (m < firstOfRoot && hashes[m] == hash &&
+                SameName(roots[merged[m].item.root].items[merged[m].item.index].name, items[i].name))
+            {
+               found = m;
+               break;
+            }
+         }
+         if (found == NO_SLOT)
+         {
+            tMergedItem entry;
+            entry.item.root = r;
+            entry.item.index = i;
+            visible[r][i] = (unsigned int)merged.size();
+            table[slot] = (unsigned int)merged.size();
+            merged.push_back(entry);
+            hashes.push_back(hash);
+         }
+         else if (items[i].isDir)
+         {
+            tMergeRef ref = {r, i};
+            merged[found].overlays.push_back(ref);
+         }
+      }
+   }
+
+   // K-way merge of the visible entries, the earlier root goes first when equal
+   std::vector<unsigned int> pos(roots.size(), 0);
+   tMergedList sorted;
+   sorted.reserve(merged.size());
+   while (sorted.size() < merged.size())
+   {
+      unsigned int best = NO_SLOT;
+      for (r = 0; r < roots.size(); r++)
+      {
+         while (pos[r] < roots[r].items.size() && visible[r][pos[r]] == NO_SLOT)
+            pos[r]++;
+         if (pos[r] == roots[r].items.size())
+            continue;
+         if (best == NO_SLOT)
+            best = r;
+         else
+         {
+            const tMergeItem& cand = roots[r].items[pos[r]];
+            const tMergeItem& curr = roots[best].items[pos[best]];
+            bool less;
+            if (cand.isDir != curr.isDir)
+               less = cand.isDir;
+            else
+               less = strcmp((const char*)&roots[r].keys[cand.keyPos], (const char*)&roots[best].keys[curr.keyPos]) < 0;
+            if (less)
+               best = r;
+         }
+      }
+      tMergedItem& entry = merged[visible[best][pos[best]]];
+      sorted.push_back(tMergedItem());
+      sorted.back().item = entry.item;
+      sorted.back().overlays.swap(entry.overlays);
+      pos[best]++;
+   }
+   merged.swap(sorted);
+}
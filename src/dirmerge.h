@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// dirmerge.h
+// Merging of the listings of overlaid directories, e.g. the machine, user
+// and shared Start Menus, into one sorted view. Only standard C++ is used
+// so the merging can be built and exercised on any platform.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Entry as listed in one of the merged roots
+typedef struct {
+   std::wstring name;      // Display name
+   unsigned int keyPos;    // Offset of the zero terminated collation key in the key buffer of the root
+   bool isDir;             // Directories are sorted first
+   unsigned int tag;       // Caller defined, e.g. the index of the corresponding file record
+} tMergeItem;
+
+// Listing of one root
+typedef struct {
+   std::vector<tMergeItem> items;   // Entries, sorted by SortMergeRoot
+   std::vector<unsigned char> keys; // Collation keys referred to by the entries
+} tMergeRoot;
+
+// Reference to an entry of a root
+typedef struct {
+   unsigned int root;      // Index of the root
+   unsigned int index;     // Index of the entry in the root listing
+} tMergeRef;
+
+// Entry of the merged view
+typedef struct {
+   tMergeRef item;                  // Entry shown, from the first root listing the name
+   std::vector<tMergeRef> overlays; // Directories with the same name in later roots, in root order
+} tMergedItem;
+
+typedef std::vector<tMergedItem> tMergedList;
+
+void SortMergeRoot(tMergeRoot& root);
+void MergeRoots(const std::vector<tMergeRoot>& roots, tMergedList& merged);
+unsigned int MergeNameHash(const std::wstring& name);
@@ -0,0 +1,988 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// dirwatch.cpp
+// Directory watcher. One thread waits for the changes in all watched trees
+// and the coalescing and debouncing is shared by both backends, which only
+// wait for the system and translate its change records.
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "dirwatch.h"
+
+#define WATCH_BUFFER_SIZE (64*1024)  // Change records read at a time, the limit for network drives on Windows
+#define MAX_DEBOUNCE_PERIODS 10      // Longest delay of a report during steady changes, in debounce times
+
+#ifdef _WIN32
+#define WATCH_SEP _T('\\')
+#define WATCH_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE)
+#define MAX_WATCH_ROOTS (MAXIMUM_WAIT_OBJECTS-1)  // Directory trees waited for besides the signal event
+#else
+#define WATCH_SEP '/'
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#endif
+
+// Changes collected since the last report, one record per path. Records made
+// obsolete by later changes keep their place with an empty path.
+typedef struct {
+   tDirChangeList changes;                   // Records in order of the first change of each path
+   std::map<tWatchPath, unsigned int> index; // Record of each path key
+   bool overflow;                            // Set when changes were lost
+} tDirChangeBatch;
+
+// Results of waiting for the system
+enum tWaitResult { eWaitStop, eWaitDirs, eWaitChanges, eWaitTimeout };
+
+#ifdef _WIN32
+// Watched directory tree
+typedef struct {
+   tWatchPath dir;               // Root directory with trailing backslash
+   HANDLE hDir;                  // Directory opened for overlapped reading of changes
+   OVERLAPPED overlapped;        // Pending read, signals its event when completed
+   std::vector<DWORD> buffer;    // Change records, DWORD aligned as required
+} tWatchRoot, *pWatchRoot;
+#endif
+
+struct tDirWatcher {
+   tDirChangeProc proc;          // Receiver of the changes
+   void *param;
+   unsigned int debounce;        // Time in ms without changes before they are reported
+   std::thread thread;
+   std::mutex lock;              // Protects the requests and the published statistics
+   std::vector<tWatchPath> dirs; // Directories to watch, taken over by the watch thread
+   bool dirsChanged;             // Set when the directories to watch have been changed
+   bool stop;                    // Set to end the watch
+   tDirWatchStats stats;         // Statistics published by the watch thread
+   // Only used by the watch thread
+   tDirChangeBatch batch;        // Changes not yet reported
+   unsigned int firstChange;     // Time of the first change of the batch
+   tDirWatchStats counts;        // Statistics maintained by the watch thread
+#ifdef _WIN32
+   HANDLE hSignal;               // Set along with the requests
+   std::vector<pWatchRoot> roots;
+#else
+   int inotifyFd;
+   int signalFd;                 // Event counter written along with the requests
+   std::vector<tWatchPath> roots;               // Watched trees
+   std::unordered_map<int, tWatchPath> watches; // Directory of each watch descriptor
+   std::map<tWatchPath, int> watchDirs;         // Watch descriptor of each directory
+   std::unordered_map<int, std::unordered_set<tWatchPath> > names; // Entry names of each watched directory
+   std::vector<char> buffer;                    // Events read
+#endif
+};
+
+//--------------------------------------------------------------------------
+
+unsigned int DirWatchTime()
+{
+   // Milliseconds of a monotonic clock, wrapping around
+   return (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//--------------------------------------------------------------------------
+
+static tWatchPath PathKey(const tWatchPath& path)
+{
+   // Key of a path, paths are compared case insensitively on Windows only
+   tWatchPath key = path;
+#ifdef _WIN32
+   if (!key.empty())
+      CharUpperBuff(&key[0], (DWORD)key.size());
+#endif
+   return key;
+}
+
+//--------------------------------------------------------------------------
+
+static void MoveDirChanges(pDirWatcher pW, const tWatchPath& oldDir, const tWatchPath& newDir)
+{
+   // Carry the pending changes of the entries within a directory along when it is renamed,
+   // or drop them when it is removed (no new directory). A removal or rename of an entry
+   // that existed before the batch is still reported by its old path.
+   tDirChangeBatch& batch = pW->batch;
+   tWatchPath prefix = PathKey(oldDir) + WATCH_SEP;
+   std::vector<unsigned int> moved;
+   std::map<tWatchPath, unsigned int>::iterator it = batch.index.lower_bound(prefix);
+   while (it != batch.index.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+   {
+      moved.push_back(it->second);
+      batch.index.erase(it++);
+   }
+   size_t i;
+   for (i = 0; i < moved.size(); i++)
+   {
+      tDirChange& change = batch.changes[moved[i]];
+      if (change.action == eDirRemoved)
+         // Not indexed any more, so that a new entry of the same path is recorded apart
+         continue;
+      if (!newDir.empty())
+      {
+         change.path = newDir + change.path.substr(oldDir.size());
+         batch.index[PathKey(change.path)] = moved[i];
+      }
+      else if (change.action == eDirRenamed && PathKey(change.oldPath).compare(0, prefix.size(), prefix) != 0)
+      {
+         // Renamed into the removed directory, the old entry is gone
+         change.action = eDirRemoved;
+         change.path = change.oldPath;
+         change.oldPath.clear();
+         if (batch.index.find(PathKey(change.path)) == batch.index.end())
+            batch.index[PathKey(change.path)] = moved[i];
+         else
+            change.path.clear();
+      }
+      else
+         change.path.clear();
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void AddDirChange(pDirWatcher pW, tDirChangeAction action, const tWatchPath& path, const tWatchPath& oldPath = tWatchPath())
+{
+   // Merge a change into the batch, so that only the net effect of the changes of each path
+   // is reported: an entry created and deleted again is left out, one deleted and created
+   // again is reported as modified, renaming a created entry reports the new name as created
+   // or, when it replaces an existing entry, as modified
+   tDirChangeBatch& batch = pW->batch;
+   pW->counts.records++;
+   if (action == eDirOverflow)
+   {
+      pW->counts.overflows++;
+      batch.changes.clear();
+      batch.index.clear();
+      batch.overflow = true;
+      return;
+   }
+   if (batch.overflow)
+      // Everything will be rescanned anyway
+      return;
+
+   // Entries within a directory follow it
+   if (action == eDirRemoved)
+      MoveDirChanges(pW, path, tWatchPath());
+   else if (action == eDirRenamed)
+      MoveDirChanges(pW, oldPath, path);
+
+   tWatchPath key = PathKey(path);
+   std::map<tWatchPath, unsigned int>::iterator it = batch.index.find(key);
+   if (action == eDirRenamed)
+   {
+      // A previous change of the target name is superseded by the rename
+      bool replaced = false;
+      if (it != batch.index.end())
+      {
+         replaced = batch.changes[it->second].action != eDirAdded;
+         batch.changes[it->second].path.clear();
+         batch.index.erase(it);
+      }
+      it = batch.index.find(PathKey(oldPath));
+      if (it == batch.index.end())
+      {
+         batch.index[key] = (unsigned int)batch.changes.size();
+         tDirChange change = {eDirRenamed, path, oldPath};
+         batch.changes.push_back(change);
+         return;
+      }
+      // Move the record of the old name to the new one
+      unsigned int pos = it->second;
+      batch.index.erase(it);
+      tDirChange& prev = batch.changes[pos];
+      if (prev.action == eDirRenamed && PathKey(prev.oldPath) == key)
+      {
+         // Renamed back
+         prev.path.clear();
+         return;
+      }
+      if (prev.action == eDirModified)
+      {
+         prev.action = eDirRenamed;
+         prev.oldPath = oldPath;
+      }
+      else if (prev.action == eDirAdded && replaced)
+         // Saved through a temporary file
+         prev.action = eDirModified;
+      prev.path = path;
+      batch.index[key] = pos;
+      return;
+   }
+
+   if (it == batch.index.end())
+   {
+      batch.index[key] = (unsigned int)batch.changes.size();
+      tDirChange change = {action, path, tWatchPath()};
+      batch.changes.push_back(change);
+      return;
+   }
+   unsigned int pos = it->second;
+   tDirChange& prev = batch.changes[pos];
+   switch (prev.action)
+   {
+      case eDirAdded:
+         if (action == eDirRemoved)
+         {
+            // Temporary entry
+            prev.path.clear();
+            batch.index.erase(it);
+         }
+         break;
+
+      case eDirRemoved:
+         if (action == eDirAdded)
+            prev.action = eDirModified;
+         break;
+
+      case eDirModified:
+         if (action == eDirRemoved)
+            prev.action = eDirRemoved;
+         break;
+
+      case eDirRenamed:
+         if (action == eDirRemoved)
+         {
+            // The entry of the old name is gone
+            prev.action = eDirRemoved;
+            prev.path = prev.oldPath;
+            prev.oldPath.clear();
+            batch.index.erase(it);
+            tWatchPath oldKey = PathKey(prev.path);
+            if (batch.index.find(oldKey) == batch.index.end())
+               batch.index[oldKey] = pos;
+            else
+               prev.path.clear();
+         }
+         break;
+
+      default:
+         break;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void PostDirChanges(pDirWatcher pW)
+{
+   // Hand the collected changes over to the receiver
+   tDirChangeBatch& batch = pW->batch;
+   tDirChangeList *pChanges = new tDirChangeList;
+   if (batch.overflow)
+   {
+      tDirChange change = {eDirOverflow, tWatchPath(), tWatchPath()};
+      pChanges->push_back(change);
+   }
+   size_t i;
+   for (i = 0; i < batch.changes.size(); i++)
+      if (!batch.changes[i].path.empty())
+         pChanges->push_back(batch.changes[i]);
+   batch.changes.clear();
+   batch.index.clear();
+   batch.overflow = false;
+
+   if (pChanges->empty())
+   {
+      delete pChanges;
+      return;
+   }
+   pW->counts.reported += (unsigned int)pChanges->size();
+   pW->counts.batches++;
+   pW->proc(pChanges, pW->firstChange, pW->param);
+}
+
+//--------------------------------------------------------------------------
+
+static tWaitResult TakeRequest(pDirWatcher pW)
+{
+   // Get the request signalled to the watch thread
+   std::lock_guard<std::mutex> guard(pW->lock);
+   if (pW->stop)
+      return eWaitStop;
+   if (pW->dirsChanged)
+   {
+      pW->dirsChanged = false;
+      return eWaitDirs;
+   }
+   return eWaitTimeout;
+}
+
+#ifdef _WIN32
+
+//--------------------------------------------------------------------------
+
+static bool OpenWatchBackend(pDirWatcher pW)
+{
+   // Create the event signalling requests to the watch thread
+   pW->hSignal = CreateEvent(NULL, FALSE, FALSE, NULL);
+   return pW->hSignal != NULL;
+}
+
+//--------------------------------------------------------------------------
+
+static void CloseWatchBackend(pDirWatcher pW)
+{
+   CloseHandle(pW->hSignal);
+}
+
+//--------------------------------------------------------------------------
+
+static void SignalWatch(pDirWatcher pW)
+{
+   SetEvent(pW->hSignal);
+}
+
+//--------------------------------------------------------------------------
+
+static BOOL ReadDirChanges(pWatchRoot pRoot)
+{
+   // Start reading the next changes in a directory tree
+   return ReadDirectoryChangesW(pRoot->hDir, &pRoot->buffer[0], (DWORD)(pRoot->buffer.size()*sizeof(DWORD)), TRUE,
+                                WATCH_FILTER, NULL, &pRoot->overlapped, NULL);
+}
+
+//--------------------------------------------------------------------------
+
+static pWatchRoot OpenWatchRoot(const tWatchPath& dir)
+{
+   // Open a directory tree and start reading its changes, NULL if not possible
+   pWatchRoot pRoot = new tWatchRoot;
+   pRoot->dir = dir;
+   pRoot->buffer.resize(WATCH_BUFFER_SIZE/sizeof(DWORD));
+   ZeroMemory(&pRoot->overlapped, sizeof(pRoot->overlapped));
+   pRoot->hDir = CreateFile(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                            OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+   pRoot->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+   if (pRoot->hDir != INVALID_HANDLE_VALUE && pRoot->overlapped.hEvent && ReadDirChanges(pRoot))
+      return pRoot;
+   if (pRoot->hDir != INVALID_HANDLE_VALUE)
+      CloseHandle(pRoot->hDir);
+   if (pRoot->overlapped.hEvent)
+      CloseHandle(pRoot->overlapped.hEvent);
+   delete pRoot;
+   return NULL;
+}
+
+//--------------------------------------------------------------------------
+
+static void CloseWatchRoot(pWatchRoot pRoot, bool reading = true)
+{
+   // Cancel the pending read of a directory tree and wait for it to complete before the buffer is released
+   if (reading)
+   {
+      DWORD size;
+      CancelIo(pRoot->hDir);
+      GetOverlappedResult(pRoot->hDir, &pRoot->overlapped, &size, TRUE);
+   }
+   CloseHandle(pRoot->hDir);
+   CloseHandle(pRoot->overlapped.hEvent);
+   delete pRoot;
+}
+
+//--------------------------------------------------------------------------
+
+static void UpdateWatchRoots(pDirWatcher pW)
+{
+   // Close the watches of the directories no longer to be watched and open those of new ones,
+   // the directories kept are watched without interruption
+   std::vector<tWatchPath> dirs;
+   {
+      std::lock_guard<std::mutex> guard(pW->lock);
+      dirs = pW->dirs;
+   }
+   size_t i, j;
+   for (i = 0; i < pW->roots.size(); )
+   {
+      for (j = 0; j < dirs.size() && PathKey(dirs[j]) != PathKey(pW->roots[i]->dir); j++);
+      if (j < dirs.size())
+      {
+         dirs.erase(dirs.begin() + j);
+         i++;
+      }
+      else
+      {
+         CloseWatchRoot(pW->roots[i]);
+         pW->roots.erase(pW->roots.begin() + i);
+      }
+   }
+   for (i = 0; i < dirs.size() && pW->roots.size() < MAX_WATCH_ROOTS; i++)
+   {
+      pWatchRoot pRoot = OpenWatchRoot(dirs[i]);
+      if (pRoot)
+         pW->roots.push_back(pRoot);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void CloseWatchRoots(pDirWatcher pW)
+{
+   size_t i;
+   for (i = 0; i < pW->roots.size(); i++)
+      CloseWatchRoot(pW->roots[i]);
+   pW->roots.clear();
+}
+
+//--------------------------------------------------------------------------
+
+static void ParseDirChanges(pDirWatcher pW, pWatchRoot pRoot, DWORD size)
+{
+   // Add the change records read to the batch, no records means that the buffer overflowed.
+   // The file names are given in UTF-16 like the paths of the Unicode build.
+   if (size == 0)
+   {
+      AddDirChange(pW, eDirOverflow, tWatchPath());
+      return;
+   }
+   tWatchPath oldPath;
+   FILE_NOTIFY_INFORMATION *pNotify = (FILE_NOTIFY_INFORMATION*)&pRoot->buffer[0];
+   while (TRUE)
+   {
+      tWatchPath path = pRoot->dir + tWatchPath(pNotify->FileName, pNotify->FileNameLength/sizeof(WCHAR));
+      switch (pNotify->Action)
+      {
+         case FILE_ACTION_ADDED:
+            AddDirChange(pW, eDirAdded, path);
+            break;
+
+         case FILE_ACTION_REMOVED:
+            AddDirChange(pW, eDirRemoved, path);
+            break;
+
+         case FILE_ACTION_MODIFIED:
+            AddDirChange(pW, eDirModified, path);
+            break;
+
+         case FILE_ACTION_RENAMED_OLD_NAME:
+            oldPath = path;
+            break;
+
+         case FILE_ACTION_RENAMED_NEW_NAME:
+            // Paired with the old name reported just before
+            if (oldPath.empty())
+               AddDirChange(pW, eDirAdded, path);
+            else
+               AddDirChange(pW, eDirRenamed, path, oldPath);
+            oldPath.clear();
+            break;
+      }
+      if (!pNotify->NextEntryOffset)
+         break;
+      pNotify = (FILE_NOTIFY_INFORMATION*)((BYTE*)pNotify + pNotify->NextEntryOffset);
+   }
+   if (!oldPath.empty())
+      // No new name within the tree
+      AddDirChange(pW, eDirRemoved, oldPath);
+}
+
+//--------------------------------------------------------------------------
+
+static tWaitResult WaitWatch(pDirWatcher pW, int timeout)
+{
+   // Wait for a request or the changes of one of the directory trees
+   HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+   DWORD i, cnt = 0;
+   handles[cnt++] = pW->hSignal;
+   for (i = 0; i < pW->roots.size(); i++)
+      handles[cnt++] = pW->roots[i]->overlapped.hEvent;
+
+   DWORD res = WaitForMultipleObjects(cnt, handles, FALSE, timeout < 0 ? INFINITE : timeout);
+   if (res == WAIT_TIMEOUT)
+      return eWaitTimeout;
+   if (res == WAIT_OBJECT_0)
+      return TakeRequest(pW);
+   if (res < WAIT_OBJECT_0 + 1 || res >= WAIT_OBJECT_0 + cnt)
+      return eWaitStop;
+
+   pWatchRoot pRoot = pW->roots[res - WAIT_OBJECT_0 - 1];
+   DWORD size = 0;
+   GetOverlappedResult(pRoot->hDir, &pRoot->overlapped, &size, FALSE);
+   ParseDirChanges(pW, pRoot, size);
+   if (!ReadDirChanges(pRoot))
+   {
+      // The directory can no longer be read, e.g. removed, have it rescanned
+      AddDirChange(pW, eDirOverflow, tWatchPath());
+      CloseWatchRoot(pRoot, false);
+      pW->roots.erase(pW->roots.begin() + (res - WAIT_OBJECT_0 - 1));
+   }
+   return eWaitChanges;
+}
+
+#else
+
+//--------------------------------------------------------------------------
+
+static bool OpenWatchBackend(pDirWatcher pW)
+{
+   // Create the inotify instance and the event counter signalling requests to the watch thread
+   pW->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   pW->signalFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   pW->buffer.resize(WATCH_BUFFER_SIZE);
+   if (pW->inotifyFd >= 0 && pW->signalFd >= 0)
+      return true;
+   if (pW->inotifyFd >= 0)
+      close(pW->inotifyFd);
+   if (pW->signalFd >= 0)
+      close(pW->signalFd);
+   return false;
+}
+
+//--------------------------------------------------------------------------
+
+static void CloseWatchBackend(pDirWatcher pW)
+{
+   close(pW->inotifyFd);
+   close(pW->signalFd);
+}
+
+//--------------------------------------------------------------------------
+
+static void SignalWatch(pDirWatcher pW)
+{
+   uint64_t one = 1;
+   if (write(pW->signalFd, &one, sizeof(one)) < 0)
+      return;
+}
+
+//--------------------------------------------------------------------------
+
+static void AddWatchTree(pDirWatcher pW, const tWatchPath& dir, bool report)
+{
+   // Watch a directory and all directories below it, inotify watches are not recursive.
+   // The entries of a directory created while watching are reported as added, as they
+   // may have been created before its watch was added.
+   int wd = inotify_add_watch(pW->inotifyFd, dir.c_str(), WATCH_MASK);
+   if (wd < 0)
+      return;
+   std::unordered_map<int, tWatchPath>::iterator it = pW->watches.find(wd);
+   if (it != pW->watches.end())
+      // Already watched under another path
+      pW->watchDirs.erase(it->second);
+   pW->watches[wd] = dir;
+   pW->watchDirs[dir] = wd;
+   std::unordered_set<tWatchPath>& names = pW->names[wd];
+   names.clear();
+
+   DIR *pDir = opendir(dir.c_str());
+   if (!pDir)
+      return;
+   struct dirent *pEntry;
+   while ((pEntry = readdir(pDir)) != NULL)
+   {
+      if (!strcmp(pEntry->d_name, ".") || !strcmp(pEntry->d_name, ".."))
+         continue;
+      names.insert(pEntry->d_name);
+      tWatchPath path = dir + pEntry->d_name;
+      bool isDir = pEntry->d_type == DT_DIR;
+      if (pEntry->d_type == DT_UNKNOWN)
+      {
+         struct stat st;
+         isDir = lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+      }
+      if (report)
+         AddDirChange(pW, eDirAdded, path);
+      if (isDir)
+         AddWatchTree(pW, path + WATCH_SEP, report);
+   }
+   closedir(pDir);
+}
+
+//--------------------------------------------------------------------------
+
+static void RemoveWatchTree(pDirWatcher pW, const tWatchPath& dir)
+{
+   // Stop watching a directory and all directories below it
+   std::map<tWatchPath, int>::iterator it = pW->watchDirs.lower_bound(dir);
+   while (it != pW->watchDirs.end() && it->first.compare(0, dir.size(), dir) == 0)
+   {
+      inotify_rm_watch(pW->inotifyFd, it->second);
+      pW->watches.erase(it->second);
+      pW->names.erase(it->second);
+      pW->watchDirs.erase(it++);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void MoveWatchTree(pDirWatcher pW, const tWatchPath& oldDir, const tWatchPath& newDir)
+{
+   // Update the paths of the watches of a directory tree renamed within the watched trees
+   std::vector<std::pair<tWatchPath, int> > moved;
+   std::map<tWatchPath, int>::iterator it = pW->watchDirs.lower_bound(oldDir);
+   while (it != pW->watchDirs.end() && it->first.compare(0, oldDir.size(), oldDir) == 0)
+   {
+      moved.push_back(std::make_pair(newDir + it->first.substr(oldDir.size()), it->second));
+      pW->watchDirs.erase(it++);
+   }
+   size_t i;
+   for (i = 0; i < moved.size(); i++)
+   {
+      pW->watchDirs[moved[i].first] = moved[i].second;
+      pW->watches[moved[i].second] = moved[i].first;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void UpdateWatchRoots(pDirWatcher pW)
+{
+   // Stop watching the trees no longer to be watched and start watching new ones
+   std::vector<tWatchPath> dirs;
+   {
+      std::lock_guard<std::mutex> guard(pW->lock);
+      dirs = pW->dirs;
+   }
+   size_t i;
+   for (i = 0; i < pW->roots.size(); i++)
+      if (std::find(dirs.begin(), dirs.end(), pW->roots[i]) == dirs.end())
+         RemoveWatchTree(pW, pW->roots[i]);
+   for (i = 0; i < dirs.size(); i++)
+      if (std::find(pW->roots.begin(), pW->roots.end(), dirs[i]) == pW->roots.end())
+         AddWatchTree(pW, dirs[i], false);
+   pW->roots = dirs;
+}
+
+//--------------------------------------------------------------------------
+
+static void CloseWatchRoots(pDirWatcher pW)
+{
+   size_t i;
+   for (i = 0; i < pW->roots.size(); i++)
+      RemoveWatchTree(pW, pW->roots[i]);
+   pW->roots.clear();
+}
+
+//--------------------------------------------------------------------------
+
+static void ReadWatchEvents(pDirWatcher pW)
+{
+   // Read all queued events. The two events of a rename are queued together and paired by
+   // their cookie, an unpaired event means a move into or out of the watched trees. An
+   // entry replaced by a move is reported as removed first, as on Windows, so that a file
+   // saved through a temporary one is reported as modified. When the queue has overflowed
+   // all trees are registered anew and reported for a rescan.
+   tWatchPath movedFrom;
+   uint32_t cookie = 0;
+   bool movedDir = false;
+   ssize_t len;
+   while ((len = read(pW->inotifyFd, &pW->buffer[0], pW->buffer.size())) > 0)
+   {
+      const char *pos = &pW->buffer[0];
+      while (pos < &pW->buffer[0] + len)
+      {
+         const struct inotify_event *pEvent = (const struct inotify_event*)pos;
+         pos += sizeof(struct inotify_event) + pEvent->len;
+
+         if (!movedFrom.empty() && !((pEvent->mask & IN_MOVED_TO) && pEvent->cookie == cookie))
+         {
+            AddDirChange(pW, eDirRemoved, movedFrom);
+            if (movedDir)
+               RemoveWatchTree(pW, movedFrom + WATCH_SEP);
+            movedFrom.clear();
+         }
+         if (pEvent->mask & IN_Q_OVERFLOW)
+         {
+            AddDirChange(pW, eDirOverflow, tWatchPath());
+            std::vector<tWatchPath> roots = pW->roots;
+            CloseWatchRoots(pW);
+            size_t i;
+            for (i = 0; i < roots.size(); i++)
+               AddWatchTree(pW, roots[i], false);
+            pW->roots = roots;
+            continue;
+         }
+
+         std::unordered_map<int, tWatchPath>::iterator it = pW->watches.find(pEvent->wd);
+         if (it == pW->watches.end())
+            continue;
+         if (pEvent->mask & IN_IGNORED)
+         {
+            // The directory is gone
+            std::map<tWatchPath, int>::iterator dirIt = pW->watchDirs.find(it->second);
+            if (dirIt != pW->watchDirs.end() && dirIt->second == pEvent->wd)
+               pW->watchDirs.erase(dirIt);
+            pW->watches.erase(it);
+            pW->names.erase(pEvent->wd);
+            continue;
+         }
+         if (!pEvent->len)
+            continue;
+
+         tWatchPath path = it->second + pEvent->name;
+         bool isDir = (pEvent->mask & IN_ISDIR) != 0;
+         std::unordered_set<tWatchPath>& names = pW->names[pEvent->wd];
+         if (pEvent->mask & IN_CREATE)
+         {
+            names.insert(pEvent->name);
+            AddDirChange(pW, eDirAdded, path);
+            if (isDir)
+               AddWatchTree(pW, path + WATCH_SEP, true);
+         }
+         else if (pEvent->mask & IN_DELETE)
+         {
+            names.erase(pEvent->name);
+            AddDirChange(pW, eDirRemoved, path);
+         }
+         else if (pEvent->mask & IN_MODIFY)
+            AddDirChange(pW, eDirModified, path);
+         else if (pEvent->mask & IN_MOVED_FROM)
+         {
+            names.erase(pEvent->name);
+            movedFrom = path;
+            cookie = pEvent->cookie;
+            movedDir = isDir;
+         }
+         else if (pEvent->mask & IN_MOVED_TO)
+         {
+            if (!names.insert(pEvent->name).second)
+               // Replaces an existing entry
+               AddDirChange(pW, eDirRemoved, path);
+            if (!movedFrom.empty())
+            {
+               AddDirChange(pW, eDirRenamed, path, movedFrom);
+               if (isDir)
+                  MoveWatchTree(pW, movedFrom + WATCH_SEP, path + WATCH_SEP);
+               movedFrom.clear();
+            }
+            else
+            {
+               AddDirChange(pW, eDirAdded, path);
+               if (isDir)
+                  AddWatchTree(pW, path + WATCH_SEP, true);
+            }
+         }
+      }
+   }
+   if (!movedFrom.empty())
+   {
+      AddDirChange(pW, eDirRemoved, movedFrom);
+      if (movedDir)
+         RemoveWatchTree(pW, movedFrom + WATCH_SEP);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static tWaitResult WaitWatch(pDirWatcher pW, int timeout)
+{
+   // Wait for a request or for inotify events
+   struct pollfd fds[2];
+   fds[0].fd = pW->signalFd;
+   fds[0].events = POLLIN;
+   fds[1].fd = pW->inotifyFd;
+   fds[1].events = POLLIN;
+   int res = poll(fds, 2, timeout);
+   if (res == 0 || (res < 0 && errno == EINTR))
+      return eWaitTimeout;
+   if (res < 0)
+      return eWaitStop;
+   if (fds[0].revents & POLLIN)
+   {
+      uint64_t cnt;
+      if (read(pW->signalFd, &cnt, sizeof(cnt)) < 0)
+         return eWaitTimeout;
+      return TakeRequest(pW);
+   }
+   ReadWatchEvents(pW);
+   return eWaitChanges;
+}
+
+#endif
+
+//--------------------------------------------------------------------------
+
+static void PublishDirWatchStats(pDirWatcher pW)
+{
+   // Make the statistics of the watch thread available to GetDirWatchStats
+   std::lock_guard<std::mutex> guard(pW->lock);
+   pW->stats = pW->counts;
+}
+
+//--------------------------------------------------------------------------
+
+static void WatchThreadProc(pDirWatcher pW)
+{
+   // Wait for changes in all watched directory trees at once and report them when no more
+   // changes have occurred for the debounce time, or at the latest after MAX_DEBOUNCE_PERIODS
+   // debounce times for a steady stream of changes. There is no timeout while idle.
+   unsigned int quietEnd = 0, latestEnd = 0;
+   tWaitResult res = eWaitTimeout;
+   while (res != eWaitStop)
+   {
+      bool pending = !pW->batch.changes.empty() || pW->batch.overflow;
+      int timeout = -1;
+      if (pending)
+      {
+         unsigned int now = DirWatchTime();
+         int left = (int)(quietEnd - now), latestLeft = (int)(latestEnd - now);
+         if (latestLeft < left)
+            left = latestLeft;
+         if (left <= 0)
+         {
+            PostDirChanges(pW);
+            PublishDirWatchStats(pW);
+            continue;
+         }
+         timeout = left;
+      }
+
+      res = WaitWatch(pW, timeout);
+      if (res == eWaitDirs)
+         UpdateWatchRoots(pW);
+      else if (res == eWaitChanges)
+      {
+         unsigned int now = DirWatchTime();
+         if (!pending)
+         {
+            pW->firstChange = now;
+            latestEnd = now + pW->debounce*MAX_DEBOUNCE_PERIODS;
+         }
+         quietEnd = now + pW->debounce;
+      }
+      PublishDirWatchStats(pW);
+   }
+   CloseWatchRoots(pW);
+}
+
+//--------------------------------------------------------------------------
+
+pDirWatcher StartDirWatcher(tDirChangeProc proc, void *param, unsigned int debounce)
+{
+   // Start watching for changes in the directory trees set by SetWatchedDirs. The changes are
+   // reported to the procedure once no more changes have occurred for the debounce time in ms.
+   pDirWatcher pW = new tDirWatcher;
+   pW->proc = proc;
+   pW->param = param;
+   pW->debounce = debounce;
+   pW->dirsChanged = false;
+   pW->stop = false;
+   pW->batch.overflow = false;
+   pW->firstChange = 0;
+   memset(&pW->stats, 0, sizeof(pW->stats));
+   memset(&pW->counts, 0, sizeof(pW->counts));
+   if (!OpenWatchBackend(pW))
+   {
+      delete pW;
+      return NULL;
+   }
+   try
+   {
+      pW->thread = std::thread(WatchThreadProc, pW);
+   }
+   catch (...)
+   {
+      CloseWatchBackend(pW);
+      delete pW;
+      return NULL;
+   }
+   return pW;
+}
+
+//--------------------------------------------------------------------------
+
+bool SetWatchedDirs(pDirWatcher pW, const std::vector<tWatchPath>& dirs)
+{
+   // Set the directory trees to watch. Directories within other ones are covered by
+   // those and left out. Returns true if the set has changed.
+   if (!pW)
+      return false;
+   std::vector<tWatchPath> roots;
+   size_t i, j;
+   for (i = 0; i < dirs.size(); i++)
+   {
+      if (dirs[i].empty())
+         continue;
+      tWatchPath dir = dirs[i];
+      if (dir[dir.size()-1] != WATCH_SEP)
+         dir += WATCH_SEP;
+      // Skip directories covered by a root, and remove the roots covered by the directory
+      tWatchPath key = PathKey(dir);
+      for (j = 0; j < roots.size() && key.compare(0, roots[j].size(), PathKey(roots[j])) != 0; j++);
+      if (j < roots.size())
+         continue;
+      for (j = 0; j < roots.size(); )
+         if (PathKey(roots[j]).compare(0, key.size(), key) == 0)
+            roots.erase(roots.begin() + j);
+         else
+            j++;
+      roots.push_back(dir);
+   }
+
+   bool changed;
+   {
+      std::lock_guard<std::mutex> guard(pW->lock);
+      changed = roots.size() != pW->dirs.size();
+      for (i = 0; i < roots.size() && !changed; i++)
+         changed = PathKey(roots[i]) != PathKey(pW->dirs[i]);
+      if (changed)
+      {
+         pW->dirs = roots;
+         pW->dirsChanged = true;
+      }
+   }
+   if (changed)
+      SignalWatch(pW);
+   return changed;
+}
+
+//--------------------------------------------------------------------------
+
+bool EndDirWatcher(pDirWatcher pW)
+{
+   // Stop watching, the watch thread cancels its pending reads and ends
+   if (!pW)
+      return false;
+   {
+      std::lock_guard<std::mutex> guard(pW->lock);
+      pW->stop = true;
+   }
+   SignalWatch(pW);
+   pW->thread.join();
+   CloseWatchBackend(pW);
+   delete pW;
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+void GetDirWatchStats(pDirWatcher pW, tDirWatchStats& stats)
+{
+   // Get the statistics published by the watch thread
+   std::lock_guard<std::mutex> guard(pW->lock);
+   stats = pW->stats;
+}
@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// dirwatch.h
+// Watching of directory trees for changes, with ReadDirectoryChangesW on
+// Windows and inotify on Linux. The changes of each entry are coalesced and
+// reported in batches once no further changes have occurred for a debounce
+// time. Only standard C++ is used beside the system watch calls.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <tchar.h>
+typedef std::basic_string<TCHAR> tWatchPath;
+#else
+typedef std::string tWatchPath;
+#endif
+
+// Change of a directory entry
+enum tDirChangeAction {
+   eDirAdded,        // Entry created or moved into the tree
+   eDirRemoved,      // Entry deleted or moved out of the tree
+   eDirModified,     // Entry contents changed
+   eDirRenamed,      // Entry renamed within the tree
+   eDirOverflow      // Changes were lost, the whole tree has to be rescanned
+};
+typedef struct {
+   tDirChangeAction action;
+   tWatchPath path;        // Full path of the entry, the new path when renamed
+   tWatchPath oldPath;     // Previous path of a renamed entry
+} tDirChange;
+typedef std::vector<tDirChange> tDirChangeList;
+
+// Receives each batch of changes on the watch thread and takes over the list.
+// The time of the first change of the batch is given in DirWatchTime units.
+typedef void (*tDirChangeProc)(tDirChangeList *pChanges, unsigned int firstChange, void *param);
+
+// Watch statistics
+typedef struct {
+   unsigned int records;   // Change records received from the system
+   unsigned int reported;  // Changes reported after coalescing
+   unsigned int batches;   // Batches reported
+   unsigned int overflows; // Times changes were lost
+} tDirWatchStats;
+
+typedef struct tDirWatcher *pDirWatcher;
+
+pDirWatcher StartDirWatcher(tDirChangeProc proc, void *param, unsigned int debounce);
+bool SetWatchedDirs(pDirWatcher pWatcher, const std::vector<tWatchPath>& dirs);
+bool EndDirWatcher(pDirWatcher pWatcher);
+void GetDirWatchStats(pDirWatcher pWatcher, tDirWatchStats& stats);
+unsigned int DirWatchTime();
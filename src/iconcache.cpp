@@ -0,0 +1,331 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// iconcache.cpp
+// Shared icon cache.
+//
+// Icons are keyed by their location (icon file and index, or the system
+// image list index for the icons of a file) and size. Each distinct icon
+// is created once and handed out with a reference count. Icons no longer
+// referenced are kept in least recently used order and destroyed when the
+// total size of the cached icons exceeds the memory budget.
+//
+// Icons not yet cached are first looked for in the persistent icon store,
+// keyed by the file or icon location and its modification time, and
+// added to it when extracted. Icons from the store are shared by the hash
+// of their pixels.
+//
+// Icons of icon locations are decoded from the icon, executable or library
+// file directly, the shell is only used for files not decodable.
+//
+
+#include <windows.h>
+#include <tchar.h>
+#include <shellapi.h>
+#include <commctrl.h>
+#include <list>
+#include <map>
+
+#include "resource.h"
+#include "utils.h"
+#include "iconcache.h"
+#include "iconstore.h"
+#include "icondecode.h"
+
+#define DEFAULT_BUDGET (2*1024*1024)
+
+typedef struct tIconEntry {
+   CString key;                           // Location and size
+   HICON hIcon;                           // Shared icon handle
+   LONG refs;                             // Number of users
+   DWORD bytes;                           // Estimated memory used by the icon bitmaps
+   std::list<tIconEntry*>::iterator lru;  // Position in the unused list when not referenced
+} tIconEntry, *pIconEntry;
+
+CRITICAL_SECTION gIconLock;
+BOOL gIconLockInit = (InitializeCriticalSection(&gIconLock), TRUE);
+std::map<CString, pIconEntry> gIconKeys;     // Entries by key
+std::map<HICON, pIconEntry> gIconHandles;    // Entries by handle
+std::list<pIconEntry> gUnusedIcons;          // Unreferenced entries, most recently used first
+DWORD gIconBytes = 0;                        // Total size of the cached icons
+DWORD gIconBudget = DEFAULT_BUDGET;
+
+//--------------------------------------------------------------------------
+
+DWORD IconBytes(HICON hIcon)
+{
+   // Estimate the memory used by an icon from its color and mask bitmaps
+   ICONINFO inf;
+   DWORD bytes = 0;
+   if (!GetIconInfo(hIcon, &inf))
+      return 0;
+   BITMAP bm;
+   if (inf.hbmColor && GetObject(inf.hbmColor, sizeof(bm), &bm))
+      bytes += bm.bmWidthBytes * bm.bmHeight;
+   if (inf.hbmMask && GetObject(inf.hbmMask, sizeof(bm), &bm))
+      bytes += bm.bmWidthBytes * bm.bmHeight;
+   if (inf.hbmColor)
+      DeleteObject(inf.hbmColor);
+   if (inf.hbmMask)
+      DeleteObject(inf.hbmMask);
+   return bytes;
+}
+
+//--------------------------------------------------------------------------
+
+void TrimIconCache()
+{
+   // Destroy the least recently used unreferenced icons until within budget, lock held
+   while (gIconBytes > gIconBudget && !gUnusedIcons.empty())
+   {
+      pIconEntry pEntry = gUnusedIcons.back();
+      gUnusedIcons.pop_back();
+      gIconKeys.erase(pEntry->key);
+      gIconHandles.erase(pEntry->hIcon);
+      gIconBytes -= pEntry->bytes;
+      DestroyIcon(pEntry->hIcon);
+      delete pEntry;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+HICON LookupIcon(const CString& key)
+{
+   // Get a new reference to a cached icon, NULL if not cached
+   HICON hIcon = NULL;
+   EnterCriticalSection(&gIconLock);
+   std::map<CString, pIconEntry>::iterator it = gIconKeys.find(key);
+   if (it != gIconKeys.end())
+   {
+      pIconEntry pEntry = it->second;
+      if (pEntry->refs++ == 0)
+         gUnusedIcons.erase(pEntry->lru);
+      hIcon = pEntry->hIcon;
+   }
+   LeaveCriticalSection(&gIconLock);
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+HICON AddIcon(const CString& key, HICON hIcon)
+{
+   // Enter a newly created icon with one reference, the cached one is used if
+   // another thread got there first
+   if (!hIcon)
+      return NULL;
+   EnterCriticalSection(&gIconLock);
+   std::map<CString, pIconEntry>::iterator it = gIconKeys.find(key);
+   if (it != gIconKeys.end())
+   {
+      pIconEntry pEntry = it->second;
+      if (pEntry->refs++ == 0)
+         gUnusedIcons.erase(pEntry->lru);
+      DestroyIcon(hIcon);
+      hIcon = pEntry->hIcon;
+   }
+   else
+   {
+      pIconEntry pEntry = new tIconEntry;
+      pEntry->key = key;
+      pEntry->hIcon = hIcon;
+      pEntry->refs = 1;
+      pEntry->bytes = IconBytes(hIcon);
+      gIconKeys[key] = pEntry;
+      gIconHandles[hIcon] = pEntry;
+      gIconBytes += pEntry->bytes;
+      TrimIconCache();
+   }
+   LeaveCriticalSection(&gIconLock);
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+HICON AcquireStoredIcon(LPCTSTR location, BOOL large, FILETIME *modTime)
+{
+   // Get an icon from the icon store, NULL if not stored for the current modification
+   // time of the location, which is then provided for storing the icon
+   WIN32_FILE_ATTRIBUTE_DATA attr;
+   LPCTSTR file = location + 2;
+   CString fileName;
+   if (location[0] == 'L')
+   {
+      // Location icon, "L|<file>|<index>"
+      fileName = CString(file).Left(CString(file).ReverseFind('|'));
+      file = fileName;
+   }
+   if (!GetFileAttributesEx(file, GetFileExInfoStandard, &attr))
+      return NULL;
+   *modTime = attr.ftLastWriteTime;
+
+   int size = GetSystemMetrics(large ? SM_CXICON : SM_CXSMICON);
+   unsigned long long hash;
+   std::vector<unsigned int> pixels;
+   if (!GetStoredPixels(location, *modTime, size, pixels, &hash))
+      return NULL;
+   CString key;
+   key.Format(_T("#%016I64X|%c"), hash, large ? 'L' : 'S');
+   HICON hIcon = LookupIcon(key);
+   if (!hIcon)
+      hIcon = AddIcon(key, IconFromPixels(&pixels[0], size));
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+HICON AcquireFileIcon(LPCTSTR fileName, BOOL large)
+{
+   // Get the shell icon of a file. Files sharing an icon in the system image list,
+   // e.g. folders or documents of the same type, share the icon handle.
+   CString location = CString(_T("F|")) + fileName;
+   FILETIME modTime = {0, 0};
+   HICON hIcon = AcquireStoredIcon(location, large, &modTime);
+   if (hIcon)
+      return hIcon;
+
+   SHFILEINFO inf;
+   UINT flags = SHGFI_SYSICONINDEX | (large ? SHGFI_LARGEICON : SHGFI_SMALLICON);
+   HIMAGELIST hList = (HIMAGELIST)SHGetFileInfo(fileName, 0, &inf, sizeof(inf), flags);
+   if (!hList)
+      return NULL;
+   CString key;
+   key.Format(_T("*%d|%c"), inf.iIcon, large ? 'L' : 'S');
+   hIcon = LookupIcon(key);
+   if (!hIcon)
+      hIcon = AddIcon(key, ImageList_GetIcon(hList, inf.iIcon, ILD_NORMAL));
+   if (modTime.dwLowDateTime || modTime.dwHighDateTime)
+      StoreIcon(location, modTime, GetSystemMetrics(large ? SM_CXICON : SM_CXSMICON), hIcon);
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+HICON AcquireLocationIcon(LPCTSTR iconFile, int iconInd, BOOL large)
+{
+   // Get an icon from an icon location (icon, executable or library file and index)
+   CString key;
+   key.Format(_T("%s|%d|%c"), iconFile, iconInd, large ? 'L' : 'S');
+   key.MakeUpper();
+   HICON hIcon = LookupIcon(key);
+   if (!hIcon)
+   {
+      CString location;
+      location.Format(_T("L|%s|%d"), iconFile, iconInd);
+      FILETIME modTime = {0, 0};
+      hIcon = AcquireStoredIcon(location, large, &modTime);
+      if (hIcon)
+         return hIcon;
+
+      int size = GetSystemMetrics(large ? SM_CXICON : SM_CXSMICON);
+      HICON hNew = DecodeLocationIcon(iconFile, iconInd, size);
+      if (!hNew && large)
+         ExtractIconEx(iconFile, iconInd, &hNew, NULL, 1);
+      else if (!hNew)
+         ExtractIconEx(iconFile, iconInd, NULL, &hNew, 1);
+      hIcon = AddIcon(key, hNew);
+      if (modTime.dwLowDateTime || modTime.dwHighDateTime)
+         StoreIcon(location, modTime, size, hIcon);
+   }
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+HICON AcquirePlaceholderIcon(BOOL folder, BOOL large)
+{
+   // Get the generic folder or document icon, shown until the actual icon is loaded
+   CString key;
+   key.Format(_T("?%c|%c"), folder ? 'F' : 'D', large ? 'L' : 'S');
+   HICON hIcon = LookupIcon(key);
+   if (!hIcon)
+   {
+      SHSTOCKICONINFO inf;
+      ZeroMemory(&inf, sizeof(inf));
+      inf.cbSize = sizeof(inf);
+      if (SUCCEEDED(SHGetStockIconInfo(folder ? SIID_FOLDER : SIID_DOCNOASSOC,
+                                       SHGSI_ICON | (large ? SHGSI_LARGEICON : SHGSI_SMALLICON), &inf)))
+         hIcon = AddIcon(key, inf.hIcon);
+   }
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL AddIconRef(HICON hIcon)
+{
+   // Add a reference to a cached icon, FALSE if not from the cache
+   BOOL found = FALSE;
+   EnterCriticalSection(&gIconLock);
+   std::map<HICON, pIconEntry>::iterator it = gIconHandles.find(hIcon);
+   if (it != gIconHandles.end())
+   {
+      if (it->second->refs++ == 0)
+         gUnusedIcons.erase(it->second->lru);
+      found = TRUE;
+   }
+   LeaveCriticalSection(&gIconLock);
+   return found;
+}
+
+//--------------------------------------------------------------------------
+
+void ReleaseIcon(HICON hIcon)
+{
+   // Release a reference to a cached icon, icons not from the cache are destroyed
+   if (!hIcon)
+      return;
+   EnterCriticalSection(&gIconLock);
+   std::map<HICON, pIconEntry>::iterator it = gIconHandles.find(hIcon);
+   if (it == gIconHandles.end())
+      DestroyIcon(hIcon);
+   else if (--it->second->refs == 0)
+   {
+      // Keep while within budget
+      gUnusedIcons.push_front(it->second);
+      it->second->lru = gUnusedIcons.begin();
+      TrimIconCache();
+   }
+   LeaveCriticalSection(&gIconLock);
+}
+
+//--------------------------------------------------------------------------
+
+void SetIconCacheBudget(DWORD bytes)
+{
+   // Set the memory budget, referenced icons are kept regardless
+   EnterCriticalSection(&gIconLock);
+   gIconBudget = bytes;
+   TrimIconCache();
+   LeaveCriticalSection(&gIconLock);
+}
+
+//--------------------------------------------------------------------------
+
+void GetIconCacheStats(DWORD *icons, DWORD *bytes)
+{
+   // Number and total size of the cached icons
+   EnterCriticalSection(&gIconLock);
+   if (icons)
+      *icons = (DWORD)gIconKeys.size();
+   if (bytes)
+      *bytes = gIconBytes;
+   LeaveCriticalSection(&gIconLock);
+}
@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// iconcache.h
+// Shared icon handles, reference counted and keyed by icon location and size.
+
+#pragma once
+
+#include <windows.h>
+
+HICON AcquireFileIcon(LPCTSTR fileName, BOOL large);
+HICON AcquireLocationIcon(LPCTSTR iconFile, int iconInd, BOOL large);
+HICON AcquirePlaceholderIcon(BOOL folder, BOOL large);
+BOOL AddIconRef(HICON hIcon);
+void ReleaseIcon(HICON hIcon);
+void SetIconCacheBudget(DWORD bytes);
+void GetIconCacheStats(DWORD *icons, DWORD *bytes);
@@ -0,0 +1,977 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// icondecode.cpp
+// Icon decoder.
+//
+// An icon file starts with an icon directory listing the images of the
+// icon in different sizes and color depths. In executables and libraries
+// the directory is an RT_GROUP_ICON resource, the images being RT_ICON
+// resources referenced by id. The resources are found by walking the
+// three levels (type, name, language) of the resource directory of the PE
+// file.
+//
+// An image is either a PNG file or a device independent bitmap of double
+// height, the color (XOR) bitmap followed by the 1 bit transparency (AND)
+// mask. The zlib stream of the PNG images is inflated by the decoder
+// itself.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "icondecode.h"
+#include "pixels.h"
+
+#define MAX_IMAGE_SIZE 1024
+#define RT_ICON_TYPE 3
+#define RT_GROUP_ICON_TYPE 14
+#define DATA_DIR_RESOURCE 2
+
+static const unsigned char gPngSig[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+//--------------------------------------------------------------------------
+
+static unsigned int Get16(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8);
+}
+
+static unsigned int Get32(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int Get16BE(const unsigned char *p)
+{
+   return (p[0] << 8) | p[1];
+}
+
+static unsigned int Get32BE(const unsigned char *p)
+{
+   return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static unsigned int MakePixel(unsigned int r, unsigned int g, unsigned int b, unsigned int a)
+{
+   // Premultiplied ARGB pixel
+   if (a < 255)
+   {
+      r = (r * a + 127) / 255;
+      g = (g * a + 127) / 255;
+      b = (b * a + 127) / 255;
+   }
+   return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+//--------------------------------------------------------------------------
+// Inflate (RFC 1951)
+
+typedef struct {
+   const unsigned char *data;    // Next input byte
+   const unsigned char *end;     // End of input
+   unsigned long long bits;      // Bit buffer, next bit lowest
+   int count;                    // Number of bits in the buffer
+   int pad;                      // Number of zero bytes added beyond the end of input
+} tBitReader;
+
+typedef struct {
+   std::vector<unsigned short> table;  // (symbol << 4) | code length, by the next maxLen input bits
+   int maxLen;                         // Longest code length
+} tHuffman;
+
+static const unsigned short gLenBase[29] = {
+   3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char gLenExtra[29] = {
+   0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short gDistBase[30] = {
+   1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+   1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char gDistExtra[30] = {
+   0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char gCodeLenOrder[19] = {
+   16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+//--------------------------------------------------------------------------
+
+static void NeedBits(tBitReader& br, int n)
+{
+   // Fill the bit buffer with at least n bits, zeros beyond the end of input
+   while (br.count < n)
+   {
+      if (br.data < br.end)
+         br.bits |= (unsigned long long)*br.data++ << br.count;
+      else
+         br.pad++;
+      br.count += 8;
+   }
+}
+
+static unsigned int GetBits(tBitReader& br, int n)
+{
+   NeedBits(br, n);
+   unsigned int val = (unsigned int)(br.bits & ((1ULL << n) - 1));
+   br.bits >>= n;
+   br.count -= n;
+   return val;
+}
+
+static bool Overrun(const tBitReader& br)
+{
+   // True if bits beyond the end of input were used
+   return br.pad * 8 > br.count;
+}
+
+//--------------------------------------------------------------------------
+
+static bool BuildHuffman(const unsigned char *lengths, int n, tHuffman& huff)
+{
+   // Build the decoding table of a canonical Huffman code from its code lengths,
+   // incomplete codes are allowed, unused table entries having zero length
+   int count[16] = {0}, next[16];
+   for (int i = 0; i < n; i++)
+      count[lengths[i]]++;
+   count[0] = 0;
+   int left = 1;
+   huff.maxLen = 1;
+   for (int len = 1; len < 16; len++)
+   {
+      left = (left << 1) - count[len];
+      if (left < 0)
+         return false;
+      if (count[len])
+         huff.maxLen = len;
+   }
+   int code = 0;
+   for (int len = 1; len < 16; len++)
+   {
+      code = (code + count[len - 1]) << 1;
+      next[len] = code;
+   }
+   huff.table.assign(1 << huff.maxLen, 0);
+   for (int sym = 0; sym < n; sym++)
+   {
+      int len = lengths[sym];
+      if (!len)
+         continue;
+      int c = next[len]++, rev = 0;
+      for (int i = 0; i < len; i++)
+         rev |= ((c >> i) & 1) << (len - 1 - i);
+      for (int i = rev; i < (1 << huff.maxLen); i += 1 << len)
+         huff.table[i] = (unsigned short)((sym << 4) | len);
+   }
+   return true;
+}
+
+static int DecodeSymbol(tBitReader& br, const tHuffman& huff)
+{
+   // Next symbol, -1 for an unused code
+   NeedBits(br, huff.maxLen);
+   unsigned int entry = huff.table[(size_t)(br.bits & ((1ULL << huff.maxLen) - 1))];
+   int len = entry & 15;
+   if (!len)
+      return -1;
+   br.bits >>= len;
+   br.count -= len;
+   return entry >> 4;
+}
+
+//--------------------------------------------------------------------------
+
+static bool ReadDynamicCodes(tBitReader& br, tHuffman& lenCode, tHuffman& distCode)
+{
+   // Read the code lengths of a dynamic block, themselves Huffman coded
+   int nLen = GetBits(br, 5) + 257, nDist = GetBits(br, 5) + 1, nCode = GetBits(br, 4) + 4;
+   if (nLen > 286 || nDist > 30)
+      return false;
+   unsigned char lengths[286 + 30];
+   memset(lengths, 0, 19);
+   for (int i = 0; i < nCode; i++)
+      lengths[gCodeLenOrder[i]] = (unsigned char)GetBits(br, 3);
+   tHuffman codeLenCode;
+   if (!BuildHuffman(lengths, 19, codeLenCode))
+      return false;
+
+   for (int i = 0; i < nLen + nDist;)
+   {
+      int sym = DecodeSymbol(br, codeLenCode), rep = 0;
+      unsigned char val = 0;
+      if (sym < 0 || Overrun(br))
+         return false;
+      if (sym < 16)
+      {
+         lengths[i++] = (unsigned char)sym;
+         continue;
+      }
+      if (sym == 16)
+      {
+         if (i == 0)
+            return false;
+         val = lengths[i - 1];
+         rep = 3 + GetBits(br, 2);
+      }
+      else if (sym == 17)
+         rep = 3 + GetBits(br, 3);
+      else
+         rep = 11 + GetBits(br, 7);
+      if (i + rep > nLen + nDist)
+         return false;
+      while (rep--)
+         lengths[i++] = val;
+   }
+   // The end of block code is needed
+   return lengths[256] != 0 && BuildHuffman(lengths, nLen, lenCode) && BuildHuffman(lengths + nLen, nDist, distCode);
+}
+
+//--------------------------------------------------------------------------
+
+static bool InflateBlock(tBitReader& br, const tHuffman& lenCode, const tHuffman& distCode,
+                         std::vector<unsigned char>& out, size_t maxOut)
+{
+   // Decode the compressed data of a block up to its end code
+   for (;;)
+   {
+      int sym = DecodeSymbol(br, lenCode);
+      if (sym < 0 || Overrun(br))
+         return false;
+      if (sym < 256)
+      {
+         if (out.size() >= maxOut)
+            return false;
+         out.push_back((unsigned char)sym);
+         continue;
+      }
+      if (sym == 256)
+         return true;
+      sym -= 257;
+      if (sym >= 29)
+         return false;
+      size_t len = gLenBase[sym] + GetBits(br, gLenExtra[sym]);
+      int dSym = DecodeSymbol(br, distCode);
+      if (dSym < 0 || dSym >= 30)
+         return false;
+      size_t dist = gDistBase[dSym] + GetBits(br, gDistExtra[dSym]);
+      if (dist > out.size() || out.size() + len > maxOut || Overrun(br))
+         return false;
+      // The copy may overlap its own output
+      size_t from = out.size() - dist;
+      for (size_t i = 0; i < len; i++)
+         out.push_back(out[from + i]);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static bool Inflate(const unsigned char *data, size_t size, std::vector<unsigned char>& out, size_t maxOut)
+{
+   // Decompress a zlib stream (RFC 1950) of at most maxOut bytes
+   if (size < 6 || (data[0] & 0x0F) != 8 || (data[0] >> 4) > 7 || (data[1] & 0x20) || ((data[0] << 8) | data[1]) % 31)
+      return false;
+   tBitReader br = { data + 2, data + size - 4, 0, 0, 0 };
+   out.clear();
+   out.reserve(maxOut);
+
+   unsigned int last;
+   do
+   {
+      last = GetBits(br, 1);
+      unsigned int type = GetBits(br, 2);
+      if (type == 0)
+      {
+         // Stored block, byte aligned
+         GetBits(br, br.count & 7);
+         if (Overrun(br))
+            return false;
+         br.data -= br.count / 8 - br.pad;
+         br.bits = 0;
+         br.count = br.pad = 0;
+         if (br.end - br.data < 4)
+            return false;
+         size_t len = Get16(br.data);
+         if ((len ^ Get16(br.data + 2)) != 0xFFFF || (size_t)(br.end - br.data - 4) < len || out.size() + len > maxOut)
+            return false;
+         out.insert(out.end(), br.data + 4, br.data + 4 + len);
+         br.data += 4 + len;
+      }
+      else if (type == 1)
+      {
+         // Fixed codes
+         unsigned char lengths[288 + 30];
+         memset(lengths, 8, 144);
+         memset(lengths + 144, 9, 112);
+         memset(lengths + 256, 7, 24);
+         memset(lengths + 280, 8, 8);
+         memset(lengths + 288, 5, 30);
+         tHuffman lenCode, distCode;
+         BuildHuffman(lengths, 288, lenCode);
+         BuildHuffman(lengths + 288, 30, distCode);
+         if (!InflateBlock(br, lenCode, distCode, out, maxOut))
+            return false;
+      }
+      else if (type == 2)
+      {
+         tHuffman lenCode, distCode;
+         if (!ReadDynamicCodes(br, lenCode, distCode) || !InflateBlock(br, lenCode, distCode, out, maxOut))
+            return false;
+      }
+      else
+         return false;
+   } while (!last);
+
+   // Adler-32 of the uncompressed data
+   unsigned int a = 1, b = 0;
+   for (size_t i = 0; i < out.size();)
+   {
+      for (size_t n = i + 5552 < out.size() ? i + 5552 : out.size(); i < n; i++)
+      {
+         a += out[i];
+         b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+   }
+   return Get32BE(data + size - 4) == ((b << 16) | a);
+}
+
+//--------------------------------------------------------------------------
+// PNG images
+
+typedef struct {
+   int width, height;            // Image size
+   int depth;                    // Bits per sample
+   int colorType;                // 0 gray, 2 RGB, 3 palette, 4 gray and alpha, 6 RGBA
+   int channels;                 // Samples per pixel
+   unsigned int palette[256];    // Palette colors, straight ARGB
+   int paletteSize;              // Number of palette entries
+   bool hasKey;                  // Transparent color defined for gray and RGB images
+   unsigned int key[3];          // Transparent gray or RGB samples
+} tPngInfo;
+
+static unsigned int GetSample(const unsigned char *row, int x, int depth)
+{
+   // Sample x of a row of single sample pixels, or byte x for depths of 8 and 16
+   if (depth >= 8)
+      return row[x];
+   int bit = x * depth;
+   return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+}
+
+//--------------------------------------------------------------------------
+
+static unsigned int PngPixel(const tPngInfo& inf, const unsigned char *row, int x)
+{
+   // Decode pixel x of an unfiltered row
+   unsigned int s[4];
+   if (inf.depth == 16)
+   {
+      for (int c = 0; c < inf.channels; c++)
+         s[c] = (row[(x * inf.channels + c) * 2] << 8) | row[(x * inf.channels + c) * 2 + 1];
+   }
+   else if (inf.depth == 8)
+   {
+      for (int c = 0; c < inf.channels; c++)
+         s[c] = row[x * inf.channels + c];
+   }
+   else
+      s[0] = GetSample(row, x, inf.depth);
+
+   // Scale to 8 bits, the key is compared with the full samples
+   unsigned int max = (1 << inf.depth) - 1, v[4];
+   for (int c = 0; c < inf.channels; c++)
+      v[c] = inf.depth == 16 ? s[c] >> 8 : s[c] * 255 / max;
+   switch (inf.colorType)
+   {
+   case 0:
+      return MakePixel(v[0], v[0], v[0], inf.hasKey && s[0] == inf.key[0] ? 0 : 255);
+   case 2:
+      return MakePixel(v[0], v[1], v[2], inf.hasKey && s[0] == inf.key[0] && s[1] == inf.key[1] && s[2] == inf.key[2] ? 0 : 255);
+   case 3:
+   {
+      // Out of range indexes are transparent
+      if ((int)s[0] >= inf.paletteSize)
+         return 0;
+      unsigned int p = inf.palette[s[0]];
+      return MakePixel((p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF, p >> 24);
+   }
+   case 4:
+      return MakePixel(v[0], v[0], v[0], v[1]);
+   default:
+      return MakePixel(v[0], v[1], v[2], v[3]);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void Unfilter(unsigned char *row, const unsigned char *prev, size_t len, int bpp, int filter)
+{
+   // Reverse the filter of a row, prev is NULL for the first row of a pass
+   for (size_t i = 0; i < len; i++)
+   {
+      int a = i >= (size_t)bpp ? row[i - bpp] : 0, b = prev ? prev[i] : 0, c = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+      switch (filter)
+      {
+      case 1:
+         row[i] = (unsigned char)(row[i] + a);
+         break;
+      case 2:
+         row[i] = (unsigned char)(row[i] + b);
+         break;
+      case 3:
+         row[i] = (unsigned char)(row[i] + ((a + b) >> 1));
+         break;
+      case 4:
+      {
+         int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+         row[i] = (unsigned char)(row[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+         break;
+      }
+      }
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static bool DecodePng(const unsigned char *data, size_t size, tIconImage& image)
+{
+   // Decode a PNG image, interlaced or not
+   tPngInfo inf;
+   memset(&inf, 0, sizeof(inf));
+   int interlace = 0;
+   std::vector<unsigned char> idat;
+   bool header = false, end = false;
+   for (size_t pos = 8; !end;)
+   {
+      if (size - pos < 12)
+         return false;
+      size_t len = Get32BE(data + pos);
+      const unsigned char *type = data + pos + 4, *chunk = data + pos + 8;
+      if (len > size - pos - 12)
+         return false;
+      pos += 12 + len;
+
+      if (!memcmp(type, "IHDR", 4))
+      {
+         if (len < 13)
+            return false;
+         inf.width = (int)Get32BE(chunk);
+         inf.height = (int)Get32BE(chunk + 4);
+         inf.depth = chunk[8];
+         inf.colorType = chunk[9];
+         interlace = chunk[12];
+         static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+         inf.channels = inf.colorType <= 6 ? channels[inf.colorType] : 0;
+         int d = inf.depth;
+         bool depthOk = inf.colorType == 0 ? (d == 1 || d == 2 || d == 4 || d == 8 || d == 16) :
+                        inf.colorType == 3 ? (d == 1 || d == 2 || d == 4 || d == 8) : (d == 8 || d == 16);
+         if (inf.width <= 0 || inf.height <= 0 || inf.width > MAX_IMAGE_SIZE || inf.height > MAX_IMAGE_SIZE ||
+             !inf.channels || !depthOk || chunk[10] || chunk[11] || interlace > 1)
+            return false;
+         header = true;
+      }
+      else if (!memcmp(type, "PLTE", 4))
+      {
+         inf.paletteSize = (int)(len / 3 < 256 ? len / 3 : 256);
+         for (int i = 0; i < inf.paletteSize; i++)
+            inf.palette[i] = 0xFF000000 | (chunk[i * 3] << 16) | (chunk[i * 3 + 1] << 8) | chunk[i * 3 + 2];
+      }
+      else if (!memcmp(type, "tRNS", 4))
+      {
+         if (inf.colorType == 3)
+         {
+            for (size_t i = 0; i < len && i < (size_t)inf.paletteSize; i++)
+               inf.palette[i] = (inf.palette[i] & 0x00FFFFFF) | ((unsigned int)chunk[i] << 24);
+         }
+         else if ((inf.colorType == 0 && len >= 2) || (inf.colorType == 2 && len >= 6))
+         {
+            inf.hasKey = true;
+            for (size_t i = 0; i < 3 && i * 2 + 1 < len; i++)
+               inf.key[i] = Get16BE(chunk + i * 2);
+         }
+      }
+      else if (!memcmp(type, "IDAT", 4))
+         idat.insert(idat.end(), chunk, chunk + len);
+      else if (!memcmp(type, "IEND", 4))
+         end = true;
+   }
+   if (!header || (inf.colorType == 3 && !inf.paletteSize))
+      return false;
+
+   // Adam7 passes, a single pass if not interlaced
+   static const int passes[7][4] = { {0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4}, {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2} };
+   static const int noPasses[1][4] = { {0, 0, 1, 1} };
+   const int (*pass)[4] = interlace ? passes : noPasses;
+   int nPasses = interlace ? 7 : 1, bits = inf.depth * inf.channels, bpp = bits >= 8 ? bits / 8 : 1;
+   size_t total = 0;
+   for (int p = 0; p < nPasses; p++)
+   {
+      size_t w = (inf.width - pass[p][0] + pass[p][2] - 1) / pass[p][2], h = (inf.height - pass[p][1] + pass[p][3] - 1) / pass[p][3];
+      if (inf.width > pass[p][0] && inf.height > pass[p][1])
+         total += h * (1 + (w * bits + 7) / 8);
+   }
+   std::vector<unsigned char> raw;
+   if (idat.empty() || !Inflate(&idat[0], idat.size(), raw, total) || raw.size() != total)
+      return false;
+
+   image.width = inf.width;
+   image.height = inf.height;
+   image.pixels.assign((size_t)inf.width * inf.height, 0);
+   unsigned char *row = raw.empty() ? NULL : &raw[0];
+   for (int p = 0; p < nPasses; p++)
+   {
+      if (inf.width <= pass[p][0] || inf.height <= pass[p][1])
+         continue;
+      int w = (inf.width - pass[p][0] + pass[p][2] - 1) / pass[p][2], h = (inf.height - pass[p][1] + pass[p][3] - 1) / pass[p][3];
+      size_t len = ((size_t)w * bits + 7) / 8;
+      const unsigned char *prev = NULL;
+      for (int y = 0; y < h; y++)
+      {
+         if (row[0] > 4)
+            return false;
+         Unfilter(row + 1, prev, len, bpp, row[0]);
+         unsigned int *out = &image.pixels[(size_t)(pass[p][1] + y * pass[p][3]) * inf.width];
+         for (int x = 0; x < w; x++)
+            out[pass[p][0] + x * pass[p][2]] = PngPixel(inf, row + 1, x);
+         prev = row + 1;
+         row += 1 + len;
+      }
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------------
+// Bitmap images
+
+static bool DecodeBitmap(const unsigned char *data, size_t size, tIconImage& image)
+{
+   // Decode an icon bitmap, the color bitmap followed by the transparency mask
+   if (size < 40)
+      return false;
+   unsigned int hdrSize = Get32(data), bitCount = Get16(data + 14), compression = Get32(data + 16), clrUsed = Get32(data + 32);
+   int width = (int)Get32(data + 4), height = (int)Get32(data + 8) / 2;
+   if (hdrSize < 40 || hdrSize > size || width <= 0 || height <= 0 || width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE ||
+       compression != 0 || (bitCount != 1 && bitCount != 4 && bitCount != 8 && bitCount != 16 && bitCount != 24 && bitCount != 32))
+      return false;
+
+   size_t colors = bitCount <= 8 ? (clrUsed && clrUsed < (1u << bitCount) ? clrUsed : 1u << bitCount) : 0;
+   size_t stride = ((width * bitCount + 31) / 32) * 4, maskStride = ((width + 31) / 32) * 4;
+   const unsigned char *palette = data + hdrSize, *bits = palette + colors * 4, *mask = bits + stride * height;
+   if ((size_t)(bits - data) + stride * height > size)
+      return false;
+   // The mask is optional for images with alpha
+   bool hasMask = (size_t)(mask - data) + maskStride * height <= size;
+   if (!hasMask && bitCount != 32)
+      return false;
+
+   bool hasAlpha = false;
+   if (bitCount == 32)
+   {
+      for (int y = 0; y < height && !hasAlpha; y++)
+         for (int x = 0; x < width && !hasAlpha; x++)
+            hasAlpha = bits[y * stride + x * 4 + 3] != 0;
+   }
+   image.width = width;
+   image.height = height;
+   image.pixels.resize((size_t)width * height);
+   for (int y = 0; y < height; y++)
+   {
+      // Rows are bottom up
+      const unsigned char *row = bits + (height - 1 - y) * stride, *maskRow = mask + (height - 1 - y) * maskStride;
+      unsigned int *out = &image.pixels[(size_t)y * width];
+      for (int x = 0; x < width; x++)
+      {
+         unsigned int r, g, b, a = 255;
+         if (bitCount <= 8)
+         {
+            size_t ind = GetSample(row, x, bitCount);
+            const unsigned char *c = palette + (ind < colors ? ind : 0) * 4;
+            b = c[0];
+            g = c[1];
+            r = c[2];
+         }
+         else if (bitCount == 16)
+         {
+            unsigned int v = Get16(row + x * 2);
+            r = ((v >> 10) & 31) * 255 / 31;
+            g = ((v >> 5) & 31) * 255 / 31;
+            b = (v & 31) * 255 / 31;
+         }
+         else
+         {
+            const unsigned char *c = row + x * (bitCount / 8);
+            b = c[0];
+            g = c[1];
+            r = c[2];
+            if (hasAlpha)
+               a = c[3];
+         }
+         if (!hasAlpha && hasMask && (maskRow[x >> 3] & (0x80 >> (x & 7))))
+            a = 0;
+         out[x] = MakePixel(r, g, b, a);
+      }
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+bool DecodeIconImage(const unsigned char *data, size_t size, tIconImage& image)
+{
+   // Decode an icon image, PNG or bitmap
+   if (size >= sizeof(gPngSig) && !memcmp(data, gPngSig, sizeof(gPngSig)))
+      return DecodePng(data, size, image);
+   return DecodeBitmap(data, size, image);
+}
+
+//--------------------------------------------------------------------------
+// Icon directories
+
+typedef struct {
+   int size;               // Width in pixels
+   int bitCount;           // Color depth
+   unsigned int bytes;     // Size of the image data
+   unsigned int location;  // Offset of the image in an icon file, resource id in a PE file
+} tIconDirEntry;
+
+static int PickIcon(const std::vector<tIconDirEntry>& entries, int wantSize)
+{
+   // Select the smallest image not smaller than wanted, else the largest, preferring
+   // the deepest colors
+   int best = 0;
+   for (size_t i = 1; i < entries.size(); i++)
+   {
+      const tIconDirEntry &e = entries[i], &b = entries[best];
+      bool eFits = e.size >= wantSize, bFits = b.size >= wantSize, better;
+      if (eFits != bFits)
+         better = eFits;
+      else if (e.size != b.size)
+         better = eFits ? e.size < b.size : e.size > b.size;
+      else
+         better = e.bitCount > b.bitCount;
+      if (better)
+         best = (int)i;
+   }
+   return best;
+}
+
+//--------------------------------------------------------------------------
+
+static bool ReadIconDir(const unsigned char *data, size_t size, size_t entrySize, std::vector<tIconDirEntry>& entries)
+{
+   // Read an icon directory, entries of 16 bytes in icon files and of 14 bytes in group resources
+   if (size < 6 || Get16(data) != 0 || (Get16(data + 2) != 1 && Get16(data + 2) != 2))
+      return false;
+   size_t cnt = Get16(data + 4);
+   if (!cnt || 6 + cnt * entrySize > size)
+      return false;
+   entries.resize(cnt);
+   for (size_t i = 0; i < cnt; i++)
+   {
+      const unsigned char *p = data + 6 + i * entrySize;
+      tIconDirEntry& e = entries[i];
+      // Zero width means 256, an unset depth is derived from the number of colors
+      e.size = p[0] ? p[0] : 256;
+      e.bitCount = Get16(p + 6) ? Get16(p + 6) : p[2] == 2 ? 1 : p[2] == 16 ? 4 : p[2] ? 8 : 32;
+      e.bytes = Get32(p + 8);
+      e.location = entrySize == 16 ? Get32(p + 12) : Get16(p + 12);
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------------
+// PE resources
+
+typedef struct {
+   const unsigned char *data;       // File contents
+   size_t size;                     // File size
+   const unsigned char *sections;   // Section table
+   unsigned int sectionCount;       // Number of sections
+   size_t rsrcOffset;               // File offset of the resource directory
+   size_t rsrcSize;                 // Size of the resource directory data within the file
+} tPeFile;
+
+static bool RvaToOffset(const tPeFile& pe, unsigned int rva, size_t *offset, size_t *avail)
+{
+   // Map a relative virtual address to a file offset and the number of bytes available there
+   for (unsigned int i = 0; i < pe.sectionCount; i++)
+   {
+      const unsigned char *s = pe.sections + i * 40;
+      unsigned int va = Get32(s + 12), rawSize = Get32(s + 16), rawPtr = Get32(s + 20);
+      if (rva >= va && rva - va < rawSize && rawPtr + (size_t)(rva - va) < pe.size)
+      {
+         *offset = rawPtr + (size_t)(rva - va);
+         *avail = rawSize - (rva - va);
+         if (*avail > pe.size - *offset)
+            *avail = pe.size - *offset;
+         return true;
+      }
+   }
+   return false;
+}
+
+//--------------------------------------------------------------------------
+
+static bool OpenPeFile(const unsigned char *data, size_t size, tPeFile& pe)
+{
+   // Locate the section table and the resource directory of a PE file
+   if (size < 64 || data[0] != 'M' || data[1] != 'Z')
+      return false;
+   size_t pos = Get32(data + 0x3C);
+   if (pos > size - 24 || memcmp(data + pos, "PE\0\0", 4))
+      return false;
+   unsigned int sectionCount = Get16(data + pos + 6), optSize = Get16(data + pos + 20);
+   size_t opt = pos + 24;
+   if (optSize > size - opt || (size - opt - optSize) / 40 < sectionCount || optSize < 2)
+      return false;
+   unsigned int magic = Get16(data + opt);
+   size_t dirCountPos = magic == 0x20B ? 108 : magic == 0x10B ? 92 : 0;
+   if (!dirCountPos || optSize < dirCountPos + 4 + (DATA_DIR_RESOURCE + 1) * 8 || Get32(data + opt + dirCountPos) <= DATA_DIR_RESOURCE)
+      return false;
+   const unsigned char *dir = data + opt + dirCountPos + 4 + DATA_DIR_RESOURCE * 8;
+   pe.data = data;
+   pe.size = size;
+   pe.sections = data + opt + optSize;
+   pe.sectionCount = sectionCount;
+   size_t avail;
+   if (!Get32(dir + 4) || !RvaToOffset(pe, Get32(dir), &pe.rsrcOffset, &avail))
+      return false;
+   pe.rsrcSize = Get32(dir + 4) < avail ? Get32(dir + 4) : avail;
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+static bool GetResourceDir(const tPeFile& pe, unsigned int dir, const unsigned char **entries, unsigned int *count)
+{
+   // Entries of a resource directory at an offset within the resource section
+   if (dir > pe.rsrcSize || pe.rsrcSize - dir < 16)
+      return false;
+   const unsigned char *p = pe.data + pe.rsrcOffset + dir;
+   *count = Get16(p + 12) + Get16(p + 14);
+   if ((pe.rsrcSize - dir - 16) / 8 < *count)
+      return false;
+   *entries = p + 16;
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+static bool FindPeResource(const tPeFile& pe, unsigned int type, int id, int pos, const unsigned char **res, size_t *resSize)
+{
+   // Find a resource of a type by id, or by its position among the resources of the
+   // type when the id is negative. The first language is used.
+   const unsigned char *entries;
+   unsigned int count, dir = 0, i;
+   if (!GetResourceDir(pe, 0, &entries, &count))
+      return false;
+   for (i = 0; i < count && Get32(entries + i * 8) != type; i++);
+   if (i == count || !(Get32(entries + i * 8 + 4) & 0x80000000))
+      return false;
+   dir = Get32(entries + i * 8 + 4) & 0x7FFFFFFF;
+
+   // Name level
+   if (!GetResourceDir(pe, dir, &entries, &count))
+      return false;
+   if (id >= 0)
+      for (i = 0; i < count && Get32(entries + i * 8) != (unsigned int)id; i++);
+   else
+      i = (unsigned int)pos;
+   if (i >= count || !(Get32(entries + i * 8 + 4) & 0x80000000))
+      return false;
+   dir = Get32(entries + i * 8 + 4) & 0x7FFFFFFF;
+
+   // Language level
+   if (!GetResourceDir(pe, dir, &entries, &count) || !count || (Get32(entries + 4) & 0x80000000))
+      return false;
+   unsigned int dataEntry = Get32(entries + 4);
+   if (dataEntry > pe.rsrcSize || pe.rsrcSize - dataEntry < 16)
+      return false;
+   const unsigned char *p = pe.data + pe.rsrcOffset + dataEntry;
+   size_t offset, avail;
+   if (!RvaToOffset(pe, Get32(p), &offset, &avail) || Get32(p + 4) > avail)
+      return false;
+   *res = pe.data + offset;
+   *resSize = Get32(p + 4);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+bool DecodeFileIcon(const unsigned char *data, size_t size, int index, int wantSize, tIconImage& image)
+{
+   // Decode the image best matching the wanted size of an icon in an icon file or
+   // PE file. As for ExtractIconEx, the index is the position of the icon in a PE
+   // file, or the negated resource id if negative. Icon files have only index 0.
+   std::vector<tIconDirEntry> entries;
+   tPeFile pe;
+   if (OpenPeFile(data, size, pe))
+   {
+      const unsigned char *group;
+      size_t groupSize;
+      if (!FindPeResource(pe, RT_GROUP_ICON_TYPE, index < 0 ? -index : -1, index, &group, &groupSize) ||
+          !ReadIconDir(group, groupSize, 14, entries))
+         return false;
+      int best = PickIcon(entries, wantSize);
+      const unsigned char *res;
+      size_t resSize;
+      return FindPeResource(pe, RT_ICON_TYPE, entries[best].location, 0, &res, &resSize) &&
+             DecodeIconImage(res, resSize, image);
+   }
+   if (index != 0 || !ReadIconDir(data, size, 16, entries))
+      return false;
+   const tIconDirEntry& e = entries[PickIcon(entries, wantSize)];
+   if (e.location > size || e.bytes > size - e.location)
+      return false;
+   return DecodeIconImage(data + e.location, e.bytes, image);
+}
+
+//--------------------------------------------------------------------------
+
+void ScaleIconImage(const tIconImage& src, int size, tIconImage& dst)
+{
+   // Resample to a square image with a Lanczos filter, keeping the image when the
+   // size already matches
+   if (src.width == size && src.height == size)
+   {
+      if (&dst != &src)
+         dst = src;
+      return;
+   }
+   std::vector<unsigned int> pixels((size_t)size * size);
+   ScalePixels(&src.pixels[0], src.width, src.height, &pixels[0], size, size, eScaleLanczos);
+   dst.width = dst.height = size;
+   dst.pixels.swap(pixels);
+}
+
+//--------------------------------------------------------------------------
+
+void UnpremultiplyPixels(unsigned int *pixels, size_t count)
+{
+   // Convert premultiplied pixels to straight alpha, as used by icon bitmaps
+   for (size_t i = 0; i < count; i++)
+   {
+      unsigned int a = pixels[i] >> 24, p = pixels[i] & 0xFF000000;
+      if (a == 0 || a == 255)
+      {
+         if (a == 0)
+            pixels[i] = 0;
+         continue;
+      }
+      for (int c = 0; c < 24; c += 8)
+      {
+         unsigned int v = (((pixels[i] >> c) & 0xFF) * 255 + a / 2) / a;
+         p |= (v > 255 ? 255 : v) << c;
+      }
+      pixels[i] = p;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+#ifdef _WIN32
+#include "iconstore.h"
+
+#define MAX_ICON_FILE_SIZE (256*1024*1024)
+
+HICON DecodeLocationIcon(LPCTSTR iconFile, int iconInd, int size)
+{
+   // Create an icon of the specified size from an icon location by decoding a
+   // mapping of the file, NULL if not decodable
+   HICON hIcon = NULL;
+   HANDLE hFile = CreateFile(iconFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                             OPEN_EXISTING, 0, NULL);
+   if (hFile == INVALID_HANDLE_VALUE)
+      return NULL;
+   LARGE_INTEGER fileSize;
+   if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart < MAX_ICON_FILE_SIZE)
+   {
+      HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (hMap)
+      {
+         const unsigned char *data = (const unsigned char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+         if (data)
+         {
+            tIconImage image;
+            if (DecodeFileIcon(data, (size_t)fileSize.QuadPart, iconInd, size, image))
+            {
+               ScaleIconImage(image, size, image);
+               UnpremultiplyPixels(&image.pixels[0], image.pixels.size());
+               hIcon = IconFromPixels(&image.pixels[0], size);
+            }
+            UnmapViewOfFile(data);
+         }
+         CloseHandle(hMap);
+      }
+   }
+   CloseHandle(hFile);
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL GetIconImage(HICON hIcon, tIconImage& image)
+{
+   // Get the premultiplied pixels of an icon at its own size. Icons without alpha
+   // channel get their transparency from the mask.
+   ICONINFO inf;
+   if (!GetIconInfo(hIcon, &inf))
+      return FALSE;
+   BITMAP bm;
+   BOOL ok = inf.hbmColor && GetObject(inf.hbmColor, sizeof(bm), &bm) && bm.bmWidth > 0 && bm.bmHeight > 0 &&
+             bm.bmWidth <= MAX_IMAGE_SIZE && bm.bmHeight <= MAX_IMAGE_SIZE;
+   if (ok)
+   {
+      BITMAPINFO bmi;
+      ZeroMemory(&bmi, sizeof(bmi));
+      bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+      bmi.bmiHeader.biWidth = bm.bmWidth;
+      bmi.bmiHeader.biHeight = -bm.bmHeight;
+      bmi.bmiHeader.biPlanes = 1;
+      bmi.bmiHeader.biBitCount = 32;
+      bmi.bmiHeader.biCompression = BI_RGB;
+      image.width = bm.bmWidth;
+      image.height = bm.bmHeight;
+      image.pixels.resize((size_t)bm.bmWidth * bm.bmHeight);
+      std::vector<unsigned int> mask(image.pixels.size());
+      HDC hDC = GetDC(NULL);
+      ok = GetDIBits(hDC, inf.hbmColor, 0, bm.bmHeight, &image.pixels[0], &bmi, DIB_RGB_COLORS) == bm.bmHeight &&
+           GetDIBits(hDC, inf.hbmMask, 0, bm.bmHeight, &mask[0], &bmi, DIB_RGB_COLORS) == bm.bmHeight;
+      ReleaseDC(NULL, hDC);
+
+      bool hasAlpha = false;
+      size_t i;
+      for (i = 0; i < image.pixels.size() && !hasAlpha; i++)
+         hasAlpha = (image.pixels[i] >> 24) != 0;
+      for (i = 0; ok && !hasAlpha && i < image.pixels.size(); i++)
+         image.pixels[i] = (image.pixels[i] & 0xFFFFFF) | ((mask[i] & 0xFFFFFF) ? 0 : 0xFF000000);
+      if (ok)
+         PremultiplyPixels(&image.pixels[0], image.pixels.size());
+   }
+   if (inf.hbmColor)
+      DeleteObject(inf.hbmColor);
+   if (inf.hbmMask)
+      DeleteObject(inf.hbmMask);
+   return ok;
+}
+#endif
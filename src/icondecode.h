@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// icondecode.h
+// Decoder of icons stored in icon (.ico) files and in the resources of
+// executables and libraries (PE files). BMP and PNG icon images are
+// decoded to 32 bit premultiplied ARGB pixels. Only standard C++ is used,
+// the caller provides the file contents, e.g. through a memory mapping.
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+// Decoded icon image
+typedef struct {
+   int width;                          // Width in pixels
+   int height;                         // Height in pixels
+   std::vector<unsigned int> pixels;   // Top down rows of premultiplied 0xAARRGGBB pixels
+} tIconImage;
+
+bool DecodeFileIcon(const unsigned char *data, size_t size, int index, int wantSize, tIconImage& image);
+bool DecodeIconImage(const unsigned char *data, size_t size, tIconImage& image);
+void ScaleIconImage(const tIconImage& src, int size, tIconImage& dst);
+void UnpremultiplyPixels(unsigned int *pixels, size_t count);
+
+#ifdef _WIN32
+#include <windows.h>
+
+HICON DecodeLocationIcon(LPCTSTR iconFile, int iconInd, int size);
+BOOL GetIconImage(HICON hIcon, tIconImage& image);
+#endif
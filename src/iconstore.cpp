@@ -0,0 +1,657 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// iconstore.cpp
+// Persistent icon store.
+//
+// The store file has the following layout, all fields being 32 bit
+// little endian and all parts 8 byte aligned:
+//
+//    tStoreHeader
+//    tStoreEntry[entryCnt]    Sorted by key hash, key and size
+//    tStoreBlob[blobCnt]      Pixel blocks, shared by entries with identical pixels
+//    char keys[keyBytes]      Keys referred by offset and length
+//    pixels                   size*size 32 bit ARGB values per blob, top row first
+//
+// The header checksum covers the tables and keys. The pixels are checked
+// against the blob hash when first used, so loading doesn't need to read
+// the whole file. Icons added during the session are kept in memory. The
+// store is rebuilt when saved: unused, stale and duplicate data is
+// dropped and the least recently used icons are left out to keep within
+// the size limit.
+//
+
+#include <string.h>
+#include <map>
+#include <algorithm>
+
+#include "iconstore.h"
+
+#define STORE_MAGIC 0x4349424C      // "LBIC"
+#define STORE_VERSION 1
+#define MAX_ICON_SIZE 256
+#define KEEP_SESSIONS 32            // Sessions an icon is kept without being used
+
+typedef struct {
+   unsigned int magic;        // STORE_MAGIC
+   unsigned int version;      // STORE_VERSION
+   unsigned int entryCnt;     // Number of entries
+   unsigned int blobCnt;      // Number of pixel blobs
+   unsigned int keyBytes;     // Size of the key section
+   unsigned int session;      // Incremented each time the store is saved
+   unsigned int fileSize;     // Total size of the file
+   unsigned int checksum;     // Checksum of the tables and keys
+} tStoreHeader;
+
+typedef struct {
+   unsigned int hash;         // Key hash
+   unsigned int keyOff;       // Key location
+   unsigned int keyLen;
+   unsigned int size;         // Icon width and height
+   unsigned int modTimeLo;    // Modification time of the icon source
+   unsigned int modTimeHi;
+   unsigned int blob;         // Pixel blob
+   unsigned int session;      // Session when last used
+} tStoreEntry;
+
+typedef struct {
+   unsigned int offset;       // Offset of the pixels in the file
+   unsigned int size;         // Icon width and height
+   unsigned int hashLo;       // Hash of the pixels
+   unsigned int hashHi;
+} tStoreBlob;
+
+// Icon added during the session
+typedef struct {
+   unsigned long long modTime;
+   std::vector<unsigned int> pixels;
+   unsigned long long hash;
+} tNewIcon;
+
+typedef std::pair<std::string, unsigned int> tIconKey;   // Key and size
+
+const unsigned char *gStoreData = NULL;   // Attached store image
+size_t gStoreSize = 0;
+std::vector<char> gEntryUsed;             // Mapped entries used during the session
+std::vector<char> gBlobChecked;           // Mapped blobs verified, 2 if found corrupt
+std::map<tIconKey, tNewIcon> gNewIcons;
+bool gStoreChanged = false;
+
+#define STORE_HEADER ((const tStoreHeader*)gStoreData)
+#define STORE_ENTRIES ((const tStoreEntry*)(gStoreData + sizeof(tStoreHeader)))
+#define STORE_BLOBS ((const tStoreBlob*)(STORE_ENTRIES + STORE_HEADER->entryCnt))
+#define STORE_KEYS ((const char*)(STORE_BLOBS + STORE_HEADER->blobCnt))
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+//--------------------------------------------------------------------------
+
+static unsigned int KeyHash(const char *key, size_t len)
+{
+   // FNV-1a
+   unsigned int hash = 2166136261U;
+   for (size_t i = 0; i < len; i++)
+   {
+      hash ^= (unsigned char)key[i];
+      hash *= 16777619U;
+   }
+   return hash;
+}
+
+static unsigned long long PixelHash(const unsigned int *pixels, unsigned int size)
+{
+   // 64 bit FNV-1a of the pixel values
+   unsigned long long hash = 14695981039346656037ULL;
+   const unsigned char *p = (const unsigned char*)pixels;
+   for (size_t i = 0; i < (size_t)size*size*4; i++)
+   {
+      hash ^= p[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+static int CompareEntry(unsigned int hash, const char *key, size_t keyLen, unsigned int size, const tStoreEntry& entry)
+{
+   // Order of the entries: hash, key and size
+   if (hash != entry.hash)
+      return hash < entry.hash ? -1 : 1;
+   int res = memcmp(key, STORE_KEYS + entry.keyOff, std::min((size_t)entry.keyLen, keyLen));
+   if (res)
+      return res;
+   if (keyLen != entry.keyLen)
+      return keyLen < entry.keyLen ? -1 : 1;
+   if (size != entry.size)
+      return size < entry.size ? -1 : 1;
+   return 0;
+}
+
+//--------------------------------------------------------------------------
+
+static bool ValidateStore(const unsigned char *data, size_t size)
+{
+   // Check that the store image is complete and consistent
+   if (size < sizeof(tStoreHeader))
+      return false;
+   const tStoreHeader *head = (const tStoreHeader*)data;
+   if (head->magic != STORE_MAGIC || head->version != STORE_VERSION || head->fileSize != size ||
+       head->entryCnt > size / sizeof(tStoreEntry) || head->blobCnt > size / sizeof(tStoreBlob))
+      return false;
+   size_t tables = sizeof(tStoreHeader) + head->entryCnt*sizeof(tStoreEntry) + head->blobCnt*sizeof(tStoreBlob);
+   if (tables + head->keyBytes > size ||
+       KeyHash((const char*)data + sizeof(tStoreHeader), tables - sizeof(tStoreHeader) + head->keyBytes) != head->checksum)
+      return false;
+
+   const tStoreEntry *entries = (const tStoreEntry*)(data + sizeof(tStoreHeader));
+   const tStoreBlob *blobs = (const tStoreBlob*)(entries + head->entryCnt);
+   unsigned int i;
+   for (i = 0; i < head->blobCnt; i++)
+      if (blobs[i].size == 0 || blobs[i].size > MAX_ICON_SIZE || blobs[i].offset % 4 ||
+          blobs[i].offset < tables + head->keyBytes || blobs[i].offset > size ||
+          (size_t)blobs[i].size*blobs[i].size*4 > size - blobs[i].offset)
+         return false;
+   for (i = 0; i < head->entryCnt; i++)
+      if (entries[i].blob >= head->blobCnt || entries[i].size != blobs[entries[i].blob].size ||
+          entries[i].keyOff > head->keyBytes || entries[i].keyLen > head->keyBytes - entries[i].keyOff)
+         return false;
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+bool AttachIconStore(const unsigned char *data, size_t size)
+{
+   // Use a store image, normally a mapping of the store file. The image must stay
+   // available until detached. An invalid image is ignored.
+   DetachIconStore();
+   if (!data || !ValidateStore(data, size))
+      return false;
+   gStoreData = data;
+   gStoreSize = size;
+   gEntryUsed.assign(STORE_HEADER->entryCnt, 0);
+   gBlobChecked.assign(STORE_HEADER->blobCnt, 0);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+void DetachIconStore()
+{
+   // Stop using the store image, the icons added during the session are kept
+   gStoreData = NULL;
+   gStoreSize = 0;
+   gEntryUsed.clear();
+   gBlobChecked.clear();
+}
+
+//--------------------------------------------------------------------------
+
+const unsigned int *FindStoredIcon(const std::string& key, unsigned long long modTime, unsigned int size,
+                                   unsigned long long *pixelHash)
+{
+   // Get the pixels of an icon, NULL if not stored or stored for another modification time.
+   // The pixels remain valid until the store is detached or rebuilt.
+   std::map<tIconKey, tNewIcon>::iterator it = gNewIcons.find(tIconKey(key, size));
+   if (it != gNewIcons.end())
+   {
+      if (it->second.modTime != modTime)
+         return NULL;
+      if (pixelHash)
+         *pixelHash = it->second.hash;
+      return &it->second.pixels[0];
+   }
+   if (!gStoreData)
+      return NULL;
+
+   // Binary search of the sorted entries
+   unsigned int hash = KeyHash(key.data(), key.size());
+   int low = 0, high = (int)STORE_HEADER->entryCnt - 1;
+   while (low <= high)
+   {
+      int mid = (low + high) / 2;
+      const tStoreEntry& entry = STORE_ENTRIES[mid];
+      int res = CompareEntry(hash, key.data(), key.size(), size, entry);
+      if (res < 0)
+         high = mid - 1;
+      else if (res > 0)
+         low = mid + 1;
+      else
+      {
+         if ((entry.modTimeLo | ((unsigned long long)entry.modTimeHi << 32)) != modTime)
+            return NULL;
+         const tStoreBlob& blob = STORE_BLOBS[entry.blob];
+         const unsigned int *pixels = (const unsigned int*)(gStoreData + blob.offset);
+         unsigned long long blobHash = blob.hashLo | ((unsigned long long)blob.hashHi << 32);
+         if (!gBlobChecked[entry.blob])
+            gBlobChecked[entry.blob] = PixelHash(pixels, blob.size) == blobHash ? 1 : 2;
+         if (gBlobChecked[entry.blob] != 1)
+            // Corrupt
+            return NULL;
+         gEntryUsed[mid] = 1;
+         if (pixelHash)
+            *pixelHash = blobHash;
+         return pixels;
+      }
+   }
+   return NULL;
+}
+
+//--------------------------------------------------------------------------
+
+void AddStoredIcon(const std::string& key, unsigned long long modTime, unsigned int size, const unsigned int *pixels)
+{
+   // Add or replace an icon, written when the store is rebuilt
+   if (size == 0 || size > MAX_ICON_SIZE)
+      return;
+   tNewIcon& icon = gNewIcons[tIconKey(key, size)];
+   icon.modTime = modTime;
+   icon.pixels.assign(pixels, pixels + size*size);
+   icon.hash = PixelHash(pixels, size);
+   gStoreChanged = true;
+}
+
+//--------------------------------------------------------------------------
+
+bool IconStoreChanged()
+{
+   // Check if the store needs to be rebuilt
+   return gStoreChanged;
+}
+
+//--------------------------------------------------------------------------
+
+void ClearAddedIcons()
+{
+   // Drop the icons added during the session once they have been written
+   gNewIcons.clear();
+   gStoreChanged = false;
+}
+
+//--------------------------------------------------------------------------
+
+// Icon to be written
+typedef struct {
+   const std::string *key;
+   unsigned int hash;
+   unsigned int size;
+   unsigned long long modTime;
+   const unsigned int *pixels;
+   unsigned long long pixelHash;
+   unsigned int session;
+} tBuildIcon;
+
+static bool BuildOrder(const tBuildIcon& first, const tBuildIcon& second)
+{
+   // Entry table order
+   if (first.hash != second.hash)
+      return first.hash < second.hash;
+   if (*first.key != *second.key)
+      return *first.key < *second.key;
+   return first.size < second.size;
+}
+
+static bool RecentFirst(const tBuildIcon *first, const tBuildIcon *second)
+{
+   return first->session > second->session;
+}
+
+bool BuildIconStore(std::vector<unsigned char>& image, size_t maxBytes)
+{
+   // Build a new store image from the used and recently used stored icons and the
+   // icons added, within the specified size if not zero
+   unsigned int session = gStoreData ? STORE_HEADER->session + 1 : 1;
+   std::vector<std::string> keys;
+   std::vector<tBuildIcon> icons;
+   keys.reserve(gNewIcons.size() + (gStoreData ? STORE_HEADER->entryCnt : 0));
+
+   std::map<tIconKey, tNewIcon>::iterator it;
+   for (it = gNewIcons.begin(); it != gNewIcons.end(); ++it)
+   {
+      keys.push_back(it->first.first);
+      tBuildIcon icon = {NULL, 0, it->first.second, it->second.modTime, &it->second.pixels[0], it->second.hash, session};
+      icons.push_back(icon);
+   }
+   unsigned int i;
+   if (gStoreData)
+   {
+      for (i = 0; i < STORE_HEADER->entryCnt; i++)
+      {
+         const tStoreEntry& entry = STORE_ENTRIES[i];
+         std::string key(STORE_KEYS + entry.keyOff, entry.keyLen);
+         unsigned int lastUse = gEntryUsed[i] ? session : entry.session;
+         if (session - lastUse > KEEP_SESSIONS || gNewIcons.find(tIconKey(key, entry.size)) != gNewIcons.end())
+            // Unused for long or replaced
+            continue;
+         const tStoreBlob& blob = STORE_BLOBS[entry.blob];
+         const unsigned int *pixels = (const unsigned int*)(gStoreData + blob.offset);
+         unsigned long long blobHash = blob.hashLo | ((unsigned long long)blob.hashHi << 32);
+         if (!gBlobChecked[entry.blob])
+            gBlobChecked[entry.blob] = PixelHash(pixels, blob.size) == blobHash ? 1 : 2;
+         if (gBlobChecked[entry.blob] != 1)
+            continue;
+         keys.push_back(key);
+         tBuildIcon icon = {NULL, 0, entry.size, entry.modTimeLo | ((unsigned long long)entry.modTimeHi << 32),
+                            pixels, blobHash, lastUse};
+         icons.push_back(icon);
+      }
+   }
+   for (i = 0; i < icons.size(); i++)
+   {
+      icons[i].key = &keys[i];
+      icons[i].hash = KeyHash(keys[i].data(), keys[i].size());
+   }
+
+   // Keep the most recently used icons within the size limit, identical pixels are stored once
+   std::vector<tBuildIcon*> recent(icons.size());
+   for (i = 0; i < icons.size(); i++)
+      recent[i] = &icons[i];
+   std::stable_sort(recent.begin(), recent.end(), RecentFirst);
+   std::map<std::pair<unsigned long long, unsigned int>, unsigned int> blobIds;
+   std::vector<tBuildIcon*> blobIcons;
+   std::vector<tBuildIcon> kept;
+   size_t total = sizeof(tStoreHeader);
+   for (i = 0; i < recent.size(); i++)
+   {
+      tBuildIcon& icon = *recent[i];
+      bool newBlob = blobIds.find(std::make_pair(icon.pixelHash, icon.size)) == blobIds.end();
+      size_t bytes = sizeof(tStoreEntry) + icon.key->size() + 8 +
+                     (newBlob ? sizeof(tStoreBlob) + (size_t)icon.size*icon.size*4 : 0);
+      if (maxBytes && total + bytes > maxBytes)
+         continue;
+      total += bytes;
+      if (newBlob)
+      {
+         blobIds[std::make_pair(icon.pixelHash, icon.size)] = (unsigned int)blobIcons.size();
+         blobIcons.push_back(&icon);
+      }
+      kept.push_back(icon);
+   }
+   std::sort(kept.begin(), kept.end(), BuildOrder);
+
+   // Lay out the image
+   tStoreHeader head;
+   head.magic = STORE_MAGIC;
+   head.version = STORE_VERSION;
+   head.entryCnt = (unsigned int)kept.size();
+   head.blobCnt = (unsigned int)blobIcons.size();
+   head.keyBytes = 0;
+   for (i = 0; i < kept.size(); i++)
+      head.keyBytes += (unsigned int)kept[i].key->size();
+   head.keyBytes = (unsigned int)ALIGN8(head.keyBytes);
+   head.session = session;
+   size_t entryOff = sizeof(tStoreHeader),
+          blobOff = entryOff + kept.size()*sizeof(tStoreEntry),
+          keyOff = blobOff + blobIcons.size()*sizeof(tStoreBlob),
+          pixelOff = keyOff + head.keyBytes,
+          size = pixelOff;
+   for (i = 0; i < blobIcons.size(); i++)
+      size += (size_t)blobIcons[i]->size*blobIcons[i]->size*4;
+   head.fileSize = (unsigned int)size;
+   image.assign(size, 0);
+
+   unsigned int keyPos = 0;
+   for (i = 0; i < kept.size(); i++)
+   {
+      tStoreEntry entry;
+      entry.hash = kept[i].hash;
+      entry.keyOff = keyPos;
+      entry.keyLen = (unsigned int)kept[i].key->size();
+      entry.size = kept[i].size;
+      entry.modTimeLo = (unsigned int)kept[i].modTime;
+      entry.modTimeHi = (unsigned int)(kept[i].modTime >> 32);
+      entry.blob = blobIds[std::make_pair(kept[i].pixelHash, kept[i].size)];
+      entry.session = kept[i].session;
+      memcpy(&image[entryOff + i*sizeof(tStoreEntry)], &entry, sizeof(entry));
+      if (entry.keyLen)
+         memcpy(&image[keyOff + keyPos], kept[i].key->data(), entry.keyLen);
+      keyPos += entry.keyLen;
+   }
+   size_t pos = pixelOff;
+   for (i = 0; i < blobIcons.size(); i++)
+   {
+      tStoreBlob blob;
+      blob.offset = (unsigned int)pos;
+      blob.size = blobIcons[i]->size;
+      blob.hashLo = (unsigned int)blobIcons[i]->pixelHash;
+      blob.hashHi = (unsigned int)(blobIcons[i]->pixelHash >> 32);
+      memcpy(&image[blobOff + i*sizeof(tStoreBlob)], &blob, sizeof(blob));
+      memcpy(&image[pos], blobIcons[i]->pixels, (size_t)blob.size*blob.size*4);
+      pos += (size_t)blob.size*blob.size*4;
+   }
+   head.checksum = KeyHash((const char*)&image[entryOff], pixelOff - entryOff);
+   memcpy(&image[0], &head, sizeof(head));
+   return true;
+}
+
+#ifdef _WIN32
+//--------------------------------------------------------------------------
+// Store file and icon handle conversion
+
+#include <tchar.h>
+
+#include "resource.h"
+#include "utils.h"
+
+CRITICAL_SECTION gStoreLock;
+BOOL gStoreLockInit = (InitializeCriticalSection(&gStoreLock), TRUE);
+CString gStoreFile(EMPTY_STR);               // Empty when the store is not used
+HANDLE gStoreFileHand = INVALID_HANDLE_VALUE,
+       gStoreMapHand = NULL;
+const BYTE *gStoreView = NULL;
+
+//--------------------------------------------------------------------------
+
+void UnmapIconStore()
+{
+   DetachIconStore();
+   if (gStoreView)
+      UnmapViewOfFile(gStoreView);
+   if (gStoreMapHand)
+      CloseHandle(gStoreMapHand);
+   if (gStoreFileHand != INVALID_HANDLE_VALUE)
+      CloseHandle(gStoreFileHand);
+   gStoreView = NULL;
+   gStoreMapHand = NULL;
+   gStoreFileHand = INVALID_HANDLE_VALUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL MapIconStore()
+{
+   // Map the store file, a missing or corrupt file is ignored
+   gStoreFileHand = CreateFile(gStoreFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   if (gStoreFileHand == INVALID_HANDLE_VALUE)
+      return FALSE;
+   DWORD fileSize = GetFileSize(gStoreFileHand, NULL);
+   BOOL ok = fileSize != INVALID_FILE_SIZE && fileSize > 0;
+   ok = ok && (gStoreMapHand = CreateFileMapping(gStoreFileHand, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL;
+   ok = ok && (gStoreView = (const BYTE*)MapViewOfFile(gStoreMapHand, FILE_MAP_READ, 0, 0, 0)) != NULL;
+   ok = ok && AttachIconStore(gStoreView, fileSize);
+   if (!ok)
+      UnmapIconStore();
+   return ok;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL LoadIconStore(LPCTSTR fileName)
+{
+   // Start using the store file, icons are only stored when loaded
+   EnterCriticalSection(&gStoreLock);
+   UnmapIconStore();
+   gStoreFile = fileName;
+   BOOL ok = MapIconStore();
+   LeaveCriticalSection(&gStoreLock);
+   return ok;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL SaveIconStore(DWORD maxBytes)
+{
+   // Write the store file if icons were added, limited to the specified size
+   EnterCriticalSection(&gStoreLock);
+   if (gStoreFile.IsEmpty() || !IconStoreChanged())
+   {
+      LeaveCriticalSection(&gStoreLock);
+      return TRUE;
+   }
+   std::vector<unsigned char> image;
+   BuildIconStore(image, maxBytes);
+
+   // The mapped file can't be replaced
+   UnmapIconStore();
+   ClearAddedIcons();
+
+   CString tmpFile = gStoreFile + _T(".tmp");
+   CreateDirectory(GetFileNameComp(gStoreFile, eFcDrive | eFcDir), NULL);
+   HANDLE hFile = CreateFile(tmpFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+   BOOL ok = hFile != INVALID_HANDLE_VALUE;
+   DWORD written;
+   ok = ok && WriteFile(hFile, &image[0], (DWORD)image.size(), &written, NULL) && written == image.size();
+   if (hFile != INVALID_HANDLE_VALUE)
+      CloseHandle(hFile);
+   ok = ok && MoveFileEx(tmpFile, gStoreFile, MOVEFILE_REPLACE_EXISTING);
+   if (!ok)
+      DeleteFile(tmpFile);
+   MapIconStore();
+   LeaveCriticalSection(&gStoreLock);
+   return ok;
+}
+
+//--------------------------------------------------------------------------
+
+std::string StoreKey(LPCTSTR location)
+{
+   // Case insensitive UTF-8 key of an icon location
+   CStringW key(location);
+   key.MakeUpper();
+   int len = WideCharToMultiByte(CP_UTF8, 0, key, key.GetLength(), NULL, 0, NULL, NULL);
+   std::string res(len, 0);
+   if (len > 0)
+      WideCharToMultiByte(CP_UTF8, 0, key, key.GetLength(), &res[0], len, NULL, NULL);
+   return res;
+}
+
+#define FILE_TIME_64(ft) ((ft).dwLowDateTime | ((unsigned long long)(ft).dwHighDateTime << 32))
+
+//--------------------------------------------------------------------------
+
+BOOL GetStoredPixels(LPCTSTR location, const FILETIME& modTime, int size, std::vector<unsigned int>& pixels,
+                     unsigned long long *pixelHash)
+{
+   // Get the stored pixels of an icon, copied from the mapped store file while locked
+   // as the file may be remapped or unmapped afterwards. FALSE if not stored for the
+   // current modification time of the icon source.
+   const unsigned int *found = NULL;
+   EnterCriticalSection(&gStoreLock);
+   if (!gStoreFile.IsEmpty())
+      found = FindStoredIcon(StoreKey(location), FILE_TIME_64(modTime), size, pixelHash);
+   if (found)
+      pixels.assign(found, found + size*size);
+   LeaveCriticalSection(&gStoreLock);
+   return found != NULL;
+}
+
+//--------------------------------------------------------------------------
+
+HICON IconFromPixels(const unsigned int *pixels, int size)
+{
+   // Create an icon from 32 bit ARGB pixels, the alpha channel defines the transparency
+   std::vector<BYTE> mask(((size + 15) / 16) * 2 * size, 0);
+   ICONINFO inf;
+   inf.fIcon = TRUE;
+   inf.xHotspot = inf.yHotspot = 0;
+   inf.hbmColor = CreateBitmap(size, size, 1, 32, pixels);
+   inf.hbmMask = CreateBitmap(size, size, 1, 1, &mask[0]);
+   HICON hIcon = inf.hbmColor && inf.hbmMask ? CreateIconIndirect(&inf) : NULL;
+   if (inf.hbmColor)
+      DeleteObject(inf.hbmColor);
+   if (inf.hbmMask)
+      DeleteObject(inf.hbmMask);
+   return hIcon;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL GetBitmapPixels(HDC hDC, HBITMAP hBitmap, int size, unsigned int *pixels)
+{
+   // Get the pixels of a bitmap as 32 bit top down rows
+   BITMAPINFO bmi;
+   ZeroMemory(&bmi, sizeof(bmi));
+   bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+   bmi.bmiHeader.biWidth = size;
+   bmi.bmiHeader.biHeight = -size;
+   bmi.bmiHeader.biPlanes = 1;
+   bmi.bmiHeader.biBitCount = 32;
+   bmi.bmiHeader.biCompression = BI_RGB;
+   return GetDIBits(hDC, hBitmap, 0, size, pixels, &bmi, DIB_RGB_COLORS) == size;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL StoreIcon(LPCTSTR location, const FILETIME& modTime, int size, HICON hIcon)
+{
+   // Add the pixels of an icon to the store
+   if (gStoreFile.IsEmpty() || !hIcon)
+      return FALSE;
+   ICONINFO inf;
+   if (!GetIconInfo(hIcon, &inf))
+      return FALSE;
+   BITMAP bm;
+   BOOL ok = inf.hbmColor && GetObject(inf.hbmColor, sizeof(bm), &bm) && bm.bmWidth == size && bm.bmHeight == size;
+   std::vector<unsigned int> pixels(size*size);
+   HDC hDC = GetDC(NULL);
+   ok = ok && GetBitmapPixels(hDC, inf.hbmColor, size, &pixels[0]);
+   if (ok)
+   {
+      // Icons without alpha channel get their transparency from the mask
+      int i;
+      BOOL hasAlpha = FALSE;
+      for (i = 0; i < size*size && !hasAlpha; i++)
+         hasAlpha = (pixels[i] & 0xFF000000) != 0;
+      if (!hasAlpha)
+      {
+         std::vector<unsigned int> mask(size*size);
+         ok = GetBitmapPixels(hDC, inf.hbmMask, size, &mask[0]);
+         for (i = 0; ok && i < size*size; i++)
+            if (!(mask[i] & 0xFFFFFF))
+               pixels[i] |= 0xFF000000;
+            else
+               pixels[i] = 0;
+      }
+   }
+   ReleaseDC(NULL, hDC);
+   if (inf.hbmColor)
+      DeleteObject(inf.hbmColor);
+   if (inf.hbmMask)
+      DeleteObject(inf.hbmMask);
+
+   if (ok)
+   {
+      EnterCriticalSection(&gStoreLock);
+      AddStoredIcon(StoreKey(location), FILE_TIME_64(modTime), size, &pixels[0]);
+      LeaveCriticalSection(&gStoreLock);
+   }
+   return ok;
+}
+#endif
@@ -0,0 +1,50 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// iconstore.h
+// Persistent store of decoded icon bitmaps, keyed by icon location, source
+// modification time and size. The store file is used through a read only
+// memory mapping, the pixels of icons found are copied from the mapping.
+// The store format functions use only standard C++.
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+bool AttachIconStore(const unsigned char *data, size_t size);
+void DetachIconStore();
+const unsigned int *FindStoredIcon(const std::string& key, unsigned long long modTime, unsigned int size,
+                                   unsigned long long *pixelHash = NULL);
+void AddStoredIcon(const std::string& key, unsigned long long modTime, unsigned int size, const unsigned int *pixels);
+bool IconStoreChanged();
+void ClearAddedIcons();
+bool BuildIconStore(std::vector<unsigned char>& image, size_t maxBytes);
+
+#ifdef _WIN32
+#include <windows.h>
+
+BOOL LoadIconStore(LPCTSTR fileName);
+BOOL SaveIconStore(DWORD maxBytes);
+BOOL GetStoredPixels(LPCTSTR location, const FILETIME& modTime, int size, std::vector<unsigned int>& pixels,
+                     unsigned long long *pixelHash);
+HICON IconFromPixels(const unsigned int *pixels, int size);
+BOOL StoreIcon(LPCTSTR location, const FILETIME& modTime, int size, HICON hIcon);
+#endif
@@ -0,0 +1,224 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// layout.cpp
+// Toolbar geometry. The placement of each screen edge is a specialization
+// of the same template, so that the orientation tests are resolved at
+// compile time, and the queries only depend on whether the toolbar is
+// vertical.
+
+#include "layout.h"
+
+#define BASE_DPI 96
+#define FRAME_SIZE 1    // Width of the window frame
+
+// Properties of a screen edge
+template <tLayoutEdge edge> struct tEdgeTraits {
+   static const bool vertical = (edge == eEdgeLeft || edge == eEdgeRight);
+   static const bool farSide = (edge == eEdgeRight || edge == eEdgeBottom);
+};
+
+//--------------------------------------------------------------------------
+
+static int Scale(int size, int dpi)
+{
+   // Scale a size given for 96 DPI, rounding to the nearest pixel
+   return (size*dpi + BASE_DPI/2) / BASE_DPI;
+}
+
+//--------------------------------------------------------------------------
+
+static bool IsVertical(tLayoutEdge edge)
+{
+   // Tell whether the buttons are stacked vertically at a screen edge
+   return edge == eEdgeLeft || edge == eEdgeRight;
+}
+
+//--------------------------------------------------------------------------
+
+template <tLayoutEdge edge>
+static bool ComputeEdgeLayout(const tLayoutParams& params, const tLayoutRect& work, tLayout& layout)
+{
+   // Place the toolbar at one screen edge of a work area. The buttons are
+   // put in a single row or column as long as they fit along the edge,
+   // otherwise they are spread evenly over as few lines as needed.
+   typedef tEdgeTraits<edge> tTraits;
+   int dpi = params.dpi > 0 ? params.dpi : BASE_DPI;
+   layout.edge = edge;
+   layout.iconSize = Scale(params.iconSize, dpi);
+   layout.iconOffset = Scale(params.iconOffset, dpi);
+   layout.margin = Scale(params.margin, dpi);
+   layout.endSpace = Scale(params.endSpace, dpi);
+   layout.buttonSize = layout.iconSize + layout.iconOffset*2;
+   layout.count = params.count;
+
+   int gap = Scale(params.gap, dpi),
+       step = layout.buttonSize + gap,
+       ends = (layout.margin + layout.endSpace)*2,
+       space = tTraits::vertical ? work.bottom - work.top : work.right - work.left;
+   if (step <= 0)
+      return false;
+   unsigned int fit = space - ends > step ? (unsigned int)((space - ends) / step) : 1;
+   if (params.count <= fit)
+   {
+      layout.lines = 1;
+      layout.perLine = params.count;
+   }
+   else
+   {
+      layout.lines = (params.count + fit - 1) / fit;
+      layout.perLine = (params.count + layout.lines - 1) / layout.lines;
+   }
+
+   int length = ends + (int)layout.perLine*step,
+       thickness = layout.margin*2 + (int)layout.lines*step - gap + FRAME_SIZE*2,
+       along = tTraits::vertical ? work.top : work.left,
+       across = tTraits::farSide ? (tTraits::vertical ? work.right : work.bottom) - thickness :
+                                   (tTraits::vertical ? work.left : work.top);
+   if (params.center && space > length)
+      along += (space - length) / 2;
+   if (layout.perLine == 0)
+      layout.perLine = 1;
+
+   if (tTraits::vertical)
+   {
+      layout.window.left = across;
+      layout.window.right = across + thickness;
+      layout.window.top = along;
+      layout.window.bottom = along + length;
+   }
+   else
+   {
+      layout.window.left = along;
+      layout.window.right = along + length;
+      layout.window.top = across;
+      layout.window.bottom = across + thickness;
+   }
+
+   // The buttons of a toolbar at the right edge have always been one pixel
+   // further to the right
+   int first = layout.margin + layout.endSpace,
+       firstLine = layout.margin + (edge == eEdgeRight ? FRAME_SIZE : 0);
+   layout.xFirst = tTraits::vertical ? firstLine : first;
+   layout.yFirst = tTraits::vertical ? first : firstLine;
+   layout.xInc = tTraits::vertical ? 0 : step;
+   layout.yInc = tTraits::vertical ? step : 0;
+   layout.xLineInc = tTraits::vertical ? step : 0;
+   layout.yLineInc = tTraits::vertical ? 0 : step;
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+bool ComputeLayout(const tLayoutParams& params, tLayout& layout)
+{
+   // Compute the toolbar layout for the chosen monitor
+   if (!params.workAreas || params.workAreaCount == 0)
+      return false;
+   const tLayoutRect& work = params.workAreas[params.monitor < params.workAreaCount ? params.monitor : 0];
+   switch (params.edge)
+   {
+      case eEdgeLeft:
+         return ComputeEdgeLayout<eEdgeLeft>(params, work, layout);
+
+      case eEdgeTop:
+         return ComputeEdgeLayout<eEdgeTop>(params, work, layout);
+
+      case eEdgeRight:
+         return ComputeEdgeLayout<eEdgeRight>(params, work, layout);
+
+      case eEdgeBottom:
+         return ComputeEdgeLayout<eEdgeBottom>(params, work, layout);
+   }
+   return false;
+}
+
+//--------------------------------------------------------------------------
+
+tLayoutRect LayoutButtonRect(const tLayout& layout, unsigned int ind)
+{
+   // Get the rectangle of a button
+   unsigned int perLine = layout.perLine ? layout.perLine : 1;
+   int slot = (int)(ind % perLine),
+       line = (int)(ind / perLine);
+   tLayoutRect r;
+   r.left = layout.xFirst + slot*layout.xInc + line*layout.xLineInc;
+   r.top = layout.yFirst + slot*layout.yInc + line*layout.yLineInc;
+   r.right = r.left + layout.buttonSize;
+   r.bottom = r.top + layout.buttonSize;
+   return r;
+}
+
+//--------------------------------------------------------------------------
+
+template <bool vertical>
+static int HitTest(const tLayout& layout, int x, int y)
+{
+   // Find the button containing a position, the gaps between buttons belong to none
+   int along = vertical ? y - layout.yFirst : x - layout.xFirst,
+       across = vertical ? x - layout.xFirst : y - layout.yFirst,
+       step = vertical ? layout.yInc : layout.xInc;
+   if (step <= 0 || along < 0 || across < 0 || along % step >= layout.buttonSize || across % step >= layout.buttonSize)
+      return -1;
+   unsigned int slot = along / step,
+                line = across / step;
+   if (slot >= layout.perLine || line >= layout.lines)
+      return -1;
+   unsigned int ind = line*layout.perLine + slot;
+   return ind < layout.count ? (int)ind : -1;
+}
+
+//--------------------------------------------------------------------------
+
+int LayoutHitTest(const tLayout& layout, int x, int y)
+{
+   // Get the index of the button at a position, -1 if none
+   return IsVertical(layout.edge) ? HitTest<true>(layout, x, y) : HitTest<false>(layout, x, y);
+}
+
+//--------------------------------------------------------------------------
+
+template <bool vertical>
+static unsigned int InsertIndex(const tLayout& layout, int x, int y)
+{
+   // Round the position to the nearest boundary between buttons in the nearest line
+   int along = vertical ? y - layout.yFirst : x - layout.xFirst,
+       across = vertical ? x - layout.xFirst : y - layout.yFirst,
+       step = vertical ? layout.yInc : layout.xInc;
+   if (step <= 0)
+      return 0;
+   unsigned int slot = along > 0 ? (unsigned int)((along*2 + step) / (step*2)) : 0,
+                line = across > 0 ? (unsigned int)((across*2 + step) / (step*2)) : 0;
+   if (slot > layout.perLine)
+      slot = layout.perLine;
+   if (line >= layout.lines)
+      line = layout.lines - 1;
+   unsigned int ind = line*layout.perLine + slot;
+   return ind < layout.count ? ind : layout.count;
+}
+
+//--------------------------------------------------------------------------
+
+unsigned int LayoutInsertIndex(const tLayout& layout, int x, int y)
+{
+   // Get the list position a button dropped at a position is moved to,
+   // from 0 up to the number of buttons
+   return IsVertical(layout.edge) ? InsertIndex<true>(layout, x, y) : InsertIndex<false>(layout, x, y);
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// layout.h
+// Geometry of the toolbar: the window rectangle on one of the monitors and
+// the button cells within it, wrapped into several rows or columns when the
+// buttons do not fit along the screen edge. Pure computation in standard
+// C++ without any memory allocation.
+
+#pragma once
+
+// Screen edges the toolbar can be placed at, the values of the location setting
+enum tLayoutEdge { eEdgeLeft = 1, eEdgeTop = 2, eEdgeRight = 3, eEdgeBottom = 4 };
+
+typedef struct {
+   int left, top, right, bottom;
+} tLayoutRect;
+
+// Layout parameters, sizes given for 96 DPI
+typedef struct {
+   tLayoutEdge edge;             // Screen edge of the toolbar
+   bool center;                  // Center the toolbar along the edge
+   unsigned int count;           // Number of buttons
+   int iconSize;                 // Icon width and height
+   int iconOffset;               // Offset between the icon and the button frame
+   int gap;                      // Space between adjacent buttons
+   int margin;                   // Space between the window frame and the buttons
+   int endSpace;                 // Extra space at both ends of the toolbar, used for the popup menu
+   int dpi;                      // Screen resolution, 0 for 96 DPI
+   const tLayoutRect *workAreas; // Work areas of the monitors in screen coordinates
+   unsigned int workAreaCount;   // Number of work areas
+   unsigned int monitor;         // Index of the work area used, the first one if out of range
+} tLayoutParams;
+
+// Computed layout, positions in window coordinates unless stated otherwise
+typedef struct {
+   tLayoutEdge edge;             // Screen edge of the toolbar
+   tLayoutRect window;           // Window rectangle in screen coordinates
+   int iconSize, iconOffset;     // Scaled icon size and offset
+   int buttonSize;               // Button width and height
+   int margin, endSpace;         // Scaled margin and end space
+   int xFirst, yFirst;           // Position of the first button
+   int xInc, yInc;               // Increment between buttons in a row or column
+   int xLineInc, yLineInc;       // Increment between rows or columns
+   unsigned int count;           // Number of buttons
+   unsigned int perLine;         // Buttons per row or column
+   unsigned int lines;           // Number of rows or columns
+} tLayout;
+
+bool ComputeLayout(const tLayoutParams& params, tLayout& layout);
+tLayoutRect LayoutButtonRect(const tLayout& layout, unsigned int ind);
+int LayoutHitTest(const tLayout& layout, int x, int y);
+unsigned int LayoutInsertIndex(const tLayout& layout, int x, int y);
@@ -0,0 +1,540 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// pixels.cpp
+// Processing of 32 bit 0xAARRGGBB pixels with SSE2 and AVX2 versions of
+// each operation selected at run time. The vector versions compute exactly
+// what the scalar ones do, so the result never depends on the processor.
+
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "pixels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PIXELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define LANCZOS_LOBES 3
+
+// Filter weights of one scaling direction
+typedef struct {
+   int taps;                     // Source pixels per destination pixel
+   std::vector<int> first;       // First source pixel of each destination pixel
+   std::vector<short> weights;   // Weights of each destination pixel, summing to WEIGHT_ONE
+} tScaleWeights;
+
+static tPixelIsa DetectIsa();
+
+static tPixelIsa gSupportedIsa = DetectIsa();
+static tPixelIsa gIsa = gSupportedIsa;
+
+//--------------------------------------------------------------------------
+
+static tPixelIsa DetectIsa()
+{
+   // Find the best instruction set supported by both processor and operating system
+#ifdef PIXELS_X86
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   int maxLeaf = info[0];
+   __cpuid(info, 1);
+   bool sse2 = (info[3] & (1 << 26)) != 0, osAvx = false;
+   if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)))
+      osAvx = (_xgetbv(0) & 6) == 6;
+   if (osAvx && maxLeaf >= 7)
+   {
+      __cpuidex(info, 7, 0);
+      if (info[1] & (1 << 5))
+         return ePixelAvx2;
+   }
+   return sse2 ? ePixelSse2 : ePixelScalar;
+#else
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      return ePixelAvx2;
+   return __builtin_cpu_supports("sse2") ? ePixelSse2 : ePixelScalar;
+#endif
+#else
+   return ePixelScalar;
+#endif
+}
+
+//--------------------------------------------------------------------------
+
+tPixelIsa GetPixelIsa()
+{
+   // Get the instruction set in use
+   return gIsa;
+}
+
+//--------------------------------------------------------------------------
+
+tPixelIsa SetPixelIsa(tPixelIsa isa)
+{
+   // Limit the instruction set used, e.g. to compare the versions, and return
+   // the one actually selected
+   gIsa = isa < gSupportedIsa ? isa : gSupportedIsa;
+   return gIsa;
+}
+
+//--------------------------------------------------------------------------
+
+static inline unsigned int Div255(unsigned int x)
+{
+   // Exact rounded division by 255 for x <= 255 * 255
+   x += 128;
+   return (x + (x >> 8)) >> 8;
+}
+
+//--------------------------------------------------------------------------
+
+static inline unsigned int PremultiplyPixel(unsigned int p)
+{
+   // Premultiply the colors of a straight pixel
+   unsigned int a = p >> 24;
+   return (a << 24) | (Div255(((p >> 16) & 0xFF) * a) << 16) | (Div255(((p >> 8) & 0xFF) * a) << 8) |
+          Div255((p & 0xFF) * a);
+}
+
+//--------------------------------------------------------------------------
+
+static inline unsigned int GrayPixel(unsigned int p)
+{
+   // Luminance at half intensity and half opacity, valid for both straight and
+   // premultiplied pixels
+   unsigned int y = (29 * (p & 0xFF) + 150 * ((p >> 8) & 0xFF) + 77 * ((p >> 16) & 0xFF) + 128) >> 8;
+   y >>= 1;
+   return ((p >> 25) << 24) | (y << 16) | (y << 8) | y;
+}
+
+#ifdef PIXELS_X86
+//--------------------------------------------------------------------------
+
+TARGET_SSE2 static void PremultiplyPixelsSse2(unsigned int *pixels, size_t count)
+{
+   // Premultiply four pixels at a time, each 16 bit lane computed as Div255.
+   // The alpha channels are restored afterwards.
+   __m128i zero = _mm_setzero_si128();
+   __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+   __m128i round = _mm_set1_epi16(128);
+   size_t i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      __m128i px = _mm_loadu_si128((const __m128i *)(pixels + i));
+      __m128i lo = _mm_unpacklo_epi8(px, zero), hi = _mm_unpackhi_epi8(px, zero);
+      __m128i aLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+      __m128i aHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+      lo = _mm_add_epi16(_mm_mullo_epi16(lo, aLo), round);
+      hi = _mm_add_epi16(_mm_mullo_epi16(hi, aHi), round);
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+      __m128i res = _mm_packus_epi16(lo, hi);
+      res = _mm_or_si128(_mm_andnot_si128(alphaMask, res), _mm_and_si128(alphaMask, px));
+      _mm_storeu_si128((__m128i *)(pixels + i), res);
+   }
+   for (; i < count; i++)
+      pixels[i] = PremultiplyPixel(pixels[i]);
+}
+
+//--------------------------------------------------------------------------
+
+TARGET_AVX2 static void PremultiplyPixelsAvx2(unsigned int *pixels, size_t count)
+{
+   // Premultiply eight pixels at a time, the same steps as with SSE2 in each
+   // half of the registers
+   __m256i zero = _mm256_setzero_si256();
+   __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+   __m256i round = _mm256_set1_epi16(128);
+   size_t i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      __m256i px = _mm256_loadu_si256((const __m256i *)(pixels + i));
+      __m256i lo = _mm256_unpacklo_epi8(px, zero), hi = _mm256_unpackhi_epi8(px, zero);
+      __m256i aLo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, 0xFF), 0xFF);
+      __m256i aHi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, 0xFF), 0xFF);
+      lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, aLo), round);
+      hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, aHi), round);
+      lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+      hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+      __m256i res = _mm256_packus_epi16(lo, hi);
+      res = _mm256_or_si256(_mm256_andnot_si256(alphaMask, res), _mm256_and_si256(alphaMask, px));
+      _mm256_storeu_si256((__m256i *)(pixels + i), res);
+   }
+   PremultiplyPixelsSse2(pixels + i, count - i);
+}
+
+//--------------------------------------------------------------------------
+
+TARGET_SSE2 static void GrayPixelsSse2(unsigned int *pixels, size_t count)
+{
+   // Gray four pixels at a time
+   __m128i zero = _mm_setzero_si128();
+   __m128i coef = _mm_set_epi16(0, 77, 150, 29, 0, 77, 150, 29);
+   __m128i round = _mm_set1_epi32(128);
+   size_t i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      __m128i px = _mm_loadu_si128((const __m128i *)(pixels + i));
+      __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+      __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+      __m128i even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+      __m128i odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1)));
+      __m128i y = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), round), 9);
+      y = _mm_or_si128(_mm_or_si128(y, _mm_slli_epi32(y, 8)), _mm_slli_epi32(y, 16));
+      __m128i a = _mm_slli_epi32(_mm_srli_epi32(px, 25), 24);
+      _mm_storeu_si128((__m128i *)(pixels + i), _mm_or_si128(y, a));
+   }
+   for (; i < count; i++)
+      pixels[i] = GrayPixel(pixels[i]);
+}
+
+//--------------------------------------------------------------------------
+
+TARGET_AVX2 static void GrayPixelsAvx2(unsigned int *pixels, size_t count)
+{
+   // Gray eight pixels at a time
+   __m256i zero = _mm256_setzero_si256();
+   __m256i coef = _mm256_set_epi16(0, 77, 150, 29, 0, 77, 150, 29, 0, 77, 150, 29, 0, 77, 150, 29);
+   __m256i round = _mm256_set1_epi32(128);
+   size_t i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      __m256i px = _mm256_loadu_si256((const __m256i *)(pixels + i));
+      __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef);
+      __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef);
+      __m256i even = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+      __m256i odd = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi), _MM_SHUFFLE(3, 1, 3, 1)));
+      __m256i y = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(even, odd), round), 9);
+      y = _mm256_or_si256(_mm256_or_si256(y, _mm256_slli_epi32(y, 8)), _mm256_slli_epi32(y, 16));
+      __m256i a = _mm256_slli_epi32(_mm256_srli_epi32(px, 25), 24);
+      _mm256_storeu_si256((__m256i *)(pixels + i), _mm256_or_si256(y, a));
+   }
+   GrayPixelsSse2(pixels + i, count - i);
+}
+#endif
+
+//--------------------------------------------------------------------------
+
+void PremultiplyPixels(unsigned int *pixels, size_t count)
+{
+   // Convert straight pixels to premultiplied ones
+#ifdef PIXELS_X86
+   if (gIsa == ePixelAvx2)
+      return PremultiplyPixelsAvx2(pixels, count);
+   if (gIsa == ePixelSse2)
+      return PremultiplyPixelsSse2(pixels, count);
+#endif
+   for (size_t i = 0; i < count; i++)
+      pixels[i] = PremultiplyPixel(pixels[i]);
+}
+
+//--------------------------------------------------------------------------
+
+void GrayPixels(unsigned int *pixels, size_t count)
+{
+   // Turn pixels into dimmed gray, as used for unavailable items
+#ifdef PIXELS_X86
+   if (gIsa == ePixelAvx2)
+      return GrayPixelsAvx2(pixels, count);
+   if (gIsa == ePixelSse2)
+      return GrayPixelsSse2(pixels, count);
+#endif
+   for (size_t i = 0; i < count; i++)
+      pixels[i] = GrayPixel(pixels[i]);
+}
+
+//--------------------------------------------------------------------------
+
+static double Sinc(double x)
+{
+   // Normalized sinc function
+   if (x == 0)
+      return 1;
+   x *= 3.14159265358979323846;
+   return sin(x) / x;
+}
+
+//--------------------------------------------------------------------------
+
+static void ComputeWeights(int srcLen, int dstLen, tScaleFilter filter, tScaleWeights& res)
+{
+   // Compute the fixed point filter weights for scaling srcLen pixels to dstLen.
+   // Weights outside the source are moved to the edge pixels.
+   double scale = (double)srcLen / dstLen, stretch = scale > 1 ? scale : 1;
+   std::vector<std::vector<double> > weights(dstLen);
+   std::vector<int> first(dstLen);
+   res.taps = 1;
+   for (int i = 0; i < dstLen; i++)
+   {
+      int start, end;
+      std::vector<double> w(srcLen, 0.0);
+      if (filter == eScaleBox)
+      {
+         double from = i * scale, to = from + scale;
+         start = (int)from;
+         end = (int)ceil(to);
+         if (end > srcLen)
+            end = srcLen;
+         for (int j = start; j < end; j++)
+            w[j] = ((to < j + 1 ? to : j + 1) - (from > j ? from : j)) / scale;
+      }
+      else
+      {
+         double center = (i + 0.5) * scale - 0.5, support = LANCZOS_LOBES * stretch;
+         start = srcLen;
+         end = 0;
+         for (int j = (int)floor(center - support) + 1; j < center + support; j++)
+         {
+            double x = (j - center) / stretch;
+            int k = j < 0 ? 0 : j >= srcLen ? srcLen - 1 : j;
+            w[k] += Sinc(x) * Sinc(x / LANCZOS_LOBES);
+            if (k < start)
+               start = k;
+            if (k >= end)
+               end = k + 1;
+         }
+      }
+      double sum = 0;
+      for (int j = start; j < end; j++)
+         sum += w[j];
+      weights[i].assign(w.begin() + start, w.begin() + end);
+      for (size_t j = 0; j < weights[i].size(); j++)
+         weights[i][j] /= sum;
+      first[i] = start;
+      if (end - start > res.taps)
+         res.taps = end - start;
+   }
+
+   // Convert to fixed point with an exact sum, all destination pixels using
+   // the same number of taps within the source
+   res.first.resize(dstLen);
+   res.weights.assign((size_t)dstLen * res.taps, 0);
+   for (int i = 0; i < dstLen; i++)
+   {
+      int start = first[i] + res.taps > srcLen ? srcLen - res.taps : first[i], sum = 0, largest = 0;
+      short *w = &res.weights[(size_t)i * res.taps + first[i] - start];
+      for (size_t j = 0; j < weights[i].size(); j++)
+      {
+         w[j] = (short)floor(weights[i][j] * WEIGHT_ONE + 0.5);
+         sum += w[j];
+         if (w[j] > w[largest])
+            largest = (int)j;
+      }
+      w[largest] += (short)(WEIGHT_ONE - sum);
+      res.first[i] = start;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static inline unsigned int ClampPixel(const int *sum)
+{
+   // Round and clamp filtered channel sums to a valid premultiplied pixel
+   int v[4];
+   for (int c = 0; c < 4; c++)
+   {
+      v[c] = (sum[c] + WEIGHT_ONE / 2) >> WEIGHT_BITS;
+      v[c] = v[c] < 0 ? 0 : v[c] > 255 ? 255 : v[c];
+   }
+   for (int c = 0; c < 3; c++)
+      if (v[c] > v[3])
+         v[c] = v[3];
+   return ((unsigned int)v[3] << 24) | (v[2] << 16) | (v[1] << 8) | v[0];
+}
+
+//--------------------------------------------------------------------------
+
+static void ResampleRows(const unsigned int *src, int srcWidth, int rows, const tScaleWeights& w,
+                         unsigned int *dst, int dstWidth)
+{
+   // Scale each row and store the result transposed, so that a second pass
+   // over the result scales the columns
+   for (int y = 0; y < rows; y++)
+   {
+      const unsigned int *row = src + (size_t)y * srcWidth;
+      for (int x = 0; x < dstWidth; x++)
+      {
+         const unsigned int *p = row + w.first[x];
+         const short *wt = &w.weights[(size_t)x * w.taps];
+         int sum[4] = { 0, 0, 0, 0 };
+         for (int k = 0; k < w.taps; k++)
+            for (int c = 0; c < 4; c++)
+               sum[c] += wt[k] * (int)((p[k] >> (c * 8)) & 0xFF);
+         dst[(size_t)x * rows + y] = ClampPixel(sum);
+      }
+   }
+}
+
+#ifdef PIXELS_X86
+//--------------------------------------------------------------------------
+
+TARGET_SSE2 static inline __m128i FilterSse2(const unsigned int *p, const short *wt, int taps, __m128i zero)
+{
+   // Filter one destination pixel, two taps at a time, into four 32 bit
+   // channel sums
+   __m128i acc = zero;
+   int k = 0;
+   for (; k + 1 < taps; k += 2)
+   {
+      __m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + k)), zero);
+      px = _mm_unpacklo_epi16(px, _mm_srli_si128(px, 8));
+      __m128i wp = _mm_set1_epi32((int)((unsigned short)wt[k] | ((unsigned int)(unsigned short)wt[k + 1] << 16)));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(px, wp));
+   }
+   if (k < taps)
+   {
+      __m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p[k]), zero);
+      px = _mm_unpacklo_epi16(px, zero);
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32((unsigned short)wt[k])));
+   }
+   return acc;
+}
+
+//--------------------------------------------------------------------------
+
+TARGET_SSE2 static inline __m128i ClampSse2(__m128i acc)
+{
+   // Round and clamp channel sums in each 128 bit half, leaving the pixels
+   // as the low 32 bits
+   acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(WEIGHT_ONE / 2)), WEIGHT_BITS);
+   __m128i v = _mm_packs_epi32(acc, acc);
+   v = _mm_min_epi16(_mm_max_epi16(v, _mm_setzero_si128()), _mm_set1_epi16(255));
+   v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, 0xFF));
+   return _mm_packus_epi16(v, v);
+}
+
+//--------------------------------------------------------------------------
+
+TARGET_SSE2 static void ResampleRowsSse2(const unsigned int *src, int srcWidth, int rows, const tScaleWeights& w,
+                                         unsigned int *dst, int dstWidth)
+{
+   // Scale rows one destination pixel at a time
+   __m128i zero = _mm_setzero_si128();
+   for (int y = 0; y < rows; y++)
+   {
+      const unsigned int *row = src + (size_t)y * srcWidth;
+      for (int x = 0; x < dstWidth; x++)
+      {
+         __m128i acc = FilterSse2(row + w.first[x], &w.weights[(size_t)x * w.taps], w.taps, zero);
+         dst[(size_t)x * rows + y] = (unsigned int)_mm_cvtsi128_si32(ClampSse2(acc));
+      }
+   }
+}
+
+//--------------------------------------------------------------------------
+
+TARGET_AVX2 static void ResampleRowsAvx2(const unsigned int *src, int srcWidth, int rows, const tScaleWeights& w,
+                                         unsigned int *dst, int dstWidth)
+{
+   // Scale rows two destination pixels at a time, one in each 128 bit half
+   __m256i zero = _mm256_setzero_si256();
+   int taps = w.taps;
+   for (int y = 0; y < rows; y++)
+   {
+      const unsigned int *row = src + (size_t)y * srcWidth;
+      int x = 0;
+      for (; x + 1 < dstWidth; x += 2)
+      {
+         const unsigned int *p0 = row + w.first[x], *p1 = row + w.first[x + 1];
+         const short *w0 = &w.weights[(size_t)x * taps], *w1 = w0 + taps;
+         __m256i acc = zero;
+         int k = 0;
+         for (; k + 1 < taps; k += 2)
+         {
+            __m256i px = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)(p0 + k))),
+                                                 _mm_loadl_epi64((const __m128i *)(p1 + k)), 1);
+            px = _mm256_unpacklo_epi8(px, zero);
+            px = _mm256_unpacklo_epi16(px, _mm256_srli_si256(px, 8));
+            __m256i wp = _mm256_inserti128_si256(
+               _mm256_castsi128_si256(_mm_set1_epi32((int)((unsigned short)w0[k] | ((unsigned int)(unsigned short)w0[k + 1] << 16)))),
+               _mm_set1_epi32((int)((unsigned short)w1[k] | ((unsigned int)(unsigned short)w1[k + 1] << 16))), 1);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(px, wp));
+         }
+         __m128i acc0 = _mm256_castsi256_si128(acc), acc1 = _mm256_extracti128_si256(acc, 1);
+         if (k < taps)
+         {
+            acc0 = _mm_add_epi32(acc0, FilterSse2(p0 + k, w0 + k, 1, _mm_setzero_si128()));
+            acc1 = _mm_add_epi32(acc1, FilterSse2(p1 + k, w1 + k, 1, _mm_setzero_si128()));
+         }
+         dst[(size_t)x * rows + y] = (unsigned int)_mm_cvtsi128_si32(ClampSse2(acc0));
+         dst[(size_t)(x + 1) * rows + y] = (unsigned int)_mm_cvtsi128_si32(ClampSse2(acc1));
+      }
+      if (x < dstWidth)
+      {
+         __m128i acc = FilterSse2(row + w.first[x], &w.weights[(size_t)x * taps], taps, _mm_setzero_si128());
+         dst[(size_t)x * rows + y] = (unsigned int)_mm_cvtsi128_si32(ClampSse2(acc));
+      }
+   }
+}
+#endif
+
+//--------------------------------------------------------------------------
+
+static void Resample(const unsigned int *src, int srcWidth, int rows, const tScaleWeights& w,
+                     unsigned int *dst, int dstWidth)
+{
+   // Scale and transpose rows with the selected instruction set
+#ifdef PIXELS_X86
+   if (gIsa == ePixelAvx2)
+      return ResampleRowsAvx2(src, srcWidth, rows, w, dst, dstWidth);
+   if (gIsa == ePixelSse2)
+      return ResampleRowsSse2(src, srcWidth, rows, w, dst, dstWidth);
+#endif
+   ResampleRows(src, srcWidth, rows, w, dst, dstWidth);
+}
+
+//--------------------------------------------------------------------------
+
+bool ScalePixels(const unsigned int *src, int srcWidth, int srcHeight,
+                 unsigned int *dst, int dstWidth, int dstHeight, tScaleFilter filter)
+{
+   // Scale premultiplied pixels, first the rows then the columns. The source and
+   // destination may be the same buffer.
+   if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+      return false;
+   if (srcWidth == dstWidth && srcHeight == dstHeight)
+   {
+      if (dst != src)
+         memmove(dst, src, (size_t)srcWidth * srcHeight * sizeof(*src));
+      return true;
+   }
+   tScaleWeights wx, wy;
+   ComputeWeights(srcWidth, dstWidth, filter, wx);
+   ComputeWeights(srcHeight, dstHeight, filter, wy);
+   std::vector<unsigned int> tmp((size_t)dstWidth * srcHeight);
+   Resample(src, srcWidth, srcHeight, wx, &tmp[0], dstWidth);
+   Resample(&tmp[0], srcHeight, dstWidth, wy, dst, dstHeight);
+   return true;
+}
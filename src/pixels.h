@@ -0,0 +1,45 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// pixels.h
+// Processing of 32 bit 0xAARRGGBB pixels: premultiplication, graying and
+// high quality scaling. Each operation has SSE2 and AVX2 versions, used
+// when supported by the processor, and a scalar version giving identical
+// results. Only standard C++ and compiler intrinsics are used.
+
+#pragma once
+
+#include <stddef.h>
+
+// Instruction sets
+enum tPixelIsa { ePixelScalar, ePixelSse2, ePixelAvx2 };
+
+// Scaling filters
+enum tScaleFilter {
+   eScaleBox,        // Average of the covered source pixels
+   eScaleLanczos     // Lanczos windowed sinc of three lobes
+};
+
+tPixelIsa GetPixelIsa();
+tPixelIsa SetPixelIsa(tPixelIsa isa);
+void PremultiplyPixels(unsigned int *pixels, size_t count);
+void GrayPixels(unsigned int *pixels, size_t count);
+bool ScalePixels(const unsigned int *src, int srcWidth, int srcHeight,
+                 unsigned int *dst, int dstWidth, int dstHeight, tScaleFilter filter);
@@ -0,0 +1,318 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// render.cpp
+// Toolbar rendering.
+//
+// Each frame composes the invalid part of the toolbar in a back buffer of
+// the size of the window client area, which is then copied to the window
+// with one blit.
+//
+// Icons are converted once to premultiplied pixels at the size shown and
+// packed into the cells of an atlas bitmap, from which they are drawn with
+// AlphaBlend. An atlas entry holds a reference to its icon in the icon
+// cache, so the handle stays valid for it. Entries not drawn by a full
+// frame are removed.
+//
+
+#include <windows.h>
+#include <tchar.h>
+#include <atlstr.h>
+#include <map>
+#include <vector>
+
+#include "render.h"
+#include "iconcache.h"
+#include "icondecode.h"
+#include "pixels.h"
+
+#pragma comment(lib, "msimg32.lib")
+
+#define ATLAS_COLUMNS 16
+
+typedef struct {
+   int slot;            // Atlas cell
+   DWORD frame;         // Last frame the icon was drawn in
+} tAtlasEntry;
+
+typedef std::pair<HICON, BOOL> tAtlasKey;    // Icon and grayed state
+
+// Back buffer
+HDC gBufferDC = NULL;
+HBITMAP gBufferBitmap = NULL;
+HGDIOBJ gBufferOrgBitmap = NULL;
+LONG gBufferWidth = 0, gBufferHeight = 0;
+
+// Icon atlas
+HDC gAtlasDC = NULL;
+HBITMAP gAtlasBitmap = NULL;
+HGDIOBJ gAtlasOrgBitmap = NULL;
+unsigned int *gAtlasPixels = NULL;
+int gAtlasIconSize = 0;                      // Size of the icons in the atlas
+int gAtlasRows = 0;                          // Rows of cells in the atlas bitmap
+int gAtlasNextSlot = 0;                      // First cell never used
+std::vector<int> gAtlasFreeSlots;            // Cells of removed icons
+std::map<tAtlasKey, tAtlasEntry> gAtlasIcons; // Entries by icon and grayed state
+
+// Frame statistics
+DWORD gFrame = 0;
+LARGE_INTEGER gFrameStart;
+DWORD gFrames = 0, gLastFrameTime = 0;
+ULONGLONG gTotalFrameTime = 0;
+
+//--------------------------------------------------------------------------
+
+HBITMAP CreateDib(HDC hDC, int width, int height, void **bits)
+{
+   // Create a top down 32 bit device independent bitmap
+   BITMAPINFO bmi;
+   ZeroMemory(&bmi, sizeof(bmi));
+   bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+   bmi.bmiHeader.biWidth = width;
+   bmi.bmiHeader.biHeight = -height;
+   bmi.bmiHeader.biPlanes = 1;
+   bmi.bmiHeader.biBitCount = 32;
+   bmi.bmiHeader.biCompression = BI_RGB;
+   return CreateDIBSection(hDC, &bmi, DIB_RGB_COLORS, bits, NULL, 0);
+}
+
+//--------------------------------------------------------------------------
+
+void ClearIconAtlas(int iconSize)
+{
+   // Remove all icons, the atlas is then used for icons of the specified size
+   std::map<tAtlasKey, tAtlasEntry>::iterator it;
+   for (it = gAtlasIcons.begin(); it != gAtlasIcons.end(); ++it)
+      ReleaseIcon(it->first.first);
+   gAtlasIcons.clear();
+   gAtlasFreeSlots.clear();
+   gAtlasNextSlot = 0;
+   if (gAtlasDC)
+   {
+      SelectObject(gAtlasDC, gAtlasOrgBitmap);
+      DeleteObject(gAtlasBitmap);
+      DeleteDC(gAtlasDC);
+   }
+   gAtlasDC = NULL;
+   gAtlasBitmap = NULL;
+   gAtlasPixels = NULL;
+   gAtlasRows = 0;
+   gAtlasIconSize = iconSize;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL GrowIconAtlas()
+{
+   // Double the number of cell rows, keeping the icons in place
+   int rows = gAtlasRows ? gAtlasRows*2 : 1,
+       width = ATLAS_COLUMNS*gAtlasIconSize;
+   void *bits;
+   HDC hDC = gAtlasDC ? gAtlasDC : CreateCompatibleDC(NULL);
+   HBITMAP hBitmap = hDC ? CreateDib(hDC, width, rows*gAtlasIconSize, &bits) : NULL;
+   if (!hBitmap)
+   {
+      if (hDC && !gAtlasDC)
+         DeleteDC(hDC);
+      return FALSE;
+   }
+   if (gAtlasBitmap)
+   {
+      GdiFlush();
+      CopyMemory(bits, gAtlasPixels, width*gAtlasRows*gAtlasIconSize*sizeof(unsigned int));
+      SelectObject(hDC, hBitmap);
+      DeleteObject(gAtlasBitmap);
+   }
+   else
+      gAtlasOrgBitmap = SelectObject(hDC, hBitmap);
+   gAtlasDC = hDC;
+   gAtlasBitmap = hBitmap;
+   gAtlasPixels = (unsigned int*)bits;
+   gAtlasRows = rows;
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+int AddAtlasIcon(HICON hIcon, int size, BOOL grayed)
+{
+   // Enter an icon, possibly grayed, into a free atlas cell, -1 if not possible. Only
+   // icons from the icon cache are entered, since the atlas keeps a reference to them.
+   if (size != gAtlasIconSize)
+      ClearIconAtlas(size);
+   tIconImage image;
+   if (!AddIconRef(hIcon))
+      return -1;
+   if (!GetIconImage(hIcon, image))
+   {
+      ReleaseIcon(hIcon);
+      return -1;
+   }
+   ScaleIconImage(image, size, image);
+   if (grayed)
+      GrayPixels(&image.pixels[0], image.pixels.size());
+
+   int slot;
+   if (!gAtlasFreeSlots.empty())
+   {
+      slot = gAtlasFreeSlots.back();
+      gAtlasFreeSlots.pop_back();
+   }
+   else
+   {
+      if (gAtlasNextSlot >= gAtlasRows*ATLAS_COLUMNS && !GrowIconAtlas())
+      {
+         ReleaseIcon(hIcon);
+         return -1;
+      }
+      slot = gAtlasNextSlot++;
+   }
+
+   GdiFlush();
+   int y, stride = ATLAS_COLUMNS*size;
+   unsigned int *cell = gAtlasPixels + (slot / ATLAS_COLUMNS)*size*stride + (slot % ATLAS_COLUMNS)*size;
+   for (y = 0; y < size; y++)
+      CopyMemory(cell + y*stride, &image.pixels[y*size], size*sizeof(unsigned int));
+
+   tAtlasEntry entry = {slot, gFrame};
+   gAtlasIcons[tAtlasKey(hIcon, grayed)] = entry;
+   return slot;
+}
+
+//--------------------------------------------------------------------------
+
+void SweepIconAtlas()
+{
+   // Remove the icons not drawn in the current frame
+   std::map<tAtlasKey, tAtlasEntry>::iterator it = gAtlasIcons.begin();
+   while (it != gAtlasIcons.end())
+   {
+      if (it->second.frame != gFrame)
+      {
+         ReleaseIcon(it->first.first);
+         gAtlasFreeSlots.push_back(it->second.slot);
+         it = gAtlasIcons.erase(it);
+      }
+      else
+         ++it;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+BOOL DrawAtlasIcon(HDC hDC, HICON hIcon, int x, int y, int size, BOOL grayed)
+{
+   // Draw an icon from the atlas, entering it the first time it is drawn at this size
+   if (!hIcon)
+      return FALSE;
+   int slot;
+   std::map<tAtlasKey, tAtlasEntry>::iterator it = gAtlasIcons.find(tAtlasKey(hIcon, grayed));
+   if (it != gAtlasIcons.end() && size == gAtlasIconSize)
+   {
+      it->second.frame = gFrame;
+      slot = it->second.slot;
+   }
+   else if ((slot = AddAtlasIcon(hIcon, size, grayed)) < 0)
+      // Icons not in the atlas are drawn directly
+      return grayed ? DrawState(hDC, NULL, NULL, (LPARAM)hIcon, 0, x, y, size, size, DST_ICON | DSS_DISABLED) :
+                      DrawIconEx(hDC, x, y, hIcon, size, size, 0, NULL, DI_NORMAL);
+
+   BLENDFUNCTION blend = {AC_SRC_OVER, 0, 255, AC_SRC_ALPHA};
+   return AlphaBlend(hDC, x, y, size, size,
+                     gAtlasDC, (slot % ATLAS_COLUMNS)*size, (slot / ATLAS_COLUMNS)*size, size, size, blend);
+}
+
+//--------------------------------------------------------------------------
+
+HDC BeginRenderFrame(HWND hWnd, BOOL *newBuffer)
+{
+   // Start composing a frame for the client area of a window. The back buffer is
+   // created again when the size has changed, the whole frame must then be composed.
+   QueryPerformanceCounter(&gFrameStart);
+   RECT r;
+   GetClientRect(hWnd, &r);
+   *newBuffer = !gBufferDC || r.right != gBufferWidth || r.bottom != gBufferHeight;
+   if (*newBuffer)
+   {
+      if (gBufferDC)
+      {
+         SelectObject(gBufferDC, gBufferOrgBitmap);
+         DeleteObject(gBufferBitmap);
+         DeleteDC(gBufferDC);
+         gBufferDC = NULL;
+      }
+      void *bits;
+      HDC hDC = CreateCompatibleDC(NULL);
+      HBITMAP hBitmap = hDC ? CreateDib(hDC, max(r.right, 1), max(r.bottom, 1), &bits) : NULL;
+      if (!hBitmap)
+      {
+         if (hDC)
+            DeleteDC(hDC);
+         return NULL;
+      }
+      gBufferDC = hDC;
+      gBufferBitmap = hBitmap;
+      gBufferOrgBitmap = SelectObject(hDC, hBitmap);
+      gBufferWidth = r.right;
+      gBufferHeight = r.bottom;
+   }
+   gFrame++;
+   return gBufferDC;
+}
+
+//--------------------------------------------------------------------------
+
+void EndRenderFrame(HDC hDC, const RECT& rect, DWORD cells, BOOL allDrawn)
+{
+   // Present the composed part of the frame. When all of it was composed the icons
+   // no longer shown are removed from the atlas.
+   BitBlt(hDC, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top,
+          gBufferDC, rect.left, rect.top, SRCCOPY);
+   if (allDrawn)
+      SweepIconAtlas();
+
+   LARGE_INTEGER end, freq;
+   QueryPerformanceCounter(&end);
+   QueryPerformanceFrequency(&freq);
+   gLastFrameTime = (DWORD)((end.QuadPart - gFrameStart.QuadPart)*1000000 / freq.QuadPart);
+   gTotalFrameTime += gLastFrameTime;
+   gFrames++;
+#ifdef _DEBUG
+   CString trace;
+   trace.Format(_T("Frame %d: %d cells in %d us, %d icons in atlas\n"),
+                gFrames, cells, gLastFrameTime, gAtlasIcons.size());
+   OutputDebugString(trace);
+#endif
+}
+
+//--------------------------------------------------------------------------
+
+void GetRenderStats(DWORD *frames, DWORD *lastMicros, DWORD *avgMicros, DWORD *atlasIcons)
+{
+   // Number of frames, time to compose and present them, and number of atlas icons
+   if (frames)
+      *frames = gFrames;
+   if (lastMicros)
+      *lastMicros = gLastFrameTime;
+   if (avgMicros)
+      *avgMicros = gFrames ? (DWORD)(gTotalFrameTime / gFrames) : 0;
+   if (atlasIcons)
+      *atlasIcons = (DWORD)gAtlasIcons.size();
+}
@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// render.h
+// Toolbar rendering. The toolbar is composed in a back buffer and presented
+// with a single blit, icons being drawn from an atlas bitmap holding the
+// premultiplied pixels of each icon at the size shown.
+
+#pragma once
+
+#include <windows.h>
+
+HDC BeginRenderFrame(HWND hWnd, BOOL *newBuffer);
+void EndRenderFrame(HDC hDC, const RECT& rect, DWORD cells, BOOL allDrawn);
+BOOL DrawAtlasIcon(HDC hDC, HICON hIcon, int x, int y, int size, BOOL grayed = FALSE);
+void GetRenderStats(DWORD *frames, DWORD *lastMicros, DWORD *avgMicros, DWORD *atlasIcons);
@@ -62,6 +62,7 @@
 #define IDM_ADDSTARTMENU                426
 #define ID_RUN                          427
 #define IDM_RUN                         428
+#define IDM_TRACEREPAINT                429
 #define IDC_RADIO1                      501
 #define IDC_RADIO2                      502
 #define IDC_RADIO3                      503
@@ -81,13 +82,14 @@
 #define IDS_ERROR                       1002
 #define IDS_FATAL                       1003
 #define IDS_SHORTCUT                    1004
+#define IDS_MORE                        1005
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        134
-#define _APS_NEXT_COMMAND_VALUE         429
+#define _APS_NEXT_COMMAND_VALUE         430
 #define _APS_NEXT_CONTROL_VALUE         512
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
@@ -0,0 +1,336 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// shelllink.cpp
+// Shell Link (.lnk) reader.
+//
+// The file consists of the following parts, those in brackets being
+// present depending on the link flags:
+//
+//    ShellLinkHeader          76 bytes, starting with the header size and CLSID
+//    [LinkTargetIDList]       Size prefixed list of shell item ids
+//    [LinkInfo]               Volume and local/network path of the target
+//    [StringData]             Name, relative path, working dir, arguments, icon location
+//    ExtraData                Size prefixed blocks, terminated by a size below 4
+//
+// The target path is taken from the environment variable block when
+// present, otherwise from the link info, and lastly from the file system
+// items of the id list.
+//
+
+#include <string.h>
+
+#include "shelllink.h"
+
+#define HEADER_SIZE 0x4C
+#define ENV_BLOCK_SIG 0xA0000001
+#define ICON_ENV_BLOCK_SIG 0xA0000007
+#define FILE_ENTRY_EXT_SIG 0xBEEF0004
+#define ENV_BLOCK_SIZE 0x314
+
+static const unsigned char gLinkClsid[16] = {
+   0x01, 0x14, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46
+};
+
+//--------------------------------------------------------------------------
+
+static unsigned int Get16(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8);
+}
+
+static unsigned int Get32(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+//--------------------------------------------------------------------------
+
+static std::wstring Latin1(const char *str, size_t len)
+{
+   // Default conversion of strings in the system code page
+   std::wstring res;
+   res.reserve(len);
+   for (size_t i = 0; i < len; i++)
+      res += (wchar_t)(unsigned char)str[i];
+   return res;
+}
+
+//--------------------------------------------------------------------------
+
+static std::wstring Utf16(const unsigned char *p, size_t cnt)
+{
+   // Convert little endian UTF-16 to a wide string, combining surrogates where wchar_t is 32 bit
+   std::wstring res;
+   res.reserve(cnt);
+   for (size_t i = 0; i < cnt; i++)
+   {
+      unsigned int c = Get16(&p[i*2]);
+      if (sizeof(wchar_t) > 2 && c >= 0xD800 && c < 0xDC00 && i+1 < cnt)
+      {
+         unsigned int c2 = Get16(&p[(i+1)*2]);
+         if (c2 >= 0xDC00 && c2 < 0xE000)
+         {
+            c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+            i++;
+         }
+      }
+      res += (wchar_t)c;
+   }
+   return res;
+}
+
+//--------------------------------------------------------------------------
+
+static bool GetAnsiZ(const unsigned char *data, size_t size, size_t off, tAnsiDecoder decoder, std::wstring& str)
+{
+   // Zero terminated string in the system code page
+   if (off >= size)
+      return false;
+   const unsigned char *end = (const unsigned char*)memchr(&data[off], 0, size - off);
+   if (!end)
+      return false;
+   str = decoder((const char*)&data[off], end - &data[off]);
+   return true;
+}
+
+static bool GetUnicodeZ(const unsigned char *data, size_t size, size_t off, std::wstring& str)
+{
+   // Zero terminated UTF-16 string
+   size_t len = 0;
+   while (off + len*2 + 1 < size && Get16(&data[off + len*2]))
+      len++;
+   if (off + len*2 + 1 >= size)
+      return false;
+   str = Utf16(&data[off], len);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+
+static bool ParseIdList(const unsigned char *data, size_t size, tAnsiDecoder decoder, std::wstring& path)
+{
+   // Get the file system path of an id list consisting of a drive item followed by
+   // file and folder items. Any other or damaged list gives an empty path, never
+   // the part read before the failing item.
+   path.clear();
+   size_t off = 0;
+   while (off + 2 <= size)
+   {
+      unsigned int itemSize = Get16(&data[off]);
+      if (itemSize == 0)
+         break;
+      if (itemSize < 3 || off + itemSize > size)
+         break;
+      const unsigned char *item = &data[off];
+      unsigned int type = item[2];
+      if (type == 0x1F)
+      {
+         // Root folder (e.g. My Computer), the path starts with the following drive
+         if (!path.empty())
+            break;
+      }
+      else if (type == 0x23 || type == 0x25 || type == 0x29 || type == 0x2F)
+      {
+         // Drive, e.g. "C:\". Other volume types are shell namespace items such as
+         // Control Panel (0x2E).
+         std::wstring drive;
+         if (!GetAnsiZ(item, itemSize, 3, decoder, drive))
+            break;
+         path = drive;
+      }
+      else if ((type & 0x70) == 0x30 && !path.empty())
+      {
+         // File or folder, the long name is in the extension block referred by the last 16 bits
+         std::wstring name;
+         if (itemSize < 14 || !((type & 0x04) ? GetUnicodeZ(item, itemSize, 14, name) : GetAnsiZ(item, itemSize, 14, decoder, name)))
+            break;
+         unsigned int extOff = Get16(&item[itemSize - 2]);
+         if (extOff >= 14 && extOff + 8 <= itemSize - 2 && Get32(&item[extOff + 4]) == FILE_ENTRY_EXT_SIG)
+         {
+            unsigned int version = Get16(&item[extOff + 2]),
+                         nameOff = extOff + 0x12;
+            if (version >= 7)
+               nameOff += 18;
+            if (version >= 3)
+               nameOff += 2;
+            if (version >= 9)
+               nameOff += 4;
+            if (version >= 8)
+               nameOff += 4;
+            std::wstring longName;
+            if (version >= 3 && GetUnicodeZ(item, itemSize - 2, nameOff, longName) && !longName.empty())
+               name = longName;
+         }
+         if (!path.empty() && path[path.size()-1] != L'\\')
+            path += L'\\';
+         path += name;
+      }
+      else
+         // Not a plain file system location
+         break;
+      off += itemSize;
+   }
+   if (off + 2 <= size && Get16(&data[off]) == 0)
+      return true;
+   path.clear();
+   return false;
+}
+
+//--------------------------------------------------------------------------
+
+static bool ParseLinkInfo(const unsigned char *data, size_t size, tAnsiDecoder decoder, std::wstring& path)
+{
+   // Get the target path from the link info structure
+   if (size < 0x1C)
+      return false;
+   unsigned int headerSize = Get32(&data[4]),
+                flags = Get32(&data[8]),
+                baseOff = Get32(&data[0x10]),
+                netOff = Get32(&data[0x14]),
+                suffixOff = Get32(&data[0x18]);
+   std::wstring base, suffix;
+   if (headerSize >= 0x24 && size >= 0x24)
+   {
+      // Unicode variants present
+      unsigned int baseOffU = Get32(&data[0x1C]),
+                   suffixOffU = Get32(&data[0x20]);
+      if ((flags & 1) && baseOffU)
+         GetUnicodeZ(data, size, baseOffU, base);
+      if (suffixOffU)
+         GetUnicodeZ(data, size, suffixOffU, suffix);
+   }
+   if ((flags & 1) && base.empty() && !GetAnsiZ(data, size, baseOff, decoder, base))
+      return false;
+   if (suffix.empty())
+      GetAnsiZ(data, size, suffixOff, decoder, suffix);
+
+   if (!(flags & 1) && (flags & 2))
+   {
+      // Network location, the share name followed by the suffix
+      if (netOff + 0x14 > size)
+         return false;
+      const unsigned char *net = &data[netOff];
+      unsigned int netSize = Get32(net),
+                   nameOff = Get32(&net[8]);
+      if (netSize > size - netOff)
+         return false;
+      if (nameOff > 0x14 && netSize >= 0x1C)
+         GetUnicodeZ(net, netSize, Get32(&net[0x14]), base);
+      if (base.empty() && !GetAnsiZ(net, netSize, nameOff, decoder, base))
+         return false;
+      if (!suffix.empty() && !base.empty() && base[base.size()-1] != L'\\')
+         base += L'\\';
+   }
+   path = base + suffix;
+   return !path.empty();
+}
+
+//--------------------------------------------------------------------------
+
+bool ParseShellLink(const unsigned char *data, size_t size, tShellLink& link, tAnsiDecoder decoder)
+{
+   // Decode the contents of a .lnk file
+   if (!decoder)
+      decoder = Latin1;
+   link = tShellLink();
+   if (size < HEADER_SIZE || Get32(data) != HEADER_SIZE || memcmp(&data[4], gLinkClsid, 16))
+      return false;
+   link.flags = Get32(&data[0x14]);
+   link.fileAttributes = Get32(&data[0x18]);
+   link.iconIndex = (int)Get32(&data[0x38]);
+   link.showCommand = Get32(&data[0x3C]);
+   size_t off = HEADER_SIZE;
+
+   std::wstring idListPath, linkInfoPath;
+   if (link.flags & SL_HAS_ID_LIST)
+   {
+      if (off + 2 > size)
+         return false;
+      unsigned int listSize = Get16(&data[off]);
+      off += 2;
+      if (off + listSize > size)
+         return false;
+      if (!ParseIdList(&data[off], listSize, decoder, idListPath))
+         idListPath.clear();
+      off += listSize;
+   }
+   if (link.flags & SL_HAS_LINK_INFO)
+   {
+      if (off + 4 > size)
+         return false;
+      unsigned int infoSize = Get32(&data[off]);
+      if (infoSize < 4 || infoSize > size - off)
+         return false;
+      ParseLinkInfo(&data[off], infoSize, decoder, linkInfoPath);
+      off += infoSize;
+   }
+
+   // String data, each a count of characters followed by the characters
+   std::wstring *strings[5] = {&link.description, &link.relativePath, &link.workingDir, &link.arguments, &link.iconLocation};
+   unsigned int i;
+   for (i = 0; i < 5; i++)
+   {
+      if (!(link.flags & (SL_HAS_NAME << i)))
+         continue;
+      if (off + 2 > size)
+         return false;
+      size_t cnt = Get16(&data[off]),
+             len = (link.flags & SL_IS_UNICODE) ? cnt*2 : cnt;
+      off += 2;
+      if (off + len > size)
+         return false;
+      *strings[i] = (link.flags & SL_IS_UNICODE) ? Utf16(&data[off], cnt) : decoder((const char*)&data[off], cnt);
+      off += len;
+   }
+
+   // Extra data blocks
+   std::wstring envTarget, envIcon;
+   while (off + 4 <= size)
+   {
+      unsigned int blockSize = Get32(&data[off]);
+      if (blockSize < 8 || blockSize > size - off)
+         break;
+      unsigned int sig = Get32(&data[off + 4]);
+      if ((sig == ENV_BLOCK_SIG || sig == ICON_ENV_BLOCK_SIG) && blockSize >= ENV_BLOCK_SIZE)
+      {
+         // Fixed size ANSI and Unicode path fields
+         std::wstring str;
+         GetUnicodeZ(&data[off], blockSize, 0x10C, str);
+         if (str.empty())
+            GetAnsiZ(&data[off], 0x10C, 8, decoder, str);
+         if (sig == ENV_BLOCK_SIG)
+            envTarget = str;
+         else
+            envIcon = str;
+      }
+      off += blockSize;
+   }
+
+   if ((link.flags & SL_HAS_EXP_STRING) && !envTarget.empty())
+      link.target = envTarget;
+   else if (!linkInfoPath.empty())
+      link.target = linkInfoPath;
+   else
+      link.target = idListPath;
+   if ((link.flags & SL_HAS_EXP_ICON) && !envIcon.empty())
+      link.iconLocation = envIcon;
+
+   return true;
+}
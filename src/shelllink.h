@@ -0,0 +1,59 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+// shelllink.h
+// Reader of the Shell Link (.lnk) binary file format, as specified in
+// [MS-SHLLINK]. Only standard C++ is used, the caller provides the file
+// contents, e.g. through a memory mapping.
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+// Link flags
+#define SL_HAS_ID_LIST        0x00000001
+#define SL_HAS_LINK_INFO      0x00000002
+#define SL_HAS_NAME           0x00000004
+#define SL_HAS_RELATIVE_PATH  0x00000008
+#define SL_HAS_WORKING_DIR    0x00000010
+#define SL_HAS_ARGUMENTS      0x00000020
+#define SL_HAS_ICON_LOCATION  0x00000040
+#define SL_IS_UNICODE         0x00000080
+#define SL_HAS_EXP_STRING     0x00000200
+#define SL_HAS_EXP_ICON       0x00004000
+
+// Decoded shell link
+typedef struct {
+   unsigned int flags;           // Link flags
+   unsigned int fileAttributes;  // Attributes of the target when the link was saved
+   int iconIndex;                // Index of the icon within the icon location
+   unsigned int showCommand;     // Window show command
+   std::wstring target;          // Target path, possibly containing environment variables, empty if not a file system target
+   std::wstring description;     // Description (comment)
+   std::wstring relativePath;    // Target path relative to the link
+   std::wstring workingDir;      // Working directory
+   std::wstring arguments;       // Command line arguments
+   std::wstring iconLocation;    // Icon file, possibly containing environment variables
+} tShellLink;
+
+// Conversion of strings stored in the system code page, Latin-1 is assumed if not provided
+typedef std::wstring (*tAnsiDecoder)(const char *str, size_t len);
+
+bool ParseShellLink(const unsigned char *data, size_t size, tShellLink& link, tAnsiDecoder decoder = NULL);
@@ -25,12 +25,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <tchar.h>
 #include <ShlObj.h>
 #include  <io.h>
+#include <algorithm>
+#include <map>
 
 #include "resource.h"
 
 #include "utils.h"
+#include "shelllink.h"
+#include "iconcache.h"
 
 #define BUFF_SIZE 1024
+#define MAX_LINK_SIZE (1024*1024)   // Larger shortcut files are left to the shell
 
 LPCTSTR AppRegRoot = NULL;
 HKEY gRegRootKey = HKEY_CURRENT_USER;
@@ -207,6 +212,30 @@ CString GetFileNameComp(LPCTSTR fileName, WORD type)
 
 //--------------------------------------------------------------------------
 
+DWORD AddSortKey(LPCTSTR str, std::vector<BYTE>& keys, BOOL natural)
+{
+   // Append the locale sort key of a string to a key buffer and return its offset.
+   // Keys are zero terminated and compare correctly with strcmp.
+   DWORD flags = LCMAP_SORTKEY | LINGUISTIC_IGNORECASE | (natural ? SORT_DIGITSASNUMBERS : 0);
+   DWORD pos = (DWORD)keys.size();
+   int len = LCMapStringEx(LOCALE_NAME_USER_DEFAULT, flags, str, -1, NULL, 0, NULL, NULL, 0);
+   if (len > 0)
+   {
+      keys.resize(pos + len);
+      if (LCMapStringEx(LOCALE_NAME_USER_DEFAULT, flags, str, -1, (LPWSTR)&keys[pos], len, NULL, NULL, 0))
+         return pos;
+   }
+
+   // Fall back to the upper case characters as key
+   CStringA upper(str);
+   upper.MakeUpper();
+   keys.resize(pos);
+   keys.insert(keys.end(), (LPCSTR)upper, (LPCSTR)upper + upper.GetLength() + 1);
+   return pos;
+}
+
+//--------------------------------------------------------------------------
+
 BOOL FindFiles(LPCTSTR path, CString& fileName, HANDLE *findInfo)
 {
    // Expand possible wild card file specifications
@@ -234,6 +263,151 @@ BOOL FindFiles(LPCTSTR path, CString& fileName, HANDLE *findInfo)
 
 //--------------------------------------------------------------------------
 
+LONG gFsCalls = 0;   // Number of file system calls made by the functions below
+
+#define COUNT_FS_CALL() InterlockedIncrement(&gFsCalls)
+
+DWORD GetFsCallCount(BOOL reset)
+{
+   // Get the number of file system calls made, e.g. for measuring a scan
+   return reset ? InterlockedExchange(&gFsCalls, 0) : gFsCalls;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL EnumDirBasic(CString dir, tFileRecordList& records)
+{
+   // Fallback enumeration for file systems not supporting file id listing
+   WIN32_FIND_DATA findData;
+   COUNT_FS_CALL();
+   HANDLE hFind = FindFirstFileEx(dir + _T("*"), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+   if (hFind == INVALID_HANDLE_VALUE)
+      return FALSE;
+   do
+   {
+      if (!_tcscmp(findData.cFileName, _T(".")) || !_tcscmp(findData.cFileName, _T("..")))
+         continue;
+      tFileRecord rec;
+      rec.name = findData.cFileName;
+      rec.path = dir + rec.name;
+      rec.attributes = findData.dwFileAttributes;
+      rec.size = ((ULONGLONG)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+      rec.modTime = findData.ftLastWriteTime;
+      rec.fileId = 0;
+      records.push_back(rec);
+      COUNT_FS_CALL();
+   } while (FindNextFile(hFind, &findData));
+   FindClose(hFind);
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL EnumDir(LPCTSTR dirName, tFileRecordList& records)
+{
+   // Get all entries of a directory, with the information the file system returns in the same call
+   CString dir = dirName;
+   APPEND_BS(dir);
+   records.clear();
+
+   COUNT_FS_CALL();
+   HANDLE hDir = CreateFile(dir, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+   if (hDir == INVALID_HANDLE_VALUE)
+      return FALSE;
+
+   const DWORD buffSize = 64*1024;
+   std::vector<BYTE> buff(buffSize);
+   FILE_INFO_BY_HANDLE_CLASS infoClass = FileIdBothDirectoryRestartInfo;
+   BOOL ok = TRUE, first = TRUE;
+   while (ok)
+   {
+      COUNT_FS_CALL();
+      ok = GetFileInformationByHandleEx(hDir, infoClass, &buff[0], buffSize);
+      if (!ok)
+      {
+         if (first && GetLastError() != ERROR_NO_MORE_FILES)
+         {
+            // Not supported by this file system
+            CloseHandle(hDir);
+            return EnumDirBasic(dir, records);
+         }
+         break;
+      }
+      first = FALSE;
+      infoClass = FileIdBothDirectoryInfo;
+
+      PFILE_ID_BOTH_DIR_INFO pInf = (PFILE_ID_BOTH_DIR_INFO)&buff[0];
+      while (TRUE)
+      {
+         CString name(pInf->FileName, pInf->FileNameLength/sizeof(WCHAR));
+         if (name != _T(".") && name != _T(".."))
+         {
+            tFileRecord rec;
+            rec.name = name;
+            rec.path = dir + name;
+            rec.attributes = pInf->FileAttributes;
+            rec.size = pInf->EndOfFile.QuadPart;
+            rec.modTime.dwLowDateTime = pInf->LastWriteTime.LowPart;
+            rec.modTime.dwHighDateTime = pInf->LastWriteTime.HighPart;
+            rec.fileId = pInf->FileId.QuadPart;
+            records.push_back(rec);
+         }
+         if (!pInf->NextEntryOffset)
+            break;
+         pInf = (PFILE_ID_BOTH_DIR_INFO)((PBYTE)pInf + pInf->NextEntryOffset);
+      }
+   }
+   CloseHandle(hDir);
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+static ULONGLONG HashBytes(ULONGLONG hash, const void *data, size_t size)
+{
+   // 64 bit FNV-1a hash continued over some bytes
+   const BYTE *pos = (const BYTE*)data;
+   while (size--)
+      hash = (hash ^ *pos++) * 1099511628211ULL;
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+ULONGLONG FileRecordStamp(const tFileRecord& rec)
+{
+   // Hash of the name, file id, size, attributes and the full resolution write time of an entry,
+   // changes whenever the entry is replaced or written, also within the same second
+   ULONGLONG hash = 14695981039346656037ULL;
+   hash = HashBytes(hash, (LPCTSTR)rec.name, rec.name.GetLength()*sizeof(TCHAR));
+   hash = HashBytes(hash, &rec.fileId, sizeof(rec.fileId));
+   hash = HashBytes(hash, &rec.size, sizeof(rec.size));
+   hash = HashBytes(hash, &rec.attributes, sizeof(rec.attributes));
+   hash = HashBytes(hash, &rec.modTime, sizeof(rec.modTime));
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+ULONGLONG DirFingerprint(const tFileRecordList& records)
+{
+   // Fingerprint of a directory listing, independent of the order of the entries. The entry
+   // stamps are mixed before being summed, so that changes of different entries don't cancel.
+   ULONGLONG sum = records.size();
+   size_t i;
+   for (i = 0; i < records.size(); i++)
+   {
+      ULONGLONG mix = FileRecordStamp(records[i]);
+      mix = (mix ^ (mix >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      mix = (mix ^ (mix >> 27)) * 0x94D049BB133111EBULL;
+      sum += mix ^ (mix >> 31);
+   }
+   return sum;
+}
+
+//--------------------------------------------------------------------------
+
 BOOL LocateFile(CString& path)
 {
    if (FileExists(path))
@@ -247,14 +421,23 @@ BOOL LocateFile(CString& path)
 
 BOOL FileExists(LPCTSTR fileName)
 {
+   COUNT_FS_CALL();
    return PathFileExists(fileName);
 }
 
 //--------------------------------------------------------------------------
 
+DWORD FileAttributes(LPCTSTR name)
+{
+   COUNT_FS_CALL();
+   return GetFileAttributes(name);
+}
+
+//--------------------------------------------------------------------------
+
 BOOL IsDir(LPCTSTR name)
 {
-   int attr = GetFileAttributes(name);
+   int attr = FileAttributes(name);
    return attr == -1 ? FALSE : (attr & FILE_ATTRIBUTE_DIRECTORY);
 }
 
@@ -262,7 +445,7 @@ BOOL IsDir(LPCTSTR name)
 
 BOOL FileIsHidden(LPCTSTR name)
 {
-   int attr = GetFileAttributes(name);
+   int attr = FileAttributes(name);
    return attr == -1 ? FALSE : (attr & FILE_ATTRIBUTE_HIDDEN);
 }
 
@@ -271,12 +454,22 @@ BOOL FileIsHidden(LPCTSTR name)
 time_t FileModTime(LPCTSTR name)
 {
 	struct _stat buf;
+   COUNT_FS_CALL();
 	return _tstat(name, &buf) ? 0 : buf.st_mtime;
 
 }
 
 //--------------------------------------------------------------------------
 
+time_t FileTime2Time(const FILETIME& fileTime)
+{
+   // Convert a file time to seconds since 1970
+   ULONGLONG t = ((ULONGLONG)fileTime.dwHighDateTime << 32) | fileTime.dwLowDateTime;
+   return (time_t)((t - 116444736000000000ULL) / 10000000);
+}
+
+//--------------------------------------------------------------------------
+
 BOOL CopyDir(LPCTSTR src, LPCTSTR dst)
 {
    SHFILEOPSTRUCT sf;
@@ -302,7 +495,8 @@ BOOL CopyDir(LPCTSTR src, LPCTSTR dst)
 
 HWND CreateTooltip(HWND hWnd, LPCTSTR text)
 {
-   // Create a tooltip window
+   // Create a tooltip window for a window. With LPSTR_TEXTCALLBACK as text the window
+   // is asked for the text through TTN_GETDISPINFO each time the tooltip is shown.
    HWND hTipWin;
    TOOLINFO toolInfo;
 
@@ -373,85 +567,268 @@ BOOL CreateShortcut(LPCTSTR linkPath, LPCTSTR targetPath, LPCTSTR comment, LPCTS
 
 //--------------------------------------------------------------------------
 
-BOOL GetShortcutInfo(LPCTSTR path, CString& targetPath, 
-                     HICON *largeIcon, HICON *smallIcon, CString *comment)
+std::wstring AnsiDecode(const char *str, size_t len)
 {
-   // Get the attributes of the specified shortcut
-   HRESULT hRes; 
-   IShellLink* psl;
-   CString iconFileName;
-   int iconInd;
-   SHFILEINFO inf;
+   // Convert a shell link string stored in the system code page
+   std::wstring res;
+   int cnt = MultiByteToWideChar(CP_ACP, 0, str, (int)len, NULL, 0);
+   if (cnt > 0)
+   {
+      res.resize(cnt);
+      MultiByteToWideChar(CP_ACP, 0, str, (int)len, &res[0], cnt);
+   }
+   return res;
+}
 
-   hRes = CoCreateInstance(CLSID_ShellLink, NULL, CLSCTX_INPROC_SERVER, IID_IShellLink, (LPVOID*)&psl); 
-   if (SUCCEEDED(hRes))
-   { 
-      IPersistFile* ppf; 
+//--------------------------------------------------------------------------
 
-      hRes = psl->QueryInterface(IID_IPersistFile, (LPVOID*)&ppf); 
+BOOL ReadShellLink(LPCTSTR path, tShellLink& link)
+{
+   // Decode a shortcut file directly from a mapping of its contents
+   BOOL ok = FALSE;
+   COUNT_FS_CALL();
+   HANDLE hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+   if (hFile == INVALID_HANDLE_VALUE)
+      return FALSE;
+   LARGE_INTEGER size;
+   if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && size.QuadPart < MAX_LINK_SIZE)
+   {
+      HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (hMap)
+      {
+         const BYTE *data = (const BYTE*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+         if (data)
+         {
+            ok = ParseShellLink(data, (size_t)size.QuadPart, link, AnsiDecode);
+            UnmapViewOfFile(data);
+         }
+         CloseHandle(hMap);
+      }
+   }
+   CloseHandle(hFile);
+   return ok;
+}
 
-      if (SUCCEEDED(hRes))
+//--------------------------------------------------------------------------
+
+// Shell link objects of the calling thread, created once and reused for all shortcuts
+__declspec(thread) IShellLink *gShellLink = NULL;
+__declspec(thread) IPersistFile *gPersistFile = NULL;
+
+void ReleaseShellLinkObjects()
+{
+   // Release the shell link objects of the calling thread, before it leaves COM
+   if (gPersistFile)
+      gPersistFile->Release();
+   if (gShellLink)
+      gShellLink->Release();
+   gPersistFile = NULL;
+   gShellLink = NULL;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL ReadShellLinkCom(LPCTSTR path, CString& targetPath, CString& iconFile, int& iconIndex, CString& descr)
+{
+   // Get the shortcut information through the shell, used for targets not
+   // resolved by ReadShellLink, e.g. relative or non file system targets
+   HRESULT hRes; 
+
+   if (!gShellLink)
+   {
+      hRes = CoCreateInstance(CLSID_ShellLink, NULL, CLSCTX_INPROC_SERVER, IID_IShellLink, (LPVOID*)&gShellLink); 
+      if (FAILED(hRes))
       {
+         gShellLink = NULL;
+         return FALSE;
+      }
+      hRes = gShellLink->QueryInterface(IID_IPersistFile, (LPVOID*)&gPersistFile); 
+      if (FAILED(hRes))
+      {
+         ReleaseShellLinkObjects();
+         return FALSE;
+      }
+   }
+
 #ifndef UNICODE
-         WCHAR wsz[BUFF_SIZE]; 
-         MultiByteToWideChar(CP_ACP, 0, path, -1, wsz, BUFF_SIZE); 
-         hRes = ppf->Load(wsz, STGM_READ);
+   WCHAR wsz[BUFF_SIZE]; 
+   MultiByteToWideChar(CP_ACP, 0, path, -1, wsz, BUFF_SIZE); 
+   hRes = gPersistFile->Load(wsz, STGM_READ);
 #else
-         hRes = ppf->Load(path, STGM_READ);
+   hRes = gPersistFile->Load(path, STGM_READ);
 #endif
-      }
-      iconInd = 0;
-      hRes = psl->GetPath(targetPath.GetBuffer(BUFF_SIZE), BUFF_SIZE, NULL, SLGP_RAWPATH);
-      targetPath.ReleaseBuffer();
-      if (!targetPath.IsEmpty())
-         ExpEnvVars(targetPath);
+   if (FAILED(hRes))
+      return FALSE;
+
+   gShellLink->GetPath(targetPath.GetBuffer(BUFF_SIZE), BUFF_SIZE, NULL, SLGP_RAWPATH);
+   targetPath.ReleaseBuffer();
+   gShellLink->GetIconLocation(iconFile.GetBuffer(BUFF_SIZE), BUFF_SIZE, &iconIndex);
+   iconFile.ReleaseBuffer();
+   gShellLink->GetDescription(descr.GetBuffer(BUFF_SIZE), BUFF_SIZE);
+   descr.ReleaseBuffer();
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+// Resolved shortcut, cached by path and validated by size and modification time
+typedef struct {
+   ULONGLONG size;
+   FILETIME modTime;
+   CString target;         // Raw target and icon location, environment variables not expanded
+   CString iconFile;
+   int iconIndex;
+   CString descr;
+} tShortcutData;
+
+CRITICAL_SECTION gShortcutLock;
+BOOL gShortcutLockInit = (InitializeCriticalSection(&gShortcutLock), TRUE);
+std::map<CString, tShortcutData> gShortcutCache;
+LONG gShortcutHits = 0, gShortcutMisses = 0;
+
+BOOL ResolveShortcut(LPCTSTR path, tShortcutData& data)
+{
+   // Get the information of a shortcut, from the cache when the file is unchanged
+   WIN32_FILE_ATTRIBUTE_DATA attr;
+   COUNT_FS_CALL();
+   if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attr))
+      return FALSE;
+   ULONGLONG size = ((ULONGLONG)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+   CString key = path;
+   key.MakeUpper();
+
+   EnterCriticalSection(&gShortcutLock);
+   std::map<CString, tShortcutData>::iterator it = gShortcutCache.find(key);
+   BOOL found = it != gShortcutCache.end() && it->second.size == size &&
+                CompareFileTime(&it->second.modTime, &attr.ftLastWriteTime) == 0;
+   if (found)
+      data = it->second;
+   LeaveCriticalSection(&gShortcutLock);
+   if (found)
+   {
+      InterlockedIncrement(&gShortcutHits);
+      return TRUE;
+   }
+   InterlockedIncrement(&gShortcutMisses);
+
+   // Read the shortcut file itself, the shell is only needed when no file system target is found
+   data.size = size;
+   data.modTime = attr.ftLastWriteTime;
+   data.iconIndex = 0;
+   tShellLink link;
+   if (ReadShellLink(path, link) && !link.target.empty())
+   {
+      data.target = link.target.c_str();
+      data.iconFile = link.iconLocation.c_str();
+      data.iconIndex = link.iconIndex;
+      data.descr = link.description.c_str();
+   }
+   else
+      ReadShellLinkCom(path, data.target, data.iconFile, data.iconIndex, data.descr);
+
+   EnterCriticalSection(&gShortcutLock);
+   gShortcutCache[key] = data;
+   LeaveCriticalSection(&gShortcutLock);
+   return TRUE;
+}
 
-      if (largeIcon && smallIcon)
+//--------------------------------------------------------------------------
+
+void InvalidateShortcutCache(LPCTSTR dir)
+{
+   // Forget the cached shortcuts within a directory tree, all if not specified
+   EnterCriticalSection(&gShortcutLock);
+   if (!dir || !*dir)
+      gShortcutCache.clear();
+   else
+   {
+      CString prefix = dir;
+      APPEND_BS(prefix);
+      prefix.MakeUpper();
+      std::map<CString, tShortcutData>::iterator it = gShortcutCache.lower_bound(prefix);
+      while (it != gShortcutCache.end() && it->first.Left(prefix.GetLength()) == prefix)
+         it = gShortcutCache.erase(it);
+   }
+   LeaveCriticalSection(&gShortcutLock);
+}
+
+//--------------------------------------------------------------------------
+
+void GetShortcutCacheStats(DWORD *hits, DWORD *misses)
+{
+   // Number of shortcut resolutions served from the cache and read from file
+   if (hits)
+      *hits = gShortcutHits;
+   if (misses)
+      *misses = gShortcutMisses;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL GetShortcutInfo(LPCTSTR path, CString& targetPath, 
+                     HICON *largeIcon, HICON *smallIcon, CString *comment,
+                     CString *iconFile, int *iconIndex)
+{
+   // Get the attributes of the specified shortcut
+   CString iconFileName, descr;
+   int iconInd = 0;
+   SHFILEINFO inf;
+
+   tShortcutData data;
+   targetPath = EMPTY_CSTR;
+   if (ResolveShortcut(path, data))
+   {
+      targetPath = data.target;
+      iconFileName = data.iconFile;
+      iconInd = data.iconIndex;
+      descr = data.descr;
+   }
+   if (!targetPath.IsEmpty())
+      ExpEnvVars(targetPath);
+
+   if ((largeIcon && smallIcon) || iconFile)
+   {
+      if (!iconFileName.IsEmpty())
+         ExpEnvVars(iconFileName);
+      if (iconFileName.IsEmpty() && targetPath.IsEmpty())
       {
-         hRes = psl->GetIconLocation(iconFileName.GetBuffer(BUFF_SIZE), BUFF_SIZE, &iconInd);
-         iconFileName.ReleaseBuffer();
-         if (!iconFileName.IsEmpty())
-            ExpEnvVars(iconFileName);
-         if (iconFileName.IsEmpty() && targetPath.IsEmpty())
-         {
-            SHGetFileInfo(path, 0, &inf, sizeof(inf), SHGFI_ICONLOCATION);
-            iconFileName = inf.szDisplayName;
-            iconInd = inf.iIcon;
-         }
-         if (iconFileName.IsEmpty())
-         {
-            GetFileIcons(targetPath, largeIcon, smallIcon);
-         }
-         else
-         {
-            if (iconInd == -1)
-               iconInd = 0;
-            hRes = ExtractIconEx(iconFileName, iconInd, largeIcon, smallIcon, 1);
-            if (hRes == -1)
-               GetFileIcons(path, largeIcon, smallIcon);
-         }
+         SHGetFileInfo(path, 0, &inf, sizeof(inf), SHGFI_ICONLOCATION);
+         iconFileName = inf.szDisplayName;
+         iconInd = inf.iIcon;
       }
-
-      if (comment)
+      if (iconInd == -1)
+         iconInd = 0;
+      if (iconFile)
       {
-         *comment = GetFileNameComp(path, eFcName);
-         CString descr;
-         hRes = psl->GetDescription(descr.GetBuffer(BUFF_SIZE), BUFF_SIZE);
-         descr.ReleaseBuffer();
-         if (!descr.IsEmpty())
-         {
-            if (isdigit(comment->GetAt(0)) && isdigit(comment->GetAt(1)))
-               *comment = EMPTY_CSTR;
-            else
-               *comment += CRLF;
-            *comment += descr;
-         }
+         // Icon location only, empty when the icons of the target are used
+         *iconFile = iconFileName;
+         if (iconIndex)
+            *iconIndex = iconInd;
       }
+   }
 
-      ppf->Release(); 
-      psl->Release();
+   if (largeIcon && smallIcon)
+   {
+      if (iconFileName.IsEmpty())
+         GetFileIcons(targetPath, largeIcon, smallIcon);
+      else
+         GetLocationIcons(iconFileName, iconInd, path, largeIcon, smallIcon);
+   }
+
+   if (comment)
+   {
+      *comment = GetFileNameComp(path, eFcName);
+      if (!descr.IsEmpty())
+      {
+         if (isdigit(comment->GetAt(0)) && isdigit(comment->GetAt(1)))
+            *comment = EMPTY_CSTR;
+         else
+            *comment += CRLF;
+         *comment += descr;
+      }
+   }
 
-   } 
    return TRUE; 
 } 
 
@@ -459,18 +836,36 @@ BOOL GetShortcutInfo(LPCTSTR path, CString& targetPath,
 
 BOOL GetFileIcons(LPCTSTR fileName, HICON *largeIcon, HICON *smallIcon)
 {
-   SHFILEINFO inf;
+   // Get the shell icons of a file, shared handles to be released by ReleaseIcon
    if (largeIcon)
-   {
-      SHGetFileInfo(fileName, 0, &inf, sizeof(inf), SHGFI_ICON | SHGFI_LARGEICON);
-      *largeIcon = inf.hIcon;
-   }
+      *largeIcon = AcquireFileIcon(fileName, TRUE);
    if (smallIcon)
+      *smallIcon = AcquireFileIcon(fileName, FALSE);
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL GetLocationIcons(LPCTSTR iconFile, int iconInd, LPCTSTR fileName, HICON *largeIcon, HICON *smallIcon)
+{
+   // Get the icons from an icon location, use the icons of the specified file if not available.
+   // The icons are shared handles to be released by ReleaseIcon.
+   if (iconFile && *iconFile)
    {
-      SHGetFileInfo(fileName, 0, &inf, sizeof(inf), SHGFI_ICON | SHGFI_SMALLICON);
-      *smallIcon = inf.hIcon;
+      HICON large = largeIcon ? AcquireLocationIcon(iconFile, iconInd, TRUE) : NULL,
+            small = smallIcon ? AcquireLocationIcon(iconFile, iconInd, FALSE) : NULL;
+      if ((large || !largeIcon) && (small || !smallIcon))
+      {
+         if (largeIcon)
+            *largeIcon = large;
+         if (smallIcon)
+            *smallIcon = small;
+         return TRUE;
+      }
+      ReleaseIcon(large);
+      ReleaseIcon(small);
    }
-   return TRUE;
+   return GetFileIcons(fileName, largeIcon, smallIcon);
 }
 
 //--------------------------------------------------------------------------
@@ -515,7 +910,7 @@ void InitPopupMenu(HMENU hMenu, BOOL useMenuCom)
 
 //--------------------------------------------------------------------------
 
-BOOL AddMenuItem(HMENU hMenu, LPCTSTR text, HMENU hSubMenu)
+BOOL AddMenuItem(HMENU hMenu, LPCTSTR text, HMENU hSubMenu, INT pos)
 {
    // Create a new menu item or sub menu
    MENUITEMINFO menuInf;
@@ -527,7 +922,7 @@ BOOL AddMenuItem(HMENU hMenu, LPCTSTR text, HMENU hSubMenu)
    menuInf.cch = STR_LEN(text);
    menuInf.hSubMenu = hSubMenu;
 
-   return InsertMenuItem(hMenu, -1, TRUE, &menuInf);
+   return InsertMenuItem(hMenu, pos, TRUE, &menuInf);
 }
 
 //--------------------------------------------------------------------------
@@ -562,7 +957,7 @@ PVOID GetMenuItemData(HMENU hMenu, INT itemID)
    menuInf.cbSize = sizeof(menuInf);
    menuInf.fMask = MIIM_DATA;
    BOOL ok = GetMenuItemInfo(hMenu, itemID, TRUE, &menuInf);
-   return (ok ? ((pItemData)(menuInf.dwItemData))->extra : NULL);
+   return (ok && menuInf.dwItemData ? ((pItemData)(menuInf.dwItemData))->extra : NULL);
 }
 
 //--------------------------------------------------------------------------
@@ -619,26 +1014,88 @@ BOOL HandleMenuItemIconMessage(UINT message, LPARAM lParam)
 
 //--------------------------------------------------------------------------
 
+// Search data for the window showing a popup menu
+typedef struct {
+   HMENU hMenu;
+   HWND hWnd;
+} tMenuWindFind;
+
+BOOL CALLBACK FindMenuWindowProc(HWND hWnd, LPARAM lParam)
+{
+   // Check if a window is the menu window of the searched menu
+   tMenuWindFind *pFind = (tMenuWindFind*)lParam;
+   TCHAR className[16];
+   if (GetClassName(hWnd, className, STR_SIZE(className)) && _tcscmp(className, _T("#32768")) == 0 &&
+       (HMENU)SendMessage(hWnd, MN_GETHMENU, 0, 0) == pFind->hMenu)
+   {
+      pFind->hWnd = hWnd;
+      return FALSE;
+   }
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL SetMenuItemIcons(HMENU hMenu, INT pos, HICON smallIcon, HICON largeIcon)
+{
+   // Replace the icons of a menu item, the previous ones are released. If the menu
+   // is currently shown only the item is redrawn.
+   MENUITEMINFO menuInf;
+   ZeroMemory(&menuInf, sizeof(menuInf));
+   menuInf.cbSize = sizeof(menuInf);
+   menuInf.fMask = MIIM_DATA;
+   if (!GetMenuItemInfo(hMenu, pos, TRUE, &menuInf) || !menuInf.dwItemData)
+      return FALSE;
+   pItemData pData = (pItemData)menuInf.dwItemData;
+   ReleaseIcon(pData->smallIcon);
+   ReleaseIcon(pData->largeIcon);
+   pData->smallIcon = smallIcon;
+   pData->largeIcon = largeIcon;
+
+   // Menus are shown by windows of the thread tracking them
+   tMenuWindFind find = {hMenu, NULL};
+   EnumThreadWindows(GetCurrentThreadId(), FindMenuWindowProc, (LPARAM)&find);
+   RECT r;
+   if (find.hWnd && GetMenuItemRect(NULL, hMenu, pos, &r))
+   {
+      MapWindowPoints(NULL, find.hWnd, (LPPOINT)&r, 2);
+      InvalidateRect(find.hWnd, &r, FALSE);
+   }
+   return TRUE;
+}
+
+//--------------------------------------------------------------------------
+
+BOOL DestroyMenuItemData(HMENU hMenu, INT pos)
+{
+   // Free the icons and data of a menu item
+   MENUITEMINFO menuInf;
+   ZeroMemory(&menuInf, sizeof(menuInf));
+   menuInf.cbSize = sizeof(menuInf);
+   menuInf.fMask = MIIM_DATA;
+   if (!GetMenuItemInfo(hMenu, pos, TRUE, &menuInf) || !menuInf.dwItemData)
+      return FALSE;
+   pItemData pData = (pItemData)menuInf.dwItemData;
+   ReleaseIcon(pData->largeIcon);
+   ReleaseIcon(pData->smallIcon);
+   if (pData->extra)
+      delete pData->extra;
+   delete pData;
+   menuInf.dwItemData = NULL;
+   return SetMenuItemInfo(hMenu, pos, TRUE, &menuInf);
+}
+
+//--------------------------------------------------------------------------
+
 BOOL DestroyMenuData(HMENU hMenu, BOOL destroyMenu)
 {
    INT i;
    for (i = 0; i < GetMenuItemCount(hMenu); i++)
    {
-      MENUITEMINFO menuInf;
-      ZeroMemory(&menuInf, sizeof(menuInf));
-      menuInf.cbSize = sizeof(menuInf);
-      menuInf.fMask = MIIM_DATA | MIIM_SUBMENU;
-      if (GetMenuItemInfo(hMenu, i, TRUE, &menuInf))
-      {
-         pItemData pData = (pItemData)menuInf.dwItemData;
-         DestroyIcon(pData->largeIcon);
-         DestroyIcon(pData->smallIcon);
-         if (pData->extra)
-            delete pData->extra;
-         delete pData;
-      }
-      if (menuInf.hSubMenu)
-         DestroyMenuData(menuInf.hSubMenu);
+      HMENU subMenu = GetSubMenu(hMenu, i);
+      DestroyMenuItemData(hMenu, i);
+      if (subMenu)
+         DestroyMenuData(subMenu);
    }
    if (destroyMenu)
 	   DestroyMenu(hMenu);
@@ -689,6 +1146,14 @@ CString GetQuickLaunchDir()
 
 //--------------------------------------------------------------------------
 
+CString GetLocalAppDataDir()
+{
+   // Get the path of the local (non roaming) application data directory
+   return GetExplorerDir(_T("User Shell Folders\\Local AppData"));
+}
+
+//--------------------------------------------------------------------------
+
 CString GetAutoStartDir(BOOL allUsers)
 {
    return GetExplorerDir(allUsers ? _T("Shell Folders\\Common Startup") : _T("User Shell Folders\\Startup"), 
@@ -705,74 +1170,262 @@ CString GetStartMenuDir(BOOL allUsers)
 
 //--------------------------------------------------------------------------
 
-// Directory change data structure
+#define MAX_POOL_THREADS 8
+#define POOL_END_TIMEOUT 2000 // Time in ms the workers are given to finish their current tasks
+
+// Batch of tasks submitted by RunTasks
 typedef struct {
-   HANDLE hChange;
-   HANDLE hThread;
-   HWND hWnd;
-   DWORD messageID;
-} tWatchInfo, *pWatchInfo;
+   tTaskProc proc;
+   PVOID *params;
+   LONG cnt;            // Number of tasks
+   LONG next;           // Next task to start
+   LONG done;           // Number of tasks completed
+   DWORD maxWorkers;    // Workers allowed to run tasks of the batch at the same time
+   DWORD workers;       // Workers running tasks of the batch
+   HANDLE hDone;        // Set when all tasks are completed
+} tTaskBatch, *pTaskBatch;
+
+// Pool of worker threads shared by all batches. The workers are created once and live
+// until EndTaskPool, so their COM apartments and shell link objects serve all batches.
+typedef struct {
+   CRITICAL_SECTION lock;
+   std::vector<pTaskBatch> batches;    // Batches with tasks not yet started, in submission order
+   HANDLE hWork;                       // Set while a worker may take a task or when stopping
+   HANDLE threads[MAX_POOL_THREADS];
+   DWORD threadCnt;
+   BOOL started;
+   BOOL stop;                          // Set to end the workers
+} tTaskPool;
+
+tTaskPool gTaskPool;
+INIT_ONCE gTaskPoolInit = INIT_ONCE_STATIC_INIT;
 
-DWORD WINAPI WatchThreadProc(LPVOID param)
+//--------------------------------------------------------------------------
+
+static void UpdateWorkSignal()
+{
+   // Signal the workers whether there is a task they may take, called with the pool locked
+   BOOL work = gTaskPool.stop;
+   size_t i;
+   for (i = 0; i < gTaskPool.batches.size() && !work; i++)
+      work = gTaskPool.batches[i]->workers < gTaskPool.batches[i]->maxWorkers;
+   if (work)
+      SetEvent(gTaskPool.hWork);
+   else
+      ResetEvent(gTaskPool.hWork);
+}
+
+//--------------------------------------------------------------------------
+
+static LONG TakeTask(pTaskBatch pBatch, BOOL worker)
 {
-   pWatchInfo pInf = (pWatchInfo)param;
-   BOOL notified = FALSE;
-   while (TRUE)
+   // Take the next task of a batch, -1 if all have been started. Called with the pool locked.
+   if (pBatch->next >= pBatch->cnt || (worker && pBatch->workers >= pBatch->maxWorkers))
+      return -1;
+   LONG ind = pBatch->next++;
+   if (worker)
+      pBatch->workers++;
+   if (pBatch->next == pBatch->cnt)
+      gTaskPool.batches.erase(std::find(gTaskPool.batches.begin(), gTaskPool.batches.end(), pBatch));
+   UpdateWorkSignal();
+   return ind;
+}
+
+//--------------------------------------------------------------------------
+
+static void FinishTask(pTaskBatch pBatch, BOOL worker)
+{
+   // Count a completed task and signal the submitter when it was the last one. The batch
+   // may be gone as soon as it is signalled.
+   EnterCriticalSection(&gTaskPool.lock);
+   if (worker)
+      pBatch->workers--;
+   HANDLE hDone = ++pBatch->done == pBatch->cnt ? pBatch->hDone : NULL;
+   UpdateWorkSignal();
+   LeaveCriticalSection(&gTaskPool.lock);
+   if (hDone)
+      SetEvent(hDone);
+}
+
+//--------------------------------------------------------------------------
+
+static void CancelTasks(pTaskBatch pBatch)
+{
+   // Drop the tasks of a batch not yet started, the batch is done when the running ones are
+   EnterCriticalSection(&gTaskPool.lock);
+   if (pBatch->next < pBatch->cnt)
    {
-      // Don't send notifications to the application until possible bursts has calmed down
-      if (WaitForSingleObject(pInf->hChange, 1000) == WAIT_OBJECT_0)
+      gTaskPool.batches.erase(std::find(gTaskPool.batches.begin(), gTaskPool.batches.end(), pBatch));
+      pBatch->cnt = pBatch->next;
+      if (pBatch->done == pBatch->cnt)
+         SetEvent(pBatch->hDone);
+      UpdateWorkSignal();
+   }
+   LeaveCriticalSection(&gTaskPool.lock);
+}
+
+//--------------------------------------------------------------------------
+
+DWORD WINAPI TaskThreadProc(LPVOID param)
+{
+   // Run the tasks of the submitted batches until the pool is ended
+   CoInitialize(NULL);
+   while (WaitForSingleObject(gTaskPool.hWork, INFINITE) == WAIT_OBJECT_0)
+   {
+      EnterCriticalSection(&gTaskPool.lock);
+      if (gTaskPool.stop)
+      {
+         LeaveCriticalSection(&gTaskPool.lock);
+         break;
+      }
+      pTaskBatch pBatch = NULL;
+      LONG ind = -1;
+      size_t i;
+      for (i = 0; i < gTaskPool.batches.size() && ind < 0; i++)
       {
-         notified = TRUE;
-         // Wait for next
-         FindNextChangeNotification(pInf->hChange);
+         pBatch = gTaskPool.batches[i];
+         ind = TakeTask(pBatch, TRUE);
       }
-      else if (notified)
+      LeaveCriticalSection(&gTaskPool.lock);
+      if (ind >= 0)
       {
-         // Timer event, now report the pending change
-         PostMessage(pInf->hWnd, pInf->messageID, NULL, NULL);
-         notified = FALSE;
+         pBatch->proc(pBatch->params[ind]);
+         FinishTask(pBatch, TRUE);
       }
    }
+   ReleaseShellLinkObjects();
+   CoUninitialize();
    return 0;
 }
 
 //--------------------------------------------------------------------------
 
-BOOL StartWatchDir(LPCTSTR dir, HWND hWnd, DWORD messageID, LPVOID watchHand)
+BOOL CALLBACK StartTaskPool(PINIT_ONCE initOnce, PVOID param, PVOID *context)
 {
-   // Watch for changes in the specified directory and report with the specified message id to the specified window
-   pWatchInfo pInf = new tWatchInfo;
-   BOOL ok =  pInf != NULL;
-   if (ok)
+   // Create the worker threads, more than processors as the tasks are mostly waiting for I/O
+   InitializeCriticalSection(&gTaskPool.lock);
+   gTaskPool.hWork = CreateEvent(NULL, TRUE, FALSE, NULL);
+   gTaskPool.threadCnt = 0;
+   gTaskPool.stop = FALSE;
+   SYSTEM_INFO sysInfo;
+   GetSystemInfo(&sysInfo);
+   DWORD i, cnt = sysInfo.dwNumberOfProcessors*2;
+   IN_RANGE(cnt, 1, MAX_POOL_THREADS);
+   for (i = 0; gTaskPool.hWork && i < cnt; i++)
    {
-      pInf->hWnd = hWnd;
-      pInf->messageID = messageID;
+      HANDLE hThread = CreateThread(NULL, 0, TaskThreadProc, NULL, 0, NULL);
+      if (hThread)
+         gTaskPool.threads[gTaskPool.threadCnt++] = hThread;
    }
+   gTaskPool.started = TRUE;
+   return TRUE;
+}
 
-   ok = ok && (pInf->hChange = FindFirstChangeNotification(dir, TRUE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE)) != INVALID_HANDLE_VALUE;
-   ok = ok && (pInf->hThread = CreateThread(NULL, 0, WatchThreadProc, pInf, 0, NULL)) != NULL;
+//--------------------------------------------------------------------------
 
-   if (ok && watchHand)
-      watchHand = (PVOID)pInf;
-   else if (!ok)
-      delete pInf;
+BOOL RunTasks(tTaskProc proc, PVOID *params, DWORD cnt, DWORD maxThreads, BOOL pumpMessages)
+{
+   // Run the specified tasks on the worker pool and return when all are done. At most
+   // maxThreads threads run the tasks, the calling thread included unless pumping messages,
+   // all pool threads by default. When pumping messages the calling thread only paints and
+   // handles sent messages meanwhile. Other input is left queued so that the window state
+   // cannot change under the caller, and a quit request is passed on after the tasks.
+   // Pressing Esc meanwhile cancels the tasks not yet started and gives FALSE, the key
+   // being left queued as well, e.g. for closing the menu being filled.
+   if (!cnt)
+      return TRUE;
+   InitOnceExecuteOnce(&gTaskPoolInit, StartTaskPool, NULL, NULL);
+
+   tTaskBatch batch;
+   batch.proc = proc;
+   batch.params = params;
+   batch.cnt = (LONG)cnt;
+   batch.next = 0;
+   batch.done = 0;
+   batch.workers = 0;
+   batch.maxWorkers = maxThreads ? maxThreads - (pumpMessages ? 0 : 1) : gTaskPool.threadCnt;
+   batch.maxWorkers = min(batch.maxWorkers, gTaskPool.threadCnt);
+   batch.hDone = batch.maxWorkers ? CreateEvent(NULL, TRUE, FALSE, NULL) : NULL;
+   if (!batch.hDone)
+   {
+      // Run all tasks on the calling thread
+      DWORD i;
+      for (i = 0; i < cnt; i++)
+         proc(params[i]);
+      return TRUE;
+   }
+   EnterCriticalSection(&gTaskPool.lock);
+   gTaskPool.batches.push_back(&batch);
+   UpdateWorkSignal();
+   LeaveCriticalSection(&gTaskPool.lock);
 
-   return ok;
+   BOOL cancelled = FALSE;
+   if (!pumpMessages)
+   {
+      // Take part until all tasks are started, then wait for the ones still running
+      while (TRUE)
+      {
+         EnterCriticalSection(&gTaskPool.lock);
+         LONG ind = TakeTask(&batch, FALSE);
+         LeaveCriticalSection(&gTaskPool.lock);
+         if (ind < 0)
+            break;
+         proc(params[ind]);
+         FinishTask(&batch, FALSE);
+      }
+      WaitForSingleObject(batch.hDone, INFINITE);
+   }
+   else
+   {
+      BOOL quit = FALSE;
+      int exitCode = 0;
+      while (MsgWaitForMultipleObjects(1, &batch.hDone, FALSE, INFINITE,
+                                       quit ? 0 : QS_PAINT | QS_SENDMESSAGE | (cancelled ? 0 : QS_INPUT)) == WAIT_OBJECT_0 + 1)
+      {
+         // Sent messages are handled within PeekMessage
+         MSG msg;
+         while (!quit && PeekMessage(&msg, NULL, 0, 0, PM_REMOVE | PM_QS_PAINT))
+         {
+            if (msg.message == WM_QUIT)
+            {
+               quit = TRUE;
+               exitCode = (int)msg.wParam;
+            }
+            else
+               DispatchMessage(&msg);
+         }
+         // Peeking marks the queued input as seen, the wait only returns for new input
+         if (!cancelled && PeekMessage(&msg, NULL, WM_KEYDOWN, WM_KEYDOWN, PM_NOREMOVE) && msg.wParam == VK_ESCAPE)
+         {
+            CancelTasks(&batch);
+            cancelled = TRUE;
+         }
+      }
+      if (quit)
+         PostQuitMessage(exitCode);
+   }
+   CloseHandle(batch.hDone);
+   return !cancelled;
 }
 
 //--------------------------------------------------------------------------
 
-BOOL EndWatchDir(LPVOID watchHand)
+void EndTaskPool()
 {
-   // Stop directory watch
-   BOOL ok = FALSE;
-   pWatchInfo pInf = (pWatchInfo)watchHand;
-   if (pInf)
-   {
-      ok = TerminateThread(pInf->hThread, 0);
-      FindCloseChangeNotification(pInf->hChange);
-   }
-   return ok;
+   // End the worker threads, giving them some time to finish their current tasks
+   if (!gTaskPool.started)
+      return;
+   EnterCriticalSection(&gTaskPool.lock);
+   gTaskPool.stop = TRUE;
+   UpdateWorkSignal();
+   LeaveCriticalSection(&gTaskPool.lock);
+   if (gTaskPool.threadCnt)
+      WaitForMultipleObjects(gTaskPool.threadCnt, gTaskPool.threads, TRUE, POOL_END_TIMEOUT);
+   DWORD i;
+   for (i = 0; i < gTaskPool.threadCnt; i++)
+      CloseHandle(gTaskPool.threads[i]);
+   gTaskPool.threadCnt = 0;
+   gTaskPool.started = FALSE;
 }
 
 //--------------------------------------------------------------------------
@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
 #include <atlstr.h>
+#include <vector>
 
 #define CURR_INSTANCE GetModuleHandle(NULL)
 
@@ -54,37 +55,65 @@ BOOL DelRegVal(LPCTSTR valName, HKEY rootKey = NULL);
 enum tFileComp {eFcDrive = 1, eFcDir = 2, eFcName = 4, eFcType = 8};
 CString GetFileNameComp(LPCTSTR fileName, WORD type);
 BOOL FindFiles(LPCTSTR path, CString& fileName, HANDLE *findInfo);
+DWORD AddSortKey(LPCTSTR str, std::vector<BYTE>& keys, BOOL natural = FALSE);
+
+// Directory entry returned by EnumDir
+typedef struct {
+   CString path;           // Full path
+   CString name;           // File name including extension
+   DWORD attributes;       // File attributes
+   ULONGLONG size;         // File size in bytes
+   FILETIME modTime;       // Last write time
+   ULONGLONG fileId;       // File system id, 0 if not available
+} tFileRecord;
+typedef std::vector<tFileRecord> tFileRecordList;
+
+BOOL EnumDir(LPCTSTR dirName, tFileRecordList& records);
+ULONGLONG FileRecordStamp(const tFileRecord& rec);
+ULONGLONG DirFingerprint(const tFileRecordList& records);
+DWORD GetFsCallCount(BOOL reset = FALSE);
 BOOL LocateFile(CString& path);
 BOOL FileExists(LPCTSTR fileName);
+DWORD FileAttributes(LPCTSTR name);
 BOOL IsDir(LPCTSTR name);
 BOOL FileIsHidden(LPCTSTR name);
 time_t FileModTime(LPCTSTR name);
+time_t FileTime2Time(const FILETIME& fileTime);
 BOOL CopyDir(LPCTSTR src, LPCTSTR dst);
 
 HWND CreateTooltip(HWND hWnd, LPCTSTR text);
 
 BOOL CreateShortcut(LPCTSTR linkPath, LPCTSTR targetPath, LPCTSTR comment = NULL, LPCTSTR arguments = NULL,
                     LPCTSTR workDir = NULL, LPCTSTR iconFile = NULL, int iconIndex = 0, int showCommand = SW_SHOWNORMAL);
-BOOL GetShortcutInfo(LPCTSTR path, CString& targetPath, HICON *largeIcon = NULL, HICON *smallIcon = NULL, CString* comment = NULL);
+BOOL GetShortcutInfo(LPCTSTR path, CString& targetPath, HICON *largeIcon = NULL, HICON *smallIcon = NULL, CString* comment = NULL,
+                     CString *iconFile = NULL, int *iconIndex = NULL);
 BOOL GetFileIcons(LPCTSTR fileName, HICON *largeIcon = NULL, HICON *smallIcon = NULL);
+BOOL GetLocationIcons(LPCTSTR iconFile, int iconInd, LPCTSTR fileName, HICON *largeIcon, HICON *smallIcon);
+void ReleaseShellLinkObjects();
+void InvalidateShortcutCache(LPCTSTR dir = NULL);
+void GetShortcutCacheStats(DWORD *hits, DWORD *misses);
 CString GetTrueTarget(LPCTSTR path);
 
 void InitPopupMenu(HMENU hMenu, BOOL useMenuCom = FALSE);
-BOOL AddMenuItem(HMENU hMenu, LPCTSTR text, HMENU hSubMenu = NULL);
+BOOL AddMenuItem(HMENU hMenu, LPCTSTR text, HMENU hSubMenu = NULL, INT pos = -1);
 BOOL SetMenuItemData(HMENU hMenu, INT itemID, HICON smallIcon, HICON largeIcon = NULL, BOOL useLarge = FALSE, PVOID extra = NULL);
 PVOID GetMenuItemData(HMENU hMenu, INT itemID);
 BOOL SetLargeMenus(BOOL on);
 BOOL HandleMenuItemIconMessage(UINT message, LPARAM lParam);
+BOOL SetMenuItemIcons(HMENU hMenu, INT pos, HICON smallIcon, HICON largeIcon);
+BOOL DestroyMenuItemData(HMENU hMenu, INT pos);
 BOOL DestroyMenuData(HMENU hMenu, BOOL destroyMenu = FALSE);
 
 BOOL DoRun(LPCTSTR com, LPCTSTR params, HWND hWnd, WORD showType = SW_SHOWNORMAL, LPCTSTR verb = NULL);
 
 CString GetQuickLaunchDir();
+CString GetLocalAppDataDir();
 CString GetAutoStartDir(BOOL allUsers = FALSE);
 CString GetStartMenuDir(BOOL allUsers = FALSE);
 
-BOOL StartWatchDir(LPCTSTR dir, HWND hWnd, DWORD messageID, LPVOID watchHand);
-BOOL EndWatchDir(LPVOID watchHand);
+typedef void (*tTaskProc)(PVOID param);
+BOOL RunTasks(tTaskProc proc, PVOID *params, DWORD cnt, DWORD maxThreads = 0, BOOL pumpMessages = FALSE);
+void EndTaskPool();
 
 CString LoadFormatResString(UINT ID, ...);
 CString ErrorString(DWORD err = GetLastError());
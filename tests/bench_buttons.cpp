@@ -0,0 +1,197 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// bench_buttons.cpp
+// Time of the button lookups done by UpdateButtons, with the linear scans
+// of the former fixed button array and with the button list of buttonlist.h
+// used by LaunchBar.cpp. The linear lookups and the command keys are
+// replicated with standard strings: the command compare of CString
+// CompareNoCase by wcscasecmp and MakeUpper by towupper.
+//
+// Usage: bench_buttons [buttons]   (100, 1000 and 5000 by default)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "buttonlist.h"
+
+#define MIN_TIME 0.5      // Seconds to run each measurement at least
+
+typedef std::wstring tString;
+
+// Button as seen by the lookups
+typedef struct {
+   tString command;
+} tButton, *pButton;
+
+// Button list with the former linear lookups
+typedef struct {
+   std::vector<pButton> list;
+} tLinearButtons;
+
+// Button list with the hash indexes
+typedef tButtonList<pButton, tString> tIndexedButtons;
+
+//--------------------------------------------------------------------------
+
+static tString CommandKey(const tString& com)
+{
+   // Get the key of a command in the command index
+   tString key = com;
+   size_t i;
+   for (i = 0; i < key.size(); i++)
+      key[i] = towupper(key[i]);
+   return key;
+}
+
+//--------------------------------------------------------------------------
+
+static long LinearHwnd2Index(const tLinearButtons& buttons, pButton pBut)
+{
+   size_t i;
+   for (i = 0; i < buttons.list.size(); i++)
+      if (buttons.list[i] == pBut)
+         return (long)i;
+   return -1;
+}
+
+//--------------------------------------------------------------------------
+
+static long LinearCom2Index(const tLinearButtons& buttons, const tString& com)
+{
+   size_t i;
+   for (i = 0; i < buttons.list.size(); i++)
+      if (wcscasecmp(buttons.list[i]->command.c_str(), com.c_str()) == 0)
+         return (long)i;
+   return -1;
+}
+
+//--------------------------------------------------------------------------
+
+static size_t LinearUpdate(const tLinearButtons& buttons, const std::vector<tString>& files)
+{
+   // The lookups of the former UpdateButtons: a sorted map of the listing to
+   // validate the buttons and a linear Com2Index for each listed file
+   std::map<tString, size_t> fileMap;
+   size_t i, found = 0;
+   for (i = 0; i < files.size(); i++)
+      fileMap[CommandKey(files[i])] = i;
+   for (i = 0; i < buttons.list.size(); i++)
+      found += fileMap.count(CommandKey(buttons.list[i]->command));
+   for (i = 0; i < files.size(); i++)
+      found += LinearCom2Index(buttons, files[i]) != -1;
+   return found;
+}
+
+//--------------------------------------------------------------------------
+
+static size_t IndexedUpdate(const tIndexedButtons& buttons, const std::vector<tString>& files)
+{
+   // The lookups of UpdateButtons with the hash indexes
+   std::unordered_map<tString, size_t> fileMap;
+   size_t i, found = 0;
+   for (i = 0; i < files.size(); i++)
+      fileMap[CommandKey(files[i])] = i;
+   for (i = 0; i < buttons.list.size(); i++)
+      found += fileMap.count(CommandKey(buttons.list[i]->command));
+   for (i = 0; i < files.size(); i++)
+      found += buttons.FindCommand(CommandKey(files[i])) != -1;
+   return found;
+}
+
+//--------------------------------------------------------------------------
+
+static void Measure(unsigned int count)
+{
+   // Buttons for every entry of a Quick Launch folder, listed in another order and case
+   std::vector<tButton> storage(count);
+   std::vector<tString> files(count);
+   tLinearButtons linear;
+   tIndexedButtons indexed;
+   unsigned int i;
+   for (i = 0; i < count; i++)
+   {
+      wchar_t buff[200];
+      swprintf(buff, 200, L"C:\\Users\\someone\\AppData\\Roaming\\Microsoft\\Internet Explorer\\Quick Launch\\Program %05u.lnk", i);
+      storage[i].command = buff;
+      files[count - 1 - i] = CommandKey(buff);
+   }
+   for (i = 0; i < count; i++)
+   {
+      pButton pBut = &storage[i];
+      linear.list.push_back(pBut);
+      indexed.Insert(pBut, CommandKey(pBut->command), i);
+   }
+
+   double times[4];
+   size_t checks[4];
+   int m;
+   for (m = 0; m < 4; m++)
+   {
+      size_t runs = 0;
+      double secs = 0;
+      checks[m] = 0;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      while (secs < MIN_TIME)
+      {
+         if (m == 0)
+            checks[m] = LinearUpdate(linear, files);
+         else if (m == 1)
+            checks[m] = IndexedUpdate(indexed, files);
+         else
+            for (i = 0; i < count; i++)
+               checks[m] += (m == 2 ? LinearHwnd2Index(linear, &storage[i]) : indexed.Find(&storage[i])) == (long)i;
+         runs++;
+         secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+      times[m] = secs * 1e3 / runs;
+      if (m >= 2)
+         checks[m] /= runs;
+   }
+   if (checks[0] != 2*count || checks[1] != 2*count || checks[2] != count || checks[3] != count)
+      printf("Lookups failed\n");
+   printf("%8u %12.3f %12.3f %12.3f %12.3f\n", count, times[0], times[1], times[2], times[3]);
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+   printf("Milliseconds per UpdateButtons lookups and per Hwnd2Index of every button\n");
+   printf("%8s %12s %12s %12s %12s\n", "Buttons", "Update lin", "Update hash", "Hwnd lin", "Hwnd hash");
+   int i;
+   if (argc > 1)
+      for (i = 1; i < argc; i++)
+         Measure((unsigned int)atoi(argv[i]));
+   else
+   {
+      Measure(100);
+      Measure(1000);
+      Measure(5000);
+   }
+   return 0;
+}
@@ -0,0 +1,258 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// bench_dirwatch.cpp
+// Stress run of the directory watcher: a burst of file operations in a
+// temporary tree, applied to a model of the tree as the changes are reported,
+// as ApplyDirChanges does with the buttons. Reports the entries the model
+// misses or has in excess, the coalescing and the report latency.
+//
+// Usage: bench_dirwatch [files] [debounce ms]   (100000 and 250 by default)
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dirwatch.h"
+
+#define QUIET_TIME 1500   // Time in ms without reports ending the run
+
+typedef std::set<std::string> tEntrySet;
+
+static std::string gRoot;
+static std::mutex gLock;
+static tEntrySet gModel;
+static unsigned int gLastReport = 0, gMaxLatency = 0;
+
+//--------------------------------------------------------------------------
+
+static void ListTree(const std::string& dir, tEntrySet& entries)
+{
+   // Add the paths of all entries in a tree
+   DIR *pDir = opendir(dir.c_str());
+   if (!pDir)
+      return;
+   struct dirent *pEntry;
+   while ((pEntry = readdir(pDir)) != NULL)
+   {
+      std::string name = pEntry->d_name;
+      if (name == "." || name == "..")
+         continue;
+      entries.insert(dir + "/" + name);
+      if (pEntry->d_type == DT_DIR)
+         ListTree(dir + "/" + name, entries);
+   }
+   closedir(pDir);
+}
+
+//--------------------------------------------------------------------------
+
+static void RemoveTree(const std::string& dir)
+{
+   DIR *pDir = opendir(dir.c_str());
+   if (pDir)
+   {
+      struct dirent *pEntry;
+      while ((pEntry = readdir(pDir)) != NULL)
+      {
+         std::string name = pEntry->d_name;
+         if (name == "." || name == "..")
+            continue;
+         if (pEntry->d_type == DT_DIR)
+            RemoveTree(dir + "/" + name);
+         else
+            unlink((dir + "/" + name).c_str());
+      }
+      closedir(pDir);
+   }
+   rmdir(dir.c_str());
+}
+
+//--------------------------------------------------------------------------
+
+static void MoveEntries(const std::string& oldDir, const std::string& newDir)
+{
+   // Move or, without a new directory, remove the entries within a directory
+   std::string prefix = oldDir + "/";
+   std::vector<std::string> moved;
+   tEntrySet::iterator it = gModel.lower_bound(prefix);
+   while (it != gModel.end() && it->compare(0, prefix.size(), prefix) == 0)
+   {
+      if (!newDir.empty())
+         moved.push_back(newDir + "/" + it->substr(prefix.size()));
+      gModel.erase(it++);
+   }
+   gModel.insert(moved.begin(), moved.end());
+}
+
+//--------------------------------------------------------------------------
+
+static void ApplyChanges(tDirChangeList *pChanges, unsigned int firstChange, void *)
+{
+   // Apply the reported changes to the model
+   std::lock_guard<std::mutex> guard(gLock);
+   unsigned int now = DirWatchTime();
+   if (now - firstChange > gMaxLatency)
+      gMaxLatency = now - firstChange;
+   gLastReport = now;
+   size_t i;
+   for (i = 0; i < pChanges->size(); i++)
+   {
+      const tDirChange& change = (*pChanges)[i];
+      switch (change.action)
+      {
+         case eDirOverflow:
+            gModel.clear();
+            ListTree(gRoot, gModel);
+            break;
+
+         case eDirAdded:
+            gModel.insert(change.path);
+            break;
+
+         case eDirRemoved:
+            gModel.erase(change.path);
+            MoveEntries(change.path, std::string());
+            break;
+
+         case eDirRenamed:
+            gModel.erase(change.oldPath);
+            gModel.insert(change.path);
+            MoveEntries(change.oldPath, change.path);
+            break;
+
+         default:
+            break;
+      }
+   }
+   delete pChanges;
+}
+
+//--------------------------------------------------------------------------
+
+static void WriteFile(const std::string& path)
+{
+   int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+   if (fd >= 0)
+   {
+      if (write(fd, "x", 1) != 1)
+         printf("Cannot write %s\n", path.c_str());
+      close(fd);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+   int files = argc > 1 ? atoi(argv[1]) : 100000,
+       debounce = argc > 2 ? atoi(argv[2]) : 250;
+   char dir[] = "/tmp/bench_dirwatch_XXXXXX";
+   if (!mkdtemp(dir))
+      return 1;
+   gRoot = std::string(dir) + "/root";
+   std::string outside = std::string(dir) + "/outside";
+   mkdir(gRoot.c_str(), 0755);
+   mkdir(outside.c_str(), 0755);
+
+   pDirWatcher pW = StartDirWatcher(ApplyChanges, NULL, debounce);
+   std::vector<tWatchPath> dirs(1, gRoot);
+   SetWatchedDirs(pW, dirs);
+   usleep(100000);
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   char name[64];
+   int d, i;
+   // Directories filled right after being created
+   for (d = 0; d < 10; d++)
+   {
+      sprintf(name, "/d%d", d);
+      mkdir((gRoot + name).c_str(), 0755);
+      for (i = 0; i < files/20; i++)
+      {
+         sprintf(name, "/d%d/f%d", d, i);
+         WriteFile(gRoot + name);
+      }
+   }
+   // Files created, half of them deleted and some renamed
+   for (i = 0; i < files/2; i++)
+   {
+      sprintf(name, "/g%d", i);
+      WriteFile(gRoot + name);
+   }
+   for (i = 0; i < files/2; i += 2)
+   {
+      sprintf(name, "/g%d", i);
+      unlink((gRoot + name).c_str());
+   }
+   for (i = 1; i < files/2; i += 10)
+   {
+      sprintf(name, "/g%d", i);
+      std::string from = gRoot + name;
+      sprintf(name, "/h%d", i);
+      rename(from.c_str(), (gRoot + name).c_str());
+   }
+   // A directory renamed and written to, another one moved out of the tree and deleted
+   rename((gRoot + "/d1").c_str(), (gRoot + "/e1").c_str());
+   WriteFile(gRoot + "/e1/late");
+   rename((gRoot + "/d2").c_str(), (outside + "/d2").c_str());
+   unsigned int opsEnd = DirWatchTime();
+   double opsTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   RemoveTree(outside + "/d2");
+
+   // Wait until the reports have stopped
+   while (true)
+   {
+      usleep(100000);
+      std::lock_guard<std::mutex> guard(gLock);
+      unsigned int now = DirWatchTime();
+      if ((int)(now - opsEnd) > QUIET_TIME && (int)(now - gLastReport) > QUIET_TIME)
+         break;
+   }
+   tDirWatchStats stats;
+   GetDirWatchStats(pW, stats);
+   EndDirWatcher(pW);
+
+   tEntrySet actual;
+   ListTree(gRoot, actual);
+   size_t missing = 0, extra = 0;
+   tEntrySet::iterator it;
+   for (it = actual.begin(); it != actual.end(); ++it)
+      missing += gModel.count(*it) == 0;
+   for (it = gModel.begin(); it != gModel.end(); ++it)
+      extra += actual.count(*it) == 0;
+   printf("%d files created, 30%% of them deleted or renamed, in %.0f ms, debounce %d ms\n", files, opsTime, debounce);
+   printf("Entries: %u in the tree, %u missing and %u in excess in the model\n",
+          (unsigned int)actual.size(), (unsigned int)missing, (unsigned int)extra);
+   printf("Changes: %u records, %u reported in %u batches, %u overflows\n",
+          stats.records, stats.reported, stats.batches, stats.overflows);
+   printf("Latency: last batch %d ms after the operations, at most %u ms after the first change of a batch\n",
+          (int)(gLastReport - opsEnd), gMaxLatency);
+   RemoveTree(dir);
+   return missing || extra ? 1 : 0;
+}
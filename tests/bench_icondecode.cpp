@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// bench_icondecode.cpp
+// Time per decoded icon of the icon decoder, for each file at the small and
+// large button sizes, including scaling to the exact size as LoadIcon does.
+//
+// Usage: bench_icondecode [.ico, .exe and .dll files]   (the fixtures and application icons by default)
+
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "icondecode.h"
+
+#define MIN_TIME 0.5      // Seconds to run each measurement at least
+
+//--------------------------------------------------------------------------
+
+static double TimeDecode(const std::vector<unsigned char>& data, int wantSize, bool& ok)
+{
+   // Microseconds per decode and scale of the first icon
+   tIconImage image, scaled;
+   size_t decoded = 0;
+   double secs = 0;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   while (secs < MIN_TIME)
+   {
+      ok = DecodeFileIcon(&data[0], data.size(), 0, wantSize, image);
+      if (ok)
+         ScaleIconImage(image, wantSize, scaled);
+      decoded++;
+      if (decoded % 16 == 0)
+         secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+   return secs * 1e6 / decoded;
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+   std::vector<std::string> paths;
+   int i;
+   for (i = 1; i < argc; i++)
+      paths.push_back(argv[i]);
+   if (paths.empty())
+   {
+      const char *names[] = { "sample32.dll", "sample64.dll", "mixed.ico", "../../src/main.ico", "../../src/menu.ico", "../../src/run.ico" };
+      for (i = 0; i < (int)(sizeof(names)/sizeof(names[0])); i++)
+         paths.push_back(std::string(FIXTURE_DIR) + names[i]);
+   }
+
+   size_t f;
+   printf("%-40s %8s %10s %10s\n", "File", "Bytes", "16 us", "32 us");
+   for (f = 0; f < paths.size(); f++)
+   {
+      FILE *pFile = fopen(paths[f].c_str(), "rb");
+      if (!pFile)
+         continue;
+      std::vector<unsigned char> data;
+      unsigned char buff[4096];
+      size_t len;
+      while ((len = fread(buff, 1, sizeof(buff), pFile)) > 0)
+         data.insert(data.end(), buff, buff + len);
+      fclose(pFile);
+      if (data.empty())
+         continue;
+
+      bool ok16, ok32;
+      double time16 = TimeDecode(data, 16, ok16), time32 = TimeDecode(data, 32, ok32);
+      std::string name = paths[f].substr(paths[f].find_last_of('/') + 1);
+      printf("%-40s %8u %10.2f %10.2f%s\n", name.c_str(), (unsigned int)data.size(), time16, time32, ok16 && ok32 ? "" : "  (failed)");
+   }
+   return 0;
+}
@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// bench_layout.cpp
+// Time of the layout computation done by SetupLayout and of the queries
+// done for each mouse message, in nanoseconds per call. The times include
+// spreading the positions over the window, a few nanoseconds.
+//
+// Usage: bench_layout [buttons]   (50 by default)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "layout.h"
+
+#define MIN_TIME 0.5      // Seconds to run each measurement at least
+#define BATCH 1024        // Calls between reading the clock
+
+// Sum of the results, so that the calls are not optimized away
+volatile long long gSink;
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+   unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 50;
+   tLayoutRect work[2] = { { 0, 0, 1920, 1040 }, { -1280, 100, 0, 1124 } };
+   tLayoutParams params;
+   params.center = true;
+   params.count = count;
+   params.iconSize = 32;
+   params.iconOffset = 5;
+   params.gap = 2;
+   params.margin = 2;
+   params.endSpace = 12;
+   params.dpi = 144;
+   params.workAreas = work;
+   params.workAreaCount = 2;
+   params.monitor = 1;
+
+   const char *names[] = { "Left", "Top", "Right", "Bottom" };
+   int edge, m;
+   printf("%u buttons, nanoseconds per call\n", count);
+   printf("%-8s %6s %10s %10s %10s %10s\n", "Edge", "Lines", "Layout", "Rect", "Hit test", "Drop");
+   for (edge = eEdgeLeft; edge <= eEdgeBottom; edge++)
+   {
+      params.edge = (tLayoutEdge)edge;
+      tLayout layout;
+      ComputeLayout(params, layout);
+      int width = layout.window.right - layout.window.left, height = layout.window.bottom - layout.window.top;
+      double times[4];
+      long long sum = 0;
+      for (m = 0; m < 4; m++)
+      {
+         size_t calls = 0;
+         double secs = 0;
+         unsigned int i = 0;
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+         while (secs < MIN_TIME)
+         {
+            int b;
+            for (b = 0; b < BATCH; b++, i++)
+            {
+               // Positions spread over the window
+               int x = (int)(i*7919 % (unsigned int)width), y = (int)(i*104729 % (unsigned int)height);
+               if (m == 0)
+               {
+                  params.count = count + (i & 1);
+                  sum += ComputeLayout(params, layout);
+               }
+               else if (m == 1)
+                  sum += LayoutButtonRect(layout, i % (count ? count : 1)).left;
+               else if (m == 2)
+                  sum += LayoutHitTest(layout, x, y);
+               else
+                  sum += LayoutInsertIndex(layout, x, y);
+            }
+            calls += BATCH;
+            secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         }
+         params.count = count;
+         ComputeLayout(params, layout);
+         times[m] = secs * 1e9 / calls;
+      }
+      gSink = sum;
+      printf("%-8s %6u %10.2f %10.2f %10.2f %10.2f\n", names[edge - 1], layout.lines, times[0], times[1], times[2], times[3]);
+   }
+   return 0;
+}
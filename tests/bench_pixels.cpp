@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// bench_pixels.cpp
+// Time of the pixel operations with each supported instruction set, on the
+// image sizes met when loading button icons.
+//
+// Usage: bench_pixels
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "pixels.h"
+
+#define MIN_TIME 0.5      // Seconds to run each measurement at least
+
+// Scaling measured
+typedef struct {
+   int srcSize;
+   int dstSize;
+   tScaleFilter filter;
+   const char *name;
+} tScaleCase;
+
+static const tScaleCase gScaleCases[] = {
+   { 256, 32, eScaleLanczos, "256 -> 32 Lanczos" },
+   { 48, 20, eScaleLanczos,  "48 -> 20 Lanczos" },
+   { 48, 24, eScaleBox,      "48 -> 24 box" },
+   { 16, 40, eScaleLanczos,  "16 -> 40 Lanczos" }
+};
+
+//--------------------------------------------------------------------------
+
+static double TimePerCall(void (*pOp)(unsigned int*, size_t), std::vector<unsigned int> pixels)
+{
+   // Microseconds per call of a pixel operation
+   size_t calls = 0;
+   double secs = 0;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   while (secs < MIN_TIME)
+   {
+      // Repeated on the same pixels, the time does not depend on their values
+      pOp(&pixels[0], pixels.size());
+      calls++;
+      secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+   return secs * 1e6 / calls;
+}
+
+//--------------------------------------------------------------------------
+
+static double TimeScale(const tScaleCase& c, const std::vector<unsigned int>& src)
+{
+   // Microseconds per scaling
+   std::vector<unsigned int> dst((size_t)c.dstSize * c.dstSize);
+   size_t calls = 0;
+   double secs = 0;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   while (secs < MIN_TIME)
+   {
+      ScalePixels(&src[0], c.srcSize, c.srcSize, &dst[0], c.dstSize, c.dstSize, c.filter);
+      calls++;
+      secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+   return secs * 1e6 / calls;
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   const char *names[] = { "scalar", "SSE2", "AVX2" };
+   tPixelIsa supported = SetPixelIsa(ePixelAvx2);
+   std::vector<unsigned int> pixels(256*256);
+   size_t i;
+   srand(1);
+   for (i = 0; i < pixels.size(); i++)
+      pixels[i] = ((unsigned int)rand() << 16) ^ (unsigned int)rand();
+   std::vector<unsigned int> premultiplied = pixels;
+
+   printf("%-20s", "Microseconds");
+   int isa;
+   size_t c;
+   for (isa = ePixelScalar; isa <= supported; isa++)
+      printf(" %10s", names[isa]);
+   printf("\n%-20s", "Premultiply 256x256");
+   for (isa = ePixelScalar; isa <= supported; isa++)
+   {
+      SetPixelIsa((tPixelIsa)isa);
+      printf(" %10.2f", TimePerCall(PremultiplyPixels, pixels));
+   }
+   printf("\n%-20s", "Gray 256x256");
+   for (isa = ePixelScalar; isa <= supported; isa++)
+   {
+      SetPixelIsa((tPixelIsa)isa);
+      printf(" %10.2f", TimePerCall(GrayPixels, pixels));
+   }
+   PremultiplyPixels(&premultiplied[0], premultiplied.size());
+   for (c = 0; c < sizeof(gScaleCases)/sizeof(gScaleCases[0]); c++)
+   {
+      printf("\n%-20s", gScaleCases[c].name);
+      for (isa = ePixelScalar; isa <= supported; isa++)
+      {
+         SetPixelIsa((tPixelIsa)isa);
+         printf(" %10.2f", TimeScale(gScaleCases[c], premultiplied));
+      }
+   }
+   printf("\n");
+   return 0;
+}
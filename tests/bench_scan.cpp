@@ -0,0 +1,302 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// bench_scan.cpp
+// Proxy benchmark of the scan of overlaid folder trees as done by ScanDir,
+// with the listings of the roots and of sibling directories taken one after
+// the other or by a bounded pool of workers. Only the merging uses shipped
+// code, the merge engine. EnumDir and the task pool are Win32, so they are
+// stood in for by readdir and lstat and by std::thread workers, and the
+// times show the effect of overlapping the listings, not those of the
+// application. A delay per listing models a slow volume, e.g. the roaming
+// profile holding the user Start Menu.
+//
+// Usage: bench_scan [delay per listing in us] [workers]
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dirmerge.h"
+
+#define TOP_DIRS 20      // Folders in each root
+#define SUB_DIRS 10      // Folders in each top folder
+#define SUB_FILES 48     // Shortcuts in each sub folder
+#define MAX_WORKERS 8    // As MAX_POOL_THREADS of the task pool
+#define RUNS 5
+
+// Listing of one directory
+typedef struct {
+   std::string dir;
+   std::vector<std::string> names;
+   std::vector<bool> isDir;
+} tListing;
+
+// Merged folder, its directory and the overlaid ones
+typedef std::vector<std::string> tFolder;
+
+static unsigned int gDelay = 0;
+static unsigned int gWorkers = 1;
+
+//--------------------------------------------------------------------------
+
+static void MakeFile(const std::string& path)
+{
+   int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644);
+   if (fd >= 0)
+      close(fd);
+}
+
+//--------------------------------------------------------------------------
+
+static size_t MakeTree(const std::string& base)
+{
+   // Create two overlaid roots, half of the top folders of the second root have
+   // the same names as ones of the first root. Returns the number of entries.
+   size_t entries = 0;
+   int r, i, j, k;
+   for (r = 0; r < 2; r++)
+   {
+      std::string root = base + (r ? "/user" : "/machine");
+      mkdir(root.c_str(), 0755);
+      for (i = 0; i < TOP_DIRS; i++)
+      {
+         std::string top = root + "/Folder " + std::to_string(i + r*TOP_DIRS/2);
+         mkdir(top.c_str(), 0755);
+         entries++;
+         for (j = 0; j < SUB_DIRS; j++)
+         {
+            std::string sub = top + "/Sub " + std::to_string(j);
+            mkdir(sub.c_str(), 0755);
+            entries++;
+            for (k = 0; k < SUB_FILES; k++, entries++)
+               MakeFile(sub + "/App " + std::to_string(r) + "-" + std::to_string(k) + ".lnk");
+         }
+      }
+   }
+   return entries;
+}
+
+//--------------------------------------------------------------------------
+
+static void ListDir(tListing& list)
+{
+   // List a directory with the attributes of each entry, as EnumDir does
+   if (gDelay)
+      std::this_thread::sleep_for(std::chrono::microseconds(gDelay));
+   DIR *pDir = opendir(list.dir.c_str());
+   if (!pDir)
+      return;
+   struct dirent *pEntry;
+   while ((pEntry = readdir(pDir)) != NULL)
+   {
+      if (pEntry->d_name[0] == '.')
+         continue;
+      struct stat st;
+      if (lstat((list.dir + "/" + pEntry->d_name).c_str(), &st) != 0)
+         continue;
+      list.names.push_back(pEntry->d_name);
+      list.isDir.push_back(S_ISDIR(st.st_mode));
+   }
+   closedir(pDir);
+}
+
+//--------------------------------------------------------------------------
+
+static void ListWorker(std::vector<tListing> *pLists, std::atomic<size_t> *pNext)
+{
+   // Take the next directory to list until all are done
+   size_t i;
+   while ((i = (*pNext)++) < pLists->size())
+      ListDir((*pLists)[i]);
+}
+
+//--------------------------------------------------------------------------
+
+static void ListDirs(std::vector<tListing>& lists, bool parallel)
+{
+   // List the directories in turn or with the worker pool
+   if (!parallel || gWorkers < 2)
+   {
+      size_t i;
+      for (i = 0; i < lists.size(); i++)
+         ListDir(lists[i]);
+      return;
+   }
+   std::atomic<size_t> next(0);
+   std::vector<std::thread> threads;
+   unsigned int i;
+   for (i = 1; i < gWorkers && i < lists.size(); i++)
+      threads.push_back(std::thread(ListWorker, &lists, &next));
+   ListWorker(&lists, &next);
+   for (i = 0; i < threads.size(); i++)
+      threads[i].join();
+}
+
+//--------------------------------------------------------------------------
+
+static unsigned long long MergeFolder(const std::vector<tListing>& lists, size_t first, size_t cnt, std::vector<tFolder>& subFolders)
+{
+   // Merge the listings of a folder, add its merged sub folders and return a hash of the merged entries in order
+   std::vector<tMergeRoot> roots(cnt);
+   size_t r, i;
+   for (r = 0; r < cnt; r++)
+   {
+      const tListing& list = lists[first + r];
+      tMergeRoot& root = roots[r];
+      root.items.resize(list.names.size());
+      for (i = 0; i < list.names.size(); i++)
+      {
+         root.items[i].name.assign(list.names[i].begin(), list.names[i].end());
+         root.items[i].keyPos = (unsigned int)root.keys.size();
+         root.items[i].isDir = list.isDir[i];
+         root.items[i].tag = (unsigned int)i;
+         // The upper case fallback of AddSortKey
+         const char *pName;
+         for (pName = list.names[i].c_str(); *pName; pName++)
+            root.keys.push_back((unsigned char)toupper(*pName));
+         root.keys.push_back(0);
+      }
+      SortMergeRoot(root);
+   }
+   tMergedList merged;
+   MergeRoots(roots, merged);
+
+   unsigned long long hash = 14695981039346656037ULL;
+   for (i = 0; i < merged.size(); i++)
+   {
+      const tMergeRef& ref = merged[i].item;
+      const tListing& list = lists[first + ref.root];
+      const tMergeItem& item = roots[ref.root].items[ref.index];
+      hash = (hash ^ MergeNameHash(item.name)) * 1099511628211ULL;
+      if (!item.isDir)
+         continue;
+      tFolder sub(1, list.dir + "/" + list.names[item.tag]);
+      for (r = 0; r < merged[i].overlays.size(); r++)
+      {
+         const tMergeRef& over = merged[i].overlays[r];
+         sub.push_back(lists[first + over.root].dir + "/" + lists[first + over.root].names[roots[over.root].items[over.index].tag]);
+      }
+      subFolders.push_back(sub);
+   }
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+static unsigned long long ScanTree(const tFolder& top, bool parallel, size_t& entries)
+{
+   // Scan all folders of the merged tree level by level, listing all directories of a level
+   // at once. Returns the sum of the hashes of the folders, which does not depend on the order.
+   std::vector<tFolder> level(1, top);
+   unsigned long long hash = 0;
+   entries = 0;
+   while (!level.empty())
+   {
+      std::vector<tListing> lists;
+      size_t f, d;
+      for (f = 0; f < level.size(); f++)
+         for (d = 0; d < level[f].size(); d++)
+         {
+            lists.push_back(tListing());
+            lists.back().dir = level[f][d];
+         }
+      ListDirs(lists, parallel);
+      for (d = 0; d < lists.size(); d++)
+         entries += lists[d].names.size();
+
+      std::vector<tFolder> next;
+      size_t first = 0;
+      for (f = 0; f < level.size(); f++)
+      {
+         hash += MergeFolder(lists, first, level[f].size(), next);
+         first += level[f].size();
+      }
+      level.swap(next);
+   }
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+static double TimeScan(const tFolder& top, bool parallel, unsigned long long& hash, size_t& entries)
+{
+   // Best time of the runs in ms
+   double best = 0;
+   int i;
+   for (i = 0; i < RUNS; i++)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      hash = ScanTree(top, parallel, entries);
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      if (!i || ms < best)
+         best = ms;
+   }
+   return best;
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+   gDelay = argc > 1 ? atoi(argv[1]) : 0;
+   gWorkers = std::thread::hardware_concurrency()*2;
+   if (argc > 2)
+      gWorkers = atoi(argv[2]);
+   if (gWorkers < 1)
+      gWorkers = 1;
+   if (gWorkers > MAX_WORKERS)
+      gWorkers = MAX_WORKERS;
+
+   char base[] = "/tmp/bench_scan_XXXXXX";
+   if (!mkdtemp(base))
+      return 1;
+   size_t created = MakeTree(base);
+   tFolder top;
+   top.push_back(std::string(base) + "/machine");
+   top.push_back(std::string(base) + "/user");
+
+   unsigned long long serialHash, parallelHash;
+   size_t serialEntries, parallelEntries;
+   double serial = TimeScan(top, false, serialHash, serialEntries);
+   double parallel = TimeScan(top, true, parallelHash, parallelEntries);
+   printf("Proxy of ScanDir: readdir listings on std::thread workers, not EnumDir and the task pool\n");
+   printf("%u entries, %u us per listing, %u workers: serial %.1f ms, parallel %.1f ms, speedup %.2f\n",
+          (unsigned int)created, gDelay, gWorkers, serial, parallel, serial / parallel);
+
+   std::string cmd = std::string("rm -rf ") + base;
+   if (system(cmd.c_str()) != 0)
+      return 1;
+   if (serialHash != parallelHash || serialEntries != created || parallelEntries != created)
+   {
+      printf("Scans differ\n");
+      return 1;
+   }
+   return 0;
+}
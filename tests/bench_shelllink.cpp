@@ -0,0 +1,127 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// bench_shelllink.cpp
+// Throughput of the Shell Link parser in files per second, parsing files
+// already in memory and mapping each file as GetShortcutInfo does.
+//
+// Usage: bench_shelllink [.lnk files]   (the fixtures by default)
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "shelllink.h"
+
+#define MIN_TIME 1.0      // Seconds to run each measurement at least
+
+//--------------------------------------------------------------------------
+
+static bool ParseMapped(const char *path, tShellLink& link)
+{
+   // Map a file and parse it
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return false;
+   struct stat st;
+   bool ok = false;
+   if (fstat(fd, &st) == 0 && st.st_size > 0)
+   {
+      void *pData = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (pData != MAP_FAILED)
+      {
+         ok = ParseShellLink((const unsigned char*)pData, st.st_size, link);
+         munmap(pData, st.st_size);
+      }
+   }
+   close(fd);
+   return ok;
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+   std::vector<std::string> paths;
+   int i;
+   for (i = 1; i < argc; i++)
+      paths.push_back(argv[i]);
+   if (paths.empty())
+   {
+      const char *names[] = { "idlist.lnk", "local.lnk", "unicode.lnk", "network.lnk", "env.lnk", "ansi.lnk", "nonfs.lnk" };
+      for (i = 0; i < (int)(sizeof(names)/sizeof(names[0])); i++)
+         paths.push_back(std::string(FIXTURE_DIR) + names[i]);
+   }
+
+   std::vector<std::vector<unsigned char> > files;
+   size_t f, bytes = 0;
+   for (f = 0; f < paths.size(); f++)
+   {
+      FILE *pFile = fopen(paths[f].c_str(), "rb");
+      if (!pFile)
+         continue;
+      std::vector<unsigned char> data;
+      unsigned char buff[4096];
+      size_t len;
+      while ((len = fread(buff, 1, sizeof(buff), pFile)) > 0)
+         data.insert(data.end(), buff, buff + len);
+      fclose(pFile);
+      if (!data.empty())
+      {
+         bytes += data.size();
+         files.push_back(data);
+      }
+   }
+   if (files.empty())
+   {
+      printf("No files\n");
+      return 1;
+   }
+
+   tShellLink link;
+   size_t parsed = 0, valid = 0;
+   double secs = 0;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   while (secs < MIN_TIME)
+   {
+      for (f = 0; f < files.size(); f++, parsed++)
+         valid += ParseShellLink(&files[f][0], files[f].size(), link);
+      secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+   printf("%u files, %u bytes, %u valid\n", (unsigned int)files.size(), (unsigned int)bytes, (unsigned int)(valid * files.size() / parsed));
+   printf("In memory: %.0f files/s\n", parsed / secs);
+
+   parsed = 0;
+   secs = 0;
+   start = std::chrono::steady_clock::now();
+   while (secs < MIN_TIME)
+   {
+      for (f = 0; f < paths.size(); f++, parsed++)
+         ParseMapped(paths[f].c_str(), link);
+      secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   }
+   printf("Mapped:    %.0f files/s\n", parsed / secs);
+   return 0;
+}
@@ -0,0 +1,40 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// check.h
+// Checks of the unit tests. A failed check is reported and counted, and the
+// test returns the result of CHECK_RESULT from main.
+
+#pragma once
+
+#include <stdio.h>
+
+static int gCheckFailures = 0;
+
+#define CHECK(cond) \
+   do { \
+      if (!(cond)) \
+      { \
+         printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #cond); \
+         gCheckFailures++; \
+      } \
+   } while (0)
+
+#define CHECK_RESULT() (gCheckFailures ? (printf("%d checks failed\n", gCheckFailures), 1) : (printf("All checks passed\n"), 0))
@@ -0,0 +1,333 @@
+# Generates the icon fixtures of test_icondecode and bench_icondecode:
+#
+#   png_cases.bin      PNG images of all color types, depths and interlacing, each
+#                      followed by the expected premultiplied pixels
+#   mixed.ico          Icon file with a 64x64 PNG image and a 16x16 bitmap image
+#   sample32.dll       PE32 and PE32+ libraries without code holding the icons of
+#   sample64.dll       src/main.ico (id 101) and src/run.ico (id 102) as resources
+#   ico_expected.bin   Size and 64 bit FNV-1a hash of the expected pixels of the image
+#                      of each icon file picked for 16, 32 and 48 pixels, decoded by
+#                      the reference code below
+#
+# Usage: python3 mkicons.py   (run in tests/fixtures)
+
+import glob
+import os
+import random
+import struct
+import zlib
+
+random.seed(1)
+
+SRC_DIR = os.path.join('..', '..', 'src')
+WANT_SIZES = (16, 32, 48)
+
+
+def premultiply(r, g, b, a):
+    if a < 255:
+        r, g, b = ((c * a + 127) // 255 for c in (r, g, b))
+    return (a << 24) | (r << 16) | (g << 8) | b
+
+
+def pixel_bytes(pixels):
+    return b''.join(struct.pack('<I', p) for p in pixels)
+
+
+def pixel_hash(pixels):
+    h = 14695981039346656037
+    for c in pixel_bytes(pixels):
+        h = ((h ^ c) * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+# PNG ----------------------------------------------------------------------
+
+PASSES = [(0, 0, 8, 8), (4, 0, 8, 8), (0, 4, 4, 8), (2, 0, 4, 4), (0, 2, 2, 4), (1, 0, 2, 2), (0, 1, 1, 2)]
+
+
+def png_chunk(kind, data):
+    return struct.pack('>I', len(data)) + kind + data + struct.pack('>I', zlib.crc32(kind + data) & 0xFFFFFFFF)
+
+
+def make_png(color_type, depth, width, height, interlace, level):
+    # Random image, returns the PNG file and the expected pixels
+    channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}[color_type]
+    max_value = (1 << depth) - 1
+    palette = trns = key = None
+    if color_type == 3:
+        palette = [tuple(random.randrange(256) for _ in range(3)) for _ in range(1 << depth)]
+        trns = [random.randrange(256) for _ in range(len(palette) // 2)]
+    samples = [[[random.randrange(max_value + 1) for _ in range(channels)] for x in range(width)] for y in range(height)]
+    if color_type in (0, 2) and random.random() < 0.7:
+        key = list(samples[0][0])
+
+    expected = []
+    for y in range(height):
+        for x in range(width):
+            s = samples[y][x]
+            v = [c >> 8 if depth == 16 else c * 255 // max_value for c in s]
+            if color_type == 0:
+                p = premultiply(v[0], v[0], v[0], 0 if key and s == key else 255)
+            elif color_type == 2:
+                p = premultiply(v[0], v[1], v[2], 0 if key and s == key else 255)
+            elif color_type == 3:
+                r, g, b = palette[s[0]]
+                p = premultiply(r, g, b, trns[s[0]] if s[0] < len(trns) else 255)
+            elif color_type == 4:
+                p = premultiply(v[0], v[0], v[0], v[1])
+            else:
+                p = premultiply(*v)
+            expected.append(p)
+
+    def row_bytes(row):
+        out = bytearray()
+        if depth >= 8:
+            for s in row:
+                for c in s:
+                    out += c.to_bytes(depth // 8, 'big')
+        else:
+            acc = bits = 0
+            for s in row:
+                acc = (acc << depth) | s[0]
+                bits += depth
+                if bits == 8:
+                    out.append(acc)
+                    acc = bits = 0
+            if bits:
+                out.append(acc << (8 - bits))
+        return bytes(out)
+
+    bpp = max(1, depth * channels // 8)
+
+    def filter_row(row, prev):
+        kind = random.randrange(5)
+        out = bytearray([kind])
+        for i, c in enumerate(row):
+            a = row[i - bpp] if i >= bpp else 0
+            b = prev[i] if prev else 0
+            cc = prev[i - bpp] if prev and i >= bpp else 0
+            if kind == 0:
+                pred = 0
+            elif kind == 1:
+                pred = a
+            elif kind == 2:
+                pred = b
+            elif kind == 3:
+                pred = (a + b) // 2
+            else:
+                p = a + b - cc
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - cc)
+                pred = a if pa <= pb and pa <= pc else (b if pb <= pc else cc)
+            out.append((c - pred) & 255)
+        return out
+
+    raw = bytearray()
+    for (xs, ys, dx, dy) in (PASSES if interlace else [(0, 0, 1, 1)]):
+        if width <= xs or height <= ys:
+            continue
+        prev = None
+        for y in range(ys, height, dy):
+            row = row_bytes([samples[y][x] for x in range(xs, width, dx)])
+            raw += filter_row(row, prev)
+            prev = row
+
+    data = b'\x89PNG\r\n\x1a\n' + png_chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, depth, color_type, 0, 0, interlace))
+    if color_type == 3:
+        data += png_chunk(b'PLTE', b''.join(bytes(c) for c in palette)) + png_chunk(b'tRNS', bytes(trns))
+    if key:
+        data += png_chunk(b'tRNS', b''.join(c.to_bytes(2, 'big') for c in key))
+    z = zlib.compress(bytes(raw), level)
+    # Image data split over two chunks
+    half = len(z) // 2
+    data += png_chunk(b'IDAT', z[:half]) + png_chunk(b'IDAT', z[half:]) + png_chunk(b'IEND', b'')
+    return data, expected
+
+
+# Icon files ---------------------------------------------------------------
+
+def read_icon_dir(data, entry_size):
+    # Entries of an icon directory: size, bit count, data size, location
+    count = struct.unpack('<H', data[4:6])[0]
+    entries = []
+    for i in range(count):
+        e = data[6 + i * entry_size:6 + (i + 1) * entry_size]
+        colors, bit_count = e[2], struct.unpack('<H', e[6:8])[0]
+        if not bit_count:
+            bit_count = 1 if colors == 2 else 4 if colors == 16 else 8 if colors else 32
+        location = struct.unpack('<I', e[12:16])[0] if entry_size == 16 else struct.unpack('<H', e[12:14])[0]
+        entries.append((e[0] or 256, bit_count, struct.unpack('<I', e[8:12])[0], location))
+    return entries
+
+
+def pick_icon(entries, want):
+    # The smallest image not smaller than wanted, else the largest, preferring the deepest colors
+    best = 0
+    for i in range(1, len(entries)):
+        e, b = entries[i], entries[best]
+        e_fits, b_fits = e[0] >= want, b[0] >= want
+        if e_fits != b_fits:
+            better = e_fits
+        elif e[0] != b[0]:
+            better = e[0] < b[0] if e_fits else e[0] > b[0]
+        else:
+            better = e[1] > b[1]
+        if better:
+            best = i
+    return best
+
+
+def decode_bitmap(data):
+    # Reference decoding of an icon bitmap with its mask
+    hdr_size, width, height2, _, bit_count, _, _, _, _, clr_used, _ = struct.unpack('<IiiHHIIiiII', data[:40])
+    height = height2 // 2
+    colors = (clr_used if clr_used and clr_used < (1 << bit_count) else 1 << bit_count) if bit_count <= 8 else 0
+    palette = data[hdr_size:hdr_size + colors * 4]
+    stride = (width * bit_count + 31) // 32 * 4
+    mask_stride = (width + 31) // 32 * 4
+    bits = hdr_size + colors * 4
+    mask = bits + stride * height
+    has_alpha = bit_count == 32 and any(data[bits + y * stride + x * 4 + 3] for y in range(height) for x in range(width))
+    pixels = []
+    for y in range(height):
+        row = bits + (height - 1 - y) * stride
+        mask_row = mask + (height - 1 - y) * mask_stride
+        for x in range(width):
+            a = 255
+            if bit_count <= 8:
+                bit = x * bit_count
+                index = (data[row + bit // 8] >> (8 - bit_count - bit % 8)) & ((1 << bit_count) - 1)
+                b, g, r = palette[index * 4:index * 4 + 3]
+            else:
+                c = row + x * (bit_count // 8)
+                b, g, r = data[c:c + 3]
+                if has_alpha:
+                    a = data[c + 3]
+            if not has_alpha and data[mask_row + x // 8] & (0x80 >> (x % 8)):
+                a = 0
+            pixels.append(premultiply(r, g, b, a))
+    return width, height, pixels
+
+
+def icon_file(images):
+    # Icon file of (size, bit count, image data) entries
+    data = struct.pack('<HHH', 0, 1, len(images))
+    offset = 6 + 16 * len(images)
+    body = b''
+    for size, bit_count, image in images:
+        data += struct.pack('<BBBBHHII', size % 256, size % 256, 0, 0, 1, bit_count, len(image), offset + len(body))
+        body += image
+    return data + body
+
+
+# PE files -----------------------------------------------------------------
+
+def resource_section(groups, rva):
+    # Resource directory of icon groups, each a list of (size, bit count, image data)
+    icons, group_data = [], []
+    for group_id, images in groups:
+        data = struct.pack('<HHH', 0, 1, len(images))
+        for size, bit_count, image in images:
+            icons.append((len(icons) + 1, image))
+            data += struct.pack('<BBBBHHIH', size % 256, size % 256, 0, 0, 1, bit_count, len(image), len(icons))
+        group_data.append((group_id, data))
+    types = [(3, icons), (14, group_data)]
+
+    def directory(count):
+        return struct.pack('<IIHHHH', 0, 0, 0, 0, 0, count)
+
+    # Directories first, then the data entries, then the data
+    dir_size = 16 + 8 * len(types) + sum(16 + 8 * len(res) + len(res) * (16 + 8) for _, res in types)
+    entry_size = 16 * sum(len(res) for _, res in types)
+    root = directory(len(types))
+    name_dirs = b''
+    lang_dirs = b''
+    entries = b''
+    blobs = b''
+    pos = 16 + 8 * len(types)
+    lang_pos = pos + sum(16 + 8 * len(res) for _, res in types)
+    for type_id, res in types:
+        root += struct.pack('<II', type_id, 0x80000000 | (pos + len(name_dirs)))
+        names = directory(len(res))
+        for res_id, data in res:
+            names += struct.pack('<II', res_id, 0x80000000 | (lang_pos + len(lang_dirs)))
+            lang_dirs += directory(1) + struct.pack('<II', 0x409, dir_size + len(entries))
+            entries += struct.pack('<IIII', rva + dir_size + entry_size + len(blobs), len(data), 0, 0)
+            blobs += data + b'\0' * (-len(data) % 8)
+        name_dirs += names
+    section = root + name_dirs + lang_dirs
+    assert len(section) == dir_size
+    return section + entries + blobs
+
+
+def pe_file(groups, pe32_plus):
+    section_rva, file_align, section_align = 0x1000, 0x200, 0x1000
+    rsrc = resource_section(groups, section_rva)
+    raw_size = (len(rsrc) + file_align - 1) // file_align * file_align
+    opt_size = 240 if pe32_plus else 224
+    image_size = section_rva + (len(rsrc) + section_align - 1) // section_align * section_align
+
+    coff = struct.pack('<HHIIIHH', 0x8664 if pe32_plus else 0x14C, 1, 0, 0, 0, opt_size, 0x2102 if not pe32_plus else 0x2022)
+    if pe32_plus:
+        opt = struct.pack('<HBBIIIII', 0x20B, 12, 0, 0, raw_size, 0, 0, 0x1000)
+        opt += struct.pack('<QII', 0x180000000, section_align, file_align)
+    else:
+        opt = struct.pack('<HBBIIIIII', 0x10B, 12, 0, 0, raw_size, 0, 0, 0x1000, 0x1000)
+        opt += struct.pack('<III', 0x10000000, section_align, file_align)
+    opt += struct.pack('<HHHHHHI', 6, 0, 0, 0, 6, 0, 0)
+    opt += struct.pack('<IIIHH', image_size, file_align, 0, 2, 0x140)
+    if pe32_plus:
+        opt += struct.pack('<QQQQII', 0x100000, 0x1000, 0x100000, 0x1000, 0, 16)
+    else:
+        opt += struct.pack('<IIIIII', 0x100000, 0x1000, 0x100000, 0x1000, 0, 16)
+    dirs = [(0, 0)] * 16
+    dirs[2] = (section_rva, len(rsrc))
+    opt += b''.join(struct.pack('<II', *d) for d in dirs)
+    assert len(opt) == opt_size
+
+    section = b'.rsrc\0\0\0' + struct.pack('<IIIIIIHHI', len(rsrc), section_rva, raw_size, file_align, 0, 0, 0, 0, 0x40000040)
+    dos = b'MZ' + b'\0' * 58 + struct.pack('<I', 0x40)
+    headers = dos + b'PE\0\0' + coff + opt + section
+    headers += b'\0' * (file_align - len(headers))
+    return headers + rsrc + b'\0' * (raw_size - len(rsrc))
+
+
+def icon_images(data):
+    # The (size, bit count, image data) entries of an icon file
+    return [(e[0], e[1], data[e[3]:e[3] + e[2]]) for e in read_icon_dir(data, 16)]
+
+
+# Fixtures -----------------------------------------------------------------
+
+cases = b''
+for color_type, depths in [(0, [1, 2, 4, 8, 16]), (2, [8, 16]), (3, [1, 2, 4, 8]), (4, [8, 16]), (6, [8, 16])]:
+    for depth in depths:
+        for interlace in (0, 1):
+            width, height = random.choice([1, 3, 7, 16, 20]), random.choice([1, 5, 16, 19])
+            png, expected = make_png(color_type, depth, width, height, interlace, random.choice([0, 1, 9]))
+            cases += struct.pack('<I', len(png)) + png + struct.pack('<II', width, height) + pixel_bytes(expected)
+open('png_cases.bin', 'wb').write(cases)
+
+expected = {}
+help_icon = open(os.path.join(SRC_DIR, 'help.ico'), 'rb').read()
+png, png_pixels = make_png(6, 8, 64, 64, 0, 9)
+open('mixed.ico', 'wb').write(icon_file([(64, 32, png)] + icon_images(help_icon)))
+
+for path in sorted(glob.glob(os.path.join(SRC_DIR, '*.ico'))) + ['mixed.ico']:
+    data = open(path, 'rb').read()
+    entries = read_icon_dir(data, 16)
+    for want in WANT_SIZES:
+        size, _, length, location = entries[pick_icon(entries, want)]
+        image = data[location:location + length]
+        if image[:8] == b'\x89PNG\r\n\x1a\n':
+            width = height = 64
+            pixels = png_pixels
+        else:
+            width, height, pixels = decode_bitmap(image)
+        name = os.path.basename(path).encode()
+        expected[(name, want)] = struct.pack('<I', len(name)) + name + struct.pack('<IIIQ', want, width, height, pixel_hash(pixels))
+open('ico_expected.bin', 'wb').write(b''.join(expected[k] for k in sorted(expected)))
+
+groups = [(101, icon_images(open(os.path.join(SRC_DIR, 'main.ico'), 'rb').read())),
+          (102, icon_images(open(os.path.join(SRC_DIR, 'run.ico'), 'rb').read()))]
+open('sample32.dll', 'wb').write(pe_file(groups, False))
+open('sample64.dll', 'wb').write(pe_file(groups, True))
@@ -0,0 +1,172 @@
+# Generates the .lnk fixtures of test_shelllink, laid out as specified in
+# [MS-SHLLINK]. Each fixture exercises one way a target path is stored.
+#
+# Usage: python3 mklnk.py   (writes the files to the current directory)
+
+import struct
+
+LINK_CLSID = bytes([0x01, 0x14, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46])
+MY_COMPUTER = bytes([0x20, 0xD0, 0x4F, 0xE0, 0x3A, 0xEA, 0x10, 0x69, 0xA2, 0xD8, 0x08, 0x00, 0x2B, 0x30, 0x30, 0x9D])
+CONTROL_PANEL = bytes([0x21, 0xEC, 0x20, 0x20, 0x3A, 0xEA, 0x10, 0x69, 0xA2, 0xDD, 0x08, 0x00, 0x2B, 0x30, 0x30, 0x9D])
+
+HAS_ID_LIST = 0x1
+HAS_LINK_INFO = 0x2
+HAS_NAME = 0x4
+HAS_RELATIVE_PATH = 0x8
+HAS_WORKING_DIR = 0x10
+HAS_ARGUMENTS = 0x20
+HAS_ICON_LOCATION = 0x40
+IS_UNICODE = 0x80
+HAS_EXP_STRING = 0x200
+HAS_EXP_ICON = 0x4000
+
+
+def utf16z(s):
+    return s.encode('utf-16-le') + b'\0\0'
+
+
+def header(flags, attributes=0x20, icon_index=0, show=1):
+    data = struct.pack('<I', 0x4C) + LINK_CLSID + struct.pack('<II', flags, attributes)
+    data += b'\0' * 24 + struct.pack('<IiI', 0x1234, icon_index, show) + b'\0' * 12
+    assert len(data) == 0x4C
+    return data
+
+
+def root_item(clsid):
+    return struct.pack('<HBB', 20, 0x1F, 0x50) + clsid
+
+
+def drive_item(drive):
+    body = b'\x2F' + drive.encode('ascii') + b'\0' + b'\0' * 19
+    return struct.pack('<H', len(body) + 2) + body
+
+
+def file_item(short, long_name, is_dir):
+    # File entry with the long name in a version 9 extension block
+    body = struct.pack('<BBIIH', 0x31 if is_dir else 0x32, 0, 0, 0, 0x10) + short.encode('ascii') + b'\0'
+    if len(body) % 2:
+        body += b'\0'
+    ext_off = len(body) + 2
+    ext = struct.pack('<HHI', 0, 9, 0xBEEF0004) + b'\0' * 8 + struct.pack('<H', 0x2E) + b'\0' * 18
+    ext += b'\0' * 2 + b'\0' * 4 + b'\0' * 4 + utf16z(long_name) + struct.pack('<H', 0)
+    ext = struct.pack('<H', len(ext)) + ext[2:]
+    item = body + ext
+    return struct.pack('<H', len(item) + 4) + item + struct.pack('<H', ext_off)
+
+
+def id_list(items):
+    data = b''.join(items) + b'\0\0'
+    return struct.pack('<H', len(data)) + data
+
+
+def link_info_local(base, suffix='', unicode=False):
+    volume = struct.pack('<IIII', 0x11, 3, 0x1A2B3C4D, 0x10) + b'\0'
+    header_size = 0x24 if unicode else 0x1C
+    volume_off = header_size
+    base_off = volume_off + len(volume)
+    base_a = base.encode('latin-1', 'replace') + b'\0'
+    suffix_off = base_off + len(base_a)
+    suffix_a = suffix.encode('latin-1', 'replace') + b'\0'
+    tail = volume + base_a + suffix_a
+    offsets = struct.pack('<IIIII', 0x1, volume_off, base_off, 0, suffix_off)
+    if unicode:
+        base_u_off = header_size + len(tail)
+        tail += utf16z(base)
+        suffix_u_off = header_size + len(tail)
+        tail += utf16z(suffix)
+        offsets += struct.pack('<II', base_u_off, suffix_u_off)
+    body = struct.pack('<I', header_size) + offsets + tail
+    return struct.pack('<I', len(body) + 4) + body
+
+
+def link_info_network(share, suffix):
+    net_name = share.encode('ascii') + b'\0'
+    net = struct.pack('<IIIII', 0, 0x2, 0x14, 0, 0x00020000) + net_name
+    net = struct.pack('<I', len(net)) + net[4:]
+    header_size = 0x1C
+    net_off = header_size
+    suffix_off = net_off + len(net)
+    body = struct.pack('<IIIIII', header_size, 0x2, 0, 0, net_off, suffix_off) + net + suffix.encode('ascii') + b'\0'
+    return struct.pack('<I', len(body) + 4) + body
+
+
+def string_data(strings, unicode=True):
+    data = b''
+    for s in strings:
+        if unicode:
+            data += struct.pack('<H', len(s)) + s.encode('utf-16-le')
+        else:
+            data += struct.pack('<H', len(s)) + s.encode('latin-1')
+    return data
+
+
+def env_block(sig, path):
+    data = struct.pack('<II', 0x314, sig)
+    data += path.encode('ascii').ljust(260, b'\0') + path.encode('utf-16-le').ljust(520, b'\0')
+    assert len(data) == 0x314
+    return data
+
+
+def extra_end():
+    return struct.pack('<I', 0)
+
+
+def write(name, data):
+    with open(name, 'wb') as f:
+        f.write(data)
+
+
+# Target in the id list only, description and icon location
+flags = HAS_ID_LIST | HAS_NAME | HAS_ICON_LOCATION | IS_UNICODE
+write('idlist.lnk', header(flags, icon_index=3) +
+      id_list([root_item(MY_COMPUTER), drive_item('C:\\'),
+               file_item('PROGRA~1', 'Program Files', True), file_item('MYAPP~1.EXE', 'My App.exe', False)]) +
+      string_data(['Start My App', '%SystemRoot%\\system32\\shell32.dll']) + extra_end())
+
+# Local link info preferred over the id list, with all string data
+flags = HAS_ID_LIST | HAS_LINK_INFO | HAS_NAME | HAS_RELATIVE_PATH | HAS_WORKING_DIR | HAS_ARGUMENTS | IS_UNICODE
+write('local.lnk', header(flags, show=3) +
+      id_list([root_item(MY_COMPUTER), drive_item('C:\\'), file_item('WINDOWS', 'Windows', True)]) +
+      link_info_local('C:\\Windows\\System32\\notepad.exe') +
+      string_data(['Text editor', '..\\..\\Windows\\System32\\notepad.exe', 'C:\\Users\\Public', '/A "read me.txt"']) +
+      extra_end())
+
+# Unicode base path and path suffix of the link info
+flags = HAS_LINK_INFO | IS_UNICODE
+write('unicode.lnk', header(flags) +
+      link_info_local('C:\\Users\\\u00c5sa\\\u0414\u043e\u043a\u0443\u043c\u0435\u043d\u0442\u044b\\', 'report \U0001F4C8.docx', True) +
+      extra_end())
+
+# Network share
+flags = HAS_LINK_INFO | HAS_WORKING_DIR | IS_UNICODE
+write('network.lnk', header(flags) + link_info_network('\\\\server\\share', 'tools\\app.exe') +
+      string_data(['\\\\server\\share\\tools']) + extra_end())
+
+# Environment variable blocks for the target and the icon
+flags = HAS_LINK_INFO | HAS_EXP_STRING | HAS_EXP_ICON | HAS_ICON_LOCATION | IS_UNICODE
+write('env.lnk', header(flags, icon_index=-2) +
+      link_info_local('C:\\Program Files\\App\\app.exe') +
+      string_data(['C:\\Windows\\system32\\shell32.dll']) +
+      env_block(0xA0000001, '%ProgramFiles%\\App\\app.exe') +
+      env_block(0xA0000007, '%SystemRoot%\\system32\\shell32.dll') + extra_end())
+
+# String data in the system code page
+flags = HAS_LINK_INFO | HAS_NAME | HAS_ARGUMENTS
+write('ansi.lnk', header(flags) + link_info_local('C:\\Caf\u00e9\\menu.exe') +
+      string_data(['Caf\u00e9 menu', '-q'], False) + extra_end())
+
+# Not a file system target, e.g. a Control Panel item
+flags = HAS_ID_LIST | HAS_NAME | IS_UNICODE
+write('nonfs.lnk', header(flags) +
+      id_list([root_item(CONTROL_PANEL), struct.pack('<HB', 8, 0x71) + b'\0' * 5]) +
+      string_data(['Control Panel']) + extra_end())
+
+# Id list cut off in the first folder item, which must not leave "C:\" as the target
+flags = HAS_ID_LIST | IS_UNICODE
+items = root_item(MY_COMPUTER) + drive_item('C:\\') + file_item('WINDOWS', 'Windows', True)[:12]
+write('truncidlist.lnk', header(flags) + struct.pack('<H', len(items)) + items + extra_end())
+
+# Volume item of a shell namespace folder (0x2E), not a drive
+flags = HAS_ID_LIST | IS_UNICODE
+write('guid.lnk', header(flags) +
+      id_list([root_item(MY_COMPUTER), struct.pack('<HBB', 20, 0x2E, 0) + CONTROL_PANEL]) + extra_end())
@@ -0,0 +1,180 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_buttonlist.cpp
+// Tests of the button list: the basic operations, and random inserts,
+// removals and moves after which both indexes must give the same answers
+// as linear scans of the list, as done with the former button array.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "buttonlist.h"
+#include "check.h"
+
+// Button as used by the list, the command is the upper case key
+typedef struct {
+   std::string command;
+} tButton, *pButton;
+
+typedef tButtonList<pButton, std::string> tButtons;
+
+//--------------------------------------------------------------------------
+
+static long LinearFind(const tButtons& buttons, pButton pBut)
+{
+   size_t i;
+   for (i = 0; i < buttons.list.size(); i++)
+      if (buttons.list[i] == pBut)
+         return (long)i;
+   return -1;
+}
+
+//--------------------------------------------------------------------------
+
+static long LinearFindCommand(const tButtons& buttons, const std::string& key)
+{
+   size_t i;
+   for (i = 0; i < buttons.list.size(); i++)
+      if (buttons.list[i]->command == key)
+         return (long)i;
+   return -1;
+}
+
+//--------------------------------------------------------------------------
+
+static bool SameAsLinear(const tButtons& buttons, std::vector<tButton>& storage, const std::vector<std::string>& keys)
+{
+   // Both indexes agree with scanning the list, also for buttons and commands not present
+   bool same = buttons.cnt == buttons.list.size() && buttons.pos.size() == buttons.cnt &&
+               buttons.commands.size() == buttons.cnt;
+   size_t i;
+   for (i = 0; same && i < storage.size(); i++)
+      same = buttons.Find(&storage[i]) == LinearFind(buttons, &storage[i]);
+   for (i = 0; same && i < keys.size(); i++)
+      same = buttons.FindCommand(keys[i]) == LinearFindCommand(buttons, keys[i]);
+   return same;
+}
+
+//--------------------------------------------------------------------------
+
+static void TestBasic()
+{
+   // Inserting, moving and removing a few buttons
+   std::vector<tButton> storage(4);
+   storage[0].command = "A.LNK";
+   storage[1].command = "B.LNK";
+   storage[2].command = "A.LNK";
+   storage[3].command = "C.EXE";
+   tButtons buttons;
+   CHECK(buttons.cnt == 0 && buttons.Find(&storage[0]) == -1 && buttons.FindCommand("A.LNK") == -1);
+
+   buttons.Insert(&storage[0], storage[0].command, 0);
+   buttons.Insert(&storage[1], storage[1].command, 100);
+   buttons.Insert(&storage[2], storage[2].command, 1);
+   buttons.Insert(&storage[3], storage[3].command, 0);
+   // C.EXE, A.LNK, A.LNK (second), B.LNK
+   CHECK(buttons.cnt == 4);
+   CHECK(buttons.list[0] == &storage[3] && buttons.list[1] == &storage[0] &&
+         buttons.list[2] == &storage[2] && buttons.list[3] == &storage[1]);
+   CHECK(buttons.Find(&storage[1]) == 3 && buttons.Find(&storage[2]) == 2);
+   // The first of the buttons sharing a command
+   CHECK(buttons.FindCommand("A.LNK") == 1);
+
+   buttons.Move(1, 3);
+   // C.EXE, A.LNK (second), B.LNK, A.LNK
+   CHECK(buttons.Find(&storage[0]) == 3 && buttons.Find(&storage[2]) == 1 && buttons.Find(&storage[1]) == 2);
+   CHECK(buttons.FindCommand("A.LNK") == 1);
+   buttons.Move(3, 0);
+   // A.LNK, C.EXE, A.LNK (second), B.LNK
+   CHECK(buttons.Find(&storage[0]) == 0 && buttons.Find(&storage[3]) == 1);
+   buttons.Move(2, 2);
+   CHECK(buttons.Find(&storage[2]) == 2);
+
+   buttons.Remove(0, storage[0].command);
+   // C.EXE, A.LNK (second), B.LNK
+   CHECK(buttons.cnt == 3 && buttons.Find(&storage[0]) == -1);
+   CHECK(buttons.FindCommand("A.LNK") == 1 && buttons.Find(&storage[1]) == 2);
+   buttons.Remove(1, storage[2].command);
+   CHECK(buttons.FindCommand("A.LNK") == -1 && buttons.FindCommand("B.LNK") == 1);
+   buttons.Remove(1, storage[1].command);
+   buttons.Remove(0, storage[3].command);
+   CHECK(buttons.cnt == 0 && buttons.pos.empty() && buttons.commands.empty());
+}
+
+//--------------------------------------------------------------------------
+
+static void TestRandom()
+{
+   // Random changes of a list with repeated commands
+   std::vector<tButton> storage(300);
+   std::vector<std::string> keys;
+   size_t i;
+   for (i = 0; i < 60; i++)
+   {
+      char buff[40];
+      sprintf(buff, "C:\\QUICK LAUNCH\\PROGRAM %02u.LNK", (unsigned int)i);
+      keys.push_back(buff);
+   }
+   for (i = 0; i < storage.size(); i++)
+      storage[i].command = keys[rand() % 50];
+
+   tButtons buttons;
+   std::vector<pButton> absent;
+   for (i = 0; i < storage.size(); i++)
+      absent.push_back(&storage[i]);
+   int step;
+   bool same = true;
+   for (step = 0; step < 5000 && same; step++)
+   {
+      int op = rand() % 3;
+      if (op == 0 && !absent.empty())
+      {
+         size_t ind = rand() % absent.size();
+         buttons.Insert(absent[ind], absent[ind]->command, rand() % (buttons.cnt + 2));
+         absent.erase(absent.begin() + ind);
+      }
+      else if (op == 1 && buttons.cnt)
+      {
+         unsigned int at = rand() % buttons.cnt;
+         pButton pBut = buttons.list[at];
+         buttons.Remove(at, pBut->command);
+         absent.push_back(pBut);
+      }
+      else if (op == 2 && buttons.cnt)
+         buttons.Move(rand() % buttons.cnt, rand() % buttons.cnt);
+      same = SameAsLinear(buttons, storage, keys);
+   }
+   if (!same)
+      printf("Indexes differ after step %d\n", step);
+   CHECK(same);
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   srand(1);
+   TestBasic();
+   TestRandom();
+   return CHECK_RESULT();
+}
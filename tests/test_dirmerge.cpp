@@ -0,0 +1,250 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_dirmerge.cpp
+// Tests of the merge engine on in-memory root listings. Besides fixed cases
+// of the machine, user and shared Start Menus, random listings are merged and
+// compared with a plain reference: all entries sorted together, a name of an
+// earlier root hiding the same name of later roots.
+
+#include <stdlib.h>
+#include <wctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "dirmerge.h"
+#include "check.h"
+
+//--------------------------------------------------------------------------
+
+static void AddItem(tMergeRoot& root, const wchar_t *name, bool isDir)
+{
+   // Add an entry with the upper case name as collation key
+   tMergeItem item;
+   item.name = name;
+   item.keyPos = (unsigned int)root.keys.size();
+   item.isDir = isDir;
+   item.tag = (unsigned int)root.items.size();
+   for (; *name; name++)
+      root.keys.push_back((unsigned char)towupper(*name));
+   root.keys.push_back(0);
+   root.items.push_back(item);
+}
+
+//--------------------------------------------------------------------------
+
+static const std::wstring& ItemName(const std::vector<tMergeRoot>& roots, const tMergeRef& ref)
+{
+   return roots[ref.root].items[ref.index].name;
+}
+
+//--------------------------------------------------------------------------
+
+static void TestStartMenus()
+{
+   // Machine, user and shared Start Menu with overlapping folders and shortcuts
+   std::vector<tMergeRoot> roots(3);
+   AddItem(roots[0], L"Zip.lnk", false);
+   AddItem(roots[0], L"Accessories", true);
+   AddItem(roots[0], L"Office.lnk", false);
+   AddItem(roots[1], L"accessories", true);
+   AddItem(roots[1], L"Browser.lnk", false);
+   AddItem(roots[1], L"OFFICE.LNK", false);
+   AddItem(roots[1], L"Tools", true);
+   AddItem(roots[2], L"ACCESSORIES", true);
+   AddItem(roots[2], L"Tools", true);
+   AddItem(roots[2], L"Timesheet.lnk", false);
+   size_t r;
+   for (r = 0; r < roots.size(); r++)
+      SortMergeRoot(roots[r]);
+   tMergedList merged;
+   MergeRoots(roots, merged);
+
+   const wchar_t *expected[] = { L"Accessories", L"Tools", L"Browser.lnk", L"Office.lnk", L"Timesheet.lnk", L"Zip.lnk" };
+   CHECK(merged.size() == sizeof(expected)/sizeof(expected[0]));
+   for (r = 0; r < merged.size() && r < sizeof(expected)/sizeof(expected[0]); r++)
+      CHECK(ItemName(roots, merged[r].item) == expected[r]);
+   if (merged.size() < 2)
+      return;
+
+   // The folders of the later roots are overlays in root order, hidden shortcuts are dropped
+   CHECK(merged[0].item.root == 0);
+   CHECK(merged[0].overlays.size() == 2);
+   if (merged[0].overlays.size() == 2)
+   {
+      CHECK(merged[0].overlays[0].root == 1 && ItemName(roots, merged[0].overlays[0]) == L"accessories");
+      CHECK(merged[0].overlays[1].root == 2 && ItemName(roots, merged[0].overlays[1]) == L"ACCESSORIES");
+   }
+   CHECK(merged[1].item.root == 1);
+   CHECK(merged[1].overlays.size() == 1 && merged[1].overlays[0].root == 2);
+   CHECK(merged[3].item.root == 0 && merged[3].overlays.empty());
+}
+
+//--------------------------------------------------------------------------
+
+static void TestEdgeCases()
+{
+   // No roots, empty roots, and a folder and a shortcut with the same name in one root
+   std::vector<tMergeRoot> roots;
+   tMergedList merged(1);
+   MergeRoots(roots, merged);
+   CHECK(merged.empty());
+
+   roots.resize(2);
+   SortMergeRoot(roots[0]);
+   MergeRoots(roots, merged);
+   CHECK(merged.empty());
+
+   AddItem(roots[1], L"Games.lnk", false);
+   AddItem(roots[1], L"Games.lnk", true);
+   AddItem(roots[1], L"b", false);
+   AddItem(roots[1], L"B", false);
+   SortMergeRoot(roots[1]);
+   MergeRoots(roots, merged);
+   CHECK(merged.size() == 4);
+   if (merged.size() == 4)
+   {
+      CHECK(roots[1].items[merged[0].item.index].isDir);
+      // Equal keys keep the listing order
+      CHECK(ItemName(roots, merged[1].item) == L"b");
+      CHECK(ItemName(roots, merged[2].item) == L"B");
+      CHECK(!roots[1].items[merged[3].item.index].isDir);
+   }
+   CHECK(MergeNameHash(L"Games.LNK") == MergeNameHash(L"games.lnk"));
+}
+
+//--------------------------------------------------------------------------
+
+// Entry of the reference merge
+typedef struct {
+   tMergeRef ref;
+   std::string key;
+   bool isDir;
+   std::vector<tMergeRef> overlays;
+} tRefItem;
+
+//--------------------------------------------------------------------------
+
+static bool RefLess(const tRefItem& first, const tRefItem& second)
+{
+   // Directories first, then key, then root and listing order
+   if (first.isDir != second.isDir)
+      return first.isDir;
+   if (first.key != second.key)
+      return first.key < second.key;
+   if (first.ref.root != second.ref.root)
+      return first.ref.root < second.ref.root;
+   return first.ref.index < second.ref.index;
+}
+
+//--------------------------------------------------------------------------
+
+static std::wstring UpperName(const std::wstring& name)
+{
+   // Case folded name
+   std::wstring upper = name;
+   size_t i;
+   for (i = 0; i < upper.size(); i++)
+      upper[i] = (wchar_t)towupper(upper[i]);
+   return upper;
+}
+
+//--------------------------------------------------------------------------
+
+static void ReferenceMerge(const std::vector<tMergeRoot>& roots, std::vector<tRefItem>& merged)
+{
+   // Hide the names of earlier roots in a quadratic pass and sort what is left
+   merged.clear();
+   unsigned int r, i;
+   size_t m;
+   for (r = 0; r < roots.size(); r++)
+   {
+      size_t firstOfRoot = merged.size();
+      for (i = 0; i < roots[r].items.size(); i++)
+      {
+         const tMergeItem& item = roots[r].items[i];
+         tMergeRef ref = {r, i};
+         for (m = 0; m < firstOfRoot && UpperName(ItemName(roots, merged[m].ref)) != UpperName(item.name); m++);
+         if (m < firstOfRoot)
+         {
+            if (item.isDir)
+               merged[m].overlays.push_back(ref);
+            continue;
+         }
+         tRefItem entry;
+         entry.ref = ref;
+         entry.key = (const char*)&roots[r].keys[item.keyPos];
+         entry.isDir = item.isDir;
+         merged.push_back(entry);
+      }
+   }
+   std::stable_sort(merged.begin(), merged.end(), RefLess);
+}
+
+//--------------------------------------------------------------------------
+
+static void TestRandomRoots()
+{
+   // Random listings with many clashing names, compared with the reference merge
+   const wchar_t *names[] = { L"a", L"A", L"b", L"ab", L"Ab", L"abc", L"B.lnk", L"b.LNK", L"c", L"Tools", L"tools", L"zz" };
+   const int nameCnt = sizeof(names)/sizeof(names[0]);
+   srand(1);
+   int run;
+   for (run = 0; run < 2000; run++)
+   {
+      std::vector<tMergeRoot> roots(1 + rand() % 4);
+      size_t r, i, k;
+      for (r = 0; r < roots.size(); r++)
+      {
+         int cnt = rand() % 10;
+         for (i = 0; i < (size_t)cnt; i++)
+            AddItem(roots[r], names[rand() % nameCnt], rand() % 3 == 0);
+         SortMergeRoot(roots[r]);
+      }
+      tMergedList merged;
+      MergeRoots(roots, merged);
+      std::vector<tRefItem> expected;
+      ReferenceMerge(roots, expected);
+
+      bool same = merged.size() == expected.size();
+      for (i = 0; same && i < merged.size(); i++)
+      {
+         same = merged[i].item.root == expected[i].ref.root && merged[i].item.index == expected[i].ref.index &&
+                merged[i].overlays.size() == expected[i].overlays.size();
+         for (k = 0; same && k < merged[i].overlays.size(); k++)
+            same = merged[i].overlays[k].root == expected[i].overlays[k].root &&
+                   merged[i].overlays[k].index == expected[i].overlays[k].index;
+      }
+      CHECK(same);
+      if (!same)
+         break;
+   }
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   TestStartMenus();
+   TestEdgeCases();
+   TestRandomRoots();
+   return CHECK_RESULT();
+}
@@ -0,0 +1,293 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_dirwatch.cpp
+// Tests of the directory watcher with inotify on a temporary tree: the net
+// change reported for each way an entry is changed, entries following their
+// renamed directory, and the rescan request after the event queue overflowed
+// while the receiver was busy.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dirwatch.h"
+#include "check.h"
+
+#define DEBOUNCE 200         // Debounce time of the watcher in ms, long enough for a slow machine
+#define BATCH_TIMEOUT 5000   // Longest wait for a batch in ms
+#define QUEUE_LIMIT_FILE "/proc/sys/fs/inotify/max_queued_events"
+
+static std::string gRoot, gOutside;
+static std::mutex gLock;
+static std::condition_variable gBatchReady;
+static std::deque<tDirChangeList*> gBatches;
+static bool gBlockReceiver = false;
+
+//--------------------------------------------------------------------------
+
+static void ReceiveChanges(tDirChangeList *pChanges, unsigned int, void *)
+{
+   // Queue a batch for the test, waiting while the receiver is blocked
+   std::unique_lock<std::mutex> guard(gLock);
+   gBatches.push_back(pChanges);
+   gBatchReady.notify_all();
+   while (gBlockReceiver)
+      gBatchReady.wait(guard);
+}
+
+//--------------------------------------------------------------------------
+
+static std::vector<std::string> NextBatch(unsigned int timeout = BATCH_TIMEOUT)
+{
+   // The changes of the next batch as sorted "<action> <relative path>[ <- <old path>]"
+   // strings, empty when no batch arrived in time
+   std::vector<std::string> res;
+   std::unique_lock<std::mutex> guard(gLock);
+   std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+   while (gBatches.empty())
+      if (gBatchReady.wait_until(guard, end) == std::cv_status::timeout)
+         return res;
+   tDirChangeList *pChanges = gBatches.front();
+   gBatches.pop_front();
+   const char actions[] = "ADMRO";
+   size_t i;
+   for (i = 0; i < pChanges->size(); i++)
+   {
+      const tDirChange& change = (*pChanges)[i];
+      std::string str(1, actions[change.action]);
+      if (change.action != eDirOverflow)
+         str += " " + change.path.substr(gRoot.size() + 1);
+      if (change.action == eDirRenamed)
+         str += " <- " + change.oldPath.substr(gRoot.size() + 1);
+      res.push_back(str);
+   }
+   delete pChanges;
+   std::sort(res.begin(), res.end());
+   return res;
+}
+
+//--------------------------------------------------------------------------
+
+static std::vector<std::string> Changes(const char *first, const char *second = NULL, const char *third = NULL)
+{
+   std::vector<std::string> res;
+   res.push_back(first);
+   if (second)
+      res.push_back(second);
+   if (third)
+      res.push_back(third);
+   std::sort(res.begin(), res.end());
+   return res;
+}
+
+//--------------------------------------------------------------------------
+
+static void WriteFile(const std::string& path)
+{
+   int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_APPEND, 0644);
+   if (fd >= 0)
+   {
+      CHECK(write(fd, "x", 1) == 1);
+      close(fd);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void RemoveTree(const std::string& dir)
+{
+   DIR *pDir = opendir(dir.c_str());
+   if (pDir)
+   {
+      struct dirent *pEntry;
+      while ((pEntry = readdir(pDir)) != NULL)
+      {
+         std::string name = pEntry->d_name;
+         if (name == "." || name == "..")
+            continue;
+         if (pEntry->d_type == DT_DIR)
+            RemoveTree(dir + "/" + name);
+         else
+            unlink((dir + "/" + name).c_str());
+      }
+      closedir(pDir);
+   }
+   rmdir(dir.c_str());
+}
+
+//--------------------------------------------------------------------------
+
+static void TestCoalescing()
+{
+   // The net change of each entry
+   WriteFile(gRoot + "/a");
+   CHECK(NextBatch() == Changes("A a"));
+   WriteFile(gRoot + "/a");
+   CHECK(NextBatch() == Changes("M a"));
+
+   // A temporary entry is left out
+   WriteFile(gRoot + "/temp");
+   unlink((gRoot + "/temp").c_str());
+   WriteFile(gRoot + "/b");
+   CHECK(NextBatch() == Changes("A b"));
+
+   // Saved through a temporary file, replaced by a file moved in, replaced by a rename
+   WriteFile(gRoot + "/a.tmp");
+   rename((gRoot + "/a.tmp").c_str(), (gRoot + "/a").c_str());
+   CHECK(NextBatch() == Changes("M a"));
+   WriteFile(gOutside + "/x");
+   rename((gOutside + "/x").c_str(), (gRoot + "/b").c_str());
+   CHECK(NextBatch() == Changes("M b"));
+   WriteFile(gRoot + "/old");
+   CHECK(NextBatch() == Changes("A old"));
+   rename((gRoot + "/old").c_str(), (gRoot + "/a").c_str());
+   CHECK(NextBatch() == Changes("R a <- old"));
+
+   // Renamed, renamed back, deleted and recreated
+   rename((gRoot + "/a").c_str(), (gRoot + "/c").c_str());
+   CHECK(NextBatch() == Changes("R c <- a"));
+   rename((gRoot + "/c").c_str(), (gRoot + "/d").c_str());
+   rename((gRoot + "/d").c_str(), (gRoot + "/c").c_str());
+   WriteFile(gRoot + "/e");
+   CHECK(NextBatch() == Changes("A e"));
+   unlink((gRoot + "/c").c_str());
+   WriteFile(gRoot + "/c");
+   CHECK(NextBatch() == Changes("M c"));
+
+   // Moved out of the tree and deleted
+   rename((gRoot + "/b").c_str(), (gOutside + "/b").c_str());
+   unlink((gRoot + "/e").c_str());
+   CHECK(NextBatch() == Changes("D b", "D e"));
+}
+
+//--------------------------------------------------------------------------
+
+static void TestDirectories()
+{
+   // Entries follow their directory when it is renamed or removed
+   mkdir((gRoot + "/dir").c_str(), 0755);
+   WriteFile(gRoot + "/dir/x");
+   rename((gRoot + "/dir").c_str(), (gRoot + "/moved").c_str());
+   CHECK(NextBatch() == Changes("A moved", "A moved/x"));
+
+   // The watch of a renamed directory follows it
+   rename((gRoot + "/moved").c_str(), (gRoot + "/dir").c_str());
+   CHECK(NextBatch() == Changes("R dir <- moved"));
+   WriteFile(gRoot + "/dir/y");
+   CHECK(NextBatch() == Changes("A dir/y"));
+
+   // A directory moved in is watched with its contents, one moved out is not
+   mkdir((gOutside + "/in").c_str(), 0755);
+   WriteFile(gOutside + "/in/z");
+   rename((gOutside + "/in").c_str(), (gRoot + "/in").c_str());
+   CHECK(NextBatch() == Changes("A in", "A in/z"));
+   WriteFile(gRoot + "/in/z");
+   CHECK(NextBatch() == Changes("M in/z"));
+   rename((gRoot + "/dir").c_str(), (gOutside + "/dir").c_str());
+   CHECK(NextBatch() == Changes("D dir"));
+   WriteFile(gOutside + "/dir/x");
+   WriteFile(gRoot + "/in/w");
+   CHECK(NextBatch() == Changes("A in/w"));
+}
+
+//--------------------------------------------------------------------------
+
+static void TestOverflow(pDirWatcher pW)
+{
+   // Changes lost while the receiver is busy are reported as a request for a rescan
+   {
+      std::lock_guard<std::mutex> guard(gLock);
+      gBlockReceiver = true;
+   }
+   WriteFile(gRoot + "/first");
+   CHECK(NextBatch() == Changes("A first"));
+   // Each file gives a create and a modify event, make more than the queue holds
+   int limit = 16384, i;
+   FILE *pFile = fopen(QUEUE_LIMIT_FILE, "r");
+   if (pFile)
+   {
+      if (fscanf(pFile, "%d", &limit) != 1)
+         limit = 16384;
+      fclose(pFile);
+   }
+   char name[32];
+   for (i = 0; i < limit/2 + 1000; i++)
+   {
+      sprintf(name, "/many%d", i);
+      WriteFile(gRoot + name);
+   }
+   {
+      std::lock_guard<std::mutex> guard(gLock);
+      gBlockReceiver = false;
+      gBatchReady.notify_all();
+   }
+   std::vector<std::string> changes = NextBatch();
+   CHECK(!changes.empty() && changes[0] == "O");
+   tDirWatchStats stats;
+   GetDirWatchStats(pW, stats);
+   CHECK(stats.overflows > 0);
+
+   // Watching goes on after the rescan
+   while (!NextBatch(DEBOUNCE*10).empty())
+      ;
+   WriteFile(gRoot + "/last");
+   CHECK(NextBatch() == Changes("A last"));
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   char dir[] = "/tmp/test_dirwatch_XXXXXX";
+   if (!mkdtemp(dir))
+      return 1;
+   gRoot = std::string(dir) + "/root";
+   gOutside = std::string(dir) + "/outside";
+   mkdir(gRoot.c_str(), 0755);
+   mkdir(gOutside.c_str(), 0755);
+
+   pDirWatcher pW = StartDirWatcher(ReceiveChanges, NULL, DEBOUNCE);
+   CHECK(pW != NULL);
+   std::vector<tWatchPath> dirs(1, gRoot);
+   CHECK(SetWatchedDirs(pW, dirs));
+   // Let the watch thread register the tree
+   usleep(100000);
+   TestCoalescing();
+   TestDirectories();
+   TestOverflow(pW);
+
+   tDirWatchStats stats;
+   GetDirWatchStats(pW, stats);
+   CHECK(stats.records >= stats.reported && stats.batches > 10);
+   CHECK(EndDirWatcher(pW));
+   RemoveTree(dir);
+   return CHECK_RESULT();
+}
@@ -0,0 +1,260 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_icondecode.cpp
+// Tests of the icon decoder on the fixtures made by mkicons.py: PNG images of
+// all formats, the icon files of the application, an icon file mixing PNG and
+// bitmap images, and PE32 and PE32+ libraries with icon resources. Damaged
+// copies of each must be rejected or decoded without reading beyond them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "icondecode.h"
+#include "check.h"
+
+#define SRC_DIR FIXTURE_DIR "../../src/"
+
+//--------------------------------------------------------------------------
+
+static std::vector<unsigned char> ReadFile(const std::string& path)
+{
+   // Contents of a file, empty if missing
+   std::vector<unsigned char> data;
+   FILE *pFile = fopen(path.c_str(), "rb");
+   if (!pFile)
+   {
+      printf("Missing file %s\n", path.c_str());
+      return data;
+   }
+   unsigned char buff[4096];
+   size_t len;
+   while ((len = fread(buff, 1, sizeof(buff), pFile)) > 0)
+      data.insert(data.end(), buff, buff + len);
+   fclose(pFile);
+   return data;
+}
+
+//--------------------------------------------------------------------------
+
+static unsigned int Get32(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+//--------------------------------------------------------------------------
+
+static unsigned long long PixelHash(const std::vector<unsigned int>& pixels)
+{
+   // 64 bit FNV-1a of the little endian pixel values, as written by mkicons.py
+   unsigned long long hash = 14695981039346656037ULL;
+   size_t i;
+   int b;
+   for (i = 0; i < pixels.size(); i++)
+      for (b = 0; b < 32; b += 8)
+      {
+         hash ^= (pixels[i] >> b) & 0xFF;
+         hash *= 1099511628211ULL;
+      }
+   return hash;
+}
+
+//--------------------------------------------------------------------------
+
+static void DamageFile(const std::vector<unsigned char>& data, int wantSize, size_t truncateStep, int flips)
+{
+   // Decode truncated copies and copies with random bit flips. The copies have exactly
+   // the damaged size, so that reading beyond them is caught by the sanitizers.
+   size_t len;
+   int i;
+   tIconImage image;
+   for (len = 0; len < data.size(); len += truncateStep)
+   {
+      std::vector<unsigned char> part(data.begin(), data.begin() + len);
+      DecodeFileIcon(part.empty() ? NULL : &part[0], len, 0, wantSize, image);
+      DecodeIconImage(part.empty() ? NULL : &part[0], len, image);
+   }
+   for (i = 0; i < flips; i++)
+   {
+      std::vector<unsigned char> bad = data;
+      bad[rand() % bad.size()] ^= 1 << (rand() % 8);
+      if (rand() % 2)
+         bad[rand() % bad.size()] = (unsigned char)rand();
+      if (DecodeFileIcon(&bad[0], bad.size(), 0, wantSize, image))
+         CHECK(image.width > 0 && image.height > 0 && image.pixels.size() == (size_t)image.width * image.height);
+      DecodeIconImage(&bad[0], bad.size(), image);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void TestPngCases()
+{
+   // PNG images of all color types, depths and interlacing
+   std::vector<unsigned char> cases = ReadFile(FIXTURE_DIR "png_cases.bin");
+   size_t pos = 0;
+   int cnt = 0;
+   while (pos + 4 <= cases.size())
+   {
+      size_t len = Get32(&cases[pos]);
+      const unsigned char *pPng = &cases[pos + 4];
+      pos += 4 + len;
+      int width = (int)Get32(&cases[pos]), height = (int)Get32(&cases[pos + 4]);
+      const unsigned char *pExpected = &cases[pos + 8];
+      pos += 8 + (size_t)width * height * 4;
+      cnt++;
+
+      tIconImage image;
+      bool ok = DecodeIconImage(pPng, len, image);
+      CHECK(ok);
+      CHECK(image.width == width && image.height == height);
+      bool same = ok && image.pixels.size() == (size_t)width * height;
+      size_t i;
+      for (i = 0; same && i < image.pixels.size(); i++)
+         same = image.pixels[i] == Get32(pExpected + i*4);
+      if (!same)
+         printf("PNG case %d differs\n", cnt);
+      CHECK(same);
+
+      std::vector<unsigned char> png(pPng, pPng + len);
+      DamageFile(png, 32, 1, 100);
+   }
+   CHECK(cnt == 30);
+}
+
+//--------------------------------------------------------------------------
+
+static void TestIconFiles()
+{
+   // The image picked for each size from the icon files, compared with the reference decoding
+   std::vector<unsigned char> expected = ReadFile(FIXTURE_DIR "ico_expected.bin");
+   size_t pos = 0;
+   int cnt = 0;
+   while (pos + 4 <= expected.size())
+   {
+      size_t len = Get32(&expected[pos]);
+      std::string name((const char*)&expected[pos + 4], len);
+      pos += 4 + len;
+      int wantSize = (int)Get32(&expected[pos]), width = (int)Get32(&expected[pos + 4]), height = (int)Get32(&expected[pos + 8]);
+      unsigned long long hash = Get32(&expected[pos + 12]) | ((unsigned long long)Get32(&expected[pos + 16]) << 32);
+      pos += 20;
+      cnt++;
+
+      std::vector<unsigned char> data = ReadFile(name == "mixed.ico" ? FIXTURE_DIR + name : SRC_DIR + name);
+      tIconImage image;
+      bool ok = !data.empty() && DecodeFileIcon(&data[0], data.size(), 0, wantSize, image);
+      CHECK(ok);
+      CHECK(image.width == width && image.height == height);
+      if (!ok || PixelHash(image.pixels) != hash)
+      {
+         printf("%s at %d differs\n", name.c_str(), wantSize);
+         CHECK(false);
+      }
+      // Icon files only have index 0
+      CHECK(!DecodeFileIcon(&data[0], data.size(), 1, wantSize, image));
+      if (wantSize == 32)
+         DamageFile(data, wantSize, 7, 200);
+   }
+   CHECK(cnt == 14*3);
+}
+
+//--------------------------------------------------------------------------
+
+static bool SameImage(const tIconImage& first, const tIconImage& second)
+{
+   return first.width == second.width && first.height == second.height && first.pixels == second.pixels;
+}
+
+//--------------------------------------------------------------------------
+
+static void TestPeFiles()
+{
+   // Icon groups found by position and by resource id, as by ExtractIconEx
+   std::vector<unsigned char> mainIcon = ReadFile(SRC_DIR "main.ico"), runIcon = ReadFile(SRC_DIR "run.ico");
+   const char *names[] = { FIXTURE_DIR "sample32.dll", FIXTURE_DIR "sample64.dll" };
+   int wantSizes[] = { 16, 32, 48 };
+   size_t n, s;
+   for (n = 0; n < 2; n++)
+   {
+      std::vector<unsigned char> data = ReadFile(names[n]);
+      if (data.empty() || mainIcon.empty() || runIcon.empty())
+      {
+         CHECK(false);
+         continue;
+      }
+      for (s = 0; s < 3; s++)
+      {
+         tIconImage fromIco, fromPe;
+         CHECK(DecodeFileIcon(&mainIcon[0], mainIcon.size(), 0, wantSizes[s], fromIco));
+         CHECK(DecodeFileIcon(&data[0], data.size(), 0, wantSizes[s], fromPe) && SameImage(fromIco, fromPe));
+         CHECK(DecodeFileIcon(&data[0], data.size(), -101, wantSizes[s], fromPe) && SameImage(fromIco, fromPe));
+         CHECK(DecodeFileIcon(&runIcon[0], runIcon.size(), 0, wantSizes[s], fromIco));
+         CHECK(DecodeFileIcon(&data[0], data.size(), 1, wantSizes[s], fromPe) && SameImage(fromIco, fromPe));
+         CHECK(DecodeFileIcon(&data[0], data.size(), -102, wantSizes[s], fromPe) && SameImage(fromIco, fromPe));
+      }
+      tIconImage image;
+      CHECK(!DecodeFileIcon(&data[0], data.size(), 2, 32, image));
+      CHECK(!DecodeFileIcon(&data[0], data.size(), -103, 32, image));
+      DamageFile(data, 32, 13, 500);
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void TestScaling()
+{
+   // Scaling to the button size and unpremultiplying
+   std::vector<unsigned char> data = ReadFile(SRC_DIR "run.ico");
+   tIconImage image, scaled;
+   CHECK(!data.empty() && DecodeFileIcon(&data[0], data.size(), 0, 32, image));
+   ScaleIconImage(image, 20, scaled);
+   CHECK(scaled.width == 20 && scaled.height == 20 && scaled.pixels.size() == 400);
+   size_t i;
+   bool premultiplied = true;
+   for (i = 0; i < scaled.pixels.size(); i++)
+   {
+      unsigned int p = scaled.pixels[i], a = p >> 24;
+      premultiplied = premultiplied && ((p >> 16) & 0xFF) <= a && ((p >> 8) & 0xFF) <= a && (p & 0xFF) <= a;
+   }
+   CHECK(premultiplied);
+   ScaleIconImage(image, 32, scaled);
+   CHECK(SameImage(image, scaled));
+
+   unsigned int pixels[3] = { 0xFF102030, 0x80402010, 0x00000000 };
+   UnpremultiplyPixels(pixels, 3);
+   CHECK(pixels[0] == 0xFF102030);
+   CHECK(pixels[1] == 0x807F3F1F || pixels[1] == 0x80804020);
+   CHECK(pixels[2] == 0);
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   srand(1);
+   TestPngCases();
+   TestIconFiles();
+   TestPeFiles();
+   TestScaling();
+   return CHECK_RESULT();
+}
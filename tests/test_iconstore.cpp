@@ -0,0 +1,289 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_iconstore.cpp
+// Round trip and corruption tests of the icon store. Each session writes
+// the store image to a file and maps it read only, as SaveIconStore and
+// LoadIconStore do on Windows.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "iconstore.h"
+#include "check.h"
+
+#define BLOB_CNT_OFF 12        // Offset of the blob count in the store header
+#define KEEP_SESSIONS 32       // Sessions an icon is kept without being used, as in iconstore.cpp
+
+static std::string gStoreFile;
+static void *gStoreView = NULL;
+static size_t gStoreViewSize = 0;
+
+//--------------------------------------------------------------------------
+
+static std::vector<unsigned int> MakePixels(unsigned int size, unsigned int seed)
+{
+   // Pixels differing by seed
+   std::vector<unsigned int> pixels(size*size);
+   size_t i;
+   for (i = 0; i < pixels.size(); i++)
+      pixels[i] = seed*2654435761U + (unsigned int)i*40503U;
+   return pixels;
+}
+
+//--------------------------------------------------------------------------
+
+static void UnmapStore()
+{
+   DetachIconStore();
+   if (gStoreView)
+      munmap(gStoreView, gStoreViewSize);
+   gStoreView = NULL;
+}
+
+//--------------------------------------------------------------------------
+
+static bool SaveAndMap(size_t maxBytes, std::vector<unsigned char> *pImage = NULL)
+{
+   // Rebuild the store, write it and map the file as the store of the next session
+   std::vector<unsigned char> image;
+   BuildIconStore(image, maxBytes);
+   UnmapStore();
+   ClearAddedIcons();
+   if (pImage)
+      *pImage = image;
+
+   FILE *pFile = fopen(gStoreFile.c_str(), "wb");
+   if (!pFile || fwrite(&image[0], 1, image.size(), pFile) != image.size())
+      return false;
+   fclose(pFile);
+   int fd = open(gStoreFile.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+   gStoreView = mmap(NULL, image.size(), PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (gStoreView == MAP_FAILED)
+   {
+      gStoreView = NULL;
+      return false;
+   }
+   gStoreViewSize = image.size();
+   return AttachIconStore((const unsigned char*)gStoreView, gStoreViewSize);
+}
+
+//--------------------------------------------------------------------------
+
+static bool HasIcon(const char *key, unsigned long long modTime, unsigned int size, const std::vector<unsigned int>& pixels)
+{
+   // Check that an icon is stored with the expected pixels
+   const unsigned int *pFound = FindStoredIcon(key, modTime, size);
+   return pFound && !memcmp(pFound, &pixels[0], pixels.size()*4);
+}
+
+//--------------------------------------------------------------------------
+
+static void TestRoundTrip()
+{
+   // Icons of both sizes, two of them with identical pixels, survive being saved and mapped
+   std::vector<unsigned int> a16 = MakePixels(16, 1), a32 = MakePixels(32, 2), b16 = MakePixels(16, 3);
+   AddStoredIcon("C:\\APPS\\A.EXE,0", 100, 16, &a16[0]);
+   AddStoredIcon("C:\\APPS\\A.EXE,0", 100, 32, &a32[0]);
+   AddStoredIcon("C:\\APPS\\B.EXE,0", 200, 16, &b16[0]);
+   AddStoredIcon("C:\\APPS\\COPY OF A.EXE,0", 300, 16, &a16[0]);
+   CHECK(IconStoreChanged());
+   CHECK(HasIcon("C:\\APPS\\A.EXE,0", 100, 16, a16));
+
+   std::vector<unsigned char> image;
+   CHECK(SaveAndMap(0, &image));
+   CHECK(!IconStoreChanged());
+   unsigned int blobCnt;
+   memcpy(&blobCnt, &image[BLOB_CNT_OFF], 4);
+   CHECK(blobCnt == 3);
+
+   unsigned long long hash1 = 0, hash2 = 1;
+   CHECK(HasIcon("C:\\APPS\\A.EXE,0", 100, 16, a16));
+   CHECK(HasIcon("C:\\APPS\\A.EXE,0", 100, 32, a32));
+   CHECK(HasIcon("C:\\APPS\\B.EXE,0", 200, 16, b16));
+   CHECK(FindStoredIcon("C:\\APPS\\A.EXE,0", 100, 16, &hash1) != NULL);
+   CHECK(FindStoredIcon("C:\\APPS\\COPY OF A.EXE,0", 300, 16, &hash2) != NULL);
+   CHECK(hash1 == hash2);
+   // Pixels are read from the mapping
+   const unsigned char *pFound = (const unsigned char*)FindStoredIcon("C:\\APPS\\B.EXE,0", 200, 16);
+   CHECK(pFound >= (const unsigned char*)gStoreView && pFound < (const unsigned char*)gStoreView + gStoreViewSize);
+
+   // Stale modification time, other size and unknown key
+   CHECK(!FindStoredIcon("C:\\APPS\\A.EXE,0", 101, 16));
+   CHECK(!FindStoredIcon("C:\\APPS\\B.EXE,0", 200, 32));
+   CHECK(!FindStoredIcon("C:\\APPS\\C.EXE,0", 100, 16));
+
+   // A changed source replaces the stored icon
+   std::vector<unsigned int> b16New = MakePixels(16, 4);
+   AddStoredIcon("C:\\APPS\\B.EXE,0", 201, 16, &b16New[0]);
+   CHECK(!FindStoredIcon("C:\\APPS\\B.EXE,0", 200, 16));
+   CHECK(SaveAndMap(0));
+   CHECK(HasIcon("C:\\APPS\\B.EXE,0", 201, 16, b16New));
+   CHECK(HasIcon("C:\\APPS\\A.EXE,0", 100, 32, a32));
+}
+
+//--------------------------------------------------------------------------
+
+static void TestCompaction()
+{
+   // Icons not used for KEEP_SESSIONS sessions are dropped, used ones are kept
+   std::vector<unsigned int> used = MakePixels(16, 5), unused = MakePixels(16, 6);
+   AddStoredIcon("USED", 1, 16, &used[0]);
+   AddStoredIcon("UNUSED", 1, 16, &unused[0]);
+   CHECK(SaveAndMap(0));
+   int sessions = 1;
+   while (sessions < 100)
+   {
+      CHECK(HasIcon("USED", 1, 16, used));
+      CHECK(SaveAndMap(0));
+      sessions++;
+      // Forget that the probe used the icon
+      bool kept = FindStoredIcon("UNUSED", 1, 16) != NULL;
+      DetachIconStore();
+      AttachIconStore((const unsigned char*)gStoreView, gStoreViewSize);
+      if (!kept)
+         break;
+   }
+   CHECK(sessions == KEEP_SESSIONS + 2);
+   CHECK(HasIcon("USED", 1, 16, used));
+}
+
+//--------------------------------------------------------------------------
+
+static void TestSizeCap()
+{
+   // The store stays within the size limit by dropping the least recently used icons
+   UnmapStore();
+   std::vector<unsigned int> pixels;
+   char key[32];
+   int i;
+   for (i = 0; i < 20; i++)
+   {
+      pixels = MakePixels(32, 100 + i);
+      sprintf(key, "ICON%d", i);
+      AddStoredIcon(key, 1, 32, &pixels[0]);
+   }
+   std::vector<unsigned char> image;
+   CHECK(SaveAndMap(20000, &image));
+   CHECK(image.size() <= 20000);
+   int kept = 0;
+   for (i = 0; i < 20; i++)
+   {
+      sprintf(key, "ICON%d", i);
+      kept += FindStoredIcon(key, 1, 32) != NULL;
+   }
+   CHECK(kept > 0 && kept < 20);
+
+   // The icons used survive a smaller cap
+   DetachIconStore();
+   AttachIconStore((const unsigned char*)gStoreView, gStoreViewSize);
+   int used = -1;
+   for (i = 19; i >= 0 && used < 0; i--)
+   {
+      sprintf(key, "ICON%d", i);
+      if (FindStoredIcon(key, 1, 32))
+         used = i;
+   }
+   CHECK(SaveAndMap(5000, &image));
+   CHECK(image.size() <= 5000);
+   sprintf(key, "ICON%d", used);
+   pixels = MakePixels(32, 100 + used);
+   CHECK(HasIcon(key, 1, 32, pixels));
+}
+
+//--------------------------------------------------------------------------
+
+static void TestCorruption()
+{
+   // No damaged image may give wrong pixels: a store with damaged tables is rejected as
+   // a whole and an icon with damaged pixels is not found, truncated stores are rejected
+   std::vector<unsigned int> pixels[3] = { MakePixels(16, 7), MakePixels(32, 8), MakePixels(16, 9) };
+   const char *keys[3] = { "K1", "K2", "K3" };
+   unsigned int sizes[3] = { 16, 32, 16 };
+   int i;
+   UnmapStore();
+   for (i = 0; i < 3; i++)
+      AddStoredIcon(keys[i], i + 1, sizes[i], &pixels[i][0]);
+   std::vector<unsigned char> image;
+   CHECK(SaveAndMap(0, &image));
+   UnmapStore();
+
+   size_t pos, len;
+   int rejected = 0, wrong = 0, missing = 0;
+   for (pos = 0; pos < image.size(); pos++)
+   {
+      std::vector<unsigned char> bad = image;
+      bad[pos] ^= 1 << (pos % 8);
+      if (!AttachIconStore(&bad[0], bad.size()))
+      {
+         rejected++;
+         continue;
+      }
+      for (i = 0; i < 3; i++)
+      {
+         const unsigned int *pFound = FindStoredIcon(keys[i], i + 1, sizes[i]);
+         if (!pFound)
+            missing++;
+         else if (memcmp(pFound, &pixels[i][0], pixels[i].size()*4))
+            wrong++;
+      }
+      DetachIconStore();
+   }
+   CHECK(wrong == 0);
+   CHECK(rejected > 0 && missing > 0);
+
+   for (len = 0; len < image.size(); len++)
+   {
+      std::vector<unsigned char> part(image.begin(), image.begin() + len);
+      CHECK(!AttachIconStore(part.empty() ? NULL : &part[0], len));
+   }
+   std::vector<unsigned char> longer = image;
+   longer.push_back(0);
+   CHECK(!AttachIconStore(&longer[0], longer.size()));
+   CHECK(AttachIconStore(&image[0], image.size()));
+   DetachIconStore();
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   char dir[] = "/tmp/test_iconstore_XXXXXX";
+   if (!mkdtemp(dir))
+      return 1;
+   gStoreFile = std::string(dir) + "/icons.dat";
+   TestRoundTrip();
+   TestCompaction();
+   TestSizeCap();
+   TestCorruption();
+   UnmapStore();
+   unlink(gStoreFile.c_str());
+   rmdir(dir);
+   return CHECK_RESULT();
+}
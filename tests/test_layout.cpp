@@ -0,0 +1,276 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_layout.cpp
+// Tests of the toolbar layout: single line layouts against the formulas of
+// the former SetupLayout and Pos2Index, and wrapped layouts for all edges,
+// sizes, resolutions and button counts against the properties every layout
+// must have, down to the hit test of each pixel of the window.
+
+#include <math.h>
+#include <stdio.h>
+
+#include "layout.h"
+#include "check.h"
+
+// Sizes used by LaunchBar.cpp for small and large icons
+#define WIND_MARGIN 2
+#define WIND_OFF 12
+static const int gIconSizes[2] = { 16, 32 };
+static const int gIconOffsets[2] = { 3, 5 };
+static const int gGaps[2] = { 0, 2 };
+
+static const tLayoutRect gWorkAreas[] = {
+   { 0, 0, 1920, 1040 },
+   { -1280, 100, 0, 1124 },
+   { 1920, -200, 2560, 280 },
+   { 0, 0, 300, 200 }
+};
+
+//--------------------------------------------------------------------------
+
+static tLayoutParams MakeParams(tLayoutEdge edge, bool center, unsigned int count, int large, int dpi, unsigned int monitor)
+{
+   tLayoutParams params;
+   params.edge = edge;
+   params.center = center;
+   params.count = count;
+   params.iconSize = gIconSizes[large];
+   params.iconOffset = gIconOffsets[large];
+   params.gap = gGaps[large];
+   params.margin = WIND_MARGIN;
+   params.endSpace = WIND_OFF;
+   params.dpi = dpi;
+   params.workAreas = gWorkAreas;
+   params.workAreaCount = sizeof(gWorkAreas)/sizeof(gWorkAreas[0]);
+   params.monitor = monitor;
+   return params;
+}
+
+//--------------------------------------------------------------------------
+
+static bool SameRect(const tLayoutRect& first, const tLayoutRect& second)
+{
+   return first.left == second.left && first.top == second.top && first.right == second.right && first.bottom == second.bottom;
+}
+
+//--------------------------------------------------------------------------
+
+static void TestSingleLine()
+{
+   // Toolbars fitting along the edge are placed exactly as by the former SetupLayout
+   int edge, large, center, monitor;
+   unsigned int count;
+   int windowDiffs = 0, buttonDiffs = 0, dropDiffs = 0, layouts = 0;
+   for (edge = eEdgeLeft; edge <= eEdgeBottom; edge++)
+      for (large = 0; large < 2; large++)
+         for (center = 0; center < 2; center++)
+            for (monitor = 0; monitor < 2; monitor++)
+               for (count = 0; count <= 50; count++)
+               {
+                  const tLayoutRect& screen = gWorkAreas[monitor];
+                  bool vertical = edge == eEdgeLeft || edge == eEdgeRight;
+                  int buttonSize = gIconSizes[large] + gIconOffsets[large]*2, inc = buttonSize + gGaps[large],
+                      xFirst = vertical ? WIND_MARGIN + (edge == eEdgeRight) : WIND_MARGIN + WIND_OFF,
+                      yFirst = vertical ? WIND_MARGIN + WIND_OFF : WIND_MARGIN,
+                      thickness = WIND_MARGIN*2 + buttonSize + 2, length = (WIND_MARGIN + WIND_OFF)*2 + (int)count*inc;
+                  if (length > (vertical ? screen.bottom - screen.top : screen.right - screen.left))
+                     // Wrapped, there is no former layout to compare with
+                     continue;
+                  tLayoutParams params = MakeParams((tLayoutEdge)edge, center != 0, count, large, 96, monitor);
+                  tLayout layout;
+                  CHECK(ComputeLayout(params, layout));
+                  layouts++;
+
+                  // Former window rectangle
+                  tLayoutRect window;
+                  window.left = edge == eEdgeRight ? screen.right - thickness : screen.left;
+                  window.top = edge == eEdgeBottom ? screen.bottom - thickness : screen.top;
+                  window.right = window.left + (vertical ? thickness : length);
+                  window.bottom = window.top + (vertical ? length : thickness);
+                  if (center)
+                  {
+                     if (vertical)
+                     {
+                        window.top += (screen.bottom - screen.top - length) / 2;
+                        window.bottom = window.top + length;
+                     }
+                     else
+                     {
+                        window.left += (screen.right - screen.left - length) / 2;
+                        window.right = window.left + length;
+                     }
+                  }
+                  windowDiffs += !SameRect(window, layout.window);
+                  CHECK(layout.lines == 1 && layout.perLine == (count ? count : 1));
+
+                  unsigned int i;
+                  for (i = 0; i < count; i++)
+                  {
+                     tLayoutRect r = LayoutButtonRect(layout, i);
+                     buttonDiffs += r.left != xFirst + (vertical ? 0 : (int)i*inc) || r.top != yFirst + (vertical ? (int)i*inc : 0) ||
+                                    r.right - r.left != buttonSize || r.bottom - r.top != buttonSize;
+                  }
+
+                  // Former Pos2Index of the dragged button position
+                  int pos;
+                  for (pos = -2*inc; pos < length + 2*inc; pos++)
+                  {
+                     int first = vertical ? yFirst : xFirst;
+                     long ind = lround((pos - first)/(double)inc);
+                     ind = ind < 0 ? 0 : ind > (long)count ? (long)count : ind;
+                     unsigned int drop = vertical ? LayoutInsertIndex(layout, xFirst, pos) : LayoutInsertIndex(layout, pos, yFirst);
+                     dropDiffs += drop != (unsigned int)ind;
+                  }
+               }
+   CHECK(layouts > 4*2*2*2*24);
+   CHECK(windowDiffs == 0);
+   CHECK(buttonDiffs == 0);
+   CHECK(dropDiffs == 0);
+}
+
+//--------------------------------------------------------------------------
+
+static void CheckLayout(const tLayoutParams& params, const tLayout& layout, bool scanPixels)
+{
+   // Properties of any layout: at the edge of its work area, the buttons in as few
+   // lines as possible within the window, and each pixel hit testing to its own button
+   const tLayoutRect& work = params.workAreas[params.monitor < params.workAreaCount ? params.monitor : 0];
+   bool vertical = params.edge == eEdgeLeft || params.edge == eEdgeRight;
+   int width = layout.window.right - layout.window.left, height = layout.window.bottom - layout.window.top,
+       space = vertical ? work.bottom - work.top : work.right - work.left,
+       step = vertical ? layout.yInc : layout.xInc;
+   CHECK(params.edge != eEdgeLeft || layout.window.left == work.left);
+   CHECK(params.edge != eEdgeTop || layout.window.top == work.top);
+   CHECK(params.edge != eEdgeRight || layout.window.right == work.right);
+   CHECK(params.edge != eEdgeBottom || layout.window.bottom == work.bottom);
+   CHECK(layout.count == params.count && layout.perLine >= 1 && step > 0);
+   if (params.count)
+   {
+      CHECK(layout.lines*layout.perLine >= params.count && (layout.lines - 1)*layout.perLine < params.count);
+      // As many buttons fit along the edge as cells fit between the ends, at least one
+      int room = space - (layout.margin + layout.endSpace)*2;
+      unsigned int fit = room > step ? (unsigned int)(room / step) : 1;
+      CHECK(layout.perLine <= fit);
+      CHECK((layout.lines - 1)*fit < params.count);
+      // Wrapped lines are filled evenly
+      CHECK(layout.lines == 1 || layout.perLine - (params.count - (layout.lines - 1)*layout.perLine) < layout.lines);
+   }
+   if ((vertical ? height : width) <= space)
+   {
+      CHECK(vertical ? layout.window.top >= work.top && layout.window.bottom <= work.bottom :
+                       layout.window.left >= work.left && layout.window.right <= work.right);
+   }
+
+   unsigned int i;
+   bool inside = true, firstHit = true, drop = true;
+   for (i = 0; i < params.count; i++)
+   {
+      tLayoutRect r = LayoutButtonRect(layout, i);
+      inside = inside && r.left >= 0 && r.top >= 0 && r.right <= width && r.bottom <= height;
+      firstHit = firstHit && LayoutHitTest(layout, r.left, r.top) == (int)i && LayoutHitTest(layout, r.right - 1, r.bottom - 1) == (int)i;
+      drop = drop && LayoutInsertIndex(layout, r.left, r.top) == i;
+   }
+   CHECK(inside);
+   CHECK(firstHit);
+   CHECK(drop);
+   if (!scanPixels)
+      return;
+
+   int x, y, wrong = 0, over = 0;
+   for (y = -3; y < height + 3; y++)
+      for (x = -3; x < width + 3; x++)
+      {
+         int hit = LayoutHitTest(layout, x, y);
+         if (hit >= 0)
+         {
+            tLayoutRect r = LayoutButtonRect(layout, hit);
+            wrong += hit >= (int)params.count || x < r.left || x >= r.right || y < r.top || y >= r.bottom;
+         }
+         over += LayoutInsertIndex(layout, x, y) > params.count;
+      }
+   CHECK(wrong == 0);
+   CHECK(over == 0);
+   // Each button covers its whole cell, so no pixel of a cell may hit test elsewhere
+   int missed = 0;
+   for (i = 0; i < params.count; i++)
+   {
+      tLayoutRect r = LayoutButtonRect(layout, i);
+      for (y = r.top; y < r.bottom; y++)
+         for (x = r.left; x < r.right; x++)
+            missed += LayoutHitTest(layout, x, y) != (int)i;
+   }
+   CHECK(missed == 0);
+}
+
+//--------------------------------------------------------------------------
+
+static void TestWrapping()
+{
+   // Every edge, icon size, resolution and monitor with button counts up to wrapping
+   // in many lines, each pixel hit tested for some of the counts
+   int dpis[] = { 0, 96, 120, 144, 192 };
+   int edge, large, center, d, layouts = 0;
+   unsigned int monitor, count;
+   for (edge = eEdgeLeft; edge <= eEdgeBottom; edge++)
+      for (large = 0; large < 2; large++)
+         for (center = 0; center < 2; center++)
+            for (d = 0; d < 5; d++)
+               for (monitor = 0; monitor < 5; monitor++)
+                  for (count = 0; count <= 200; count++)
+                  {
+                     tLayoutParams params = MakeParams((tLayoutEdge)edge, center != 0, count, large, dpis[d], monitor);
+                     tLayout layout;
+                     CHECK(ComputeLayout(params, layout));
+                     bool scan = monitor == 3 && (count % 37 == 0 || count == 1 || count == 13);
+                     CheckLayout(params, layout, scan);
+                     layouts++;
+                  }
+   CHECK(layouts == 4*2*2*5*5*201);
+}
+
+//--------------------------------------------------------------------------
+
+static void TestInvalid()
+{
+   // Layouts that cannot be computed
+   tLayoutParams params = MakeParams(eEdgeBottom, false, 10, 0, 96, 0);
+   tLayout layout;
+   params.workAreaCount = 0;
+   CHECK(!ComputeLayout(params, layout));
+   params = MakeParams(eEdgeBottom, false, 10, 0, 96, 0);
+   params.workAreas = NULL;
+   CHECK(!ComputeLayout(params, layout));
+   params = MakeParams((tLayoutEdge)0, false, 10, 0, 96, 0);
+   CHECK(!ComputeLayout(params, layout));
+   params = MakeParams(eEdgeLeft, false, 10, 0, 96, 0);
+   params.iconSize = params.iconOffset = params.gap = 0;
+   CHECK(!ComputeLayout(params, layout));
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   TestSingleLine();
+   TestWrapping();
+   TestInvalid();
+   return CHECK_RESULT();
+}
@@ -0,0 +1,195 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_pixels.cpp
+// Tests of the pixel operations: the scalar versions against direct formulas,
+// and the SSE2 and AVX2 versions, where supported, against the scalar ones
+// for all lengths of the vector tails and many scaling sizes.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "pixels.h"
+#include "check.h"
+
+//--------------------------------------------------------------------------
+
+static unsigned int RandPixel()
+{
+   // Random pixel, with fully transparent and opaque alpha common as in icons
+   unsigned int p = ((unsigned int)rand() << 16) ^ (unsigned int)rand() ^ ((unsigned int)rand() << 30);
+   int kind = rand() % 4;
+   if (kind == 0)
+      p &= 0x00FFFFFF;
+   else if (kind == 1)
+      p |= 0xFF000000;
+   return p;
+}
+
+//--------------------------------------------------------------------------
+
+static std::vector<unsigned int> RandPremultiplied(size_t count)
+{
+   std::vector<unsigned int> pixels(count);
+   size_t i;
+   for (i = 0; i < count; i++)
+      pixels[i] = RandPixel();
+   if (count)
+      PremultiplyPixels(&pixels[0], count);
+   return pixels;
+}
+
+//--------------------------------------------------------------------------
+
+static void TestScalar()
+{
+   // The scalar versions against the formulas, for every color and alpha
+   SetPixelIsa(ePixelScalar);
+   CHECK(GetPixelIsa() == ePixelScalar);
+   std::vector<unsigned int> pixels(256*256);
+   unsigned int a, c;
+   for (a = 0; a < 256; a++)
+      for (c = 0; c < 256; c++)
+         pixels[a*256 + c] = (a << 24) | (c << 16) | ((255 - c) << 8) | c;
+   std::vector<unsigned int> gray = pixels;
+   PremultiplyPixels(&pixels[0], pixels.size());
+   GrayPixels(&gray[0], gray.size());
+   bool premultiplyOk = true, grayOk = true;
+   for (a = 0; a < 256; a++)
+      for (c = 0; c < 256; c++)
+      {
+         unsigned int r = (unsigned int)floor(c * a / 255.0 + 0.5), g = (unsigned int)floor((255 - c) * a / 255.0 + 0.5);
+         premultiplyOk = premultiplyOk && pixels[a*256 + c] == ((a << 24) | (r << 16) | (g << 8) | r);
+         unsigned int y = ((29 * c + 150 * (255 - c) + 77 * c + 128) >> 8) >> 1;
+         grayOk = grayOk && gray[a*256 + c] == (((a >> 1) << 24) | (y << 16) | (y << 8) | y);
+      }
+   CHECK(premultiplyOk);
+   CHECK(grayOk);
+}
+
+//--------------------------------------------------------------------------
+
+static void TestScaleProperties()
+{
+   // Uniform images stay uniform, results stay premultiplied, sizes are checked
+   SetPixelIsa(ePixelScalar);
+   tScaleFilter filters[] = { eScaleBox, eScaleLanczos };
+   int f;
+   for (f = 0; f < 2; f++)
+   {
+      std::vector<unsigned int> src(48*48, 0x80402010), dst(20*20);
+      CHECK(ScalePixels(&src[0], 48, 48, &dst[0], 20, 20, filters[f]));
+      size_t i;
+      bool uniform = true;
+      for (i = 0; i < dst.size(); i++)
+         uniform = uniform && dst[i] == 0x80402010;
+      CHECK(uniform);
+
+      src = RandPremultiplied(256*256);
+      dst.resize(37*23);
+      CHECK(ScalePixels(&src[0], 256, 256, &dst[0], 37, 23, filters[f]));
+      bool premultiplied = true;
+      for (i = 0; i < dst.size(); i++)
+      {
+         unsigned int p = dst[i], a = p >> 24;
+         premultiplied = premultiplied && ((p >> 16) & 0xFF) <= a && ((p >> 8) & 0xFF) <= a && (p & 0xFF) <= a;
+      }
+      CHECK(premultiplied);
+      CHECK(!ScalePixels(&src[0], 0, 256, &dst[0], 37, 23, filters[f]));
+      CHECK(!ScalePixels(&src[0], 256, 256, &dst[0], 37, 0, filters[f]));
+   }
+}
+
+//--------------------------------------------------------------------------
+
+static void CompareIsa(tPixelIsa isa)
+{
+   // The vector versions give the same results as the scalar ones
+   size_t count;
+   for (count = 0; count < 70; count++)
+   {
+      std::vector<unsigned int> straight(count + 1);
+      size_t i;
+      for (i = 0; i < straight.size(); i++)
+         straight[i] = RandPixel();
+      std::vector<unsigned int> expected = straight, result = straight;
+      SetPixelIsa(ePixelScalar);
+      PremultiplyPixels(count ? &expected[0] : NULL, count);
+      SetPixelIsa(isa);
+      PremultiplyPixels(count ? &result[0] : NULL, count);
+      // The pixel after the end is left alone
+      CHECK(result == expected);
+
+      SetPixelIsa(ePixelScalar);
+      GrayPixels(count ? &expected[0] : NULL, count);
+      SetPixelIsa(isa);
+      GrayPixels(count ? &result[0] : NULL, count);
+      CHECK(result == expected);
+   }
+
+   int sizes[] = { 1, 2, 3, 7, 16, 20, 24, 31, 32, 40, 48, 64, 96, 256 };
+   int nSizes = sizeof(sizes)/sizeof(sizes[0]), sw, sh, dw, f, runs = 0, differ = 0;
+   for (sw = 0; sw < nSizes; sw++)
+      for (dw = 0; dw < nSizes; dw++)
+         for (f = 0; f < 2; f++)
+         {
+            sh = (sw + dw + f) % nSizes;
+            int dh = (sw * 3 + dw) % nSizes;
+            std::vector<unsigned int> src = RandPremultiplied((size_t)sizes[sw] * sizes[sh]);
+            std::vector<unsigned int> expected((size_t)sizes[dw] * sizes[dh]), result(expected.size());
+            SetPixelIsa(ePixelScalar);
+            ScalePixels(&src[0], sizes[sw], sizes[sh], &expected[0], sizes[dw], sizes[dh], f ? eScaleLanczos : eScaleBox);
+            SetPixelIsa(isa);
+            ScalePixels(&src[0], sizes[sw], sizes[sh], &result[0], sizes[dw], sizes[dh], f ? eScaleLanczos : eScaleBox);
+            runs++;
+            if (result != expected)
+            {
+               printf("Scaling %dx%d to %dx%d differs\n", sizes[sw], sizes[sh], sizes[dw], sizes[dh]);
+               differ++;
+            }
+         }
+   CHECK(runs == nSizes*nSizes*2 && differ == 0);
+
+   // In place scaling down
+   std::vector<unsigned int> expected = RandPremultiplied(64*64), result = expected;
+   SetPixelIsa(ePixelScalar);
+   ScalePixels(&expected[0], 64, 64, &expected[0], 24, 24, eScaleLanczos);
+   SetPixelIsa(isa);
+   ScalePixels(&result[0], 64, 64, &result[0], 24, 24, eScaleLanczos);
+   CHECK(result == expected);
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   srand(1);
+   tPixelIsa supported = SetPixelIsa(ePixelAvx2);
+   const char *names[] = { "scalar", "SSE2", "AVX2" };
+   printf("Supported: %s\n", names[supported]);
+   TestScalar();
+   TestScaleProperties();
+   int isa;
+   for (isa = ePixelSse2; isa <= supported; isa++)
+      CompareIsa((tPixelIsa)isa);
+   return CHECK_RESULT();
+}
@@ -0,0 +1,187 @@
+/*
+Copyright (C) 2012-2014 Peter Lerup
+
+This file is part of LaunchBar.
+
+LaunchBar is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// test_shelllink.cpp
+// Tests of the Shell Link parser on the .lnk fixtures made by mklnk.py, one
+// for each way the target is stored, and on truncated and damaged copies.
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "shelllink.h"
+#include "check.h"
+
+//--------------------------------------------------------------------------
+
+static std::vector<unsigned char> ReadFixture(const char *name)
+{
+   // Contents of a fixture file, empty if missing
+   std::vector<unsigned char> data;
+   std::string path = std::string(FIXTURE_DIR) + name;
+   FILE *pFile = fopen(path.c_str(), "rb");
+   if (!pFile)
+   {
+      printf("Missing fixture %s\n", path.c_str());
+      return data;
+   }
+   unsigned char buff[4096];
+   size_t len;
+   while ((len = fread(buff, 1, sizeof(buff), pFile)) > 0)
+      data.insert(data.end(), buff, buff + len);
+   fclose(pFile);
+   return data;
+}
+
+//--------------------------------------------------------------------------
+
+static bool ParseFixture(const char *name, tShellLink& link)
+{
+   std::vector<unsigned char> data = ReadFixture(name);
+   return !data.empty() && ParseShellLink(&data[0], data.size(), link);
+}
+
+//--------------------------------------------------------------------------
+
+static void TestTargets()
+{
+   // The target and string data as GetShortcutInfo reports them
+   tShellLink link;
+   CHECK(ParseFixture("idlist.lnk", link));
+   CHECK(link.target == L"C:\\Program Files\\My App.exe");
+   CHECK(link.description == L"Start My App");
+   CHECK(link.iconLocation == L"%SystemRoot%\\system32\\shell32.dll");
+   CHECK(link.iconIndex == 3);
+   CHECK(link.fileAttributes == 0x20);
+
+   CHECK(ParseFixture("local.lnk", link));
+   CHECK(link.target == L"C:\\Windows\\System32\\notepad.exe");
+   CHECK(link.description == L"Text editor");
+   CHECK(link.relativePath == L"..\\..\\Windows\\System32\\notepad.exe");
+   CHECK(link.workingDir == L"C:\\Users\\Public");
+   CHECK(link.arguments == L"/A \"read me.txt\"");
+   CHECK(link.iconLocation.empty());
+   CHECK(link.showCommand == 3);
+
+   CHECK(ParseFixture("unicode.lnk", link));
+   std::wstring expected = L"C:\\Users\\\u00c5sa\\\u0414\u043e\u043a\u0443\u043c\u0435\u043d\u0442\u044b\\report ";
+   if (sizeof(wchar_t) > 2)
+      expected += (wchar_t)0x1F4C8;
+   else
+   {
+      expected += (wchar_t)0xD83D;
+      expected += (wchar_t)0xDCC8;
+   }
+   expected += L".docx";
+   CHECK(link.target == expected);
+
+   CHECK(ParseFixture("network.lnk", link));
+   CHECK(link.target == L"\\\\server\\share\\tools\\app.exe");
+   CHECK(link.workingDir == L"\\\\server\\share\\tools");
+
+   CHECK(ParseFixture("env.lnk", link));
+   CHECK(link.target == L"%ProgramFiles%\\App\\app.exe");
+   CHECK(link.iconLocation == L"%SystemRoot%\\system32\\shell32.dll");
+   CHECK(link.iconIndex == -2);
+
+   CHECK(ParseFixture("ansi.lnk", link));
+   CHECK(link.target == L"C:\\Caf\u00e9\\menu.exe");
+   CHECK(link.description == L"Caf\u00e9 menu");
+   CHECK(link.arguments == L"-q");
+
+   CHECK(ParseFixture("nonfs.lnk", link));
+   CHECK(link.target.empty());
+   CHECK(link.description == L"Control Panel");
+
+   // A damaged id list or one through a shell namespace folder gives no target at all
+   CHECK(ParseFixture("truncidlist.lnk", link));
+   CHECK(link.target.empty());
+   CHECK(ParseFixture("guid.lnk", link));
+   CHECK(link.target.empty());
+}
+
+//--------------------------------------------------------------------------
+
+static std::wstring UpperDecoder(const char *str, size_t len)
+{
+   // Decoder marking the strings it converted
+   std::wstring res;
+   size_t i;
+   for (i = 0; i < len; i++)
+      res += (wchar_t)(str[i] >= 'a' && str[i] <= 'z' ? str[i] - 'a' + 'A' : (unsigned char)str[i]);
+   return res;
+}
+
+//--------------------------------------------------------------------------
+
+static void TestDecoder()
+{
+   // Strings in the system code page go through the provided decoder
+   std::vector<unsigned char> data = ReadFixture("ansi.lnk");
+   tShellLink link;
+   CHECK(!data.empty() && ParseShellLink(&data[0], data.size(), link, UpperDecoder));
+   CHECK(link.arguments == L"-Q");
+}
+
+//--------------------------------------------------------------------------
+
+static void TestDamaged()
+{
+   // Truncated and damaged files must not be read beyond their end. Truncating the
+   // trailing extra data may still give a valid link, but not a truncated header.
+   const char *names[] = { "idlist.lnk", "local.lnk", "unicode.lnk", "network.lnk", "env.lnk", "ansi.lnk", "nonfs.lnk",
+                           "truncidlist.lnk", "guid.lnk" };
+   size_t n, len, i;
+   for (n = 0; n < sizeof(names)/sizeof(names[0]); n++)
+   {
+      std::vector<unsigned char> data = ReadFixture(names[n]);
+      tShellLink link;
+      for (len = 0; len < data.size(); len++)
+      {
+         // A copy of exactly the truncated size, so that reading beyond it is caught by the sanitizers
+         std::vector<unsigned char> part(data.begin(), data.begin() + len);
+         bool ok = ParseShellLink(part.empty() ? NULL : &part[0], len, link);
+         if (len < 0x4C)
+            CHECK(!ok);
+      }
+      for (i = 0x4C; i < data.size(); i++)
+      {
+         // Corrupt each byte in turn
+         std::vector<unsigned char> bad = data;
+         bad[i] ^= 0xFF;
+         ParseShellLink(&bad[0], bad.size(), link);
+      }
+      if (!data.empty())
+      {
+         data[4] ^= 1;
+         CHECK(!ParseShellLink(&data[0], data.size(), link));
+      }
+   }
+}
+
+//--------------------------------------------------------------------------
+
+int main()
+{
+   TestTargets();
+   TestDecoder();
+   TestDamaged();
+   return CHECK_RESULT();
+}